@@ -24,6 +24,7 @@ CFLAGS = \
 	-Wold-style-definition \
 	-fstrict-aliasing \
 	-std=c11 \
+	-D BMP2NAM_VERSION='"$(VERSIONINFO)"' \
 	$(CFLAGS_BUILDMODE) \
 	$(CFLAGS_OS) \
 	$(CFLAGS_EXTRA)
@@ -111,8 +112,8 @@ LDLIBS_BUILDMODE_release =
 #! Linked libraries which are platform-specific, according to $(OSMODE)
 LDLIBS_OS = $(LDLIBS_OS_$(OSMODE))
 LDLIBS_OS_windows = 
-LDLIBS_OS_macos = 
-LDLIBS_OS_linux = 
+LDLIBS_OS_macos = -lpthread
+LDLIBS_OS_linux = -lpthread
 LDLIBS_OS_other = 
 ifneq ($(findstring mingw,$(CC)),)
 LDLIBS_OS += -L./ -static-libgcc
@@ -0,0 +1,219 @@
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/logger.h>
+#include <libccc/image/color.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+//! The width/height (in pixels) of the area scored by the offset search: the output, plus one metatile minus one pixel
+#define ALIGN_CANVAS_W  (NAM_W_MAX + NAM_TILE_MAX - 1)
+#define ALIGN_CANVAS_H  (NAM_H_MAX + NAM_TILE_MAX - 1)
+
+//! Stores the state of the attribute grid offset search (allocated from `program.arena`)
+typedef struct s_align_
+{
+	t_u8        canvas[ALIGN_CANVAS_H][ALIGN_CANVAS_W];         //!< The reference color of each pixel which any metatile could cover, relative to the view's origin
+	t_u8        column_counts[ALIGN_CANVAS_W][REFPAL_COLORS_MAX];//!< The amount of pixels of each color, in each column of the current vertical window
+	t_u64       column_masks[ALIGN_CANVAS_W][REFPAL_COLORS_MAX / 64];//!< The colors present in each column of the current vertical window
+	t_u8        window_counts[REFPAL_COLORS_MAX];               //!< The amount of columns of the current horizontal window in which each color is present
+	t_uint      window_colors;                                  //!< The amount of colors present in the current horizontal window
+	t_uint      violations[NAM_TILE_MAX][NAM_TILE_MAX];         //!< The amount of metatiles with too many colors, for each (dy,dx) offset
+	t_uint      excess[NAM_TILE_MAX][NAM_TILE_MAX];             //!< The total amount of colors over the limit, for each (dy,dx) offset
+}
+s_align;
+
+
+
+/*
+** ************************************************************************** *|
+**                         Sliding Window Functions                           *|
+** ************************************************************************** *|
+*/
+
+//! Adds (if `add` is TRUE) or removes the pixels of canvas row `y` to the column color counts, keeping the column masks up to date
+static inline
+void    Align_SlideRow(s_align* align, t_uint y, t_uint width, t_bool add)
+{
+	for (t_uint x = 0; x < width; ++x)
+	{
+		t_u8 color = align->canvas[y][x];
+		t_u8* count = &align->column_counts[x][color];
+		if (add ? ((*count)++ == 0) : (--(*count) == 0))
+			align->column_masks[x][color / 64] ^= (1ull << (color % 64));
+	}
+}
+
+//! Returns the index of the lowest set bit of `bits` (which must not be zero), with a de Bruijn sequence lookup
+static inline
+t_uint  Align_LowestBit(t_u64 bits)
+{
+	static t_u8 const table[64] =
+	{
+		 0,  1, 48,  2, 57, 49, 28,  3, 61, 58, 50, 42, 38, 29, 17,  4,
+		62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12,  5,
+		63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+		46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19,  9, 13,  8,  7,  6,
+	};
+	return (table[((bits & (~bits + 1)) * 0x03F79D71B4CB0A89ull) >> 58]);
+}
+
+//! Adds (if `add` is TRUE) or removes the colors present in canvas column `x` to the current horizontal window
+static inline
+void    Align_SlideColumn(s_align* align, t_uint x, t_bool add)
+{
+	for (t_uint w = 0; w < REFPAL_COLORS_MAX / 64; ++w)
+	{
+		for (t_u64 bits = align->column_masks[x][w]; bits; bits &= bits - 1)
+		{
+			t_uint color = w * 64 + Align_LowestBit(bits);
+			if (add ? (align->window_counts[color]++ == 0) : (--align->window_counts[color] == 0))
+				align->window_colors += (add ? 1 : (t_uint)-1);
+		}
+	}
+}
+
+//! Fills the canvas with the reference color of each pixel (pixels outside of the bitmap are color 0, as in `ConvertBitmap_PackTiles()`)
+static
+void    Align_FillCanvas(s_align* align, t_uint width, t_uint height)
+{
+	t_u8 lookup[BMP_MAXCOLORS] = { 0 };
+	SDL_Palette const* palette = program.bitmap->format->palette;
+	for (int i = 0; i < palette->ncolors && i < BMP_MAXCOLORS; ++i)
+	{
+		t_argb32 color = Color_ARGB32_Set(0, palette->colors[i].r, palette->colors[i].g, palette->colors[i].b);
+		t_argb32 const* nearest = Color_ARGB32_GetNearest(color, program.ref_palette, REFPAL_COLORS);
+		lookup[i] = (nearest ? (t_u8)(nearest - program.ref_palette) : 0);
+		PROFILE_COUNT(PROFILE_NEAREST, 1);
+	}
+	t_u8 const* origin = program.view.pixels;
+	t_size offset = (t_size)(origin - (t_u8 const*)program.bitmap->pixels);
+	t_uint x0 = (t_uint)(offset % (t_size)program.bitmap->pitch);
+	t_uint y0 = (t_uint)(offset / (t_size)program.bitmap->pitch);
+	for (t_uint y = 0; y < height; ++y)
+	{
+		t_uint available = (y0 + y < (t_uint)program.bitmap->h && x0 < (t_uint)program.bitmap->w) ?
+			(t_uint)program.bitmap->w - x0 : 0;
+		t_u8 const* row = (available ? origin + (t_sint)y * program.bitmap->pitch : NULL);
+		for (t_uint x = 0; x < width; ++x)
+		{
+			align->canvas[y][x] = lookup[x < available ? row[x] : 0];
+		}
+	}
+	PROFILE_COUNT(PROFILE_PIXELS, width * height);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                        Attribute Grid Align Functions                      *|
+** ************************************************************************** *|
+*/
+
+//! Scores every (dx,dy) offset of the attribute grid, in one pass: a vertical window of metatile height slides down the canvas,
+//! and for each of its positions, a horizontal window of metatile width slides across it - every window is one metatile of one offset.
+static
+int     Align_Search(SDL_Point* result)
+{
+	s_align* align = (s_align*)Arena_Allocate(&program.arena, sizeof(s_align));
+	if (align == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not allocate memory for the attribute grid offset search");
+		return (ERROR);
+	}
+	Memory_Clear(align, sizeof(s_align));
+	t_uint tile = NAM_TILE;
+	t_uint width  = NAM_W + tile - 1;
+	t_uint height = NAM_H + tile - 1;
+	Align_FillCanvas(align, width, height);
+	// the colorkey is present in every palette, so it counts as one of the colors of every metatile
+	t_sint colorkey = -1;
+	if (program.colorkey.occurences)
+	{
+		t_argb32 const* nearest = Color_ARGB32_GetNearest(program.colorkey.color, program.ref_palette, REFPAL_COLORS);
+		colorkey = (nearest ? (t_sint)(nearest - program.ref_palette) : -1);
+	}
+	for (t_uint y = 0; y < tile - 1; ++y)
+		Align_SlideRow(align, y, width, TRUE);
+	for (t_uint s = 0; s < NAM_H; ++s)
+	{   // the vertical window is now rows [s, s + tile)
+		if (s > 0)
+			Align_SlideRow(align, s - 1, width, FALSE);
+		Align_SlideRow(align, s + tile - 1, width, TRUE);
+		t_uint dy = s % tile;
+		Memory_Clear(align->window_counts, sizeof(align->window_counts));
+		align->window_colors = 0;
+		for (t_uint x = 0; x < tile - 1; ++x)
+			Align_SlideColumn(align, x, TRUE);
+		for (t_uint x = 0; x < NAM_W; ++x)
+		{   // the horizontal window is now columns [x, x + tile)
+			if (x > 0)
+				Align_SlideColumn(align, x - 1, FALSE);
+			Align_SlideColumn(align, x + tile - 1, TRUE);
+			t_uint colors = align->window_colors + (colorkey >= 0 && align->window_counts[colorkey] == 0);
+			if (colors > PAL_SUB_COLORS)
+			{
+				align->violations[dy][x % tile] += 1;
+				align->excess[dy][x % tile] += colors - PAL_SUB_COLORS;
+			}
+		}
+		PROFILE_COUNT(PROFILE_COMPARISONS, NAM_W);
+	}
+	// the fewest metatiles with too many colors wins, then the fewest excess colors, then the smallest offset
+	*result = (SDL_Point){ .x=0, .y=0 };
+	for (t_uint dy = 0; dy < tile; ++dy)
+	for (t_uint dx = 0; dx < tile; ++dx)
+	{
+		t_uint const* best_violations = &align->violations[result->y][result->x];
+		t_uint const* best_excess     = &align->excess[result->y][result->x];
+		if (align->violations[dy][dx] < *best_violations ||
+			(align->violations[dy][dx] == *best_violations && align->excess[dy][dx] < *best_excess))
+			*result = (SDL_Point){ .x=(int)dx, .y=(int)dy };
+	}
+	LOG_MESSAGE("Attribute grid offset (x:%i, y:%i) has %u metatiles with too many colors (%u at offset (x:0, y:0))",
+		result->x, result->y,
+		align->violations[result->y][result->x],
+		align->violations[0][0]);
+	return (OK);
+}
+
+
+
+int     Align_View(void)
+{
+	SDL_Point offset = program.align;
+	if (program.align_auto && Align_Search(&offset))
+		return (ERROR);
+	if (program.align_auto && program.frames)
+	{   // every frame of an animation must use the same offset: the one found for the first frame is kept
+		program.align = offset;
+		program.align_auto = FALSE;
+	}
+	if (offset.x >= (int)NAM_TILE || offset.y >= (int)NAM_TILE)
+	{
+		Log_Error(&program.logger, 0, "The attribute grid offset (x:%i, y:%i) must be smaller than the metatile size (%i)",
+			offset.x, offset.y, NAM_TILE);
+		return (ERROR);
+	}
+	if (offset.x == 0 && offset.y == 0)
+		return (OK);
+	// the view starts at the offset, so that the metatiles line up with the grid of the art
+	t_size origin = (t_size)(program.view.pixels - (t_u8*)program.bitmap->pixels);
+	t_uint x = (t_uint)(origin % (t_size)program.bitmap->pitch) + (t_uint)offset.x;
+	t_uint y = (t_uint)(origin / (t_size)program.bitmap->pitch) + (t_uint)offset.y;
+	program.view.pixels += offset.y * program.view.pitch + offset.x;
+	if (x + program.view.w > (t_uint)program.bitmap->w)
+		program.view.w = (x < (t_uint)program.bitmap->w ? (t_uint)program.bitmap->w - x : 0);
+	if (y + program.view.h > (t_uint)program.bitmap->h)
+		program.view.h = (y < (t_uint)program.bitmap->h ? (t_uint)program.bitmap->h - y : 0);
+	LOG_SUCCESS("Aligned the attribute grid at offset (x:%i, y:%i): scroll the background by (x:%i, y:%i) to show the output in place",
+		offset.x, offset.y,
+		(int)NAM_W - offset.x, (int)NAM_H - offset.y);
+	return (OK);
+}
@@ -0,0 +1,352 @@
+
+#include <stdio.h>
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/logger.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+//! Stores the results of the analysis of one animation frame, until the joint output palettes are known
+typedef struct s_anim_frame_
+{
+	t_u64       hash;                               //!< The hash of the whole input frame (its bitmap palette, and all of its tiles)
+	t_u64       tiles_hash[NAM_TILES_MAX];  //!< The hash of each input tile (to find which tiles changed since the previous frame)
+	s_palette   palettes[NAM_TILES_MAX];    //!< The palette wanted by each tile (its most used colors)
+	t_u8        pixels[NAM_PIXELS_MAX];     //!< The tile pixels, reduced to reference palette colors (before output palettes are applied)
+	t_u8        reference[NAM_PIXELS_MAX];  //!< The tile pixels right after the reference palette is applied, to measure the error of the output against
+}
+s_anim_frame;
+
+
+
+/*
+** ************************************************************************** *|
+**                            Frame Input Functions                           *|
+** ************************************************************************** *|
+*/
+
+//! Checks that the given filepath `pattern` has exactly one integer conversion (like `%d` or `%03d`), so it is safe to give to `snprintf()`
+static
+int     Animation_CheckPattern(t_char const* pattern)
+{
+	t_uint conversions = 0;
+	for (t_size i = 0; pattern[i]; ++i)
+	{
+		if (pattern[i] != '%')
+			continue;
+		++i;
+		if (pattern[i] == '%')
+			continue;
+		while (pattern[i] >= '0' && pattern[i] <= '9')
+			++i;
+		if (pattern[i] != 'd')
+			return (ERROR);
+		++conversions;
+	}
+	return (conversions == 1 ? OK : ERROR);
+}
+
+//! Loads the input file for the given `frame`, and packs its pixels into `program.tiles_pixels`
+static
+int     Animation_LoadFrame(t_char const* pattern, t_uint frame)
+{
+	t_char filepath[1024];
+	if (snprintf(filepath, sizeof(filepath), pattern, (int)frame) >= (int)sizeof(filepath))
+	{
+		Log_Error(&program.logger, 0, "Animation frame filepath is too long: %s", pattern);
+		return (ERROR);
+	}
+	if (program.bitmap)
+	{
+		SDL_FreeSurface(program.bitmap);
+		program.bitmap = NULL;
+	}
+	program.view = (s_view){ 0 };
+	program.file_input = filepath;
+	int result = Input_Read();
+	program.file_input = pattern;
+	if (result)
+		return (ERROR);
+	LOG_MESSAGE("Processing frame %u: %s...", frame, filepath);
+	program.bitmap = SDL_LoadBMP_RW(SDL_RWFromConstMem(program.input_data, (int)program.input_size), TRUE);
+	if (program.bitmap == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not load BMP file: %s => %s\n", filepath, SDL_GetError());
+		return (ERROR);
+	}
+	if (program.scale && PROFILE_STAGE(Scale_Bitmap()))
+		return (ERROR);
+	if (PROFILE_STAGE(CheckBitmap_PixelFormat()))
+		return (ERROR);
+	if (PROFILE_STAGE(CheckBitmap_Dimensions()))
+		return (ERROR);
+	if (PROFILE_STAGE(Align_View()))
+		return (ERROR);
+	if (PROFILE_STAGE(ConvertBitmap_PackTiles()))
+		return (ERROR);
+	return (OK);
+}
+
+//! Hashes the current frame: every tile is hashed on its own, so that the tiles which changed can be found quickly
+static
+void    Animation_HashFrame(s_anim_frame* frame)
+{
+	SDL_Palette const* palette = program.bitmap->format->palette;
+	// the same pixel values may stand for other colors, if the bitmap palette changed
+	t_u64 context = Hash_FNV1a(palette->colors, palette->ncolors * sizeof(SDL_Color), HASH_SEED);
+	frame->hash = context;
+	for (t_uint i = 0; i < NAM_TILES; ++i)
+	{
+		frame->tiles_hash[i] = Hash_FNV1a(TILE_PIXELS(i), NAM_TILE_PIXELS, context);
+		frame->hash = Hash_FNV1a(&frame->tiles_hash[i], sizeof(t_u64), frame->hash);
+	}
+	PROFILE_COUNT(PROFILE_PIXELS, NAM_TILES * NAM_TILE_PIXELS);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                          Frame Analysis Functions                          *|
+** ************************************************************************** *|
+*/
+
+//! Runs the per-frame color reduction (every tile which is unchanged since an earlier frame is a tile cache hit)
+static
+int     Animation_AnalyzeFrame(s_anim_frame* frame)
+{
+	program.bitmap_colors_total = 0;
+	Memory_Clear(program.bitmap_colors, sizeof(program.bitmap_colors));
+	Memory_Clear(program.occur_colors,  sizeof(program.occur_colors));
+	Memory_Clear(program.tiles_colors,  sizeof(program.tiles_colors));
+	if (PROFILE_STAGE(CheckBitmap_LoadColors()))
+		return (ERROR);
+	if (PROFILE_STAGE(ConvertBitmap_ApplyRefPalette()))
+		return (ERROR);
+	if (PROFILE_STAGE(CheckBitmap_LoadColors()))
+		return (ERROR);
+	if (PROFILE_STAGE(CheckBitmap_TotalColors()))
+		return (ERROR);
+	if (PROFILE_STAGE(CheckBitmap_TilesColors()))
+		return (ERROR);
+	if (PROFILE_STAGE(ConvertBitmap_TotalColorReduction()))
+		return (ERROR);
+	if (PROFILE_STAGE(ConvertBitmap_TilesColorReduction()))
+		return (ERROR);
+	if (PROFILE_STAGE(CheckBitmap_LoadColors()))
+		return (ERROR);
+	if (PROFILE_STAGE(CheckBitmap_TotalColors()))
+		return (ERROR);
+	if (PROFILE_STAGE(CheckBitmap_TilesColors()))
+		return (ERROR);
+	if (PROFILE_STAGE(CheckBitmap_TilesPalettes()))
+		return (ERROR);
+	Memory_Copy(frame->pixels, program.tiles_pixels, sizeof(frame->pixels));
+	Memory_Copy(frame->reference, program.tiles_reference, sizeof(frame->reference));
+	Memory_Copy(frame->palettes, program.tiles_palettes, sizeof(frame->palettes));
+	return (OK);
+}
+
+//! Adds the color histogram of each tile of the current frame to the joint histogram of each tile position
+static
+void    Animation_AddColors(t_u32 (*counts)[REFPAL_COLORS_MAX], t_uint repeat)
+{
+	for (t_uint i = 0; i < NAM_TILES; ++i)
+	{
+		for (t_uint j = 0; j < PAL_COLORS; ++j)
+		{
+			s_color_use const* color = &program.tiles_colors[i].colors[j];
+			counts[i][color->index] += color->occurences * repeat;
+		}
+	}
+}
+
+//! Sets the color histogram of each tile from the joint histogram of all frames, so that one set of output palettes can be chosen for all of them
+static
+void    Animation_SetJointColors(t_u32 (*counts)[REFPAL_COLORS_MAX])
+{
+	for (t_uint i = 0; i < NAM_TILES; ++i)
+	{
+		s_color_use* colors = program.tiles_colors[i].colors;
+		t_uint total = 0;
+		Memory_Clear(colors, sizeof(program.tiles_colors[i].colors));
+		for (t_uint j = 0; j < REFPAL_COLORS; ++j)
+		{
+			if (counts[i][j] == 0)
+				continue;
+			colors[total++] = (s_color_use)
+			{
+				.color = program.ref_palette[j],
+				.index = j,
+				.occurences = counts[i][j],
+			};
+		}
+		QuickSort_Compare_ColorUse(colors, total);
+		program.tiles_colors[i].total = total;
+	}
+	program.tiles_palettes_amount = 0;
+	Memory_Clear(program.tiles_palettes, sizeof(program.tiles_palettes));
+	Memory_Clear(program.output_palettes, sizeof(program.output_palettes));
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                          Animation Mode Functions                          *|
+** ************************************************************************** *|
+*/
+
+//! Writes the changes from the `previous` NAM file to the `current` one, as a count followed by `(offset, value)` pairs - returns the size written
+static
+t_size  Animation_WriteDelta(t_u8* dest, t_u8 const* previous, t_u8 const* current)
+{
+	t_size length = 2;
+	t_u16 changes = 0;
+	for (t_size i = 0; i < NAM_SIZE; ++i)
+	{
+		if (previous[i] == current[i])
+			continue;
+		dest[length++] = (i >> 0) & 0xFF;
+		dest[length++] = (i >> 8) & 0xFF;
+		dest[length++] = current[i];
+		++changes;
+	}
+	dest[0] = (changes >> 0) & 0xFF;
+	dest[1] = (changes >> 8) & 0xFF;
+	return (length);
+}
+
+//! Converts all the frames of the animation, and writes their outputs (this is the "ConvertAnimation" span of the `--trace` timeline)
+static
+int     Animation_ConvertFrames(t_char const* pattern, s_anim_frame* frame, t_u32 (*counts)[REFPAL_COLORS_MAX])
+{
+	t_uint frames = program.frames;
+	// first pass: reduce the colors of each frame, only redoing the work for what changed since the previous frame
+	t_uint repeat = 0;
+	for (t_uint f = 0; f < frames; ++f)
+	{
+		if (Animation_LoadFrame(pattern, f))
+			return (ERROR);
+		Animation_HashFrame(&frame[f]);
+		if (f > 0 && frame[f].hash == frame[f - 1].hash)
+		{   // the histograms of the previous frame are still loaded, and are only added once all identical frames are counted
+			LOG_VERBOSE("Frame %u is identical to the previous frame", f);
+			Memory_Copy(frame[f].pixels, frame[f - 1].pixels, sizeof(frame[f].pixels));
+			Memory_Copy(frame[f].palettes, frame[f - 1].palettes, sizeof(frame[f].palettes));
+			++repeat;
+			continue;
+		}
+		if (f > 0)
+		{
+			t_uint changed = 0;
+			for (t_uint i = 0; i < NAM_TILES; ++i)
+			{
+				changed += (frame[f].tiles_hash[i] != frame[f - 1].tiles_hash[i]);
+			}
+			LOG_VERBOSE("Frame %u has %u changed tiles (out of %u)", f, changed, NAM_TILES);
+			Animation_AddColors(counts, repeat);
+		}
+		if (Animation_AnalyzeFrame(&frame[f]))
+			return (ERROR);
+		repeat = 1;
+	}
+	Animation_AddColors(counts, repeat);
+
+	// second pass: choose the output palettes once, from the colors used by each tile across all frames
+	if (program.file_palette == NULL)
+	{
+		Animation_SetJointColors(counts);
+		if (PROFILE_STAGE(CheckBitmap_DuplicatePalettes()))
+			return (ERROR);
+		if (PROFILE_STAGE(ConvertBitmap_AssertOutputPalettes()))
+			return (ERROR);
+	}
+
+	// third pass: apply the joint output palettes to each frame, and encode it (all frames share the same CHR tiles)
+	s_chrset* chrset = (s_chrset*)Arena_Allocate(&program.arena, sizeof(s_chrset));
+	t_u8* nam = (t_u8*)Arena_Allocate(&program.arena, frames * NAM_SIZE);
+	t_u8* delta = (t_u8*)Arena_Allocate(&program.arena, (frames - 1) * (2 + 3 * NAM_SIZE) + 1);
+	t_u8* chr = (t_u8*)Arena_Allocate(&program.arena, CHR_SIZE);
+	t_u8* pal = (t_u8*)Arena_Allocate(&program.arena, PAL_SIZE);
+	if (chrset == NULL || nam == NULL || delta == NULL || chr == NULL || pal == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not allocate memory for output CHR/NAM/PAL files");
+		return (ERROR);
+	}
+	Memory_Clear(chrset, sizeof(s_chrset));
+	t_size delta_size = 0;
+	for (t_uint f = 0; f < frames; ++f)
+	{
+		if (f > 0 && frame[f].hash == frame[f - 1].hash)
+		{
+			Memory_Copy(nam + f * NAM_SIZE, nam + (f - 1) * NAM_SIZE, NAM_SIZE);
+		}
+		else
+		{
+			Memory_Copy(program.tiles_pixels, frame[f].pixels, sizeof(program.tiles_pixels));
+			Memory_Copy(program.tiles_reference, frame[f].reference, sizeof(program.tiles_reference));
+			Memory_Copy(program.tiles_palettes, frame[f].palettes, sizeof(program.tiles_palettes));
+			if (PROFILE_STAGE(ConvertBitmap_ApplyOutputPalettes(TRUE)))
+				return (ERROR);
+			if (PROFILE_STAGE(EncodeBitmap_NAM(chrset, nam + f * NAM_SIZE)))
+				return (ERROR);
+		}
+		if (f > 0)
+			delta_size += Animation_WriteDelta(delta + delta_size, nam + (f - 1) * NAM_SIZE, nam + f * NAM_SIZE);
+	}
+	EncodeBitmap_CHR(chrset, chr);
+	EncodeBitmap_PAL(pal);
+	if (chrset->overflow)
+	{
+		LOG_WARNING("Too many unique %ix%i CHR tiles across all frames (maximum is %i): %u tiles were replaced by their nearest existing tile",
+			CHR_TILE, CHR_TILE, CHR_TILES, chrset->overflow);
+	}
+	LOG_SUCCESS("Converted %u frames: %u shared CHR tiles, %zu bytes of NAM deltas.", frames, chrset->amount, delta_size);
+	if (Output_Add(CHR_FILE(""), chr, CHR_SIZE) ||
+		Output_Add(NAM_FILE(""), nam, NAM_SIZE) ||
+		Output_Add(ANIM_DELTA_FILE(""), delta, delta_size) ||
+		Output_Add(PAL_FILE(""), pal, PAL_SIZE))
+		return (ERROR);
+	// only the NAM of the first frame is compressed, as the following ones are stored as deltas
+	if ((program.compress_nam || program.compress_chr) && PROFILE_STAGE(Compress_Outputs(nam, chr)))
+		return (ERROR);
+	if (PROFILE_STAGE(Output_WriteAll()))
+		return (ERROR);
+	return (OK);
+}
+
+int     Animation_Convert(void)
+{
+	t_char const* pattern = program.file_input;
+	t_uint        frames = program.frames;
+	if (Animation_CheckPattern(pattern))
+	{
+		Log_Error(&program.logger, 0, "With `--frames`, the input filepath must contain exactly one integer conversion, like `frame_%%02d.bmp`: %s", pattern);
+		return (ERROR);
+	}
+	s_anim_frame* frame = (s_anim_frame*)Arena_Allocate(&program.arena, frames * sizeof(s_anim_frame));
+	t_u32 (*counts)[REFPAL_COLORS_MAX] = (t_u32(*)[REFPAL_COLORS_MAX])Arena_Allocate(&program.arena, NAM_TILES * sizeof(*counts));
+	if (frame == NULL || counts == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not allocate memory for %u animation frames", frames);
+		return (ERROR);
+	}
+	Memory_Clear(counts, NAM_TILES * sizeof(*counts));
+
+	// the span is ended on every path, so that the trace of a failed conversion stays balanced
+	TRACE_BEGIN("ConvertAnimation");
+	int result = Animation_ConvertFrames(pattern, frame, counts);
+	TRACE_END("ConvertAnimation");
+	if (result)
+		return (ERROR);
+	if (PROFILE_STAGE(TileCache_Save(&program.tilecache, program.tilecache.filepath)))
+		return (ERROR);
+	return (OK);
+}
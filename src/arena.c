@@ -0,0 +1,189 @@
+
+#define _POSIX_C_SOURCE 200809L
+#include <unistd.h>
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/logger.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+//! Rounds up the given `size` to the next multiple of `ARENA_ALIGN`
+#define ARENA_ROUNDUP(SIZE) \
+	(((SIZE) + (ARENA_ALIGN - 1)) & ~(t_size)(ARENA_ALIGN - 1))
+
+
+
+/*
+** ************************************************************************** *|
+**                          Arena Allocation Functions                        *|
+** ************************************************************************** *|
+*/
+
+static
+s_arena_block* Arena_NewBlock(t_size size)
+{
+	t_size header = ARENA_ROUNDUP(sizeof(s_arena_block));
+	if (size < ARENA_BLOCK_SIZE)
+		size = ARENA_BLOCK_SIZE;
+	s_arena_block* block = (s_arena_block*)Memory_Allocate(header + size);
+	PROFILE_COUNT(PROFILE_ALLOCATIONS, 1);
+	if (block == NULL)
+		return (NULL);
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	block->data = (t_u8*)block + header;
+	return (block);
+}
+
+
+
+void*   Arena_Allocate(s_arena* arena, t_size size)
+{
+	s_arena_block* block;
+
+	size = ARENA_ROUNDUP(size);
+	if (arena->current == NULL)
+	{
+		if (arena->first == NULL)
+		{
+			arena->first = Arena_NewBlock(size);
+			if (arena->first == NULL)
+				return (NULL);
+		}
+		arena->current = arena->first;
+		arena->current->used = 0;
+	}
+	block = arena->current;
+	while (block->used + size > block->size)
+	{   // move on to the next block, reusing it if it is big enough
+		if (block->next == NULL || block->next->size < size)
+		{
+			s_arena_block* new = Arena_NewBlock(size);
+			if (new == NULL)
+				return (NULL);
+			new->next = block->next;
+			block->next = new;
+		}
+		block = block->next;
+		block->used = 0;
+		arena->current = block;
+	}
+	void* result = block->data + block->used;
+	block->used += size;
+	return (result);
+}
+
+
+
+void*   Arena_Duplicate(s_arena* arena, void const* array, t_size size)
+{
+	void* result = Arena_Allocate(arena, size);
+	if (result == NULL)
+		return (NULL);
+	Memory_Copy(result, array, size);
+	return (result);
+}
+
+
+
+t_char* Arena_Concat(s_arena* arena, t_char const* str1, t_char const* str2)
+{
+	t_size length1 = String_Length(str1);
+	t_size length2 = String_Length(str2);
+	t_char* result = (t_char*)Arena_Allocate(arena, length1 + length2 + 1);
+	if (result == NULL)
+		return (NULL);
+	Memory_Copy(result, str1, length1);
+	Memory_Copy(result + length1, str2, length2);
+	result[length1 + length2] = '\0';
+	return (result);
+}
+
+
+
+//! Reads a stream whose size is not known in advance (ie: a pipe), by doubling the buffer size whenever it is full
+static
+t_sintmax   Arena_ReadStream(s_arena* arena, t_fd fd, t_u8** a_file)
+{
+	t_size capacity = ARENA_BLOCK_SIZE / 2;
+	t_size total = 0;
+	t_u8* file = (t_u8*)Arena_Allocate(arena, capacity + 1);
+	if (file == NULL)
+		return (-1);
+	while (TRUE)
+	{
+		if (total == capacity)
+		{   // the previous buffer is simply abandoned in the arena, it is freed along with everything else
+			t_u8* larger = (t_u8*)Arena_Allocate(arena, capacity * 2 + 1);
+			if (larger == NULL)
+				return (-1);
+			Memory_Copy(larger, file, total);
+			file = larger;
+			capacity *= 2;
+		}
+		ssize_t result = read(fd, file + total, capacity - total);
+		if (result < 0)
+			return (-1);
+		if (result == 0)
+			break;
+		total += result;
+	}
+	file[total] = '\0';
+	*a_file = file;
+	return (total);
+}
+
+t_sintmax   Arena_ReadFile(s_arena* arena, t_fd fd, t_u8** a_file)
+{
+	off_t size = lseek(fd, 0, SEEK_END);
+	if (size < 0 || lseek(fd, 0, SEEK_SET) < 0)
+		return (Arena_ReadStream(arena, fd, a_file));
+	t_u8* file = (t_u8*)Arena_Allocate(arena, (t_size)size + 1);
+	if (file == NULL)
+		return (-1);
+	t_size total = 0;
+	while (total < (t_size)size)
+	{
+		ssize_t result = read(fd, file + total, (t_size)size - total);
+		if (result < 0)
+			return (-1);
+		if (result == 0)
+			break;
+		total += result;
+	}
+	file[total] = '\0';
+	*a_file = file;
+	return (total);
+}
+
+
+
+void    Arena_Reset(s_arena* arena)
+{
+	arena->current = arena->first;
+	if (arena->current)
+		arena->current->used = 0;
+}
+
+
+
+void    Arena_Delete(s_arena* arena)
+{
+	s_arena_block* block = arena->first;
+	s_arena_block* next;
+	while (block)
+	{
+		next = block->next;
+		Memory_Free(block);
+		block = next;
+	}
+	arena->first = NULL;
+	arena->current = NULL;
+}
@@ -44,6 +44,20 @@
 // The arbitrary threshold used for color merging
 #define THRESHOLD   8686
 
+//! If non-zero, the `--profile` instrumentation is compiled in (by default, it is compiled out of release builds)
+#ifndef PROFILING
+#if RELEASE
+#define PROFILING   0
+#else
+#define PROFILING   1
+#endif
+#endif
+
+//! The full version string of this program (set by the makefile, from the `VERSION` file)
+#ifndef BMP2NAM_VERSION
+#define BMP2NAM_VERSION "bmp2nam@?"
+#endif
+
 
 
 /*! @defgroup BMP
@@ -61,21 +75,57 @@
 
 
 
+/*! @defgroup TARGET
+**  @{
+**      BMP2NAM hardware target profiles
+**  All of the macros below which describe the output files (tile size, palettes, etc)
+**  depend on the hardware target chosen with `--target`: so they are not compile-time
+**  constants, except for the `_MAX` macros, which are the bounds for any target.
+**  The inner loops which depend on these values are compiled once per target (see `target_kernels.h`).
+*/
+
+//! Shorthand to get a property of the current hardware target
+#define TARGET(FIELD)   (program.target->FIELD)
+
+//! @}
+
+
+
 /*! @defgroup REFPAL
 **  @{
 **      BMP2NAM reference palette file
 **  All the possible colors for the output files (PAL/CHR/NAM)
 */
 
-//! The size (in bytes) of one color in the reference palette file
-#define REFPAL_COLORSIZE   (3)
-//! The amount of colors in the reference palette file
-#define REFPAL_COLORS      (64)
-//! The size (in bytes) of the reference palette file
-#define REFPAL_SIZE        (t_size)(REFPAL_COLORS * REFPAL_COLORSIZE)
-
-//! The (relative) file path of the reference palette file
-#define REFPAL_FILEPATH    "pal/nes.pal"
+//! The maximum amount of colors in the reference palette, for any target (pixels hold reference palette indices, so it cannot be more than 256)
+#define REFPAL_COLORS_MAX  (256)
+//! The amount of colors in the reference palette (the built-in one of the target, or the one given with `--refpal`)
+#define REFPAL_COLORS      (program.ref_colors)
+
+//! The file extension of a reference palette file in the binary format (see `doc/spec_pal.md`)
+#define REFPAL_FILE(X)     X".pal"
+//! The file extension of a reference palette file in the text (TOML) format (see `doc/spec_pal.md`)
+#define REFPAL_TEXTFILE(X) X".palette"
+
+//! The size (in bytes) of the header of a binary `.pal` file
+#define REFPAL_HEADER_SIZE (16)
+//! The magic identifier at the start of a binary `.pal` file
+#define REFPAL_MAGIC       "PAL"
+//! The version of the `.pal` file format which is supported
+#define REFPAL_VERSION     (1)
+//! The maximum size (in bytes) of one color, in a reference palette file
+#define REFPAL_COLORSIZE_MAX   (4)
+
+//! The maximum amount of reference palette files which can be given with `--refpal` (the best one is chosen for each bitmap)
+#define REFPAL_FILES_MAX        (8)
+//! The value of `program.emphasis` which means that every color emphasis combination is tried
+#define REFPAL_EMPHASIS_AUTO    (-1)
+//! The amount of color emphasis combinations (one bit each for red, green and blue)
+#define REFPAL_EMPHASIS_AMOUNT  (8)
+//! The amount of colors which a reference palette must have to support color emphasis (the NES palette)
+#define REFPAL_EMPHASIS_COLORS  (64)
+//! The factor (out of 256) by which each emphasis bit dims the two other color channels
+#define REFPAL_EMPHASIS_DIM     (209)
 
 //! @}
 
@@ -87,15 +137,23 @@
 **  Stores 4 distinct palettes of 4 colors each.
 **  These colors are stored as indices to the standard NES palette.
 **  The first color each of these four palettes must be the same.
+**  (other targets have a different amount of palettes and colors, see `s_target`)
 */
 
+//! The maximum amount of colors contained in one of the output color palettes, for any target
+#define PAL_SUB_COLORS_MAX  (16)
+//! The maximum amount of palettes contained in the output PAL file, for any target
+#define PAL_SUB_AMOUNT_MAX  (8)
+//! The maximum amount of colors contained in the output PAL file, in total, for any target
+#define PAL_COLORS_MAX      (PAL_SUB_COLORS_MAX * PAL_SUB_AMOUNT_MAX)
+
 //! The amount of colors contained in one of the output color palettes
-#define PAL_SUB_COLORS  (4)
+#define PAL_SUB_COLORS  TARGET(pal_colors)
 //! The amount of palettes contained in the output PAL file
-#define PAL_SUB_AMOUNT  (4)
+#define PAL_SUB_AMOUNT  TARGET(pal_amount)
 
 //! The size (in bytes) of one color contained in one of the output color palettes
-#define PAL_COLORSIZE   (1)
+#define PAL_COLORSIZE   TARGET(pal_colorsize)
 //! The amount of colors contained in the output PAL file, in total
 #define PAL_COLORS      (PAL_SUB_COLORS * PAL_SUB_AMOUNT)
 //! The size (in bytes) of the output PAL file
@@ -113,30 +171,30 @@
 **      NES 8x8 Tiled Pixel Data Format
 **  Stores 256 distinct 'tiles' (or 'chars', hence chr) of 8x8 pixel data.
 **  The colors for these pixels are 2-bits (can be 0-3) to go with a PAL.
+**  (other targets have a different amount of tiles and bits-per-pixel, see `s_target`)
 */
 
+//! The maximum amount of bits-per-pixel for the output CHR file, for any target
+#define CHR_BPP_MAX     (4)
 //! The amount of bits-per-pixel for the output CHR file (usually written BPP)
-#define CHR_BPP         (2)
+#define CHR_BPP         TARGET(chr_bpp)
 //! The dimensions of a CHR tile (in pixels, used for both width and height)
 #define CHR_TILE        (8)
 
 //! The maximum amount of colors for the output CHR file
-#define CHR_MAXCOLORS   (4)
+#define CHR_MAXCOLORS   (1 << CHR_BPP)
 
-//! The width (in CHR tiles) of the output CHR file
-#define CHR_W_TILES     (16)
-//! The height (in CHR tiles) of the output CHR file
-#define CHR_H_TILES     (16)
-
-//! The width (in pixels) of the output NAM file
-#define CHR_W           (CHR_W_TILES * CHR_TILE)
-//! The height (in pixels) of the output NAM file
-#define CHR_H           (CHR_H_TILES * CHR_TILE)
+//! The maximum amount of distinct CHR tiles in the output CHR file, for any target
+#define CHR_TILES_MAX   (1024)
+//! The maximum amount of distinct CHR tiles in the output CHR file
+#define CHR_TILES       TARGET(chr_tiles)
 
+//! The maximum size (in bytes) of a single CHR tile, for any target
+#define CHR_SIZE_TILE_MAX   (t_size)((CHR_BPP_MAX * CHR_TILE * CHR_TILE) / 8)
 //! The size (in bytes) of a single CHR tile
 #define CHR_SIZE_TILE   (t_size)((CHR_BPP * CHR_TILE * CHR_TILE) / 8)
 //! The size (in bytes) for the output CHR file
-#define CHR_SIZE        (t_size)(CHR_SIZE_TILE * CHR_W_TILES * CHR_H_TILES)
+#define CHR_SIZE        (t_size)(CHR_SIZE_TILE * CHR_TILES)
 
 //! the filepath prefix/suffix for the output CHR file
 #define CHR_FILE(X)     X".chr"
@@ -153,37 +211,66 @@
 **  into 16x16 'metatiles' to make up a tileset of 16x16-size tiles (where
 **  the data has a row-width of 32 bytes).
 **  The Attributes data stores 64 bytes of palette info for the 16x16 metatiles.
+**  (other targets have a different screen size, and store the palette of each
+**  8x8 tile in its nametable entry, see `s_target`)
 */
 
-//! The dimensions of a NAM metatile (in pixels, used for both width and height)
-#define NAM_TILE        (16)
+//! The maximum dimensions of a NAM metatile (in pixels, used for both width and height), for any target
+#define NAM_TILE_MAX    (16)
+//! The dimensions of a NAM metatile (in pixels, used for both width and height) - ie: the area which shares one palette
+#define NAM_TILE        TARGET(tile)
 
 //! The maximum amount of colors for the output NAM file
-#define NAM_MAXCOLORS   (16)
+#define NAM_MAXCOLORS   (PAL_COLORS)
+
+//! The maximum width (in pixels) of the output NAM file, for any target
+#define NAM_W_MAX       (256)
+//! The maximum height (in pixels) of the output NAM file, for any target
+#define NAM_H_MAX       (240)
+//! The width (in pixels) of the output NAM file
+#define NAM_W           TARGET(screen_w)
+//! The height (in pixels) of the output NAM file
+#define NAM_H           TARGET(screen_h)
 
 //! The width (in NAM metatiles) of the output NAM file
-#define NAM_W_TILES     (16)
+#define NAM_W_TILES     (NAM_W / NAM_TILE)
 //! The height (in NAM metatiles) of the output NAM file
-#define NAM_H_TILES     (15)
+#define NAM_H_TILES     (NAM_H / NAM_TILE)
 
+//! The maximum amount of NAM metatiles in the output NAM file, for any target (when metatiles are as small as CHR tiles)
+#define NAM_TILES_MAX   ((NAM_W_MAX / CHR_TILE) * (NAM_H_MAX / CHR_TILE))
 //! The total amount of NAM metatiles in the output NAM file
 #define NAM_TILES       (NAM_W_TILES * NAM_H_TILES)
 
-//! The width (in pixels) of the output NAM file
-#define NAM_W           (NAM_W_TILES * NAM_TILE)
-//! The height (in pixels) of the output NAM file
-#define NAM_H           (NAM_H_TILES * NAM_TILE)
+//! The maximum amount of pixels in one NAM metatile, for any target
+#define NAM_TILE_PIXELS_MAX (NAM_TILE_MAX * NAM_TILE_MAX)
+//! The amount of pixels in one NAM metatile
+#define NAM_TILE_PIXELS (NAM_TILE * NAM_TILE)
+//! The maximum amount of pixels in the output NAM file, for any target
+#define NAM_PIXELS_MAX  (NAM_W_MAX * NAM_H_MAX)
+
+//! The width (in CHR tiles) of the output NAM file
+#define NAM_W_CHR       (NAM_W / CHR_TILE)
+//! The height (in CHR tiles) of the output NAM file
+#define NAM_H_CHR       (NAM_H / CHR_TILE)
 
 //! The size (in bytes) of a single NAM metatile combo
-#define NAM_SIZE_TILE   (t_size)(1)
+#define NAM_SIZE_TILE   (t_size)TARGET(nam_entry)
 //! The size (in bytes) of the NAM attributes section (with the palette association data)
-#define NAM_SIZE_ATTR   (t_size)(64)
+#define NAM_SIZE_ATTR   (t_size)TARGET(nam_attr)
+//! The width (in bytes) of one row of the NAM attributes section (each byte covers 2x2 metatiles)
+#define NAM_W_ATTR      (NAM_W_TILES / 2)
 //! The size (in bytes) for the output NAM file
-#define NAM_SIZE        (t_size)(NAM_SIZE_TILE * NAM_W_TILES * NAM_H_TILES + NAM_SIZE_ATTR)
+#define NAM_SIZE        (t_size)(NAM_SIZE_TILE * NAM_W_CHR * NAM_H_CHR + NAM_SIZE_ATTR)
+//! The maximum size (in bytes) for the output NAM file, for any target
+#define NAM_SIZE_MAX    (t_size)(2 * (NAM_W_MAX / CHR_TILE) * (NAM_H_MAX / CHR_TILE) + 64)
 
 //! the filepath prefix/suffix for the output NAM file
 #define NAM_FILE(X)     X".nam"
 
+//! The pixels of the metatile at the given `INDEX`, in `program.tiles_pixels`
+#define TILE_PIXELS(INDEX)  (program.tiles_pixels + (t_size)(INDEX) * NAM_TILE_PIXELS)
+
 //! @}
 
 
@@ -194,6 +281,16 @@
 ** ************************************************************************** *|
 */
 
+//! Stores a rectangular window onto some 8-bit pixel memory, without owning it (used to work on a sub-region of a bitmap with zero copies)
+typedef struct s_view_
+{
+	t_u8*       pixels; //!< The address of the top-left pixel of this view
+	t_sint      pitch;  //!< The distance (in bytes) between the start of two consecutive rows of pixels
+	t_uint      w;      //!< The width (in pixels) of this view
+	t_uint      h;      //!< The height (in pixels) of this view
+}
+s_view;
+
 //! Stores information about one color palette, and whether is it unique or not
 typedef struct s_palette_
 {
@@ -201,7 +298,7 @@ typedef struct s_palette_
 	t_bool      identical;              //!< If TRUE, then palette is idential (equal size) to its parent `duplicate`
 	t_u32       popularity;             //!< The popularity of this palette (ie: how many NAM tiles use this palette ?)
 	t_u8        length;                 //!< The amount of colors in this palette (can be any number between `0` and `PAL_SUB_COLORS`)
-	t_u8        colors[PAL_SUB_COLORS]; //!< A single output palette, storing the `length` most used colors
+	t_u8        colors[PAL_SUB_COLORS_MAX]; //!< A single output palette, storing the `length` most used colors
 }
 s_palette;
 
@@ -222,17 +319,405 @@ typedef struct s_color_use_
 }
 s_color_use;
 
+//! Stores the set of unique CHR tiles used by the output (shared by all frames, when converting an animation)
+typedef struct s_chrset_
+{
+	t_uint      amount;                         //!< The amount of unique tiles stored in `tiles`
+	t_uint      overflow;                       //!< The amount of tiles which did not fit, and were replaced by their nearest existing tile
+	t_u64       hashes[CHR_TILES_MAX];          //!< The hash of each tile in `tiles`, to find duplicates quickly
+	t_u8        tiles[CHR_TILES_MAX * CHR_SIZE_TILE_MAX];//!< The tiles, already encoded in the CHR file format (each is `CHR_SIZE_TILE` bytes)
+}
+s_chrset;
+
+//! Stores the conversion error measured over one metatile (or over the whole bitmap), between the reference colors and the output colors
+typedef struct s_metrics_
+{
+	t_u32       pixels;                 //!< The amount of pixels measured
+	t_u32       changed;                //!< The amount of pixels whose output color differs from their reference color
+	t_float     delta_sum;              //!< The sum of the CIE76 color difference (ΔE) of every pixel
+	t_float     delta_max;              //!< The largest color difference (ΔE) of any pixel
+	t_u64       squared_sum;            //!< The sum of the squared differences of the RGB channels of every pixel (for the PSNR)
+}
+s_metrics;
+
 //! Stores information about the colors used in one NAM tile
 typedef struct s_tiles_use_
 {
 	t_u8        total;                  //!< The total amount of different unique colors used in this tile
 	s_palette   palette;                //!< The palette for this tile
-	s_color_use colors[BMP_MAXCOLORS];  //! The list of colors (sorted by most-to-least frequently used)
+	s_color_use colors[PAL_COLORS_MAX]; //! The list of colors (sorted by most-to-least frequently used)
 }
 s_tiles_use;
 
 
 
+//! Lists the hardware targets which can be chosen with `--target`
+typedef enum e_target_
+{
+	TARGET_NES = 0,     //!< Nintendo NES/Famicom background (the default)
+	TARGET_GB,          //!< Nintendo Game Boy (DMG) background
+	TARGET_SMS,         //!< Sega Master System background
+	TARGET_SNES_4BPP,   //!< Super Nintendo 4bpp background (BG1/BG2 in modes 0 and 1)
+TARGETS_AMOUNT
+}
+e_target;
+
+//! Lists the ways in which the colors of the output PAL file can be encoded
+typedef enum e_pal_format_
+{
+	PAL_FORMAT_INDEX = 0,   //!< One byte per color: its index in the reference palette (which is the hardware color value)
+	PAL_FORMAT_BGR555,      //!< Two bytes per color (little-endian): `0bbbbbgggggrrrrr`
+}
+e_pal_format;
+
+//! Stores the properties of one hardware target, and its specialized kernels (chosen at runtime, with `--target`)
+typedef struct s_target_
+{
+	t_char const*   name;           //!< The name of this target, as given to `--target`
+	t_char const*   description;    //!< The full name of this target, as shown in the `--help`
+	t_uint          screen_w;       //!< The width (in pixels) of one screen of background
+	t_uint          screen_h;       //!< The height (in pixels) of one screen of background
+	t_uint          tile;           //!< The attribute granularity: the size (in pixels) of the square area which shares one palette
+	t_uint          pal_colors;     //!< The amount of colors in each palette
+	t_uint          pal_amount;     //!< The amount of palettes
+	t_uint          pal_colorsize;  //!< The size (in bytes) of one color in the output PAL file
+	e_pal_format    pal_format;     //!< How the colors of the output PAL file are encoded
+	t_uint          chr_bpp;        //!< The amount of bits-per-pixel of the output CHR tiles
+	t_uint          chr_tiles;      //!< The maximum amount of unique CHR tiles which can be addressed by the nametable
+	t_uint          nam_entry;      //!< The size (in bytes) of one nametable entry (little-endian)
+	t_uint          nam_attr;       //!< The size (in bytes) of the separate attribute table which follows the nametable (or 0 if the palette is in each entry)
+	t_uint          nam_palette;    //!< The bit position of the palette number in a nametable entry (if there is no separate attribute table)
+	t_argb32 const* refpal;         //!< The built-in reference palette (the index of each color is its value in the output PAL file)
+	t_uint          refpal_colors;  //!< The amount of colors in `refpal`
+	//! The kernels which are specialized for this target (see `target_kernels.h`)
+	//!@{
+	void    (*pack_tiles)(s_view const* view, t_u8* tiles);
+	void    (*unpack_tiles)(t_u8 const* tiles, t_u8* pixels, t_sint pitch);
+	void    (*histogram_tile)(t_u8 const* pixels, t_u32* counts);
+	void    (*remap_tile)(t_u8* pixels, t_u8 const* lookup);
+	void    (*encode_tile)(t_u8* dest, t_u8 const* pixels);
+	void    (*decode_tile)(t_u8* pixels, t_sint pitch, t_u8 const* src, t_u8 offset);
+	//!@}
+}
+s_target;
+
+//! The list of all hardware targets, indexed by `e_target`
+extern s_target const   targets[TARGETS_AMOUNT];
+
+
+
+//! Lists the different counters which are gathered by the `--profile` instrumentation
+typedef enum e_profile_counter_
+{
+	PROFILE_PIXELS = 0,     //!< The amount of bitmap pixels read and/or written
+	PROFILE_NEAREST,        //!< The amount of nearest-color queries
+	PROFILE_COMPARISONS,    //!< The amount of color/palette comparisons
+	PROFILE_ALLOCATIONS,    //!< The amount of heap allocations
+PROFILE_COUNTERS_AMOUNT
+}
+e_profile_counter;
+
+//! The maximum amount of distinct pipeline stages which can be profiled
+#define PROFILE_STAGES_MAX  (32)
+
+//! Stores the timing and counters gathered for one pipeline stage
+typedef struct s_profile_stage_
+{
+	t_char const*   name;                               //!< The name of this stage (the stringified function call)
+	t_u32           calls;                              //!< The amount of times this stage was run
+	t_u64           time_ns;                            //!< The total time spent in this stage (in nanoseconds)
+	t_u64           counters[PROFILE_COUNTERS_AMOUNT];  //!< The counters accumulated while this stage was running
+}
+s_profile_stage;
+
+//! Stores all of the internal state for the `--profile` instrumentation
+typedef struct s_profile_
+{
+	t_bool          enabled;                        //!< (user-specified) If TRUE, stage timings are recorded and output at the end
+	t_char const*   file_json;                      //!< (user-specified) If non-NULL, the profile report is written as JSON to this filepath
+	t_char const*   stage;                          //!< The name of the stage which is currently running (or NULL if none)
+	t_u64           start_ns;                       //!< The timestamp at which the current stage was started
+	t_uint          current;                        //!< The index of the stage which is currently running (`0` is for work done outside any stage)
+	t_uint          stages_amount;                  //!< The amount of distinct stages recorded so far
+	s_profile_stage stages[PROFILE_STAGES_MAX];     //!< The timings and counters for each stage
+}
+s_profile;
+
+
+
+//! The filepath which stands for stdin (as `INPUTFILE`) or stdout (as `OUTPUTFILE`)
+#define PATH_STDIO          "-"
+//! The maximum amount of output files written by one conversion
+#define OUTPUT_FILES_MAX    (8)
+//! The size (in bytes) of one block of a tar archive, as written by `--bundle`
+#define OUTPUT_TAR_BLOCK    (512)
+
+//! Stores one output file of the current conversion, in memory, before it is written out
+typedef struct s_output_file_
+{
+	t_char const*   extension;  //!< The file extension of this output (appended to `program.file_output`)
+	t_u8 const*     data;       //!< The contents of the file (allocated from `program.arena`)
+	t_size          size;       //!< The size (in bytes) of `data`
+}
+s_output_file;
+
+
+
+//! The maximum amount of worker threads used by `--server` (by default, there is one per CPU core)
+#define SERVER_WORKERS_MAX  (64)
+//! The maximum amount of jobs which can be waiting for a worker thread (further requests block until one is free)
+#define SERVER_QUEUE_SIZE   (256)
+//! The maximum size (in bytes) of one request frame received by `--server`
+#define SERVER_REQUEST_MAX  (64 * 1024)
+//! The stack size (in bytes) of a server worker thread, which runs the whole conversion like the main thread does
+#define SERVER_WORKER_STACK (8 * 1024 * 1024)
+
+
+
+//! The maximum amount of frames which can be converted at once by `--frames`
+#define ANIM_FRAMES_MAX     (256)
+//! The filepath prefix/suffix for the output file of per-frame NAM deltas, written by `--frames`
+#define ANIM_DELTA_FILE(X)  X".namdelta"
+
+
+
+//! Lists the dithering algorithms which can be chosen with `--dither` (each one only uses the colors of the palette of each metatile)
+typedef enum e_dither_
+{
+	DITHER_NONE = 0,    //!< No dithering: each pixel becomes the nearest color of its metatile's palette (the default)
+	DITHER_BAYER,       //!< Ordered dithering, with an 8x8 Bayer threshold map
+	DITHER_FLOYD,       //!< Floyd-Steinberg error diffusion
+	DITHER_ATKINSON,    //!< Atkinson error diffusion (only diffuses 3/4 of the error, so it keeps more contrast)
+DITHER_AMOUNT
+}
+e_dither;
+
+//! The palette index given to `Dither_Apply()` for a metatile which should be left as it is
+#define DITHER_SKIP         (0xFF)
+//! The range of the ordered dithering offsets added to each color channel (a higher value gives a stronger pattern)
+#define DITHER_SPREAD       (64)
+//! The maximum amount of extra threads used for dithering (by default, there is one per additional CPU core)
+#define DITHER_THREADS_MAX  (16)
+
+
+
+//! The filepath prefix/suffix for the per-pixel error heatmap bitmap, written by `--heatmap`
+#define METRICS_HEATMAP_FILE(X) X".heatmap.bmp"
+//! The color difference (ΔE) which is shown as the brightest color of the heatmap
+#define METRICS_HEATMAP_MAX     (50)
+//! The PSNR (in decibels) reported for an output which is identical to its reference colors
+#define METRICS_PSNR_MAX        (99)
+
+
+
+//! Lists the formats in which the conversion report can be written by `--report`
+typedef enum e_report_format_
+{
+	REPORT_NONE = 0,    //!< No report is written (the default)
+	REPORT_JSON,        //!< The report is written as a JSON document
+REPORT_FORMATS_AMOUNT
+}
+e_report_format;
+
+//! The filepath prefix/suffix for the conversion report, written by `--report`
+#define REPORT_FILE(X)      X".report.json"
+//! The size (in bytes) of the buffer through which the report is written
+#define REPORT_BUFFER       (16 * 1024)
+//! The largest size (in bytes) of one formatted value of the report (a number, or an escaped character)
+#define REPORT_VALUE_MAX    (64)
+
+//! Stores what the conversion report needs to know about the input bitmap, before it is converted
+typedef struct s_report_
+{
+	e_report_format format;                         //!< (user-specified) The format of the report (or `REPORT_NONE` if no report is written)
+	t_u64           start_ns;                       //!< The timestamp at which the current conversion was started
+	t_uint          bitmap_w;                       //!< The width (in pixels) of the input bitmap
+	t_uint          bitmap_h;                       //!< The height (in pixels) of the input bitmap
+	t_argb32        colors[BMP_MAXCOLORS];          //!< The color of each pixel value of the input bitmap
+	t_u32           colors_used[BMP_MAXCOLORS];     //!< The amount of converted pixels which have each pixel value
+	t_u8            tiles_colors[NAM_TILES_MAX];    //!< The amount of reference colors in each metatile (including the colorkey)
+}
+s_report;
+
+
+
+//! Lists the formats in which the NAM and CHR outputs can also be compressed by `--compress`
+typedef enum e_compress_
+{
+	COMPRESS_NONE = 0,  //!< No compressed output is written (the default)
+	COMPRESS_RLE,       //!< The RLE format of the `vram_unrle()` routine of neslib (a tag byte, literals, and `tag, N` repeats)
+	COMPRESS_LZ4,       //!< One raw LZ4 block (without any frame header)
+	COMPRESS_TILES,     //!< (only for CHR) A bitstream of rows, each coded as a repeat of the row above, or by move-to-front color ranks
+COMPRESS_AMOUNT
+}
+e_compress;
+
+//! The amount of bits of the hash of 4 bytes, used to find LZ4 matches
+#define COMPRESS_HASH_BITS      (16)
+//! The amount of slots in the hash table used to find LZ4 matches
+#define COMPRESS_HASH_SIZE      (1 << COMPRESS_HASH_BITS)
+//! The maximum amount of previous positions tried for each LZ4 match, for the optimal parse
+#define COMPRESS_DEPTH          (256)
+//! The maximum amount of previous positions tried for each LZ4 match, for the greedy parse of `--compress_fast`
+#define COMPRESS_DEPTH_FAST     (16)
+//! The LZ4 match length from which the optimal parse only tries the longest match (rather than every length)
+#define COMPRESS_SUFFICIENT     (128)
+
+
+
+//! Lists the filters which can be chosen with `--scale`, to shrink a high-resolution bitmap down to the output size
+typedef enum e_scale_
+{
+	SCALE_NONE = 0,     //!< No scaling: only the top-left-most region of the bitmap is converted (the default)
+	SCALE_NEAREST,      //!< Each pixel takes the color of the source pixel at its center (shrinks by a whole factor)
+	SCALE_BOX,          //!< Each pixel averages the square block of source pixels it covers (shrinks by a whole factor)
+	SCALE_AREA,         //!< Each pixel averages the source pixels it covers, in proportion to the area covered (stretches to exactly the output size)
+SCALE_AMOUNT
+}
+e_scale;
+
+//! The amount of slots in the nearest reference color cache used while scaling (must be a power of 2)
+#define SCALE_CACHE_SIZE    (4096)
+
+
+
+//! The stack size (in bytes) of a `--portfolio` strategy thread, which runs the whole conversion like the main thread does
+#define PORTFOLIO_THREAD_STACK  (8 * 1024 * 1024)
+
+
+
+//! The delay (in milliseconds) during which `--watch` waits for more changes, before reconverting
+#define WATCH_DEBOUNCE  (50)
+
+//! Lists the files which are monitored by `--watch` (as bitflags, to report several changes at once)
+typedef enum e_watch_file_
+{
+	WATCH_INPUT   = (1 << 0),   //!< The input BMP file
+	WATCH_REFPAL  = (1 << 1),   //!< The reference palette file given with `--refpal`
+	WATCH_PALETTE = (1 << 2),   //!< The user-specified `--palette` file
+}
+e_watch_file;
+
+
+
+//! The amount of hexadecimal digits in the name of a build cache entry (one 64-bit hash)
+#define BUILDCACHE_KEYLENGTH    (16)
+
+//! Stores the state of the content-hash build cache (see `--cache_dir` and `--depfile`)
+typedef struct s_buildcache_
+{
+	t_char const*   dir;        //!< (user-specified) The directory in which converted outputs are stored, named by their hash (or NULL if disabled)
+	t_char const*   file_deps;  //!< (user-specified) The filepath of the make-style dependency file to write (or NULL if none)
+	t_u64           key;        //!< The hash of all inputs of the current conversion
+	t_bool          hit;        //!< Whether or not the outputs of the current conversion were restored from the cache
+}
+s_buildcache;
+
+
+
+//! The file extension of the persistent tile cache sidecar file
+#define TILECACHE_FILE(X)       X".tilecache"
+//! The magic number identifying a tile cache file (ASCII "B2NT")
+#define TILECACHE_MAGIC         (0x544E3242)
+//! The version number of the tile cache file format (increment this when the cached computations change)
+#define TILECACHE_VERSION       (2)
+//! The initial amount of slots in the tile cache hash table (must be a power of 2)
+#define TILECACHE_CAPACITY      (1024)
+//! The maximum amount of entries in the tile cache (when reached, the cache is cleared)
+#define TILECACHE_MAXENTRIES    (1 << 18)
+
+//! Lists the different kinds of per-tile results which are stored in the tile cache
+typedef enum e_tilecache_kind_
+{
+	TILECACHE_HISTOGRAM = 1,    //!< The sorted color histogram of a tile, as computed by `CheckBitmap_TilesColors()`
+	TILECACHE_REMAP,            //!< The output pixels of a tile, as computed by `ConvertBitmap_ApplyOutputPalettes()`
+}
+e_tilecache_kind;
+
+//! Stores the cached result of one per-tile computation, identified by a content hash
+typedef struct s_tilecache_entry_
+{
+	t_u64       key;                            //!< The hash of the tile pixels and all inputs of the computation (`0` means empty slot)
+	t_u8        kind;                           //!< The kind of result stored here (see `e_tilecache_kind`)
+	t_u8        total;                          //!< (histogram) The amount of unique colors in the tile
+	t_u8        length;                         //!< (histogram) The amount of used entries in `colors`
+	s_color_use colors[PAL_COLORS_MAX];         //!< (histogram) The colors used by the tile, sorted by popularity
+	t_u8        pixels[NAM_TILE_PIXELS_MAX];    //!< (remap) The output pixels of the tile
+}
+s_tilecache_entry;
+
+//! Stores a content-addressed hash table of per-tile results, which can persist across runs
+typedef struct s_tilecache_
+{
+	t_bool              enabled;    //!< (user-specified) If TRUE, per-tile results are looked up/stored in this cache
+	t_char const*       filepath;   //!< The filepath of the sidecar file to which this cache is persisted (or NULL if not persisted)
+	t_size              capacity;   //!< The amount of slots in the `entries` hash table (always a power of 2)
+	t_size              amount;     //!< The amount of slots which are in use
+	t_size              hits;       //!< The amount of lookups which found a cached result
+	t_size              misses;     //!< The amount of lookups which did not find a cached result
+	s_tilecache_entry*  entries;    //!< The open-addressing hash table of cached results
+}
+s_tilecache;
+
+
+
+//! The minimum size (in bytes) of one block of memory allocated by an arena
+#define ARENA_BLOCK_SIZE    (64 * 1024)
+//! The alignment (in bytes) of every allocation made from an arena
+#define ARENA_ALIGN         (16)
+
+//! Stores one contiguous block of memory, from which an arena makes its allocations
+typedef struct s_arena_block_
+{
+	struct s_arena_block_*  next;       //!< The next block in this arena (or NULL if this is the last one)
+	t_size                  size;       //!< The total size (in bytes) of the `data` of this block
+	t_size                  used;       //!< The amount of bytes of `data` which are currently in use
+	t_u8*                   data;       //!< The memory of this block (allocated just after this header)
+}
+s_arena_block;
+
+//! Stores a linear allocator, whose allocations are all freed at once (blocks are kept, so memory use stays flat)
+typedef struct s_arena_
+{
+	s_arena_block*  first;      //!< The first block of this arena (or NULL if nothing has been allocated yet)
+	s_arena_block*  current;    //!< The block from which the next allocation will be made
+}
+s_arena;
+
+
+
+//! The amount of trace events which can be stored in the ring buffer of one thread (older events get overwritten)
+#define TRACE_BUFFER_EVENTS (4096)
+//! The maximum amount of threads which can record trace events at once (the buffer of a thread which has exited is reused)
+#define TRACE_THREADS_MAX   (64)
+//! The amount of distinct file paths which can be stored in the ring buffer of one thread (older paths get overwritten)
+#define TRACE_BUFFER_FILES  (64)
+
+//! Stores one begin/end event, as recorded by the `--trace` instrumentation
+typedef struct s_trace_event_
+{
+	t_char const*   name;       //!< The name of the pipeline stage (must be a static string)
+	t_sint          file;       //!< The index in the buffer's `files` of the filepath being processed when this event occurred (or -1 if none)
+	t_u64           time_ns;    //!< The timestamp of this event (in nanoseconds)
+	t_char          phase;      //!< The trace-event phase: `'B'` for begin, `'E'` for end
+}
+s_trace_event;
+
+//! Stores the trace events recorded by one thread, as a fixed-size ring buffer
+typedef struct s_trace_buffer_
+{
+	t_uint          tid;                            //!< The trace-event thread id of the owner thread
+	t_char const*   name;                           //!< The display name of the owner thread
+	t_size          count;                          //!< The total amount of events recorded (the ring index is `count % TRACE_BUFFER_EVENTS`)
+	s_trace_event   events[TRACE_BUFFER_EVENTS];    //!< The ring buffer of recorded events
+	t_char*         files[TRACE_BUFFER_FILES];      //!< The copies of the filepaths used by events (the caller's strings may be freed before the trace is written)
+	t_size          files_since[TRACE_BUFFER_FILES];//!< The `count` at which each of `files` was stored (older events with that index used an overwritten path)
+	t_uint          files_next;                     //!< The index of `files` which will be overwritten next
+}
+s_trace_buffer;
+
+
+
 //! The total amount of possible unique program option flags
 typedef struct s_program_arg_
 {
@@ -249,10 +734,37 @@ typedef enum e_program_arg_
 {
 	PROGRAM_ARG_HELP = 0,
 	PROGRAM_ARG_VERBOSE,
+	PROGRAM_ARG_QUIET,
 	PROGRAM_ARG_BITMAP_W,
 	PROGRAM_ARG_BITMAP_H,
+	PROGRAM_ARG_TARGET,
+	PROGRAM_ARG_REFPAL,
+	PROGRAM_ARG_EMPHASIS,
 	PROGRAM_ARG_PALETTE,
 	PROGRAM_ARG_COLORKEY,
+	PROGRAM_ARG_CROP,
+	PROGRAM_ARG_ALIGN,
+	PROGRAM_ARG_SCALE,
+	PROGRAM_ARG_DITHER,
+	PROGRAM_ARG_PROGRESSIVE,
+	PROGRAM_ARG_PORTFOLIO,
+	PROGRAM_ARG_HEATMAP,
+	PROGRAM_ARG_REPORT,
+	PROGRAM_ARG_COMPRESS,
+	PROGRAM_ARG_COMPRESS_FAST,
+	PROGRAM_ARG_VERIFY,
+	PROGRAM_ARG_TILECACHE,
+	PROGRAM_ARG_CACHEDIR,
+	PROGRAM_ARG_DEPFILE,
+	PROGRAM_ARG_FRAMES,
+	PROGRAM_ARG_CHECK,
+	PROGRAM_ARG_WATCH,
+	PROGRAM_ARG_SERVER,
+	PROGRAM_ARG_STDOUT,
+	PROGRAM_ARG_BUNDLE,
+	PROGRAM_ARG_PROFILE,
+	PROGRAM_ARG_PROFILE_JSON,
+	PROGRAM_ARG_TRACE,
 PROGRAM_ARGS_AMOUNT
 }
 e_program_arg;
@@ -262,32 +774,91 @@ typedef struct s_program_
 {
 	t_char const*   called;                         //!< The name of the program, as it was called by the commandline (typically full path)
 	s_logger        logger;                         //!< The logger, holds internal state for logging to terminal output
+	s_target const* target;                         //!< (user-specified) The hardware target for the output files (NES by default)
 	t_char const*   file_input;                     //!< (user-specified) The input filepath (with .bmp file extension)
 	t_char const*   file_output;                    //!< (user-specified) The output filepath (without the file extension)
+	t_char const*   file_palette;                   //!< (user-specified) The filepath of the palette file given with `--palette` (or NULL if none)
+	t_char const*   file_refpal;                    //!< (user-specified) The filepath of the (first) reference palette file given with `--refpal` (or NULL to use the built-in one of the `target`)
+	t_char const*   files_refpal[REFPAL_FILES_MAX]; //!< (user-specified) The filepaths of every reference palette file given with `--refpal`
+	t_uint          files_refpal_amount;            //!< The amount of items in `files_refpal`
+	t_sint          emphasis;                       //!< (user-specified) The NES color emphasis bits (0 to 7) to apply to the reference palette, or `REFPAL_EMPHASIS_AUTO` to try them all
+	t_char const*   output_stream;                  //!< (user-specified) The extension of the output which is written to stdout, when `file_output` is `-` (or NULL for the first one)
+	t_bool          output_bundle;                  //!< (user-specified) If TRUE, all outputs are written to stdout as one tar archive stream, when `file_output` is `-`
+	t_u8 const*     input_data;                     //!< The contents of the input file (read from `file_input`, or from stdin)
+	t_size          input_size;                     //!< The size (in bytes) of `input_data`
+	s_output_file   outputs[OUTPUT_FILES_MAX];      //!< The output files of the current conversion, which are all written out at once
+	t_uint          outputs_amount;                 //!< The amount of items in `outputs`
 	t_uint          expected_w;                     //!< (user-specified) The expected width (in pixels) for the bitmap file
 	t_uint          expected_h;                     //!< (user-specified) The expected width (in pixels) for the bitmap file
-	s_color_use     colorkey;                       //!< (user-specified) The colorkey value provided by the user - if none is specified via argv, then `.colorkey.occurences` will be 0
-	t_argb32        ref_palette[REFPAL_COLORS];     //!< (user-specified) The reference palette to use for outputting, and comparing nearest colors from the BMP
-	s_palette       output_palettes[PAL_SUB_AMOUNT];//!< (user-specified, or generated) The output palette(s) to use
+	s_color_use     colorkey;                       //!< (user-specified) The colorkey value provided by the user (`.index` is its nearest reference color, set by `RefPal_Select()`) - if none is specified via argv, then `.colorkey.occurences` will be 0
+	SDL_Rect        crop;                           //!< (user-specified) The region of the bitmap to convert - if none is specified via argv, then `.crop.w` will be 0
+	SDL_Point       align;                          //!< (user-specified) The offset of the attribute grid within the converted region (by default, it is at (0,0))
+	t_bool          align_auto;                     //!< (user-specified) If TRUE, `align` is chosen as the offset with the fewest metatiles which have too many colors
+	e_scale         scale;                          //!< (user-specified) The filter used to shrink the bitmap down to the output size (`SCALE_NONE` by default)
+	e_dither        dither;                         //!< (user-specified) The dithering algorithm applied along with the output palettes (`DITHER_NONE` by default)
+	t_bool          progressive;                    //!< (user-specified) If TRUE, a greedy preview is written first, and then overwritten each time the output palettes are refined
+	t_uint          progressive_budget;             //!< (user-specified) The maximum time (in milliseconds) spent refining after the preview (0 means until no further improvement is found)
+	t_bool          portfolio;                      //!< (user-specified) If TRUE, several conversion strategies are run in parallel, and the one with the lowest error is kept
+	t_bool          heatmap;                        //!< (user-specified) If TRUE, a bitmap showing the color error of each output pixel is written along with the other outputs
+	e_compress      compress_nam;                   //!< (user-specified) The format of the compressed copy of the NAM output (`COMPRESS_NONE` by default)
+	e_compress      compress_chr;                   //!< (user-specified) The format of the compressed copy of the CHR output (`COMPRESS_NONE` by default)
+	t_bool          compress_fast;                  //!< (user-specified) If TRUE, the compressed outputs are made with a fast greedy parse, rather than the smallest optimal one
+	t_bool          verify;                         //!< (user-specified) If TRUE, the NAM/CHR/PAL outputs are rendered back into pixels, and checked against the BMP output before writing
+	s_report        report;                         //!< The input statistics kept for the conversion report (see `--report`)
+	t_u32           threshold;                      //!< The color distance at or below which two colors are fused by the color reduction steps (`THRESHOLD` by default)
+	t_bool          reduce_tiles_only;              //!< If TRUE, the whole-bitmap color reduction step is skipped (only the per-tile one is done)
+	t_uint          frames;                         //!< (user-specified) If non-zero, `file_input` is a printf-style pattern (like `water_%02d.bmp`) for this many animation frames
+	t_bool          check;                          //!< (user-specified) If TRUE, every input file is only checked for compliance with the target's limits (nothing is converted or written)
+	t_bool          watch;                          //!< (user-specified) If TRUE, the program keeps running, and reconverts whenever an input file changes
+	t_char const*   server;                         //!< (user-specified) If non-NULL, the program runs as a conversion server on this Unix socket path (or `-` for stdin/stdout)
+	t_argb32        ref_palette[REFPAL_COLORS_MAX]; //!< (user-specified) The reference palette to use for outputting, and comparing nearest colors from the BMP
+	t_uint          ref_colors;                     //!< The amount of colors in `ref_palette`
+	t_argb32        ref_bases[REFPAL_FILES_MAX][REFPAL_COLORS_MAX];//!< The colors of each reference palette file (or of the built-in one), before any color emphasis
+	t_uint          ref_bases_colors[REFPAL_FILES_MAX]; //!< The amount of colors of each item of `ref_bases`
+	t_uint          ref_base;                       //!< The index of the item of `ref_bases` from which `ref_palette` was made
+	t_uint          ref_emphasis;                   //!< The color emphasis bits which were applied to make `ref_palette`
+	t_u32 const   (*ref_distances)[REFPAL_COLORS_MAX];//!< The `Color_ARGB32_Difference()` between each pair of reference palette colors (shared by all threads, see `RefPal_GetDistances()`)
+	s_palette       output_palettes[PAL_SUB_AMOUNT_MAX];//!< (user-specified, or generated) The output palette(s) to use
+	s_arena         arena;                          //!< The scratch memory for the current conversion (reset once the conversion is done)
+	s_tilecache     tilecache;                      //!< The per-tile results cache (persisted to a sidecar file between runs)
+	s_buildcache    buildcache;                     //!< The whole-file outputs cache (skips conversion entirely when no input has changed)
 /*
 	t_float*        certainty;      //!< The array of tile/palette association certainty values
 	t_float         threshold_lo;   //!< The uncertainty threshold, below which a palette must be thrown out
 	t_float         threshold_hi;   //!< The certainty threshold, above which a palette must be forcibly kept
 */
 	SDL_Surface*    bitmap;                         //!< The input file (loaded .bmp file as an SDL_Surface)
+	s_view          view;                           //!< The region of the input `bitmap` which is to be converted (set by `CheckBitmap_Dimensions()`)
+	SDL_Surface*    output;                         //!< The output bitmap (whenever possible, it borrows the pixels of `view` rather than having its own)
+	_Alignas(64)
+	t_u8            tiles_pixels[NAM_PIXELS_MAX];   //!< The bitmap pixels, in tile-major order (each metatile is contiguous, in row-major order: see `TILE_PIXELS()`)
 	t_u32           bitmap_colors_total;            //!< Whether or not there are to many different unique colors in this bitmap/tile
 	s_color_use     bitmap_colors[BMP_MAXCOLORS];   //!< The total amounts of colors used in the bitmap
-	s_color_use     occur_colors[PAL_COLORS];       //!< The 16 "most used" colors (used to assert the final tileset palettes)
-	s_tiles_use     tiles_colors[NAM_TILES];        //!< The total amounts of colors used, per CHR tile
-	s_palette       tiles_palettes[NAM_TILES];      //!< The minimum necessary amount of palettes for all tiles (assuming lossless)
+	t_u8            tiles_source[NAM_PIXELS_MAX];   //!< A copy of `tiles_pixels` before the reference palette is applied (only kept when `dither` is set)
+	t_argb32        source_palette[BMP_MAXCOLORS];  //!< The original colors of the bitmap's pixel values (only kept when `dither` is set)
+	t_u8            tiles_reference[NAM_PIXELS_MAX];//!< A copy of `tiles_pixels` right after the reference palette is applied, which the error of every output is measured against
+	s_metrics       metrics;                        //!< The conversion error of the whole output (see `Metrics_End()`)
+	s_metrics       metrics_tiles[NAM_TILES_MAX];   //!< The conversion error of each metatile
+	t_float         metrics_lab[REFPAL_COLORS_MAX][3];  //!< The CIE L*a*b* coordinates of each reference palette color
+	t_u8            metrics_pixels[NAM_PIXELS_MAX]; //!< The color error of each output pixel, scaled to 0-255, in tile-major order (only kept when `heatmap` is set)
+	s_color_use     occur_colors[PAL_COLORS_MAX];   //!< The `PAL_COLORS` "most used" colors (used to assert the final tileset palettes)
+	s_tiles_use     tiles_colors[NAM_TILES_MAX];    //!< The total amounts of colors used, per CHR tile
+	s_palette       tiles_palettes[NAM_TILES_MAX];      //!< The minimum necessary amount of palettes for all tiles (assuming lossless) - or, with user-given output palettes, the palette wanted by each tile
 	t_u32           tiles_palettes_amount;          //!< The total amount of unique palettes necessary for the bitmap
+#if PROFILING
+	s_profile       profile;                        //!< The timings and counters gathered for each pipeline stage
+#endif
 }
 s_program;
 
 
 
-//! This is global variable which holds all internal state for the program
-extern s_program    program;
+//! This is global variable which holds all internal state for the program (as used by the main thread)
+extern s_program                program_main;
+//! The state used by the calling thread: `program_main`, or the heap-allocated copy of a `--server` or `--portfolio` worker
+extern _Thread_local s_program* program_context;
+//! All internal state is accessed through `program`, which is the state of the calling thread (see `program_context`)
+#define program     (*program_context)
 
 
 
@@ -299,6 +870,21 @@ extern s_program    program;
 
 t_u32 Color_Sum(t_argb32 color);
 
+//! The initial value to give to `Hash_FNV1a()`
+#define HASH_SEED   (0xCBF29CE484222325)
+//! Returns the 64-bit FNV-1a hash of the given `data`, continuing on from the given previous `hash` value
+t_u64 Hash_FNV1a(void const* data, t_size size, t_u64 hash);
+
+//! Returns the current time of the monotonic clock (which never jumps, unlike the wall clock), in nanoseconds
+t_u64   Time_GetMonotonic(void);
+
+//! The function through which `JSON_WriteString()` outputs its text, to the given `context`
+typedef void (*f_json_write)(void* context, t_char const* data, t_size size);
+//! Outputs the given `str` as a quoted and escaped JSON string (a NULL `str` is output as an empty string)
+void    JSON_WriteString(f_json_write write, void* context, t_char const* str);
+//! A `f_json_write` function which writes to the file descriptor pointed to by `fd` (a `t_fd*`)
+void    JSON_Write_FD(void* fd, t_char const* data, t_size size);
+
 //! sort indexed colors of the `ref_palette`, by brightness
 int Compare_ColorDiffs(s_colordiff c1, s_colordiff c2);
 DEFINEFUNC_H_QUICKSORT(s_colordiff, Compare_ColorDiffs)
@@ -330,10 +916,15 @@ s_palette const* Palette_GetNearest(s_palette target, s_palette const* palettes,
 
 
 
-//! Returns a new string which displays a colored square in the commandline output
-t_char* ANSI_GetColor(t_argb32 color);
-//! Returns a new string which displays a set of colored squares in the commandline output
-t_char* ANSI_GetPalette(s_palette* palette);
+//! The size (in bytes) of the buffer needed for `ANSI_GetColor()` (including the '\0' terminator)
+#define ANSI_COLOR_SIZE     (24)
+//! The size (in bytes) of the buffer needed for `ANSI_GetPalette()` (including the '\0' terminator)
+#define ANSI_PALETTE_SIZE   (PAL_SUB_COLORS_MAX * (ANSI_COLOR_SIZE + 3) + 3)
+
+//! Writes a string which displays a colored square in the commandline output, into the given `dest` buffer (returns `dest`)
+t_char const* ANSI_GetColor(t_char dest[ANSI_COLOR_SIZE], t_argb32 color);
+//! Writes a string which displays a set of colored squares in the commandline output, into the given `dest` buffer (returns `dest`)
+t_char const* ANSI_GetPalette(t_char dest[ANSI_PALETTE_SIZE], s_palette const* palette);
 
 
 
@@ -341,6 +932,405 @@ int PrintColorStats(s_color_use const* array, t_size length);
 
 
 
+/*
+** ************************************************************************** *|
+**                           Arena Memory Functions                           *|
+** ************************************************************************** *|
+*/
+
+//! Returns `size` bytes of scratch memory (aligned to `ARENA_ALIGN`) from the given `arena`, or NULL on failure
+void*       Arena_Allocate(s_arena* arena, t_size size);
+//! Returns a copy of the given `array` of `size` bytes, allocated from the given `arena`
+void*       Arena_Duplicate(s_arena* arena, void const* array, t_size size);
+//! Returns a new string, allocated from the given `arena`, which is the concatenation of `str1` and `str2`
+t_char*     Arena_Concat(s_arena* arena, t_char const* str1, t_char const* str2);
+//! Reads the entire contents of the given file descriptor `fd` (which may be a pipe) into `arena` memory, and returns the amount of bytes read (or -1 on failure)
+t_sintmax   Arena_ReadFile(s_arena* arena, t_fd fd, t_u8** a_file);
+//! Frees all allocations made from the given `arena` at once, in O(1), while keeping its blocks for reuse
+void        Arena_Reset(s_arena* arena);
+//! Returns all of the memory blocks held by the given `arena` to the heap
+void        Arena_Delete(s_arena* arena);
+
+
+
+/*
+** ************************************************************************** *|
+**                            Input/Output Functions                          *|
+** ************************************************************************** *|
+*/
+
+//! Reads the whole input file (or stdin, if `file_input` is `-`) into `program.input_data`
+int     Input_Read(void);
+//! Adds an output file for the current conversion (the given `data` must live until `Output_WriteAll()` is called)
+int     Output_Add(t_char const* extension, t_u8 const* data, t_size size);
+//! Encodes the given `surface` as a BMP file in memory, and adds it as an output file for the current conversion
+int     Output_AddBitmap(t_char const* extension, SDL_Surface* surface);
+//! Writes all the output files of the current conversion, either next to `file_output`, or to stdout
+int     Output_WriteAll(void);
+
+
+
+/*
+** ************************************************************************** *|
+**                           Output Encoding Functions                        *|
+** ************************************************************************** *|
+*/
+
+//! Encodes the output palettes as a PAL file
+void    EncodeBitmap_PAL(t_u8* dest);
+//! Encodes the current `tiles_pixels` (once output palettes are applied) as a NAM file, adding any new 8x8 tiles to `chrset`
+int     EncodeBitmap_NAM(s_chrset* chrset, t_u8* dest);
+//! Encodes the given `chrset` as a CHR file (unused tiles are left blank)
+void    EncodeBitmap_CHR(s_chrset const* chrset, t_u8* dest);
+//! Encodes the current conversion as CHR, NAM and PAL files, and adds them as output files
+int     EncodeBitmap_Outputs(void);
+
+
+
+/*
+** ************************************************************************** *|
+**                           Build Cache Functions                            *|
+** ************************************************************************** *|
+*/
+
+//! Computes `program.buildcache.key`, the hash of every input which affects the output files
+int     BuildCache_GetKey(void);
+//! Loads the cached output files for the current key into `program.outputs` - returns TRUE if all of them were restored
+t_bool  BuildCache_Restore(void);
+//! Stores the output files of the current conversion in the cache directory, for the current key
+int     BuildCache_Store(void);
+//! Writes a make-style dependency file, listing the output files as targets, and all input files as prerequisites
+int     BuildCache_WriteDeps(void);
+
+
+
+/*
+** ************************************************************************** *|
+**                          Hardware Target Functions                         *|
+** ************************************************************************** *|
+*/
+
+//! Returns the hardware target with the given `name` (case-insensitive), or NULL if there is no such target
+s_target const* Target_Find(t_char const* name);
+
+
+
+/*
+** ************************************************************************** *|
+**                          Reference Palette Functions                       *|
+** ************************************************************************** *|
+*/
+
+//! Loads the reference palette file at `filepath` (either a binary `.pal`, or a TOML `.palette` file) into `dest` - returns the amount of colors, or 0 on error
+t_uint  RefPal_LoadFile(t_argb32 dest[REFPAL_COLORS_MAX], t_char const* filepath);
+//! Returns the table of distances between each pair of colors in `palette` (computed only once for each different palette, and shared by all threads)
+t_u32 const (*RefPal_GetDistances(t_argb32 const* palette, t_uint colors))[REFPAL_COLORS_MAX];
+
+//! Writes the given `palette` into `dest`, with the given NES color `emphasis` bits applied (only 64-color palettes are changed)
+void    RefPal_Emphasis(t_argb32* dest, t_argb32 const* palette, t_uint colors, t_uint emphasis);
+//! Makes `ref_palette` from the reference palette `base` (an index in `ref_bases`) with the given color `emphasis`, and updates everything which depends on it
+void    RefPal_Select(t_uint base, t_uint emphasis);
+//! Picks the reference palette candidate (file and color emphasis) with the lowest error for the current bitmap, once its tiles are packed
+int     RefPal_Choose(void);
+
+
+
+/*
+** ************************************************************************** *|
+**                            Main Program Functions                          *|
+** ************************************************************************** *|
+*/
+
+//! Converts the input file, and writes all output files (the reference palette must already be loaded)
+int     Program_Convert(void);
+//! Clears all the state which is computed during a conversion, so that the program can convert again
+void    Program_Reset(void);
+//! Runs the color reduction and palette steps on `tiles_pixels` (once the reference palette is applied), up to the final output pixels
+int     Program_ConvertTiles(void);
+//! Encodes the final output pixels as the output BMP/CHR/NAM/PAL files (which are added to `outputs`, but not written)
+int     Program_EncodeOutputs(void);
+
+
+
+/*
+** ************************************************************************** *|
+**                          Compliance Check Functions                        *|
+** ************************************************************************** *|
+*/
+
+//! Checks (without converting) that the given BMP file complies with the limits of the target, and outputs the list of violations - returns ERROR if there are any
+int     Compliance_Check(t_char const* filepath);
+
+
+
+/*
+** ************************************************************************** *|
+**                        Attribute Grid Align Functions                      *|
+** ************************************************************************** *|
+*/
+
+//! Moves the origin of the `view` by the attribute grid offset (searching all offsets first, if `align_auto` is set)
+int     Align_View(void);
+
+
+
+/*
+** ************************************************************************** *|
+**                          Quality Metrics Functions                         *|
+** ************************************************************************** *|
+*/
+
+//! Returns the peak signal-to-noise ratio (in decibels) of the given measured error (at most `METRICS_PSNR_MAX`)
+t_float Metrics_PSNR(s_metrics const* metrics);
+
+//! Clears all measured errors, and prepares the L*a*b* coordinates of the reference colors
+int     Metrics_Begin(void);
+
+//! Measures the error of metatile `tile`, given its reference colors (`reference`) and its output pixels (`pixels`), and adds it to the total
+void    Metrics_AddTile(t_uint tile, t_u8 const* reference, t_u8 const* pixels);
+
+//! Logs the total error, and the metatile with the most error
+int     Metrics_End(void);
+
+//! Measures the error of every metatile against `tiles_reference`, in one separate pass (for outputs not made by `ConvertBitmap_ApplyOutputPalettes()`)
+int     Metrics_Measure(void);
+
+//! Adds the error heatmap bitmap to the output files
+int     Metrics_AddHeatmap(void);
+
+
+
+/*
+** ************************************************************************** *|
+**                          Conversion Report Functions                       *|
+** ************************************************************************** *|
+*/
+
+//! Keeps the dimensions and color statistics of the input bitmap, before the reference palette is applied to its pixels
+int     Report_SaveInput(void);
+
+//! Writes the conversion report file next to the output files, through a streaming writer
+int     Report_Output(void);
+
+
+
+/*
+** ************************************************************************** *|
+**                            Compression Functions                           *|
+** ************************************************************************** *|
+*/
+
+//! Returns the compression format with the given `name` (case-insensitive), or `COMPRESS_AMOUNT` if there is none
+e_compress  Compress_Find(t_char const* name);
+
+//! Returns the file extension of the compressed copy of the CHR output (if `chr` is TRUE) or NAM output in the given `format` (or NULL if there is none)
+t_char const*   Compress_GetFile(e_compress format, t_bool chr);
+
+//! Decompresses the given `src` data, compressed in the given `format` (for `COMPRESS_TILES`, the CHR tiles are encoded for `target`),
+//! into `dest` (of `capacity` bytes): returns the decompressed size, or `SIZE_ERROR` if the data is invalid or does not fit
+t_size  Compress_Decode(e_compress format, s_target const* target, t_u8 const* src, t_size size, t_u8* dest, t_size capacity);
+
+//! Adds the compressed copies of the given `nam` and `chr` output files (as chosen by `--compress`) to the output files, compressing both at once,
+//! and checking that each one decompresses back to the original file
+int     Compress_Outputs(t_u8 const* nam, t_u8 const* chr);
+
+
+
+/*
+** ************************************************************************** *|
+**                           Screen Render Functions                          *|
+** ************************************************************************** *|
+*/
+
+//! Renders the given `nam` (and its `chr_tiles` tiles of `chr`) into `pixels`, as output pixel values (`palette * PAL_SUB_COLORS + color`), with rows `pitch` bytes apart
+int     Render_Screen(t_u8 const* nam, t_u8 const* chr, t_uint chr_tiles, t_u8* pixels, t_sint pitch);
+
+//! Renders the NAM/CHR/PAL output files back into colors, and checks that they match the colors of every pixel of the BMP output
+int     Render_Verify(void);
+
+
+
+/*
+** ************************************************************************** *|
+**                          Bitmap Scaling Functions                          *|
+** ************************************************************************** *|
+*/
+
+//! Returns the scaling filter with the given `name` (case-insensitive), or `SCALE_AMOUNT` if there is none
+e_scale Scale_Find(t_char const* name);
+
+//! Replaces the bitmap (in any pixel format) by a scaled-down indexed copy, whose pixels are already mapped to the reference palette
+int     Scale_Bitmap(void);
+
+
+
+/*
+** ************************************************************************** *|
+**                             Dithering Functions                            *|
+** ************************************************************************** *|
+*/
+
+//! Returns the dithering algorithm with the given `name` (case-insensitive), or `DITHER_AMOUNT` if there is none
+e_dither    Dither_Find(t_char const* name);
+
+//! Keeps a copy of the original pixels and colors of the bitmap, before the reference palette is applied to them
+int     Dither_SaveSource(void);
+
+//! Replaces the pixels of every metatile by a dithered mix of the colors of its output palette (given by `tiles_palette`, one index per metatile)
+int     Dither_Apply(t_u8 const* tiles_palette, t_argb32 const (*colors)[PAL_SUB_COLORS_MAX]);
+
+
+
+/*
+** ************************************************************************** *|
+**                       Progressive Conversion Functions                     *|
+** ************************************************************************** *|
+*/
+
+//! Improves the output palettes (and the palette of each metatile) one color at a time, rewriting the output files whenever the total error is lower
+int     Progressive_Refine(void);
+
+
+
+/*
+** ************************************************************************** *|
+**                         Strategy Portfolio Functions                       *|
+** ************************************************************************** *|
+*/
+
+//! Runs `Program_ConvertTiles()` with each strategy of the portfolio on its own thread, and keeps the outputs of the one with the lowest total error
+int     Portfolio_Run(void);
+
+
+
+/*
+** ************************************************************************** *|
+**                          Animation Mode Functions                          *|
+** ************************************************************************** *|
+*/
+
+//! Converts every frame of the `--frames` animation with one joint set of palettes, and writes shared CHR/PAL files, plus NAM deltas
+int     Animation_Convert(void);
+
+
+
+/*
+** ************************************************************************** *|
+**                            Server Mode Functions                           *|
+** ************************************************************************** *|
+*/
+
+//! Handles conversion requests on a Unix socket (or on stdin/stdout if `address` is `-`) with a pool of worker threads
+int     Server_Run(t_char const* address);
+
+
+
+/*
+** ************************************************************************** *|
+**                             Watch Mode Functions                           *|
+** ************************************************************************** *|
+*/
+
+//! Calls `callback` once, then again every time one of the input files changes (only returns on error)
+int     Watch_Run(int (*callback)(t_u32 changed));
+
+
+
+/*
+** ************************************************************************** *|
+**                            Tile Cache Functions                            *|
+** ************************************************************************** *|
+*/
+
+//! Returns the cached result for the given `key` and `kind`, or NULL if there is none
+s_tilecache_entry*  TileCache_Find(s_tilecache* cache, t_u64 key, e_tilecache_kind kind);
+//! Returns a new (cleared) entry for the given `key` and `kind`, to be filled in by the caller (or NULL on failure)
+s_tilecache_entry*  TileCache_Insert(s_tilecache* cache, t_u64 key, e_tilecache_kind kind);
+//! Loads all cached results from the given sidecar file (a missing file is not an error)
+int                 TileCache_Load(s_tilecache* cache, t_char const* filepath);
+//! Saves all cached results to the given sidecar file
+int                 TileCache_Save(s_tilecache const* cache, t_char const* filepath);
+//! Frees all memory held by the given tile cache
+void                TileCache_Delete(s_tilecache* cache);
+
+
+
+/*
+** ************************************************************************** *|
+**                              Logging Functions                             *|
+** ************************************************************************** *|
+*/
+
+//! Evaluates to TRUE if normal (non-error) log messages are to be displayed
+#define LOG_ENABLED() \
+	(!program.logger.silence_logs)
+//! Evaluates to TRUE if verbose log messages are to be displayed
+#define LOG_VERBOSE_ENABLED() \
+	(program.logger.verbose && !program.logger.silence_logs)
+
+//! These macros check the log level before evaluating their arguments, so formatting costs nothing when silenced
+//!@{
+#define LOG_MESSAGE(...)    do { if (LOG_ENABLED())         Log_Message(&program.logger, __VA_ARGS__); } while (0)
+#define LOG_SUCCESS(...)    do { if (LOG_ENABLED())         Log_Success(&program.logger, __VA_ARGS__); } while (0)
+#define LOG_WARNING(...)    do { if (LOG_ENABLED())         Log_Warning(&program.logger, __VA_ARGS__); } while (0)
+#define LOG_VERBOSE(...)    do { if (LOG_VERBOSE_ENABLED()) Log_Verbose(&program.logger, __VA_ARGS__); } while (0)
+//!@}
+
+
+
+/*
+** ************************************************************************** *|
+**                          Profiling Instrumentation                         *|
+** ************************************************************************** *|
+*/
+
+#if PROFILING
+
+//! Starts timing the stage of the given `name` (which must be a static string)
+void Profile_Begin(t_char const* name);
+//! Stops timing the current stage, and returns the given `result` as-is
+int Profile_End(int result);
+//! Adds the stage timings and counters of `src` (recorded by another thread) into `dest`
+void Profile_Merge(s_profile* dest, s_profile const* src);
+//! Outputs the profile report, as a table on the terminal and/or as a JSON file
+int Profile_Output(void);
+
+//! Enables the `--trace` instrumentation: events will be written to the given `filepath` by `Trace_Output()`
+void Trace_Init(t_char const* filepath);
+//! Sets the display name of the calling thread, as shown in the trace viewer
+void Trace_SetThreadName(t_char const* name);
+//! Releases the ring buffer of the calling thread (which is about to exit), so that a later thread can record its events in it
+void Trace_EndThread(void);
+//! Records a begin event for the given stage `name` (which must be a static string), in the calling thread's ring buffer
+void Trace_Begin(t_char const* name);
+//! Records an end event for the given stage `name`, in the calling thread's ring buffer
+void Trace_End(t_char const* name);
+//! Writes all recorded events as a Chrome/Perfetto trace-event JSON file (should be called once all threads are done)
+int Trace_Output(void);
+
+//! Runs the given pipeline stage function `CALL`, while measuring it
+#define PROFILE_STAGE(CALL) \
+	(Profile_Begin(#CALL), Profile_End(CALL))
+//! Increments the given profile `COUNTER` of the current stage by `N`
+#define PROFILE_COUNT(COUNTER, N) \
+	(program.profile.stages[program.profile.current].counters[COUNTER] += (N))
+
+//! Records a begin event for the given static string `NAME`, to be shown in the `--trace` output
+#define TRACE_BEGIN(NAME)   Trace_Begin(NAME)
+//! Records an end event for the given static string `NAME`, to be shown in the `--trace` output
+#define TRACE_END(NAME)     Trace_End(NAME)
+
+#else
+
+#define PROFILE_STAGE(CALL)         (CALL)
+#define PROFILE_COUNT(COUNTER, N)   ((void)0)
+#define TRACE_BEGIN(NAME)           ((void)0)
+#define TRACE_END(NAME)             ((void)0)
+
+#endif
+
+
+
 /*
 ** ************************************************************************** *|
 **                           Core Program Functions                           *|
@@ -354,12 +1344,17 @@ int CheckBitmap_Dimensions(void);
 int CheckBitmap_TotalColors(void);
 int CheckBitmap_TilesColors(void);
 int CheckBitmap_DuplicatePalettes(void);
+int CheckBitmap_TilesPalettes(void);
 
+int ConvertBitmap_PackTiles(void);
+int ConvertBitmap_UnpackTiles(void);
 int ConvertBitmap_ApplyRefPalette(void);
 int ConvertBitmap_TotalColorReduction(void);
 int ConvertBitmap_TilesColorReduction(void);
 int ConvertBitmap_AssertOutputPalettes(void);
 int ConvertBitmap_ApplyOutputPalettes(t_bool user_palette);
+//! Sets the colors of the bitmap's palette to those of the `output_palettes` (one after the other)
+int ConvertBitmap_OutputColors(void);
 
 
 
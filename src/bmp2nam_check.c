@@ -22,66 +22,51 @@
 
 int     CheckBitmap_LoadReferencePalette(void)
 {
-	// open and load reference palette file
-	t_fd fd = IO_Open(REFPAL_FILEPATH, OPEN_READONLY, 0);
-	if (fd < 0)
-	{
-		Log_Error_STD(&program.logger, 0, "Could not open reference palette file: %s", REFPAL_FILEPATH);
-		return (ERROR);
-	}
-	t_u8* file = NULL;
-	t_sintmax size = IO_Read_File(fd, (void**)&file, 0);
-	if (size < 0)
-	{
-		Log_Error_STD(&program.logger, 0, "Could not read reference palette file: %s", REFPAL_FILEPATH);
-		return (ERROR);
+	Memory_Clear(program.ref_bases, sizeof(program.ref_bases));
+	if (program.files_refpal_amount == 0)
+	{   // the reference palette is built into the program, so no file needs to be read
+		program.ref_bases_colors[0] = TARGET(refpal_colors);
+		Memory_Copy(program.ref_bases[0], TARGET(refpal), TARGET(refpal_colors) * sizeof(t_argb32));
 	}
-	if ((t_size)size != REFPAL_SIZE)
+	for (t_uint i = 0; i < program.files_refpal_amount; ++i)
 	{
-		Log_Warning(&program.logger, "Reference palette file has incorrect size: %s (was %zu bytes, but should be %zu bytes)",
-			REFPAL_FILEPATH, (t_size)size, REFPAL_SIZE);
+		program.ref_bases_colors[i] = RefPal_LoadFile(program.ref_bases[i], program.files_refpal[i]);
+		if (program.ref_bases_colors[i] == 0)
+			return (ERROR);
+		if (program.ref_bases_colors[i] != TARGET(refpal_colors))
+		{
+			LOG_WARNING("Reference palette file has %u colors, but the `%s` target has %u: %s",
+				program.ref_bases_colors[i], TARGET(name), TARGET(refpal_colors), program.files_refpal[i]);
+		}
 	}
-	t_u8 r;
-	t_u8 g;
-	t_u8 b;
-	t_size index = 0;
-	for (t_u32 i = 0; i < REFPAL_COLORS; ++i)
+	if (program.emphasis != 0 && program.ref_bases_colors[0] != REFPAL_EMPHASIS_COLORS)
 	{
-		r = file[index++];
-		g = file[index++];
-		b = file[index++];
-		program.ref_palette[i] = Color_ARGB32_Set(0, r, g, b);
+		Log_Error(&program.logger, 0, "Color emphasis can only be used with %u-color (NES) reference palettes",
+			REFPAL_EMPHASIS_COLORS);
+		return (ERROR);
 	}
-	Memory_Delete((void**)&file);
+	// the first candidate is used until `RefPal_Choose()` picks the best one for each bitmap
+	RefPal_Select(0, (program.emphasis == REFPAL_EMPHASIS_AUTO ? 0 : (t_uint)program.emphasis));
 
-	Log_Message(&program.logger,
+	if (!LOG_ENABLED())
+		return (OK);
+	LOG_MESSAGE(
 		"Here is the loaded reference palette (%s), using ANSI terminal color codes:",
-		REFPAL_FILEPATH);
-	t_char* str;
-	t_char* tmp;
-	index = 0;
-	for (int y = 0; y < 16; ++y)
+		(program.file_refpal ? program.file_refpal : TARGET(name)));
+	t_char  str[16 * (ANSI_COLOR_SIZE - 1) + 1];
+	t_size  length;
+	t_size  index = 0;
+	while (index < REFPAL_COLORS)
 	{
-		str = String_New(0);
-		if (str == NULL)
-		{
-			Log_Error(&program.logger, 0, "Could not allocate palette logging output string");
-			continue;
-		}
-		for (int x = 0; x < 16; ++x)
+		length = 0;
+		str[0] = '\0';
+		for (int x = 0; x < 16 && index < REFPAL_COLORS; ++x)
 		{
-			if (index >= REFPAL_COLORS)
-			{
-				Log_Message(&program.logger, "\t%s", str);
-				String_Delete(&str);
-				return (OK);
-			}
-			tmp = ANSI_GetColor(program.ref_palette[index]);
-			String_Merge(&str, &tmp);
+			ANSI_GetColor(str + length, program.ref_palette[index]);
+			length += String_Length(str + length);
 			++index;
 		}
-		Log_Message(&program.logger, "\t%s", str);
-		String_Delete(&str);
+		LOG_MESSAGE("\t%s", str);
 	}
 	return (OK);
 }
@@ -119,7 +104,7 @@ int     CheckBitmap_PixelFormat(void)
 		return (ERROR);
 	}
 
-	Log_Verbose(&program.logger, "Loaded BMP has pixel format:"
+	LOG_VERBOSE("Loaded BMP has pixel format:"
 		"\n\t- format: %s"
 		"\n\t- palette: %s (%i)"
 		"\n\t- bits/pixel: %i"
@@ -135,9 +120,11 @@ int     CheckBitmap_PixelFormat(void)
 		program.bitmap->format->BytesPerPixel != (BMP_BPP / 8) || // TODO more robust rounding here ?
 		program.bitmap->format->format != SDL_PIXELFORMAT_INDEX8)
 	{
-		Log_Message(&program.logger, "BMP file has improper pixel format (must be 8BPP indexed): attempting to convert...");
+		LOG_MESSAGE("BMP file has improper pixel format (must be 8BPP indexed): attempting to convert...");
 
 		SDL_Surface* bitmap = SDL_ConvertSurfaceFormat(program.bitmap, SDL_PIXELFORMAT_INDEX8, 0);
+		PROFILE_COUNT(PROFILE_ALLOCATIONS, 1);
+		PROFILE_COUNT(PROFILE_PIXELS, program.bitmap->w * program.bitmap->h);
 		if (bitmap == NULL)
 		{
 			Log_Error(&program.logger, 0, "Could not convert BMP to 8BPP indexed format => %s\n", SDL_GetError());
@@ -150,9 +137,9 @@ int     CheckBitmap_PixelFormat(void)
 			Log_Error(&program.logger, 0, "bitmap.format.palette is NULL");
 			return (ERROR);
 		}
-		Log_Success(&program.logger, "Converted bitmap to the proper pixel format (8BPP indexed)");
+		LOG_SUCCESS("Converted bitmap to the proper pixel format (8BPP indexed)");
 	}
-	else Log_Success(&program.logger, "BMP file given has correct pixel format");
+	else LOG_SUCCESS("BMP file given has correct pixel format");
 
 	return (OK);
 }
@@ -161,58 +148,67 @@ int     CheckBitmap_PixelFormat(void)
 
 int     CheckBitmap_Dimensions(void)
 {
-	if (program.bitmap->w == NAM_W &&
-		program.bitmap->h == NAM_H)
+	SDL_Rect rect = program.crop;
+	if (rect.w == 0 || rect.h == 0)
 	{
-		Log_Success(&program.logger,
-			"BMP file has the correct dimensions (%ix%i)",
+		rect = (SDL_Rect){ .x=0, .y=0, .w=NAM_W, .h=NAM_H };
+		if (program.bitmap->w == (int)NAM_W &&
+			program.bitmap->h == (int)NAM_H)
+		{
+			LOG_SUCCESS(
+				"BMP file has the correct dimensions (%ix%i)",
+				program.bitmap->w,
+				program.bitmap->h);
+		}
+		else LOG_WARNING(
+			"BMP file has improper dimensions (%ix%i), only the top-left-most %ix%i pixels will be considered",
 			program.bitmap->w,
-			program.bitmap->h);
-		return (OK);
+			program.bitmap->h,
+			NAM_W, NAM_H);
 	}
-/*
-	if (program.bitmap->w > NAM_W)
-		program.bitmap->w = NAM_W;
-	if (program.bitmap->h > NAM_H)
-		program.bitmap->h = NAM_H;
-*/
-	Log_Warning(&program.logger,
-		"BMP file has improper dimensions (%ix%i), only the top-left-most %ix%i pixels will be considered",
-		program.bitmap->w,
-		program.bitmap->h,
-		NAM_W, NAM_H);
-
-	SDL_Surface* bitmap = SDL_CreateRGBSurfaceWithFormat(0,
-		NAM_W,
-		NAM_H,
-		BMP_BPP,
-		SDL_PIXELFORMAT_INDEX8);
-	if (bitmap == NULL)
+	else
 	{
-		Log_Error(&program.logger, 0,
-			"Could not create cropped bitmap which is %ix%i pixels => %s\n",
-			NAM_W, NAM_H,
-			SDL_GetError());
-		return (ERROR);
+		if (rect.x < 0 || rect.x >= program.bitmap->w ||
+			rect.y < 0 || rect.y >= program.bitmap->h)
+		{
+			Log_Error(&program.logger, 0,
+				"Crop region (x:%i, y:%i) lies outside of the BMP file (%ix%i)",
+				rect.x, rect.y,
+				program.bitmap->w,
+				program.bitmap->h);
+			return (ERROR);
+		}
+		if (rect.w > (int)NAM_W || rect.h > (int)NAM_H)
+		{
+			LOG_WARNING(
+				"Crop region is larger (%ix%i) than the output, only its top-left-most %ix%i pixels will be considered",
+				rect.w, rect.h,
+				NAM_W, NAM_H);
+		}
+		LOG_SUCCESS(
+			"Using the %ix%i region at (x:%i, y:%i) of the BMP file",
+			rect.w, rect.h,
+			rect.x, rect.y);
 	}
-	if (SDL_SetSurfacePalette(bitmap, program.bitmap->format->palette))
+	// clip the region to both the bitmap and the output dimensions
+	if (rect.w > (int)NAM_W)                         rect.w = NAM_W;
+	if (rect.h > (int)NAM_H)                         rect.h = NAM_H;
+	if (rect.x + rect.w > program.bitmap->w)    rect.w = program.bitmap->w - rect.x;
+	if (rect.y + rect.h > program.bitmap->h)    rect.h = program.bitmap->h - rect.y;
+	if (rect.w < (int)NAM_W || rect.h < (int)NAM_H)
 	{
-		Log_Error(&program.logger, 0,
-			"Could not copy palette for cropped bitmap => %s\n",
-			SDL_GetError());
-		return (ERROR);
+		LOG_WARNING(
+			"BMP region is smaller (%ix%i) than the output (%ix%i), the missing pixels will be filled with color 0",
+			rect.w, rect.h,
+			NAM_W, NAM_H);
 	}
-	SDL_Rect rect = { .x=0, .y=0, .w=NAM_W, .h=NAM_H };
-	if (SDL_BlitSurface(program.bitmap, &rect, bitmap, NULL))
+	program.view = (s_view)
 	{
-		Log_Error(&program.logger, 0,
-			"Could not crop bitmap image to be %ix%i pixels => %s\n",
-			NAM_W, NAM_H,
-			SDL_GetError());
-		return (ERROR);
-	}
-	SDL_FreeSurface(program.bitmap);
-	program.bitmap = bitmap;
+		.pixels = (t_u8*)program.bitmap->pixels + rect.y * program.bitmap->pitch + rect.x,
+		.pitch  = program.bitmap->pitch,
+		.w      = rect.w,
+		.h      = rect.h,
+	};
 	return (OK);
 }
 
@@ -220,26 +216,26 @@ int     CheckBitmap_Dimensions(void)
 
 int     CheckBitmap_TotalColors(void)
 {
-	t_u8*   pixels = (t_u8*)program.bitmap->pixels;
+	t_u8 const* pixels = program.tiles_pixels;
 	t_u8    pixel;
 	t_u8    colors_present = 0;
-	for (int y = 0; y < program.bitmap->h; ++y)
-	for (int x = 0; x < program.bitmap->w; ++x)
+	for (t_uint i = 0; i < NAM_TILES * NAM_TILE_PIXELS; ++i)
 	{
-		pixel = pixels[y * program.bitmap->w + x];
+		pixel = pixels[i];
 		if (program.bitmap_colors[pixel].occurences == 0)
 			++colors_present;
 		program.bitmap_colors[pixel].occurences += 1;
 	}
+	PROFILE_COUNT(PROFILE_PIXELS, NAM_TILES * NAM_TILE_PIXELS);
 	program.bitmap_colors_total = colors_present;
 	if (colors_present > PAL_COLORS)
 	{
-		Log_Warning(&program.logger,
+		LOG_WARNING(
 			"BMP file given has too many colors: %u (should be %u or fewer)",
 			colors_present,
 			PAL_COLORS);
 	}
-	else Log_Success(&program.logger,
+	else LOG_SUCCESS(
 		"BMP successfully loaded (uses %u unique colors).",
 		colors_present);
 
@@ -249,70 +245,81 @@ int     CheckBitmap_TotalColors(void)
 
 
 
-static
-int     GetColorOccurIndex(t_u8 bmp_color)
-{
-	for (int i = 0; i < BMP_MAXCOLORS; ++i)
-	{
-		if (program.occur_colors[i].index == bmp_color)
-		{
-			return (i);
-		}
-	}
-	return (ERROR);
-}
-
 int     CheckBitmap_TilesColors(void)
 {
 	t_u32     index;
-	t_u8*     pixels = (t_u8*)program.bitmap->pixels;
-	t_u8      pixel;
+	t_u8 const* pixels;
 	t_u8      colors_present = 0;
-	int       color;
+	t_u32     counts[BMP_MAXCOLORS];
 	SDL_Point tile;
-	for (tile.y = 0; tile.y < NAM_H_TILES; ++tile.y)
-	for (tile.x = 0; tile.x < NAM_W_TILES; ++tile.x)
+	s_tilecache_entry* cached;
+	// the histogram of a tile only depends on its pixels and on the list of "most used" colors
+	t_uint target = (program.target - targets);
+	t_u64 context = Hash_FNV1a(&target, sizeof(target), HASH_SEED);
+	for (t_uint i = 0; i < PAL_COLORS; ++i)
+	{
+		context = Hash_FNV1a(&program.occur_colors[i].index, sizeof(t_u8), context);
+		context = Hash_FNV1a(&program.occur_colors[i].color, sizeof(t_argb32), context);
+	}
+	for (tile.y = 0; tile.y < (int)NAM_H_TILES; ++tile.y)
+	for (tile.x = 0; tile.x < (int)NAM_W_TILES; ++tile.x)
 	{
 		index = (tile.y * NAM_W_TILES) + tile.x;
-		for (int i = 0; i < BMP_MAXCOLORS; ++i)
+		pixels = TILE_PIXELS(index);
+		t_u64 key = Hash_FNV1a(pixels, NAM_TILE_PIXELS, context);
+		Memory_Clear(program.tiles_colors[index].colors + PAL_COLORS,
+			(PAL_COLORS_MAX - PAL_COLORS) * sizeof(s_color_use));
+		if ((cached = TileCache_Find(&program.tilecache, key, TILECACHE_HISTOGRAM)))
 		{
-			program.tiles_colors[index].colors[i] = program.occur_colors[i];
-			program.tiles_colors[index].colors[i].occurences = 0;
+			Memory_Copy(program.tiles_colors[index].colors, cached->colors, PAL_COLORS * sizeof(s_color_use));
+			colors_present = cached->total;
 		}
-		colors_present = 0;
-		for (int y = 0; y < NAM_TILE; ++y)
-		for (int x = 0; x < NAM_TILE; ++x)
+		else
 		{
-			pixel = pixels[(tile.y * NAM_TILE + y) * NAM_W + (tile.x * NAM_TILE + x)];
-			color = GetColorOccurIndex(pixel);
-			if (color >= 0)
+			Memory_Clear(counts, sizeof(counts));
+			TARGET(histogram_tile)(pixels, counts);
+			PROFILE_COUNT(PROFILE_PIXELS, NAM_TILE_PIXELS);
+			colors_present = 0;
+			for (t_uint i = 0; i < PAL_COLORS; ++i)
 			{
-				if (program.tiles_colors[index].colors[color].occurences == 0)
+				program.tiles_colors[index].colors[i] = program.occur_colors[i];
+				program.tiles_colors[index].colors[i].occurences = counts[program.occur_colors[i].index];
+				if (program.tiles_colors[index].colors[i].occurences)
 					++colors_present;
-				program.tiles_colors[index].colors[color].occurences += 1;
+				// pixels are only counted for the first item of the list which has their color
+				counts[program.occur_colors[i].index] = 0;
+			}
+			// sort the tile colors by popularity
+			QuickSort_Compare_ColorUse(program.tiles_colors[index].colors, PAL_COLORS);
+			if ((cached = TileCache_Insert(&program.tilecache, key, TILECACHE_HISTOGRAM)))
+			{
+				Memory_Copy(cached->colors, program.tiles_colors[index].colors, PAL_COLORS * sizeof(s_color_use));
+				cached->total = colors_present;
+				cached->length = PAL_COLORS;
 			}
 		}
-		// sort the tile colors by popularity
-		QuickSort_Compare_ColorUse(program.tiles_colors[index].colors, BMP_MAXCOLORS);
 		program.tiles_colors[index].total = colors_present;
 
 		if (colors_present > PAL_SUB_COLORS)
 		{
-			Log_Warning(&program.logger,
+			LOG_WARNING(
 				"Tile has too many different colors (%i), in BMP at (x:%i, y:%i)",
 				colors_present,
 				(tile.x * NAM_TILE),
 				(tile.y * NAM_TILE));
-			Log_Verbose(&program.logger,
+			if (!LOG_VERBOSE_ENABLED())
+				continue;
+			LOG_VERBOSE(
 				"Here is the list of color occurences for this %ix%i NAM tile: ",
 				NAM_TILE, NAM_TILE);
-			for (int i = 0; i < BMP_MAXCOLORS; ++i)
+			t_char str[ANSI_COLOR_SIZE];
+			for (t_uint i = 0; i < PAL_COLORS; ++i)
 			{
 				if (program.tiles_colors[index].colors[i].occurences == 0)
 					continue;
-				Log_Verbose(&program.logger,
+				LOG_VERBOSE(
 					" - %s %2i(#%.2X = 0x%.6X) => occurences: %i\tie: %.1f%%",
-					ANSI_GetColor(program.tiles_colors[index].colors[i].color),
+					ANSI_GetColor(str, program.tiles_colors[index].colors[i].color),
 					program.tiles_colors[index].colors[i].index,
 					program.tiles_colors[index].colors[i].index,
 					program.tiles_colors[index].colors[i].color,
@@ -331,16 +338,17 @@ int     CheckBitmap_DuplicatePalettes(void)
 	s_palette*  palette;
 	s_palette*  other;
 
-	for (int i = 0; i < NAM_TILES; ++i)
+	for (t_uint i = 0; i < NAM_TILES; ++i)
 	{
 		program.tiles_colors[i].palette = Palette_GetMostUsedColors(program.tiles_colors[i].colors, PAL_SUB_COLORS);
 	}
-	for (int i = 0; i < NAM_TILES; ++i)
+	for (t_uint i = 0; i < NAM_TILES; ++i)
 	{
 		palette = &program.tiles_colors[i].palette;
-		for (int j = i - 1; j >= 0; --j)
+		for (int j = (int)i - 1; j >= 0; --j)
 		{
 			other = &program.tiles_colors[j].palette;
+			PROFILE_COUNT(PROFILE_COMPARISONS, 1);
 			if (Palette_ContainsAll(other, palette))
 			{
 //Log_Message(&program.logger, "DEBUG_1A: p:%i contains p:%i", j, i);
@@ -356,16 +364,17 @@ int     CheckBitmap_DuplicatePalettes(void)
 			}
 		}
 	}
-	for (int i = 0; i < NAM_TILES; ++i)
+	for (t_uint i = 0; i < NAM_TILES; ++i)
 	{
 		palette = &program.tiles_colors[i].palette;
 		if (palette->duplicate < 0)
 		{
-			for (int j = i + 1; j < NAM_TILES; ++j)
+			for (t_uint j = i + 1; j < NAM_TILES; ++j)
 			{
 				other = &program.tiles_colors[j].palette;
 				if (other->duplicate < 0)
 				{
+					PROFILE_COUNT(PROFILE_COMPARISONS, 1);
 					if (Palette_ContainsAll(other, palette))
 					{
 //Log_Message(&program.logger, "DEBUG_2A: p:%i contains p:%i", j, i);
@@ -382,3 +391,15 @@ int     CheckBitmap_DuplicatePalettes(void)
 	}
 	return (OK);
 }
+
+
+
+int     CheckBitmap_TilesPalettes(void)
+{
+	// with user-given output palettes, each tile is matched to the output palette nearest to its own most used colors
+	for (t_uint i = 0; i < NAM_TILES; ++i)
+	{
+		program.tiles_palettes[i] = Palette_GetMostUsedColors(program.tiles_colors[i].colors, PAL_SUB_COLORS);
+	}
+	return (OK);
+}
@@ -11,15 +11,78 @@
 
 
 
+/*
+** ************************************************************************** *|
+**                           Pixel Kernel Functions                           *|
+** ************************************************************************** *|
+*/
+
+//! Replaces every occurence of the `old` pixel value by `new`, in a contiguous block of pixels (branchless, so it can vectorize)
+static inline
+void Pixels_Replace(t_u8* pixels, t_size length, t_u8 old, t_u8 new)
+{
+	for (t_size i = 0; i < length; ++i)
+	{
+		pixels[i] = (pixels[i] == old) ? new : pixels[i];
+	}
+}
+
+
+
 /*
 ** ************************************************************************** *|
 **                           Core Program Functions                           *|
 ** ************************************************************************** *|
 */
 
+int ConvertBitmap_PackTiles(void)
+{
+	// any part of a tile which lies outside of the view is padded with color 0
+	TARGET(pack_tiles)(&program.view, program.tiles_pixels);
+	PROFILE_COUNT(PROFILE_PIXELS, NAM_TILES * NAM_TILE_PIXELS);
+	return (OK);
+}
+
+int ConvertBitmap_UnpackTiles(void)
+{
+	s_view const* view = &program.view;
+	// borrow the pixels of the input bitmap if possible, otherwise create a new (padded) bitmap
+	if (view->w == NAM_W && view->h == NAM_H)
+		program.output = SDL_CreateRGBSurfaceWithFormatFrom(view->pixels,
+			NAM_W, NAM_H, BMP_BPP, view->pitch,
+			SDL_PIXELFORMAT_INDEX8);
+	else
+	{
+		program.output = SDL_CreateRGBSurfaceWithFormat(0,
+			NAM_W, NAM_H, BMP_BPP,
+			SDL_PIXELFORMAT_INDEX8);
+		PROFILE_COUNT(PROFILE_ALLOCATIONS, 1);
+	}
+	if (program.output == NULL)
+	{
+		Log_Error(&program.logger, 0,
+			"Could not create output bitmap which is %ix%i pixels => %s\n",
+			NAM_W, NAM_H,
+			SDL_GetError());
+		return (ERROR);
+	}
+	if (SDL_SetSurfacePalette(program.output, program.bitmap->format->palette))
+	{
+		Log_Error(&program.logger, 0,
+			"Could not set palette for output bitmap => %s\n",
+			SDL_GetError());
+		return (ERROR);
+	}
+	TARGET(unpack_tiles)(program.tiles_pixels, (t_u8*)program.output->pixels, program.output->pitch);
+	PROFILE_COUNT(PROFILE_PIXELS, NAM_TILES * NAM_TILE_PIXELS);
+	return (OK);
+}
+
+
+
 int ConvertBitmap_ApplyRefPalette(void)
 {
-	Log_Verbose(&program.logger, "Finding nearest colors in the reference palette...");
+	LOG_VERBOSE("Finding nearest colors in the reference palette...");
 	s_color_use* c = NULL;
 	t_u8    nearest[BMP_MAXCOLORS];
 	for (t_u32 i = 0; i < BMP_MAXCOLORS; ++i)
@@ -28,9 +91,10 @@ int ConvertBitmap_ApplyRefPalette(void)
 		if (c == NULL)
 			continue;
 		t_argb32 const* match = Color_ARGB32_GetNearest(c->color, program.ref_palette, REFPAL_COLORS);
+		PROFILE_COUNT(PROFILE_NEAREST, 1);
 		if (match == NULL)
 		{
-			Log_Warning(&program.logger,
+			LOG_WARNING(
 				"Could not find nearest color to 0x%.6X",
 				c->color);
 			continue;
@@ -38,20 +102,18 @@ int ConvertBitmap_ApplyRefPalette(void)
 		nearest[i] = (match - program.ref_palette);
 	}
 
-	Log_Message(&program.logger, "Applying reference palette colors to the bitmap...");
-	t_u8*   pixels = (t_u8*)program.bitmap->pixels;
-	t_u8    pixel;
-	t_u32   index;
-	for (int y = 0; y < program.bitmap->h; ++y)
-	for (int x = 0; x < program.bitmap->w; ++x)
+	LOG_MESSAGE("Applying reference palette colors to the bitmap...");
+	t_u8*   pixels = program.tiles_pixels;
+	for (t_uint i = 0; i < NAM_TILES * NAM_TILE_PIXELS; ++i)
 	{
-		index = (y * program.bitmap->w + x);
-		pixel = pixels[index];
-		pixels[index] = nearest[pixel];
+		pixels[i] = nearest[pixels[i]];
 	}
+	PROFILE_COUNT(PROFILE_PIXELS, NAM_TILES * NAM_TILE_PIXELS);
+	// the color reductions change the pixels, but the error is always measured against these reference colors
+	Memory_Copy(program.tiles_reference, pixels, NAM_TILES * NAM_TILE_PIXELS);
 	SDL_Palette* palette = program.bitmap->format->palette;
 	Memory_Clear(palette->colors, palette->ncolors * sizeof(SDL_Color));
-	for (int i = 0; i < REFPAL_COLORS; ++i)
+	for (t_uint i = 0; i < REFPAL_COLORS && i < (t_uint)palette->ncolors; ++i)
 	{
 		palette->colors[i] = (SDL_Color)
 		{
@@ -68,45 +130,36 @@ int ConvertBitmap_ApplyRefPalette(void)
 
 int ConvertBitmap_TotalColorReduction(void)
 {
-	t_u8*    pixels = (t_u8*)program.bitmap->pixels;
-	t_u8     pixel;
-	t_u32    pixel_index;
+	t_u8*    pixels = program.tiles_pixels;
 	t_u8     total;
-	t_argb32 color1;
-	t_argb32 color2;
+	t_u8     color1;
+	t_u8     color2;
 	t_u8     old;
 	t_u8     new;
 
-	Log_Message(&program.logger, "Fusing together colors which are perceptually similar...");
+	LOG_MESSAGE("Fusing together colors which are perceptually similar...");
 	total = program.bitmap_colors_total;
 	if (total <= PAL_COLORS)
 		return (OK);
 	// find colors (among the most popular) which are very similar, and fuse them
 	for (int i = 0; i < total; ++i)
 	{
-		color1 = program.ref_palette[program.bitmap_colors[i].index];
+		color1 = program.bitmap_colors[i].index;
 		for (int j = i + 1; j < total; ++j)
 		{
-			color2 = program.ref_palette[program.bitmap_colors[j].index];
-			if (Color_ARGB32_Difference(color1, color2) <= THRESHOLD)
+			color2 = program.bitmap_colors[j].index;
+			PROFILE_COUNT(PROFILE_COMPARISONS, 1);
+			if (program.ref_distances[color1][color2] <= program.threshold)
 			{
 #if DEBUG
-Log_Verbose(&program.logger, "DEBUG TOTAL | i:%2i, color=%.2X(#%.6X) | j:%2i, color=%.2X(#%.6X)",
-	i, program.bitmap_colors[i].index, color1,
-	j, program.bitmap_colors[i].index, color2);
+LOG_VERBOSE("DEBUG TOTAL | i:%2i, color=%.2X(#%.6X) | j:%2i, color=%.2X(#%.6X)",
+	i, color1, program.ref_palette[color1],
+	j, color2, program.ref_palette[color2]);
 #endif
 				old = program.bitmap_colors[j].index;
 				new = program.bitmap_colors[i].index;
-				for (int y = 0; y < NAM_H; ++y)
-				for (int x = 0; x < NAM_W; ++x)
-				{
-					pixel_index = (y * NAM_W) + (x);
-					pixel = pixels[pixel_index];
-					if (pixel == old)
-					{
-						pixels[pixel_index] = new;
-					}
-				}
+				Pixels_Replace(pixels, NAM_TILES * NAM_TILE_PIXELS, old, new);
+				PROFILE_COUNT(PROFILE_PIXELS, NAM_TILES * NAM_TILE_PIXELS);
 				program.bitmap_colors[j].occurences = 0;
 				total -= 1;
 			}
@@ -123,55 +176,47 @@ Log_Verbose(&program.logger, "DEBUG TOTAL | i:%2i, color=%.2X(#%.6X) | j:%2i, co
 
 int ConvertBitmap_TilesColorReduction(void)
 {
-	Log_Message(&program.logger, "Removing superfluous colors for each tile in the bitmap...");
-	t_u8*        pixels = (t_u8*)program.bitmap->pixels;
-	t_u8         pixel;
-	t_u32        pixel_index;
+	LOG_MESSAGE("Removing superfluous colors for each tile in the bitmap...");
+	t_u8*        pixels;
 	t_u32        index;
 	t_u8         total;
 	t_u8         length;
 	s_color_use* color;
-	t_argb32     color1;
-	t_argb32     color2;
-	t_argb32     palette[PAL_SUB_COLORS];
+	t_u8         color1;
+	t_u8         color2;
+	t_argb32     palette[PAL_SUB_COLORS_MAX];
 	t_u8         old;
 	t_u8         new;
 	SDL_Point    tile;
-	for (tile.y = 0; tile.y < NAM_H_TILES; ++tile.y)
-	for (tile.x = 0; tile.x < NAM_W_TILES; ++tile.x)
+	for (tile.y = 0; tile.y < (int)NAM_H_TILES; ++tile.y)
+	for (tile.x = 0; tile.x < (int)NAM_W_TILES; ++tile.x)
 	{
 		index = (tile.y * NAM_W_TILES + tile.x);
 		total = program.tiles_colors[index].total;
 		if (total <= PAL_SUB_COLORS)
 			continue;
+		pixels = TILE_PIXELS(index);
 		length = program.tiles_colors[index].palette.length;
 		// find colors (among the most popular) which are very similar, and fuse them
 		for (int i = 0; i < length; ++i)
 		{
-			color1 = program.ref_palette[program.tiles_colors[index].palette.colors[i]];
+			color1 = program.tiles_colors[index].palette.colors[i];
 			for (int j = i + 1; j < length; ++j)
 			{
-				color2 = program.ref_palette[program.tiles_colors[index].palette.colors[j]];
-				if (Color_ARGB32_Difference(color1, color2) <= THRESHOLD)
+				color2 = program.tiles_colors[index].palette.colors[j];
+				PROFILE_COUNT(PROFILE_COMPARISONS, 1);
+				if (program.ref_distances[color1][color2] <= program.threshold)
 				{
 #if DEBUG
-Log_Verbose(&program.logger, "DEBUG TILES %3i | i:%2i, color=%.2X(#%.6X) | j:%2i, color=%.2X(#%.6X)", index,
-	i, program.tiles_colors[index].palette.colors[i], color1,
-	j, program.tiles_colors[index].palette.colors[j], color2);
+LOG_VERBOSE("DEBUG TILES %3i | i:%2i, color=%.2X(#%.6X) | j:%2i, color=%.2X(#%.6X)", index,
+	i, color1, program.ref_palette[color1],
+	j, color2, program.ref_palette[color2]);
 #endif
 //					Palette_Requantize(&program.tiles_colors[index].palette);
 					old = program.tiles_colors[index].palette.colors[j];
 					new = program.tiles_colors[index].palette.colors[i];
-					for (int y = 0; y < NAM_TILE; ++y)
-					for (int x = 0; x < NAM_TILE; ++x)
-					{
-						pixel_index = (tile.y * NAM_TILE + y) * NAM_W + (tile.x * NAM_TILE + x);
-						pixel = pixels[pixel_index];
-						if (pixel == old)
-						{
-							pixels[pixel_index] = new;
-						}
-					}
+					Pixels_Replace(pixels, NAM_TILE_PIXELS, old, new);
+					PROFILE_COUNT(PROFILE_PIXELS, NAM_TILE_PIXELS);
 					program.tiles_colors[index].colors[j].occurences = 0;
 					total -= 1;
 				}
@@ -190,23 +235,18 @@ Log_Verbose(&program.logger, "DEBUG TILES %3i | i:%2i, color=%.2X(#%.6X) | j:%2i
 		{
 			color = &program.tiles_colors[index].colors[i];
 			t_argb32 const* nearest = Color_ARGB32_GetNearest(color->color, palette, length);
+			PROFILE_COUNT(PROFILE_NEAREST, 1);
 			if (nearest == NULL)
 				continue;
 			old = color->index;
 			new = program.tiles_colors[index].palette.colors[nearest - palette];
-			for (int y = 0; y < NAM_TILE; ++y)
-			for (int x = 0; x < NAM_TILE; ++x)
-			{
-				pixel_index = (tile.y * NAM_TILE + y) * NAM_W + (tile.x * NAM_TILE + x);
-				pixel = pixels[pixel_index];
-				if (pixel == old)
-				{
-					pixels[pixel_index] = new;
-				}
-			}
-Log_Verbose(&program.logger, "DEBUG => i:%2i | old:%.2X(#%.6X), new:%.2X(#%.6X)", i,
+			Pixels_Replace(pixels, NAM_TILE_PIXELS, old, new);
+			PROFILE_COUNT(PROFILE_PIXELS, NAM_TILE_PIXELS);
+#if DEBUG
+LOG_VERBOSE("DEBUG => i:%2i | old:%.2X(#%.6X), new:%.2X(#%.6X)", i,
 	old, program.ref_palette[old],
 	new, program.ref_palette[new]);
+#endif
 			total -= 1;
 		}
 	}
@@ -251,20 +291,19 @@ int ConvertBitmap_AssertOutputPalettes(void)
 
 	// TODO check if there are free color slots in a given palette, and potentially merge palettes this way
 
-	Log_Message(&program.logger,
+	LOG_MESSAGE(
 		"The given BMP file, when broken up into %ix%i-pixel NAM tiles, uses, at minimum, %i palettes:",
 		NAM_TILE, NAM_TILE,
 		program.tiles_palettes_amount);
-	t_char* str;
-	for (t_uint i = 0; i < program.tiles_palettes_amount; ++i)
+	t_char str[ANSI_PALETTE_SIZE];
+	for (t_uint i = 0; i < program.tiles_palettes_amount && LOG_ENABLED(); ++i)
 	{
 		palette = &program.tiles_palettes[i];
-		str = ANSI_GetPalette(palette);
-		Log_Message(&program.logger,
-			"%3i | palette: %s\toccurences: %i\tie: %.1f%%", i, str,
+		LOG_MESSAGE(
+			"%3i | palette: %s\toccurences: %i\tie: %.1f%%", i,
+			ANSI_GetPalette(str, palette),
 			palette->popularity,
 			palette->popularity / (NAM_TILES / 100.));
-		String_Delete(&str);
 	}
 
 	// insert the user-specified colorkey as the first color for any palette which doesn't have it
@@ -313,6 +352,7 @@ int FindOutputPalette(int index_tile, t_bool user_palette)
 
 	if (user_palette)
 	{
+		PROFILE_COUNT(PROFILE_COMPARISONS, PAL_SUB_AMOUNT);
 		result = Palette_GetNearest(
 			program.tiles_palettes[index_tile],
 			program.output_palettes, PAL_SUB_AMOUNT);
@@ -335,6 +375,7 @@ int FindOutputPalette(int index_tile, t_bool user_palette)
 		{
 			if (index_tile == program.tiles_palettes[i].duplicate)
 			{
+				PROFILE_COUNT(PROFILE_COMPARISONS, PAL_SUB_AMOUNT);
 				result = Palette_GetNearest(
 					program.tiles_palettes[i],
 					program.output_palettes, PAL_SUB_AMOUNT);
@@ -349,6 +390,7 @@ static
 int FindOutputColor(t_u8 pixel, t_argb32 const* colors, t_size length)
 {
 	t_argb32 const* color = Color_ARGB32_GetNearest(program.ref_palette[pixel], colors, length);
+	PROFILE_COUNT(PROFILE_NEAREST, 1);
 	if (color == NULL)
 		return (-1);
 	return (color - colors);
@@ -356,36 +398,62 @@ int FindOutputColor(t_u8 pixel, t_argb32 const* colors, t_size length)
 
 int ConvertBitmap_ApplyOutputPalettes(t_bool user_palette)
 {
-	t_u8*     pixels = (t_u8*)program.bitmap->pixels;
-	t_u8      pixel;
+	t_u8*     pixels;
 	int       index_color;
 	int       index_palette;
-	t_u32     index;
 	t_u32     index_tile = 0;
-	t_argb32  output_colors[PAL_SUB_AMOUNT][PAL_SUB_COLORS];
+	t_argb32  output_colors[PAL_SUB_AMOUNT_MAX][PAL_SUB_COLORS_MAX];
+	t_u8      lookup[PAL_SUB_AMOUNT_MAX][REFPAL_COLORS_MAX];
+	t_u8      tiles_palette[NAM_TILES_MAX];
 	SDL_Point tile = { .x=0, .y=0 };
 
-	Log_Message(&program.logger, "Applying final palette colors to the bitmap...");
-	Log_Message(&program.logger,
+	LOG_MESSAGE("Applying final palette colors to the bitmap...");
+	LOG_MESSAGE(
 		"The final set of %i palettes of %i colors each (chosen by popularity):",
 		PAL_SUB_AMOUNT,
 		PAL_SUB_COLORS);
-	for (t_uint i = 0; i < PAL_SUB_AMOUNT; ++i)
+	t_char str[ANSI_PALETTE_SIZE];
+	for (t_uint i = 0; i < PAL_SUB_AMOUNT && LOG_ENABLED(); ++i)
 	{
-		t_char* tmp = ANSI_GetPalette(&program.output_palettes[i]);
-		Log_Message(&program.logger,
-			"%3i | palette: %s\toccurences: %i\tie: %.1f%%", i, tmp,
+		LOG_MESSAGE(
+			"%3i | palette: %s\toccurences: %i\tie: %.1f%%", i,
+			ANSI_GetPalette(str, &program.output_palettes[i]),
 			program.output_palettes[i].popularity,
 			program.output_palettes[i].popularity / (NAM_TILES / 100.));
-		String_Delete(&tmp);
 	}
-	for (int i = 0; i < PAL_SUB_AMOUNT; ++i)
-	for (int j = 0; j < PAL_SUB_COLORS; ++j)
+	Memory_Clear(output_colors, sizeof(output_colors));
+	for (t_uint i = 0; i < PAL_SUB_AMOUNT; ++i)
+	for (t_uint j = 0; j < PAL_SUB_COLORS; ++j)
 	{
 		output_colors[i][j] = program.ref_palette[program.output_palettes[i].colors[j]];
 	}
-	for (tile.y = 0; tile.y < NAM_H_TILES; ++tile.y)
-	for (tile.x = 0; tile.x < NAM_W_TILES; ++tile.x)
+	// the nearest output color only depends on the reference color, so it is found once per reference color, rather than once per pixel
+	for (t_uint i = 0; i < PAL_SUB_AMOUNT; ++i)
+	for (t_uint j = 0; j < REFPAL_COLORS_MAX; ++j)
+	{
+		index_color = (j < REFPAL_COLORS) ? FindOutputColor(j, output_colors[i], PAL_SUB_COLORS) : -1;
+		if (index_color < 0 && j < REFPAL_COLORS)
+			Log_Error(&program.logger, 0, "Could not find color for reference color %.2X in output palette %u", j, i);
+		// a pixel whose color cannot be found is left unchanged
+		lookup[i][j] = (index_color < 0) ? j : (i * PAL_SUB_COLORS + index_color);
+	}
+	// the output pixels of a tile only depend on its pixels, the reference palette, and its chosen output palette
+	t_u64 context[PAL_SUB_AMOUNT_MAX];
+	t_uint target = (program.target - targets);
+	t_u64 refpal = Hash_FNV1a(&target, sizeof(target), HASH_SEED);
+	refpal = Hash_FNV1a(program.ref_palette, sizeof(program.ref_palette), refpal);
+	for (t_uint i = 0; i < PAL_SUB_AMOUNT; ++i)
+	{
+		context[i] = Hash_FNV1a(&i, sizeof(i), refpal);
+		context[i] = Hash_FNV1a(output_colors[i], sizeof(output_colors[i]), context[i]);
+	}
+	// the error of each tile is measured as it is remapped (a dithered output is only measured once it is done, below)
+	t_bool measure = !program.dither;
+	if (measure && Metrics_Begin())
+		return (ERROR);
+	s_tilecache_entry* cached;
+	for (tile.y = 0; tile.y < (int)NAM_H_TILES; ++tile.y)
+	for (tile.x = 0; tile.x < (int)NAM_W_TILES; ++tile.x)
 	{
 		index_palette = FindOutputPalette(index_tile, user_palette);
 		if (index_palette < 0)
@@ -393,30 +461,44 @@ int ConvertBitmap_ApplyOutputPalettes(t_bool user_palette)
 			Log_Error(&program.logger, 0, "Could not find palette for tile at (x:%i, y:%i)",
 				(tile.x * NAM_TILE),
 				(tile.y * NAM_TILE));
+			tiles_palette[index_tile++] = DITHER_SKIP;
 			continue;
 		}
-		for (int y = 0; y < NAM_TILE; ++y)
-		for (int x = 0; x < NAM_TILE; ++x)
+		tiles_palette[index_tile] = (t_u8)index_palette;
+		pixels = TILE_PIXELS(index_tile);
+		t_u64 key = Hash_FNV1a(pixels, NAM_TILE_PIXELS, context[index_palette]);
+		if ((cached = TileCache_Find(&program.tilecache, key, TILECACHE_REMAP)))
+			Memory_Copy(pixels, cached->pixels, NAM_TILE_PIXELS);
+		else
 		{
-			index = (tile.y * NAM_TILE + y) * NAM_W + (tile.x * NAM_TILE + x);
-			pixel = pixels[index];
-			index_color = FindOutputColor(pixel, output_colors[index_palette], PAL_SUB_COLORS);
-			if (index_color < 0)
-			{
-				Log_Error(&program.logger, 0, "Could not find color for pixel at (x:%i, y:%i)",
-					(tile.x * NAM_TILE + x),
-					(tile.y * NAM_TILE + y));
-				continue;
-			}
-			pixels[index] = index_palette * (PAL_SUB_COLORS * sizeof(t_u8)) + index_color;
+			cached = TileCache_Insert(&program.tilecache, key, TILECACHE_REMAP);
+			TARGET(remap_tile)(pixels, lookup[index_palette]);
+			if (cached)
+				Memory_Copy(cached->pixels, pixels, NAM_TILE_PIXELS);
+			PROFILE_COUNT(PROFILE_PIXELS, NAM_TILE_PIXELS);
 		}
+		if (measure)
+			Metrics_AddTile(index_tile, program.tiles_reference + (t_size)index_tile * NAM_TILE_PIXELS, pixels);
 		++index_tile;
 	}
+	// dithering starts over from the original colors, so it replaces the remapped pixels (but only within each tile's chosen palette)
+	if (program.dither && Dither_Apply(tiles_palette, (t_argb32 const(*)[PAL_SUB_COLORS_MAX])output_colors))
+		return (ERROR);
+	if (program.dither ? Metrics_Measure() : Metrics_End())
+		return (ERROR);
+	return (ConvertBitmap_OutputColors());
+}
+
+
+
+int ConvertBitmap_OutputColors(void)
+{
 	SDL_Palette* palette = program.bitmap->format->palette;
-	t_argb32 color;
+	t_argb32     color;
+	int          index_color;
 	Memory_Clear(palette->colors, palette->ncolors * sizeof(SDL_Color));
-	for (int i = 0; i < PAL_SUB_AMOUNT; ++i)
-	for (int j = 0; j < PAL_SUB_COLORS; ++j)
+	for (t_uint i = 0; i < PAL_SUB_AMOUNT; ++i)
+	for (t_uint j = 0; j < PAL_SUB_COLORS && i * PAL_SUB_COLORS + j < (t_uint)palette->ncolors; ++j)
 	{
 		index_color = program.output_palettes[i].colors[j];
 		color = program.ref_palette[index_color];
@@ -0,0 +1,187 @@
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/image/color.h>
+#include <libccc/sys/logger.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+/*
+** ************************************************************************** *|
+**                              CHR Tile Functions                            *|
+** ************************************************************************** *|
+*/
+
+//! Returns the amount of bits which differ between the two given encoded tiles (ie: roughly, how many pixels differ)
+static
+t_uint  CompareTiles(t_u8 const* tile1, t_u8 const* tile2)
+{
+	t_uint result = 0;
+	for (t_size i = 0; i < CHR_SIZE_TILE; ++i)
+	{
+		t_u8 diff = (tile1[i] ^ tile2[i]);
+		for (; diff; diff &= diff - 1)
+		{
+			++result;
+		}
+	}
+	return (result);
+}
+
+//! Returns the index of the given encoded `tile` in the `chrset` (adding it if it is new, or using the nearest tile if the set is full)
+static
+t_uint  FindTile(s_chrset* chrset, t_u8 const* tile)
+{
+	t_u64 hash = Hash_FNV1a(tile, CHR_SIZE_TILE, HASH_SEED);
+	for (t_uint i = 0; i < chrset->amount; ++i)
+	{
+		PROFILE_COUNT(PROFILE_COMPARISONS, 1);
+		if (chrset->hashes[i] == hash &&
+			Memory_Equals(chrset->tiles + i * CHR_SIZE_TILE, tile, CHR_SIZE_TILE))
+			return (i);
+	}
+	if (chrset->amount < CHR_TILES)
+	{
+		chrset->hashes[chrset->amount] = hash;
+		Memory_Copy(chrset->tiles + chrset->amount * CHR_SIZE_TILE, tile, CHR_SIZE_TILE);
+		return (chrset->amount++);
+	}
+	t_uint nearest = 0;
+	t_uint nearest_diff = (t_uint)-1;
+	for (t_uint i = 0; i < chrset->amount; ++i)
+	{
+		t_uint diff = CompareTiles(chrset->tiles + i * CHR_SIZE_TILE, tile);
+		if (diff < nearest_diff)
+		{
+			nearest = i;
+			nearest_diff = diff;
+		}
+	}
+	chrset->overflow += 1;
+	return (nearest);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                           Output Encoding Functions                        *|
+** ************************************************************************** *|
+*/
+
+void    EncodeBitmap_PAL(t_u8* dest)
+{
+	for (t_uint i = 0; i < PAL_SUB_AMOUNT; ++i)
+	for (t_uint j = 0; j < PAL_SUB_COLORS; ++j)
+	{
+		t_u8 color = program.output_palettes[i].colors[j];
+		t_u8* entry = dest + (i * PAL_SUB_COLORS + j) * PAL_COLORSIZE;
+		switch (TARGET(pal_format))
+		{
+			case PAL_FORMAT_INDEX:
+				entry[0] = color;
+				break;
+			case PAL_FORMAT_BGR555:
+			{
+				t_argb32 argb = program.ref_palette[color];
+				t_u16 bgr = (t_u16)(
+					((Color_ARGB32_Get_R(argb) >> 3) << 0) |
+					((Color_ARGB32_Get_G(argb) >> 3) << 5) |
+					((Color_ARGB32_Get_B(argb) >> 3) << 10));
+				entry[0] = (t_u8)(bgr >> 0);
+				entry[1] = (t_u8)(bgr >> 8);
+				break;
+			}
+		}
+	}
+}
+
+
+
+int     EncodeBitmap_NAM(s_chrset* chrset, t_u8* dest)
+{
+	t_u8*       attributes = dest + NAM_SIZE - NAM_SIZE_ATTR;
+	t_u8 const* pixels;
+	t_u8        encoded[CHR_SIZE_TILE_MAX];
+	t_uint      chr_per_tile = NAM_TILE / CHR_TILE;
+	t_u32       index;
+	t_u32       entry;
+	SDL_Point   chr;
+	SDL_Point   tile;
+	for (chr.y = 0; chr.y < (int)NAM_H_CHR; ++chr.y)
+	for (chr.x = 0; chr.x < (int)NAM_W_CHR; ++chr.x)
+	{
+		index = (chr.y / chr_per_tile) * NAM_W_TILES + (chr.x / chr_per_tile);
+		pixels = TILE_PIXELS(index)
+			+ (chr.y % chr_per_tile) * CHR_TILE * NAM_TILE
+			+ (chr.x % chr_per_tile) * CHR_TILE;
+		TARGET(encode_tile)(encoded, pixels);
+		entry = FindTile(chrset, encoded);
+		// targets without an attribute table store the palette of each tile in its nametable entry
+		if (NAM_SIZE_ATTR == 0)
+			entry |= (pixels[0] / PAL_SUB_COLORS) << TARGET(nam_palette);
+		for (t_size i = 0; i < NAM_SIZE_TILE; ++i)
+		{
+			dest[(chr.y * NAM_W_CHR + chr.x) * NAM_SIZE_TILE + i] = (t_u8)(entry >> (i * 8));
+		}
+	}
+	PROFILE_COUNT(PROFILE_PIXELS, NAM_TILES * NAM_TILE_PIXELS);
+	if (NAM_SIZE_ATTR == 0)
+		return (OK);
+	Memory_Clear(attributes, NAM_SIZE_ATTR);
+	// each attribute byte holds the palettes of 2x2 metatiles: top-left in the low bits, then top-right, bottom-left, bottom-right
+	for (tile.y = 0; tile.y < (int)NAM_H_TILES; ++tile.y)
+	for (tile.x = 0; tile.x < (int)NAM_W_TILES; ++tile.x)
+	{
+		index = (tile.y * NAM_W_TILES + tile.x);
+		t_u8 palette = TILE_PIXELS(index)[0] / PAL_SUB_COLORS;
+		t_u8 shift = ((tile.y % 2) * 2 + (tile.x % 2)) * 2;
+		attributes[(tile.y / 2) * NAM_W_ATTR + (tile.x / 2)] |= (palette << shift);
+	}
+	return (OK);
+}
+
+
+
+void    EncodeBitmap_CHR(s_chrset const* chrset, t_u8* dest)
+{
+	Memory_Copy(dest, chrset->tiles, chrset->amount * CHR_SIZE_TILE);
+	Memory_Clear(dest + chrset->amount * CHR_SIZE_TILE, (CHR_TILES - chrset->amount) * CHR_SIZE_TILE);
+}
+
+
+
+int     EncodeBitmap_Outputs(void)
+{
+	s_chrset* chrset = (s_chrset*)Arena_Allocate(&program.arena, sizeof(s_chrset));
+	t_u8* chr = (t_u8*)Arena_Allocate(&program.arena, CHR_SIZE);
+	t_u8* nam = (t_u8*)Arena_Allocate(&program.arena, NAM_SIZE);
+	t_u8* pal = (t_u8*)Arena_Allocate(&program.arena, PAL_SIZE);
+	if (chrset == NULL || chr == NULL || nam == NULL || pal == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not allocate memory for output CHR/NAM/PAL files");
+		return (ERROR);
+	}
+	Memory_Clear(chrset, sizeof(s_chrset));
+	if (EncodeBitmap_NAM(chrset, nam))
+		return (ERROR);
+	EncodeBitmap_CHR(chrset, chr);
+	EncodeBitmap_PAL(pal);
+	if (chrset->overflow)
+	{
+		LOG_WARNING("Too many unique %ix%i CHR tiles (maximum is %i): %u tiles were replaced by their nearest existing tile",
+			CHR_TILE, CHR_TILE, CHR_TILES, chrset->overflow);
+	}
+	else LOG_SUCCESS("Encoded %u unique CHR tiles.", chrset->amount);
+	if (Output_Add(CHR_FILE(""), chr, CHR_SIZE) ||
+		Output_Add(NAM_FILE(""), nam, NAM_SIZE) ||
+		Output_Add(PAL_FILE(""), pal, PAL_SIZE))
+		return (ERROR);
+	if ((program.compress_nam || program.compress_chr) && Compress_Outputs(nam, chr))
+		return (ERROR);
+	return (OK);
+}
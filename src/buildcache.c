@@ -0,0 +1,283 @@
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/io.h>
+#include <libccc/sys/logger.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+//! The file extensions of the output files which are written by every conversion (and so, restored from the cache)
+static t_char const* const buildcache_outputs[] =
+{
+	".bmp",
+	CHR_FILE(""),
+	NAM_FILE(""),
+	PAL_FILE(""),
+};
+//! The amount of items in `buildcache_outputs`
+#define BUILDCACHE_OUTPUTS  (sizeof(buildcache_outputs) / sizeof(buildcache_outputs[0]))
+
+
+
+/*
+** ************************************************************************** *|
+**                             Cache Key Functions                            *|
+** ************************************************************************** *|
+*/
+
+//! Hashes the entire contents of the file at the given `filepath` into the given `hash`
+static
+int     BuildCache_HashFile(t_char const* filepath, t_u64* hash)
+{
+	t_fd fd = IO_Open(filepath, OPEN_READONLY, 0);
+	if (fd < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not open file to hash: %s", filepath);
+		return (ERROR);
+	}
+	t_u8* file = NULL;
+	t_sintmax size = Arena_ReadFile(&program.arena, fd, &file);
+	IO_Close(fd);
+	if (size < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not read file to hash: %s", filepath);
+		return (ERROR);
+	}
+	// the size is hashed as well, so that two files can never be concatenated into the same hash
+	*hash = Hash_FNV1a(&size, sizeof(size), *hash);
+	*hash = Hash_FNV1a(file, (t_size)size, *hash);
+	return (OK);
+}
+
+
+
+int     BuildCache_GetKey(void)
+{
+	t_u64 hash = HASH_SEED;
+	hash = Hash_FNV1a(BMP2NAM_VERSION, sizeof(BMP2NAM_VERSION), hash);
+	// the input is hashed from memory, since it may have been read from stdin
+	hash = Hash_FNV1a(&program.input_size, sizeof(program.input_size), hash);
+	hash = Hash_FNV1a(program.input_data, program.input_size, hash);
+	hash = Hash_FNV1a(TARGET(name), String_Length(TARGET(name)), hash);
+	// the reference palettes are only hashed from their files if they are not built into the program
+	for (t_uint i = 0; i < program.files_refpal_amount; ++i)
+	{
+		if (BuildCache_HashFile(program.files_refpal[i], &hash))
+			return (ERROR);
+	}
+	hash = Hash_FNV1a(&program.emphasis, sizeof(program.emphasis), hash);
+	// the `--palette` file is hashed by its contents, as they were loaded when handling the argument
+	hash = Hash_FNV1a(program.output_palettes, sizeof(program.output_palettes), hash);
+	hash = Hash_FNV1a(&program.colorkey.color, sizeof(program.colorkey.color), hash);
+	hash = Hash_FNV1a(&program.colorkey.occurences, sizeof(program.colorkey.occurences), hash);
+	hash = Hash_FNV1a(&program.crop, sizeof(program.crop), hash);
+	hash = Hash_FNV1a(&program.align, sizeof(program.align), hash);
+	hash = Hash_FNV1a(&program.align_auto, sizeof(program.align_auto), hash);
+	hash = Hash_FNV1a(&program.scale, sizeof(program.scale), hash);
+	hash = Hash_FNV1a(&program.dither, sizeof(program.dither), hash);
+	hash = Hash_FNV1a(&program.heatmap, sizeof(program.heatmap), hash);
+	hash = Hash_FNV1a(&program.compress_nam, sizeof(program.compress_nam), hash);
+	hash = Hash_FNV1a(&program.compress_chr, sizeof(program.compress_chr), hash);
+	hash = Hash_FNV1a(&program.compress_fast, sizeof(program.compress_fast), hash);
+	hash = Hash_FNV1a(&program.progressive, sizeof(program.progressive), hash);
+	hash = Hash_FNV1a(&program.portfolio, sizeof(program.portfolio), hash);
+	hash = Hash_FNV1a(&program.progressive_budget, sizeof(program.progressive_budget), hash);
+	program.buildcache.key = hash;
+	LOG_VERBOSE("Build cache key: %016llX", (unsigned long long)hash);
+	return (OK);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                            Cache Entry Functions                           *|
+** ************************************************************************** *|
+*/
+
+//! Returns the filepath of the cache entry for the current key, for the output file with the given `extension`
+static
+t_char* BuildCache_GetEntryPath(t_char const* extension)
+{
+	t_size length = String_Length(program.buildcache.dir) + 1 + BUILDCACHE_KEYLENGTH + String_Length(extension) + 1;
+	t_char* result = (t_char*)Arena_Allocate(&program.arena, length);
+	if (result == NULL)
+		return (NULL);
+	snprintf(result, length, "%s/%016llx%s",
+		program.buildcache.dir,
+		(unsigned long long)program.buildcache.key,
+		extension);
+	return (result);
+}
+
+//! Writes the given output file as a cache entry (writing to a temporary file first, so that `dest` is never left half-written)
+static
+int     BuildCache_WriteEntry(t_char const* dest, s_output_file const* output)
+{
+	t_char* tmp = Arena_Concat(&program.arena, dest, ".tmp");
+	if (tmp == NULL)
+		return (ERROR);
+	t_fd fd = IO_Open(tmp, OPEN_WRITEONLY | OPEN_CREATE | OPEN_CLEARFILE, 0644);
+	if (fd < 0)
+		return (ERROR);
+	t_size written = IO_Write_Data(fd, output->data, output->size);
+	IO_Close(fd);
+	if (written != output->size || rename(tmp, dest))
+	{
+		remove(tmp);
+		return (ERROR);
+	}
+	return (OK);
+}
+
+
+
+t_bool  BuildCache_Restore(void)
+{
+	if (program.buildcache.dir == NULL)
+		return (FALSE);
+	// the outputs which depend on the options are only restored when they were asked for
+	t_char const* outputs[OUTPUT_FILES_MAX];
+	t_size amount = 0;
+	for (; amount < BUILDCACHE_OUTPUTS; ++amount)
+		outputs[amount] = buildcache_outputs[amount];
+	if (program.heatmap)
+		outputs[amount++] = METRICS_HEATMAP_FILE("");
+	if (program.compress_nam)
+		outputs[amount++] = Compress_GetFile(program.compress_nam, FALSE);
+	if (program.compress_chr)
+		outputs[amount++] = Compress_GetFile(program.compress_chr, TRUE);
+	for (t_size i = 0; i < amount; ++i)
+	{
+		t_char* entry = BuildCache_GetEntryPath(outputs[i]);
+		t_fd fd = (entry ? IO_Open(entry, OPEN_READONLY, 0) : -1);
+		if (fd < 0)
+		{
+			LOG_VERBOSE("Build cache miss: %s", (entry ? entry : outputs[i]));
+			program.outputs_amount = 0;
+			return (FALSE);
+		}
+		t_u8* file = NULL;
+		t_sintmax size = Arena_ReadFile(&program.arena, fd, &file);
+		IO_Close(fd);
+		if (size < 0 || Output_Add(outputs[i], file, (t_size)size))
+		{
+			LOG_WARNING("Could not read build cache entry: %s", entry);
+			program.outputs_amount = 0;
+			return (FALSE);
+		}
+	}
+	LOG_SUCCESS("Build cache hit: restored outputs for %s", program.file_input);
+	program.buildcache.hit = TRUE;
+	return (TRUE);
+}
+
+
+
+int     BuildCache_Store(void)
+{
+	if (program.buildcache.dir == NULL)
+		return (OK);
+	if (mkdir(program.buildcache.dir, 0755) && errno != EEXIST)
+	{
+		LOG_WARNING("Could not create build cache directory: %s", program.buildcache.dir);
+		return (OK);
+	}
+	for (t_uint i = 0; i < program.outputs_amount; ++i)
+	{
+		t_char* entry = BuildCache_GetEntryPath(program.outputs[i].extension);
+		if (entry == NULL ||
+			BuildCache_WriteEntry(entry, &program.outputs[i]))
+		{   // a cache which cannot be written to should not make the conversion itself fail
+			LOG_WARNING("Could not store output file in build cache: %s", (entry ? entry : program.outputs[i].extension));
+			return (OK);
+		}
+	}
+	LOG_VERBOSE("Stored outputs in build cache: %s", program.buildcache.dir);
+	return (OK);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                          Dependency File Functions                         *|
+** ************************************************************************** *|
+*/
+
+//! Writes the given `path`, escaping the characters which have special meaning in a makefile rule
+static
+void    BuildCache_WriteDeps_Path(t_fd fd, t_char const* path)
+{
+	t_size start = 0;
+	t_size i;
+	for (i = 0; path[i]; ++i)
+	{
+		t_char const* escape;
+		switch (path[i])
+		{
+			case ' ': escape = "\\ "; break;
+			case '#': escape = "\\#"; break;
+			case '$': escape = "$$";  break;
+			default: continue;
+		}
+		IO_Write_Data(fd, (t_u8 const*)path + start, i - start);
+		IO_Write_String(fd, escape);
+		start = i + 1;
+	}
+	IO_Write_Data(fd, (t_u8 const*)path + start, i - start);
+}
+
+int     BuildCache_WriteDeps(void)
+{
+	if (program.buildcache.file_deps == NULL)
+		return (OK);
+	t_fd fd = IO_Open(program.buildcache.file_deps, OPEN_WRITEONLY | OPEN_CREATE | OPEN_CLEARFILE, 0644);
+	if (fd < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not open dependency file: %s", program.buildcache.file_deps);
+		return (ERROR);
+	}
+	t_char const* inputs[2 + REFPAL_FILES_MAX];
+	t_size inputs_amount = 0;
+	if (!String_Equals(program.file_input, PATH_STDIO))
+		inputs[inputs_amount++] = program.file_input;
+	for (t_uint i = 0; i < program.files_refpal_amount; ++i)
+		inputs[inputs_amount++] = program.files_refpal[i];
+	if (program.file_palette)
+		inputs[inputs_amount++] = program.file_palette;
+	for (t_uint i = 0; i < program.outputs_amount; ++i)
+	{
+		if (i > 0)
+			IO_Write_String(fd, " ");
+		BuildCache_WriteDeps_Path(fd, program.file_output);
+		BuildCache_WriteDeps_Path(fd, program.outputs[i].extension);
+	}
+	IO_Write_String(fd, ":");
+	for (t_size i = 0; i < inputs_amount; ++i)
+	{
+		IO_Write_String(fd, " \\\n ");
+		BuildCache_WriteDeps_Path(fd, inputs[i]);
+	}
+	IO_Write_String(fd, "\n");
+	// add an empty rule for each input, so that make does not fail if one of them is deleted (like `gcc -MP`)
+	for (t_size i = 0; i < inputs_amount; ++i)
+	{
+		IO_Write_String(fd, "\n");
+		BuildCache_WriteDeps_Path(fd, inputs[i]);
+		IO_Write_String(fd, ":\n");
+	}
+	IO_Close(fd);
+	LOG_VERBOSE("Wrote dependency file: %s", program.buildcache.file_deps);
+	return (OK);
+}
@@ -0,0 +1,295 @@
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/io.h>
+#include <libccc/sys/logger.h>
+#include <libccc/image/color.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+//! The amount of 64-bit words in one `s_colormask`
+#define COLORMASK_WORDS     (REFPAL_COLORS_MAX / 64)
+
+//! Stores which reference palette colors are present in one tile (or one palette), as one bit per color
+typedef struct s_colormask_
+{
+	t_u64       bits[COLORMASK_WORDS];
+}
+s_colormask;
+
+//! The amount of slots in the set of unique CHR tile hashes (must be a power of 2, larger than `CHR_TILES_MAX`)
+#define COMPLIANCE_CHRSET   (4 * CHR_TILES_MAX)
+
+//! Stores the state of the compliance check of one file
+typedef struct s_compliance_
+{
+	t_char const*   filepath;                       //!< The file being checked (for the violation list)
+	t_uint          violations;                     //!< The amount of violations found so far
+	t_u8            lookup[BMP_MAXCOLORS];          //!< The reference palette color of each bitmap palette color
+	s_colormask     tiles[NAM_TILES_MAX];           //!< The colors present in each metatile
+	t_uint          tiles_palette[NAM_TILES_MAX];   //!< The palette chosen for each metatile (or `(t_uint)-1` if it has too many colors)
+	s_colormask     palettes[NAM_TILES_MAX];        //!< The palettes which were packed so far (there can be more than `PAL_SUB_AMOUNT`)
+	t_uint          palettes_amount;                //!< The amount of items in `palettes`
+	t_u64           chrset[COMPLIANCE_CHRSET];      //!< The hashes of the unique CHR tiles (0 is an empty slot)
+	t_uint          chr_tiles;                      //!< The amount of unique CHR tiles
+}
+s_compliance;
+
+
+
+/*
+** ************************************************************************** *|
+**                             Color Mask Functions                           *|
+** ************************************************************************** *|
+*/
+
+//! Returns the amount of colors present in the given `mask`
+static inline
+t_uint  ColorMask_Count(s_colormask const* mask)
+{
+	t_uint result = 0;
+	for (t_uint i = 0; i < COLORMASK_WORDS; ++i)
+	{
+		for (t_u64 bits = mask->bits[i]; bits; bits &= bits - 1)
+			++result;
+	}
+	return (result);
+}
+
+//! Returns the amount of colors present in the union of the two given masks
+static inline
+t_uint  ColorMask_CountUnion(s_colormask const* mask1, s_colormask const* mask2)
+{
+	t_uint result = 0;
+	for (t_uint i = 0; i < COLORMASK_WORDS; ++i)
+	{
+		for (t_u64 bits = (mask1->bits[i] | mask2->bits[i]); bits; bits &= bits - 1)
+			++result;
+	}
+	return (result);
+}
+
+//! Returns the index of the given `color` among the colors present in the given `mask` (ie: the color's index within a palette)
+static inline
+t_uint  ColorMask_IndexOf(s_colormask const* mask, t_u8 color)
+{
+	t_uint result = 0;
+	for (t_uint i = 0; i < (t_uint)color / 64; ++i)
+	{
+		for (t_u64 bits = mask->bits[i]; bits; bits &= bits - 1)
+			++result;
+	}
+	for (t_u64 bits = mask->bits[color / 64] & ((1ull << (color % 64)) - 1); bits; bits &= bits - 1)
+		++result;
+	return (result);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                           Compliance Check Functions                       *|
+** ************************************************************************** *|
+*/
+
+//! Adds one line to the violation list of the current file
+#define COMPLIANCE_VIOLATION(CHECK, FORMAT, ...) \
+	do {                                                                \
+		IO_Output_Format("%s:"FORMAT"\n", (CHECK)->filepath, __VA_ARGS__); \
+		(CHECK)->violations += 1;                                       \
+	} while (0)
+
+//! Finds the reference palette color of each bitmap palette color, and the colors present in each metatile (in one pass over the pixels)
+static
+void    Compliance_TilesColors(s_compliance* check)
+{
+	SDL_Palette const* palette = program.bitmap->format->palette;
+	for (int i = 0; i < palette->ncolors && i < BMP_MAXCOLORS; ++i)
+	{
+		t_argb32 color = Color_ARGB32_Set(0, palette->colors[i].r, palette->colors[i].g, palette->colors[i].b);
+		t_argb32 const* nearest = Color_ARGB32_GetNearest(color, program.ref_palette, REFPAL_COLORS);
+		check->lookup[i] = (nearest ? (t_u8)(nearest - program.ref_palette) : 0);
+	}
+	s_colormask colorkey = { 0 };
+	if (program.colorkey.occurences)
+	{   // the colorkey is present in every palette, so it counts as one of the colors of every tile
+		t_argb32 const* nearest = Color_ARGB32_GetNearest(program.colorkey.color, program.ref_palette, REFPAL_COLORS);
+		t_u8 color = (nearest ? (t_u8)(nearest - program.ref_palette) : 0);
+		colorkey.bits[color / 64] |= (1ull << (color % 64));
+	}
+	for (t_uint i = 0; i < NAM_TILES; ++i)
+	{
+		t_u8 const* pixels = TILE_PIXELS(i);
+		s_colormask* mask = &check->tiles[i];
+		*mask = colorkey;
+		for (t_uint j = 0; j < NAM_TILE_PIXELS; ++j)
+		{
+			t_u8 color = check->lookup[pixels[j]];
+			mask->bits[color / 64] |= (1ull << (color % 64));
+		}
+	}
+	PROFILE_COUNT(PROFILE_PIXELS, NAM_TILES * NAM_TILE_PIXELS);
+}
+
+//! Checks that no metatile has more colors than one palette can hold
+static
+void    Compliance_CheckTiles(s_compliance* check)
+{
+	for (t_uint i = 0; i < NAM_TILES; ++i)
+	{
+		t_uint colors = ColorMask_Count(&check->tiles[i]);
+		check->tiles_palette[i] = 0;
+		if (colors <= PAL_SUB_COLORS)
+			continue;
+		check->tiles_palette[i] = (t_uint)-1;
+		COMPLIANCE_VIOLATION(check, "tile(%u,%u): has %u colors (maximum is %u)",
+			i % NAM_W_TILES,
+			i / NAM_W_TILES,
+			colors, PAL_SUB_COLORS);
+	}
+}
+
+//! Packs the color sets of all metatiles into as few palettes as possible (best-fit, from the largest sets to the smallest)
+static
+void    Compliance_CheckPalettes(s_compliance* check)
+{
+	check->palettes_amount = 0;
+	for (t_uint colors = PAL_SUB_COLORS; colors > 0; --colors)
+	for (t_uint i = 0; i < NAM_TILES; ++i)
+	{
+		s_colormask const* mask = &check->tiles[i];
+		if (check->tiles_palette[i] == (t_uint)-1 || ColorMask_Count(mask) != colors)
+			continue;
+		t_uint best = check->palettes_amount;
+		t_uint best_colors = PAL_SUB_COLORS + 1;
+		for (t_uint p = 0; p < check->palettes_amount; ++p)
+		{
+			PROFILE_COUNT(PROFILE_COMPARISONS, 1);
+			t_uint merged = ColorMask_CountUnion(&check->palettes[p], mask);
+			if (merged < best_colors)
+			{
+				best = p;
+				best_colors = merged;
+			}
+		}
+		if (best == check->palettes_amount)
+			check->palettes[check->palettes_amount++] = *mask;
+		else for (t_uint w = 0; w < COLORMASK_WORDS; ++w)
+			check->palettes[best].bits[w] |= mask->bits[w];
+		check->tiles_palette[i] = best;
+	}
+	if (check->palettes_amount > PAL_SUB_AMOUNT)
+	{   // this packing is not always optimal, so the amount given is an upper bound
+		COMPLIANCE_VIOLATION(check, " needs up to %u palettes (maximum is %u)",
+			check->palettes_amount, PAL_SUB_AMOUNT);
+	}
+}
+
+//! Counts the unique CHR tiles, once each metatile uses the color indices of its palette
+static
+void    Compliance_CheckCHR(s_compliance* check)
+{
+	t_u8 metatile[NAM_TILE_PIXELS_MAX];
+	t_u8 encoded[CHR_SIZE_TILE_MAX];
+	t_uint chr_per_tile = NAM_TILE / CHR_TILE;
+	Memory_Clear(check->chrset, sizeof(check->chrset));
+	check->chr_tiles = 0;
+	for (t_uint i = 0; i < NAM_TILES; ++i)
+	{
+		t_u8 const* pixels = TILE_PIXELS(i);
+		// tiles with too many colors use the indices of their own colors (only the low bits are kept in the CHR)
+		s_colormask const* palette = (check->tiles_palette[i] == (t_uint)-1) ?
+			&check->tiles[i] : &check->palettes[check->tiles_palette[i]];
+		for (t_uint j = 0; j < NAM_TILE_PIXELS; ++j)
+		{
+			metatile[j] = (t_u8)ColorMask_IndexOf(palette, check->lookup[pixels[j]]);
+		}
+		for (t_uint y = 0; y < chr_per_tile; ++y)
+		for (t_uint x = 0; x < chr_per_tile; ++x)
+		{
+			TARGET(encode_tile)(encoded, metatile + y * CHR_TILE * NAM_TILE + x * CHR_TILE);
+			// only the hashes are compared: a collision would only make the count lower by one
+			t_u64 hash = Hash_FNV1a(encoded, CHR_SIZE_TILE, HASH_SEED) | 1;
+			t_uint slot = (t_uint)hash & (COMPLIANCE_CHRSET - 1);
+			while (check->chrset[slot] != 0 && check->chrset[slot] != hash)
+				slot = (slot + 1) & (COMPLIANCE_CHRSET - 1);
+			if (check->chrset[slot] == 0 && check->chr_tiles < COMPLIANCE_CHRSET / 2)
+			{
+				check->chrset[slot] = hash;
+				check->chr_tiles += 1;
+			}
+		}
+	}
+	if (check->chr_tiles > CHR_TILES)
+	{
+		COMPLIANCE_VIOLATION(check, " has %u unique %ix%i CHR tiles (maximum is %u)",
+			check->chr_tiles, CHR_TILE, CHR_TILE, CHR_TILES);
+	}
+}
+
+
+
+//! Checks the loaded bitmap against the limits of the target (this is the "CheckCompliance" span of the `--trace` timeline)
+static
+int     Compliance_CheckBitmap(s_compliance* check)
+{
+	if (program.scale && PROFILE_STAGE(Scale_Bitmap()))
+		return (ERROR);
+	// the bitmap itself is never changed: its pixels are only copied into `program.tiles_pixels`
+	if (PROFILE_STAGE(CheckBitmap_PixelFormat()))
+		return (ERROR);
+	if (PROFILE_STAGE(CheckBitmap_Dimensions()))
+		return (ERROR);
+	if (PROFILE_STAGE(Align_View()))
+		return (ERROR);
+	if (PROFILE_STAGE(ConvertBitmap_PackTiles()))
+		return (ERROR);
+	if (PROFILE_STAGE(RefPal_Choose()))
+		return (ERROR);
+	Compliance_TilesColors(check);
+	Compliance_CheckTiles(check);
+	Compliance_CheckPalettes(check);
+	Compliance_CheckCHR(check);
+	return (OK);
+}
+
+
+
+int     Compliance_Check(t_char const* filepath)
+{
+	s_compliance* check = (s_compliance*)Arena_Allocate(&program.arena, sizeof(s_compliance));
+	if (check == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not allocate memory to check file: %s", filepath);
+		return (ERROR);
+	}
+	Memory_Clear(check, sizeof(s_compliance));
+	check->filepath = filepath;
+	program.file_input = filepath;
+	if (PROFILE_STAGE(Input_Read()))
+		return (ERROR);
+	program.bitmap = SDL_LoadBMP_RW(SDL_RWFromConstMem(program.input_data, (int)program.input_size), TRUE);
+	if (program.bitmap == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not load BMP file: %s => %s\n", filepath, SDL_GetError());
+		return (ERROR);
+	}
+	// the span is ended on every path, so that the trace of a failed check stays balanced
+	TRACE_BEGIN("CheckCompliance");
+	int result = Compliance_CheckBitmap(check);
+	TRACE_END("CheckCompliance");
+	if (result)
+		return (ERROR);
+	IO_Output_Format("%s: %s (%u palettes, %u CHR tiles, %u violations)\n",
+		filepath,
+		(check->violations ? "FAIL" : "OK"),
+		check->palettes_amount,
+		check->chr_tiles,
+		check->violations);
+	return (check->violations ? ERROR : OK);
+}
@@ -0,0 +1,740 @@
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/logger.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+//! The names of the compression formats, as accepted by `--compress` (indexed by `e_compress`)
+static t_char const* const compress_names[COMPRESS_AMOUNT] =
+{
+	"none",
+	"rle",
+	"lz4",
+	"tiles",
+};
+
+//! The file extensions of the compressed NAM outputs (indexed by `e_compress`)
+static t_char const* const compress_nam_files[COMPRESS_AMOUNT] =
+{
+	NULL,
+	NAM_FILE("")".rle",
+	NAM_FILE("")".lz4",
+	NULL, // the `tiles` format only applies to CHR data
+};
+
+//! The file extensions of the compressed CHR outputs (indexed by `e_compress`)
+static t_char const* const compress_chr_files[COMPRESS_AMOUNT] =
+{
+	NULL,
+	CHR_FILE("")".rle",
+	CHR_FILE("")".lz4",
+	CHR_FILE("")".tiles",
+};
+
+//! Stores one compression to be done: it only reads its own fields, so it can run on any thread
+typedef struct s_compress_job_
+{
+	e_compress      format;     //!< The compression format to use
+	t_bool          fast;       //!< If TRUE, a greedy parse is used instead of the optimal one
+	s_target const* target;     //!< The target of the data (needed to decode the bitplanes of CHR tiles)
+	t_u8 const*     src;        //!< The data to compress
+	t_size          size;       //!< The size (in bytes) of `src`
+	t_u8*           dest;       //!< The compressed data (`COMPRESS_CAPACITY(size)` bytes)
+	t_u8*           scratch;    //!< The working memory of the encoder (`COMPRESS_SCRATCH(size)` bytes)
+	t_size          result;     //!< The size (in bytes) of the compressed data, or `SIZE_ERROR` if it could not be compressed
+	t_u8*           decoded;    //!< The compressed data, decompressed again (`size` bytes), to check that it round-trips
+	t_bool          verified;   //!< If TRUE, the compressed data decompresses back to exactly `src`
+}
+s_compress_job;
+
+//! The largest size (in bytes) of the compressed data for `SIZE` bytes of input, in any format
+#define COMPRESS_CAPACITY(SIZE) (2 * (SIZE) + 64)
+//! The size (in bytes) of the working memory of the encoders, for `SIZE` bytes of input
+#define COMPRESS_SCRATCH(SIZE)  (COMPRESS_HASH_SIZE * sizeof(t_s32) + ((SIZE) + 1) * 4 * sizeof(t_u32))
+
+
+
+/*
+** ************************************************************************** *|
+**                            RLE Encoding Functions                          *|
+** ************************************************************************** *|
+*/
+
+//! Compresses `job->src` in the RLE format of the `vram_unrle()` routine of neslib:
+//! the first byte is a tag value (which never occurs in the data), any other byte is a literal,
+//! `tag, N` repeats the previous byte N more times (N from 1 to 255), and `tag, 0` ends the stream.
+static
+t_size  Compress_RLE(s_compress_job* job)
+{
+	t_u8 const* src = job->src;
+	t_size n = job->size;
+	t_u8* dest = job->dest;
+	t_bool used[256] = { 0 };
+	for (t_size i = 0; i < n; ++i)
+		used[src[i]] = TRUE;
+	t_uint tag = 0;
+	while (tag < 256 && used[tag])
+		++tag;
+	if (tag == 256)
+		return (SIZE_ERROR);
+	// `repeat[i]` is the length of the repeat which starts at byte i (0 for a literal)
+	t_u32* run    = (t_u32*)job->scratch;
+	t_u32* cost   = run + (n + 1);
+	t_u8*  repeat = (t_u8*)(cost + (n + 1));
+	for (t_size i = n; i-- > 0;)
+	{   // `run[i]` is the amount of bytes from i which are equal to `src[i]`
+		run[i] = 1 + ((i + 1 < n && src[i + 1] == src[i]) ? run[i + 1] : 0);
+	}
+	if (job->fast)
+	{   // greedy: any run of 3 or more repeated bytes is worth a repeat code
+		for (t_size i = 0; i < n; ++i)
+		{
+			t_size length = (i > 0 && src[i] == src[i - 1]) ? run[i] : 0;
+			repeat[i] = (t_u8)((length >= 3) ? (length > 255 ? 255 : length) : 0);
+			if (repeat[i])
+				i += repeat[i] - 1;
+		}
+	}
+	else
+	{   // optimal: `cost[i]` is the smallest size of the encoding of all bytes from i
+		cost[n] = 0;
+		for (t_size i = n; i-- > 0;)
+		{
+			cost[i] = 1 + cost[i + 1];
+			repeat[i] = 0;
+			t_size length = (i > 0 && src[i] == src[i - 1]) ? run[i] : 0;
+			for (t_size k = 1; k <= length && k <= 255; ++k)
+			{
+				if (2 + cost[i + k] < cost[i])
+				{
+					cost[i] = 2 + cost[i + k];
+					repeat[i] = (t_u8)k;
+				}
+			}
+		}
+	}
+	t_size length = 0;
+	dest[length++] = (t_u8)tag;
+	for (t_size i = 0; i < n;)
+	{
+		if (repeat[i])
+		{
+			dest[length++] = (t_u8)tag;
+			dest[length++] = repeat[i];
+			i += repeat[i];
+		}
+		else dest[length++] = src[i++];
+	}
+	dest[length++] = (t_u8)tag;
+	dest[length++] = 0;
+	return (length);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                            LZ4 Encoding Functions                          *|
+** ************************************************************************** *|
+*/
+
+//! The shortest match which the LZ4 format can encode
+#define LZ4_MINMATCH    (4)
+//! The amount of bytes at the end of a block which must be literals
+#define LZ4_LASTLITERALS (5)
+//! The last match must start at least this many bytes before the end of the block
+#define LZ4_MFLIMIT     (12)
+//! The largest match offset which the LZ4 format can encode
+#define LZ4_WINDOW      (65535)
+
+//! Returns the hash table slot of the 4 bytes at `src`
+static inline
+t_u32   Compress_LZ4_Hash(t_u8 const* src)
+{
+	t_u32 value = (t_u32)src[0] | ((t_u32)src[1] << 8) | ((t_u32)src[2] << 16) | ((t_u32)src[3] << 24);
+	return ((value * 2654435761u) >> (32 - COMPRESS_HASH_BITS));
+}
+
+//! Returns the amount of extra length bytes needed to encode the given length nibble overflow
+static inline
+t_u32   Compress_LZ4_ExtraBytes(t_size length)
+{
+	return ((length < 15) ? 0 : (t_u32)((length - 15) / 255 + 1));
+}
+
+//! Writes the extra length bytes for a length of 15 or more
+static inline
+t_size  Compress_LZ4_WriteLength(t_u8* dest, t_size length)
+{
+	t_size result = 0;
+	for (length -= 15; length >= 255; length -= 255)
+		dest[result++] = 255;
+	dest[result++] = (t_u8)length;
+	return (result);
+}
+
+//! Finds the longest match for the bytes at `i`, through the hash chains of the previous positions (at most `depth` candidates)
+static inline
+t_size  Compress_LZ4_Match(t_u8 const* src, t_size i, t_size limit, t_s32 const* chain, t_s32 candidate, t_uint depth, t_u32* offset)
+{
+	t_size best = 0;
+	for (; candidate >= 0 && i - (t_size)candidate <= LZ4_WINDOW && depth > 0; candidate = chain[candidate], --depth)
+	{
+		t_u8 const* a = src + candidate;
+		t_u8 const* b = src + i;
+		if (a[best] != b[best])
+			continue;
+		t_size length = 0;
+		while (length < limit && a[length] == b[length])
+			++length;
+		if (length > best)
+		{
+			best = length;
+			*offset = (t_u32)(i - (t_size)candidate);
+			if (best == limit)
+				break;
+		}
+	}
+	return (best);
+}
+
+//! Compresses `job->src` as one raw LZ4 block (without any frame header), readable by any LZ4 block decoder.
+//! The optimal mode does a price-based parse over every match length, the fast mode takes the longest match greedily.
+static
+t_size  Compress_LZ4(s_compress_job* job)
+{
+	t_u8 const* src = job->src;
+	t_size n = job->size;
+	t_u8* dest = job->dest;
+	t_s32* head  = (t_s32*)job->scratch;
+	t_s32* chain = head + COMPRESS_HASH_SIZE;
+	t_u32* match_length = (t_u32*)(chain + (n + 1));
+	t_u32* match_offset = match_length + (n + 1);
+	t_u32* price        = match_offset + (n + 1);
+	for (t_size i = 0; i < COMPRESS_HASH_SIZE; ++i)
+		head[i] = -1;
+	Memory_Clear(match_length, (n + 1) * sizeof(t_u32));
+	t_uint depth = (job->fast ? COMPRESS_DEPTH_FAST : COMPRESS_DEPTH);
+	// matches may only start up to `LZ4_MFLIMIT` bytes before the end, and must not cover the last literals
+	t_size match_end = (n > LZ4_MFLIMIT) ? n - LZ4_MFLIMIT + 1 : 0;
+	if (job->fast)
+	{   // greedy: `match_length[i]` is the length of the match which starts at byte i
+		for (t_size i = 0; i < n; ++i)
+		{
+			t_u32 offset = 0;
+			t_size length = 0;
+			if (i < match_end)
+			{
+				t_u32 hash = Compress_LZ4_Hash(src + i);
+				length = Compress_LZ4_Match(src, i, n - LZ4_LASTLITERALS - i, chain, head[hash], depth, &offset);
+				chain[i] = head[hash];
+				head[hash] = (t_s32)i;
+			}
+			if (length < LZ4_MINMATCH)
+				continue;
+			match_length[i] = (t_u32)length;
+			match_offset[i] = offset;
+			for (t_size j = i + 1; j < i + length && j < match_end; ++j)
+			{   // the bytes covered by the match can still be matched against later on
+				t_u32 hash = Compress_LZ4_Hash(src + j);
+				chain[j] = head[hash];
+				head[hash] = (t_s32)j;
+			}
+			i += length - 1;
+		}
+	}
+	else
+	{   // optimal: `price[i]` is the smallest size of the encoding of the first i bytes, reached by `match_length[i]` (0 for a literal)
+		price[0] = 0;
+		for (t_size i = 1; i <= n; ++i)
+			price[i] = (t_u32)-1;
+		for (t_size i = 0; i < n; ++i)
+		{
+			if (price[i] + 1 < price[i + 1])
+			{
+				price[i + 1] = price[i] + 1;
+				match_length[i + 1] = 0;
+			}
+			if (i >= match_end)
+				continue;
+			t_u32 offset = 0;
+			t_u32 hash = Compress_LZ4_Hash(src + i);
+			t_size length = Compress_LZ4_Match(src, i, n - LZ4_LASTLITERALS - i, chain, head[hash], depth, &offset);
+			chain[i] = head[hash];
+			head[hash] = (t_s32)i;
+			// past a certain length, shorter matches are not worth trying: the longest one is taken
+			t_size shortest = (length > COMPRESS_SUFFICIENT) ? length : LZ4_MINMATCH;
+			for (t_size k = shortest; k <= length; ++k)
+			{   // a match costs its token, its offset, and its extra length bytes
+				t_u32 cost = price[i] + 3 + Compress_LZ4_ExtraBytes(k - LZ4_MINMATCH);
+				if (cost < price[i + k])
+				{
+					price[i + k] = cost;
+					match_length[i + k] = (t_u32)k;
+					match_offset[i + k] = offset;
+				}
+			}
+		}
+		// walk the cheapest path back from the end, to move each match to the byte at which it starts
+		t_u32* starts_length = (t_u32*)chain;
+		t_u32* starts_offset = price;
+		Memory_Clear(starts_length, (n + 1) * sizeof(t_u32));
+		for (t_size i = n; i > 0;)
+		{
+			t_u32 length = match_length[i];
+			if (length == 0)
+			{
+				--i;
+				continue;
+			}
+			i -= length;
+			starts_length[i] = length;
+			starts_offset[i] = match_offset[i + length];
+		}
+		match_length = starts_length;
+		match_offset = starts_offset;
+	}
+	t_size length = 0;
+	t_size anchor = 0;
+	for (t_size i = 0; i <= n; ++i)
+	{
+		t_size match = (i < n) ? match_length[i] : 0;
+		if (i < n && match == 0)
+			continue;
+		// a sequence: a token, the literals since the last match, and then the match (except for the last one)
+		t_size literals = i - anchor;
+		t_u8* token = &dest[length++];
+		*token = (t_u8)((literals < 15 ? literals : 15) << 4);
+		if (literals >= 15)
+			length += Compress_LZ4_WriteLength(dest + length, literals);
+		Memory_Copy(dest + length, src + anchor, literals);
+		length += literals;
+		if (i == n)
+			break;
+		dest[length++] = (t_u8)(match_offset[i] & 0xFF);
+		dest[length++] = (t_u8)(match_offset[i] >> 8);
+		match -= LZ4_MINMATCH;
+		*token |= (t_u8)(match < 15 ? match : 15);
+		if (match >= 15)
+			length += Compress_LZ4_WriteLength(dest + length, match);
+		i += match + LZ4_MINMATCH - 1;
+		anchor = i + 1;
+	}
+	return (length);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                         CHR Tile Encoding Functions                        *|
+** ************************************************************************** *|
+*/
+
+//! Stores the state of a MSB-first bitstream being written
+typedef struct s_compress_bits_
+{
+	t_u8*   dest;   //!< The start of the bitstream
+	t_size  length; //!< The amount of bytes started so far
+	t_uint  used;   //!< The amount of bits used in the last byte (from 0 to 8)
+}
+s_compress_bits;
+
+//! Appends the `amount` lowest bits of `value` to the bitstream, highest bit first
+static inline
+void    Compress_PutBits(s_compress_bits* bits, t_uint value, t_uint amount)
+{
+	while (amount-- > 0)
+	{
+		if (bits->used == 8 || bits->length == 0)
+		{
+			bits->dest[bits->length++] = 0;
+			bits->used = 0;
+		}
+		bits->dest[bits->length - 1] |= (t_u8)(((value >> amount) & 1) << (7 - bits->used));
+		bits->used += 1;
+	}
+}
+
+//! Fills the move-to-front color lists of the `tiles` format, for each previous color
+static
+void    Compress_Tiles_InitOrder(t_u8 order[1 << CHR_BPP_MAX][1 << CHR_BPP_MAX], t_uint colors)
+{
+	for (t_uint c = 0; c < colors; ++c)
+	{   // each list starts with its own color, as runs of one color are the most common
+		order[c][0] = (t_u8)c;
+		for (t_uint i = 1; i < colors; ++i)
+			order[c][i] = (t_u8)(i <= c ? i - 1 : i);
+	}
+}
+
+//! Compresses CHR data tile by tile, in a format inspired by tokumaru's CHR compression (it is not compatible with it,
+//! see `Decompress_Tiles()` for the reference decoder):
+//! - a 16-bit little-endian tile count, followed by a MSB-first bitstream
+//! - for each row of 8 pixels: `1` if it is the same as the row above (the last row of the previous tile, for the first row),
+//!   or `0` followed by each pixel, as its rank in a move-to-front list of the colors which followed the pixel to its left
+//!   (the first pixel of the row follows the first pixel of the row above): `0`, `10`, `110`, or `111` followed by
+//!   (rank - 3) as a `bpp`-bit number (only for targets with more than 4 colors)
+//! Every row is written in the one smallest possible way, so both the fast and optimal modes give the same output.
+static
+t_size  Compress_Tiles(s_compress_job* job)
+{
+	t_uint bpp = job->target->chr_bpp;
+	t_uint colors = (1u << bpp);
+	t_size tile_size = ((t_size)bpp * CHR_TILE * CHR_TILE) / 8;
+	t_size tiles = job->size / tile_size;
+	if (tiles > 0xFFFF)
+		return (SIZE_ERROR);
+	t_u8 order[1 << CHR_BPP_MAX][1 << CHR_BPP_MAX];
+	Compress_Tiles_InitOrder(order, colors);
+	job->dest[0] = (t_u8)(tiles & 0xFF);
+	job->dest[1] = (t_u8)(tiles >> 8);
+	s_compress_bits bits = { .dest = job->dest + 2, .length = 0, .used = 0 };
+	t_u8 above[CHR_TILE] = { 0 };
+	t_u8 pixels[CHR_TILE * CHR_TILE];
+	for (t_size t = 0; t < tiles; ++t)
+	{
+		job->target->decode_tile(pixels, CHR_TILE, job->src + t * tile_size, 0);
+		for (t_uint y = 0; y < CHR_TILE; ++y)
+		{
+			t_u8 const* row = pixels + y * CHR_TILE;
+			if (Memory_Compare(row, above, CHR_TILE) == 0)
+			{
+				Compress_PutBits(&bits, 1, 1);
+				continue;
+			}
+			Compress_PutBits(&bits, 0, 1);
+			t_u8 previous = above[0];
+			for (t_uint x = 0; x < CHR_TILE; ++x)
+			{
+				t_u8* list = order[previous];
+				t_uint rank = 0;
+				while (list[rank] != row[x])
+					++rank;
+				if (rank < 3)
+					Compress_PutBits(&bits, ((1u << rank) - 1) << 1, rank + 1);
+				else
+				{
+					Compress_PutBits(&bits, 0x7, 3);
+					if (colors > 4)
+						Compress_PutBits(&bits, rank - 3, bpp);
+				}
+				for (; rank > 0; --rank)
+					list[rank] = list[rank - 1];
+				list[0] = row[x];
+				previous = row[x];
+			}
+			Memory_Copy(above, row, CHR_TILE);
+		}
+	}
+	return (2 + bits.length);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                           Decompression Functions                          *|
+** ************************************************************************** *|
+*/
+
+//! Decompresses data in the RLE format written by `Compress_RLE()` (the same as the `vram_unrle()` routine of neslib)
+static
+t_size  Decompress_RLE(t_u8 const* src, t_size size, t_u8* dest, t_size capacity)
+{
+	if (size == 0)
+		return (SIZE_ERROR);
+	t_u8 tag = src[0];
+	t_u8 last = 0;
+	t_size length = 0;
+	for (t_size i = 1; i < size; ++i)
+	{
+		if (src[i] != tag)
+		{
+			if (length == capacity)
+				return (SIZE_ERROR);
+			dest[length++] = last = src[i];
+			continue;
+		}
+		if (++i == size)
+			return (SIZE_ERROR);
+		if (src[i] == 0)
+			return (length);
+		if (capacity - length < src[i])
+			return (SIZE_ERROR);
+		Memory_Set(dest + length, last, src[i]);
+		length += src[i];
+	}
+	// the stream must end with `tag, 0`
+	return (SIZE_ERROR);
+}
+
+//! Reads the extra length bytes which follow a length nibble of 15, adding them to `*length`
+static inline
+t_bool  Decompress_LZ4_ReadLength(t_u8 const* src, t_size size, t_size* i, t_size* length)
+{
+	t_u8 byte;
+	do
+	{
+		if (*i == size)
+			return (FALSE);
+		byte = src[(*i)++];
+		*length += byte;
+	}
+	while (byte == 255);
+	return (TRUE);
+}
+
+//! Decompresses one raw LZ4 block, as written by `Compress_LZ4()` (or by any other LZ4 block encoder)
+static
+t_size  Decompress_LZ4(t_u8 const* src, t_size size, t_u8* dest, t_size capacity)
+{
+	t_size length = 0;
+	t_size i = 0;
+	while (i < size)
+	{
+		t_u8 token = src[i++];
+		t_size literals = (token >> 4);
+		if (literals == 15 && !Decompress_LZ4_ReadLength(src, size, &i, &literals))
+			return (SIZE_ERROR);
+		if (literals > size - i || literals > capacity - length)
+			return (SIZE_ERROR);
+		Memory_Copy(dest + length, src + i, literals);
+		length += literals;
+		i += literals;
+		// the last sequence of the block has no match
+		if (i == size)
+			return (length);
+		if (size - i < 2)
+			return (SIZE_ERROR);
+		t_size offset = (t_size)src[i] | ((t_size)src[i + 1] << 8);
+		i += 2;
+		t_size match = (token & 0xF);
+		if (match == 15 && !Decompress_LZ4_ReadLength(src, size, &i, &match))
+			return (SIZE_ERROR);
+		match += LZ4_MINMATCH;
+		if (offset == 0 || offset > length || match > capacity - length)
+			return (SIZE_ERROR);
+		// the match may overlap the bytes it writes, so it is copied one byte at a time
+		for (t_size j = 0; j < match; ++j, ++length)
+			dest[length] = dest[length - offset];
+	}
+	return (SIZE_ERROR);
+}
+
+//! Stores the state of a MSB-first bitstream being read
+typedef struct s_decompress_bits_
+{
+	t_u8 const* src;    //!< The start of the bitstream
+	t_size      size;   //!< The size (in bytes) of the bitstream
+	t_size      offset; //!< The index of the next bit to read
+	t_bool      failed; //!< If TRUE, a read went past the end of the bitstream
+}
+s_decompress_bits;
+
+//! Returns the next `amount` bits of the bitstream, highest bit first (or 0, if the end of the bitstream was reached)
+static inline
+t_uint  Decompress_GetBits(s_decompress_bits* bits, t_uint amount)
+{
+	t_uint value = 0;
+	for (; amount > 0; --amount, ++bits->offset)
+	{
+		if (bits->offset / 8 >= bits->size)
+		{
+			bits->failed = TRUE;
+			return (0);
+		}
+		value = (value << 1) | ((bits->src[bits->offset / 8] >> (7 - bits->offset % 8)) & 1);
+	}
+	return (value);
+}
+
+//! Decompresses CHR data in the `tiles` format written by `Compress_Tiles()`, encoding each tile back into the bitplanes of the given `target`
+static
+t_size  Decompress_Tiles(s_target const* target, t_u8 const* src, t_size size, t_u8* dest, t_size capacity)
+{
+	t_uint bpp = target->chr_bpp;
+	t_uint colors = (1u << bpp);
+	t_size tile_size = ((t_size)bpp * CHR_TILE * CHR_TILE) / 8;
+	if (size < 2)
+		return (SIZE_ERROR);
+	t_size tiles = (t_size)src[0] | ((t_size)src[1] << 8);
+	if (tiles > capacity / tile_size)
+		return (SIZE_ERROR);
+	t_u8 order[1 << CHR_BPP_MAX][1 << CHR_BPP_MAX];
+	Compress_Tiles_InitOrder(order, colors);
+	s_decompress_bits bits = { .src = src + 2, .size = size - 2, .offset = 0, .failed = FALSE };
+	t_u8 above[CHR_TILE] = { 0 };
+	// the tile is encoded by the kernel of the target, which reads its rows one metatile width apart
+	t_u8 pixels[CHR_TILE * NAM_TILE_MAX];
+	t_uint pitch = target->tile;
+	for (t_size t = 0; t < tiles; ++t)
+	{
+		for (t_uint y = 0; y < CHR_TILE; ++y)
+		{
+			t_u8* row = pixels + y * pitch;
+			if (Decompress_GetBits(&bits, 1))
+			{
+				Memory_Copy(row, above, CHR_TILE);
+				continue;
+			}
+			t_u8 previous = above[0];
+			for (t_uint x = 0; x < CHR_TILE; ++x)
+			{
+				t_uint rank = 0;
+				while (rank < 3 && Decompress_GetBits(&bits, 1))
+					++rank;
+				if (rank == 3 && colors > 4)
+					rank += Decompress_GetBits(&bits, bpp);
+				if (rank >= colors)
+					return (SIZE_ERROR);
+				t_u8* list = order[previous];
+				t_u8 color = list[rank];
+				for (; rank > 0; --rank)
+					list[rank] = list[rank - 1];
+				list[0] = color;
+				row[x] = color;
+				previous = color;
+			}
+			Memory_Copy(above, row, CHR_TILE);
+		}
+		if (bits.failed)
+			return (SIZE_ERROR);
+		target->encode_tile(dest + t * tile_size, pixels);
+	}
+	return (tiles * tile_size);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                            Compression Functions                           *|
+** ************************************************************************** *|
+*/
+
+e_compress  Compress_Find(t_char const* name)
+{
+	for (t_uint i = 0; i < COMPRESS_AMOUNT; ++i)
+	{
+		if (String_Equals_IgnoreCase(name, compress_names[i]))
+			return ((e_compress)i);
+	}
+	return (COMPRESS_AMOUNT);
+}
+
+t_char const*   Compress_GetFile(e_compress format, t_bool chr)
+{
+	return ((chr ? compress_chr_files : compress_nam_files)[format]);
+}
+
+t_size  Compress_Decode(e_compress format, s_target const* target, t_u8 const* src, t_size size, t_u8* dest, t_size capacity)
+{
+	switch (format)
+	{
+		case COMPRESS_RLE:   return (Decompress_RLE(src, size, dest, capacity));
+		case COMPRESS_LZ4:   return (Decompress_LZ4(src, size, dest, capacity));
+		case COMPRESS_TILES: return (Decompress_Tiles(target, src, size, dest, capacity));
+		default:             return (SIZE_ERROR);
+	}
+}
+
+//! Runs the given compression job, and then decompresses its result to check that it round-trips
+static
+void*   Compress_Run(void* arg)
+{
+	s_compress_job* job = (s_compress_job*)arg;
+	switch (job->format)
+	{
+		case COMPRESS_RLE:   job->result = Compress_RLE(job);   break;
+		case COMPRESS_LZ4:   job->result = Compress_LZ4(job);   break;
+		case COMPRESS_TILES: job->result = Compress_Tiles(job); break;
+		default:             job->result = SIZE_ERROR;          break;
+	}
+	if (job->result == SIZE_ERROR)
+		return (NULL);
+	t_size size = Compress_Decode(job->format, job->target, job->dest, job->result, job->decoded, job->size);
+	job->verified = (size == job->size && Memory_Equals(job->decoded, job->src, job->size));
+	return (NULL);
+}
+
+
+
+int     Compress_Outputs(t_u8 const* nam, t_u8 const* chr)
+{
+	s_compress_job jobs[2] =
+	{
+		{ .format = program.compress_nam, .src = nam, .size = NAM_SIZE },
+		{ .format = program.compress_chr, .src = chr, .size = CHR_SIZE },
+	};
+	// all the memory is allocated beforehand, since the arena must only be used from this thread
+	for (t_uint i = 0; i < 2; ++i)
+	{
+		if (jobs[i].format == COMPRESS_NONE)
+			continue;
+		jobs[i].fast = program.compress_fast;
+		jobs[i].target = program.target;
+		jobs[i].dest    = (t_u8*)Arena_Allocate(&program.arena, COMPRESS_CAPACITY(jobs[i].size));
+		jobs[i].scratch = (t_u8*)Arena_Allocate(&program.arena, COMPRESS_SCRATCH(jobs[i].size));
+		jobs[i].decoded = (t_u8*)Arena_Allocate(&program.arena, jobs[i].size);
+		PROFILE_COUNT(PROFILE_ALLOCATIONS, 3);
+		if (jobs[i].dest == NULL || jobs[i].scratch == NULL || jobs[i].decoded == NULL)
+		{
+			Log_Error(&program.logger, 0, "Could not allocate memory to compress the output %s file", (i ? "CHR" : "NAM"));
+			return (ERROR);
+		}
+	}
+	t_bool started = FALSE;
+#if defined(__unix__) || defined(__APPLE__)
+	// the NAM and CHR files are compressed at the same time: the CHR one on another thread
+	pthread_t thread;
+	if (jobs[0].format && jobs[1].format)
+		started = (pthread_create(&thread, NULL, Compress_Run, &jobs[1]) == 0);
+#endif
+	for (t_uint i = 0; i < 2; ++i)
+	{
+		if (jobs[i].format && !(i == 1 && started))
+			Compress_Run(&jobs[i]);
+	}
+#if defined(__unix__) || defined(__APPLE__)
+	if (started)
+		pthread_join(thread, NULL);
+#endif
+	for (t_uint i = 0; i < 2; ++i)
+	{
+		if (jobs[i].format == COMPRESS_NONE)
+			continue;
+		t_char const* name = (i ? "CHR" : "NAM");
+		if (jobs[i].result == SIZE_ERROR)
+		{
+			Log_Error(&program.logger, 0, "Could not compress the output %s file as `%s`%s", name,
+				compress_names[jobs[i].format],
+				(jobs[i].format == COMPRESS_RLE ? ": every byte value occurs in it, so none is left for the RLE tag (try `lz4`)" : ""));
+			return (ERROR);
+		}
+		if (!jobs[i].verified)
+		{   // this can only be a bug in one of the codecs: a broken file is never written
+			Log_Error(&program.logger, 0, "The `%s` compression of the output %s file does not decompress back to it",
+				compress_names[jobs[i].format], name);
+			return (ERROR);
+		}
+		PROFILE_COUNT(PROFILE_PIXELS, jobs[i].size);
+		LOG_SUCCESS("Compressed the %s file as `%s`: %zu -> %zu bytes (%.1f%%)", name,
+			compress_names[jobs[i].format],
+			jobs[i].size, jobs[i].result,
+			jobs[i].result / (jobs[i].size / 100.));
+		if (Output_Add(Compress_GetFile(jobs[i].format, i), jobs[i].dest, jobs[i].result))
+			return (ERROR);
+	}
+	return (OK);
+}
@@ -0,0 +1,383 @@
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdatomic.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#define DITHER_THREADS 1
+#else
+#define DITHER_THREADS 0
+#endif
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/logger.h>
+#include <libccc/image/color.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+//! Stores one neighbor to which some of the quantization error of a pixel is diffused
+typedef struct s_dither_weight_
+{
+	t_sint  dx;         //!< The horizontal offset of the neighbor pixel
+	t_sint  dy;         //!< The vertical offset of the neighbor pixel (never negative)
+	t_sint  weight;     //!< The share of the error which the neighbor receives (out of `1 << shift`)
+}
+s_dither_weight;
+
+//! The Floyd-Steinberg error diffusion kernel (in sixteenths)
+static s_dither_weight const dither_floyd[] =
+{
+	{ +1, 0, 7 },
+	{ -1, 1, 3 }, { 0, 1, 5 }, { +1, 1, 1 },
+};
+//! The Atkinson error diffusion kernel (in eighths: only 3/4 of the error is diffused, which keeps more contrast)
+static s_dither_weight const dither_atkinson[] =
+{
+	{ +1, 0, 1 }, { +2, 0, 1 },
+	{ -1, 1, 1 }, { 0, 1, 1 }, { +1, 1, 1 },
+	{ 0, 2, 1 },
+};
+
+//! The 8x8 Bayer threshold matrix, for ordered dithering
+static t_u8 const dither_bayer[8][8] =
+{
+	{  0, 32,  8, 40,  2, 34, 10, 42 },
+	{ 48, 16, 56, 24, 50, 18, 58, 26 },
+	{ 12, 44,  4, 36, 14, 46,  6, 38 },
+	{ 60, 28, 52, 20, 62, 30, 54, 22 },
+	{  3, 35, 11, 43,  1, 33,  9, 41 },
+	{ 51, 19, 59, 27, 49, 17, 57, 25 },
+	{ 15, 47,  7, 39, 13, 45,  5, 37 },
+	{ 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+//! The amount of padding pixels around the error buffer (so that diffusing the error never needs a bounds check)
+#define DITHER_PAD  (2)
+
+//! Stores everything needed to dither the whole bitmap (worker threads cannot read the caller's `program`, see `program_context`)
+typedef struct s_dither_job_
+{
+	e_dither            mode;                           //!< The dithering algorithm to use
+	t_uint              tile;                           //!< The size (in pixels) of one metatile
+	t_uint              w_tiles;                        //!< The amount of metatiles in one row
+	t_uint              h_tiles;                        //!< The amount of rows of metatiles
+	t_uint              pal_colors;                     //!< The amount of colors in each output palette
+	t_u8 const*         source;                         //!< The original pixels, in tile-major order (see `program.tiles_source`)
+	t_argb32 const*     source_palette;                 //!< The original colors of the bitmap (see `program.source_palette`)
+	t_u8 const*         tiles_palette;                  //!< The output palette of each metatile (or `DITHER_SKIP` to leave the tile as it is)
+	t_argb32 const    (*colors)[PAL_SUB_COLORS_MAX];    //!< The colors of each output palette
+	t_u8*               dest;                           //!< The output pixels, in tile-major order (see `program.tiles_pixels`)
+	t_s16             (*error)[3];                      //!< The accumulated error of each pixel, in row-major order (with `DITHER_PAD` pixels of padding)
+	t_uint              error_pitch;                    //!< The amount of items in one row of `error`
+	t_s16               threshold[NAM_TILE_PIXELS_MAX]; //!< The ordered dithering offset of each pixel of a metatile (metatiles are aligned with the Bayer matrix)
+	atomic_uint         next_band;                      //!< The next row of metatiles to be handed out to a thread
+	atomic_uint         progress[NAM_H_MAX / CHR_TILE]; //!< The amount of metatiles which are done, in each row of metatiles
+}
+s_dither_job;
+
+
+
+/*
+** ************************************************************************** *|
+**                             Dithering Kernels                              *|
+** ************************************************************************** *|
+*/
+
+//! Returns the given channel value, clamped to the 0-255 range
+static inline
+t_u8    Dither_Clamp(t_sint value)
+{
+	return ((t_u8)(value < 0 ? 0 : (value > 255 ? 255 : value)));
+}
+
+//! Dithers one metatile with ordered dithering: the threshold map is added to each pixel, before finding its nearest color
+static
+void    Dither_Tile_Ordered(s_dither_job* job, t_uint index, t_argb32 const* colors, t_u8 palette)
+{
+	t_uint pixels = job->tile * job->tile;
+	t_u8 const* source = job->source + index * pixels;
+	t_u8* dest = job->dest + index * pixels;
+	for (t_uint i = 0; i < pixels; ++i)
+	{
+		t_argb32 color = job->source_palette[source[i]];
+		t_sint offset = job->threshold[i];
+		color = Color_ARGB32_Set(0,
+			Dither_Clamp(Color_ARGB32_Get_R(color) + offset),
+			Dither_Clamp(Color_ARGB32_Get_G(color) + offset),
+			Dither_Clamp(Color_ARGB32_Get_B(color) + offset));
+		t_argb32 const* nearest = Color_ARGB32_GetNearest(color, colors, job->pal_colors);
+		dest[i] = (t_u8)(palette * job->pal_colors + (nearest ? nearest - colors : 0));
+	}
+}
+
+//! Dithers one metatile with error diffusion: the error of each pixel is spread to its neighbors which are not yet done
+static
+void    Dither_Tile_Diffusion(s_dither_job* job, t_uint index, t_argb32 const* colors, t_u8 palette)
+{
+	s_dither_weight const* kernel = (job->mode == DITHER_ATKINSON ? dither_atkinson : dither_floyd);
+	t_uint kernel_length = (job->mode == DITHER_ATKINSON ?
+		sizeof(dither_atkinson) / sizeof(s_dither_weight) :
+		sizeof(dither_floyd)    / sizeof(s_dither_weight));
+	t_uint shift = (job->mode == DITHER_ATKINSON ? 3 : 4);
+	t_uint pixels = job->tile * job->tile;
+	t_u8 const* source = job->source + index * pixels;
+	t_u8* dest = job->dest + index * pixels;
+	t_uint x0 = (index % job->w_tiles) * job->tile + DITHER_PAD;
+	t_uint y0 = (index / job->w_tiles) * job->tile;
+	for (t_uint y = 0; y < job->tile; ++y)
+	for (t_uint x = 0; x < job->tile; ++x)
+	{
+		t_s16* error = job->error[(y0 + y) * job->error_pitch + (x0 + x)];
+		t_argb32 color = job->source_palette[source[y * job->tile + x]];
+		t_sint rgb[3] =
+		{
+			Dither_Clamp(Color_ARGB32_Get_R(color) + error[0]),
+			Dither_Clamp(Color_ARGB32_Get_G(color) + error[1]),
+			Dither_Clamp(Color_ARGB32_Get_B(color) + error[2]),
+		};
+		t_argb32 const* nearest = Color_ARGB32_GetNearest(
+			Color_ARGB32_Set(0, rgb[0], rgb[1], rgb[2]), colors, job->pal_colors);
+		if (nearest == NULL)
+			continue;
+		dest[y * job->tile + x] = (t_u8)(palette * job->pal_colors + (nearest - colors));
+		rgb[0] -= Color_ARGB32_Get_R(*nearest);
+		rgb[1] -= Color_ARGB32_Get_G(*nearest);
+		rgb[2] -= Color_ARGB32_Get_B(*nearest);
+		// the error which flows back into the metatile to the left is lost, since that metatile is already done
+		for (t_uint k = 0; k < kernel_length; ++k)
+		{
+			t_s16* neighbor = job->error[(y0 + y + kernel[k].dy) * job->error_pitch + (x0 + x + kernel[k].dx)];
+			neighbor[0] += (t_s16)((rgb[0] * kernel[k].weight) >> shift);
+			neighbor[1] += (t_s16)((rgb[1] * kernel[k].weight) >> shift);
+			neighbor[2] += (t_s16)((rgb[2] * kernel[k].weight) >> shift);
+		}
+	}
+}
+
+//! Dithers one row of metatiles, from left to right: with error diffusion, each metatile waits until the ones above it (and above-right) are done
+static
+void    Dither_Band(s_dither_job* job, t_uint band)
+{
+	for (t_uint tx = 0; tx < job->w_tiles; ++tx)
+	{
+		if (job->mode != DITHER_BAYER && band > 0)
+		{   // the row above must be 3 metatiles ahead, so that both rows never diffuse error into the same pixels at once
+			t_uint needed = (tx + 3 < job->w_tiles ? tx + 3 : job->w_tiles);
+			while (atomic_load_explicit(&job->progress[band - 1], memory_order_acquire) < needed)
+			{
+#if DITHER_THREADS
+				sched_yield();
+#endif
+			}
+		}
+		t_uint index = band * job->w_tiles + tx;
+		t_u8 palette = job->tiles_palette[index];
+		if (palette != DITHER_SKIP)
+		{
+			if (job->mode == DITHER_BAYER)
+				Dither_Tile_Ordered(job, index, job->colors[palette], palette);
+			else
+				Dither_Tile_Diffusion(job, index, job->colors[palette], palette);
+		}
+		atomic_store_explicit(&job->progress[band], tx + 1, memory_order_release);
+	}
+}
+
+//! Dithers rows of metatiles until there are none left (rows are handed out in order, so a row's dependencies are always being worked on)
+static
+void    Dither_Work(s_dither_job* job)
+{
+	t_uint band;
+	while ((band = atomic_fetch_add(&job->next_band, 1)) < job->h_tiles)
+	{
+		Dither_Band(job, band);
+	}
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                            Dithering Thread Pool                           *|
+** ************************************************************************** *|
+*/
+
+#if DITHER_THREADS
+
+//! Stores the state of the dithering threads, which are started once, and then reused for every conversion
+static struct s_dither_pool_
+{
+	pthread_mutex_t lock;           //!< Protects all the fields below
+	pthread_cond_t  start;          //!< Signaled whenever a new job is given to the threads
+	pthread_cond_t  done;           //!< Signaled when the last thread is done with the current job
+	t_uint          threads;        //!< The amount of threads which were started
+	t_uint          running;        //!< The amount of threads which are still working on the current job
+	t_uint          generation;     //!< Incremented for each new job
+	t_bool          busy;           //!< If TRUE, a job is running (another caller, like a `--server` worker, dithers on its own)
+	s_dither_job*   job;            //!< The current job
+}
+dither_pool =
+{
+	.lock   = PTHREAD_MUTEX_INITIALIZER,
+	.start  = PTHREAD_COND_INITIALIZER,
+	.done   = PTHREAD_COND_INITIALIZER,
+};
+
+static
+void*   Dither_Pool_Worker(void* arg)
+{
+	t_uint seen = 0;
+	(void)arg;
+	pthread_mutex_lock(&dither_pool.lock);
+	while (TRUE)
+	{
+		while (dither_pool.generation == seen)
+			pthread_cond_wait(&dither_pool.start, &dither_pool.lock);
+		seen = dither_pool.generation;
+		s_dither_job* job = dither_pool.job;
+		pthread_mutex_unlock(&dither_pool.lock);
+		Dither_Work(job);
+		pthread_mutex_lock(&dither_pool.lock);
+		if (--dither_pool.running == 0)
+			pthread_cond_signal(&dither_pool.done);
+	}
+	return (NULL);
+}
+
+//! Starts the threads of the pool, the first time that it is used (the calling thread always works too)
+static
+void    Dither_Pool_Init(void)
+{
+	pthread_attr_t attr;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	t_uint threads = (cpus <= 1 ? 0 : (t_uint)cpus - 1);
+	if (threads > DITHER_THREADS_MAX)
+		threads = DITHER_THREADS_MAX;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (; dither_pool.threads < threads; ++dither_pool.threads)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread, &attr, Dither_Pool_Worker, NULL))
+			break;
+	}
+	pthread_attr_destroy(&attr);
+	LOG_VERBOSE("Started %u dithering threads", dither_pool.threads);
+}
+
+#endif
+
+//! Runs the given `job` on all threads of the pool (or only on the calling thread, if the pool is already busy)
+static
+void    Dither_Run(s_dither_job* job)
+{
+#if DITHER_THREADS
+	pthread_mutex_lock(&dither_pool.lock);
+	if (dither_pool.busy)
+	{
+		pthread_mutex_unlock(&dither_pool.lock);
+		Dither_Work(job);
+		return;
+	}
+	if (dither_pool.generation == 0 && dither_pool.threads == 0)
+		Dither_Pool_Init();
+	dither_pool.busy = TRUE;
+	dither_pool.job = job;
+	dither_pool.running = dither_pool.threads;
+	dither_pool.generation += 1;
+	pthread_cond_broadcast(&dither_pool.start);
+	pthread_mutex_unlock(&dither_pool.lock);
+	Dither_Work(job);
+	pthread_mutex_lock(&dither_pool.lock);
+	while (dither_pool.running > 0)
+		pthread_cond_wait(&dither_pool.done, &dither_pool.lock);
+	dither_pool.busy = FALSE;
+	pthread_mutex_unlock(&dither_pool.lock);
+#else
+	Dither_Work(job);
+#endif
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                             Dithering Functions                            *|
+** ************************************************************************** *|
+*/
+
+e_dither    Dither_Find(t_char const* name)
+{
+	static t_char const* const names[DITHER_AMOUNT] =
+	{
+		[DITHER_NONE]     = "none",
+		[DITHER_BAYER]    = "bayer",
+		[DITHER_FLOYD]    = "floyd",
+		[DITHER_ATKINSON] = "atkinson",
+	};
+	for (t_uint i = 0; i < DITHER_AMOUNT; ++i)
+	{
+		if (String_Equals_IgnoreCase(name, names[i]))
+			return ((e_dither)i);
+	}
+	return (DITHER_AMOUNT);
+}
+
+
+
+int     Dither_SaveSource(void)
+{
+	// the original colors are lost once the reference palette is applied, but dithering needs them
+	for (t_uint i = 0; i < BMP_MAXCOLORS; ++i)
+	{
+		program.source_palette[i] = program.bitmap_colors[i].color;
+	}
+	Memory_Copy(program.tiles_source, program.tiles_pixels, NAM_TILES * NAM_TILE_PIXELS);
+	return (OK);
+}
+
+
+
+int     Dither_Apply(t_u8 const* tiles_palette, t_argb32 const (*colors)[PAL_SUB_COLORS_MAX])
+{
+	s_dither_job* job = (s_dither_job*)Arena_Allocate(&program.arena, sizeof(s_dither_job));
+	t_uint error_pitch = NAM_W + 2 * DITHER_PAD;
+	t_s16 (*error)[3] = (t_s16(*)[3])Arena_Allocate(&program.arena, (NAM_H + DITHER_PAD) * error_pitch * sizeof(*error));
+	if (job == NULL || error == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not allocate memory for dithering");
+		return (ERROR);
+	}
+	LOG_MESSAGE("Dithering the bitmap with the final palette colors...");
+	Memory_Clear(job, sizeof(s_dither_job));
+	Memory_Clear(error, (NAM_H + DITHER_PAD) * error_pitch * sizeof(*error));
+	job->mode           = program.dither;
+	job->tile           = NAM_TILE;
+	job->w_tiles        = NAM_W_TILES;
+	job->h_tiles        = NAM_H_TILES;
+	job->pal_colors     = PAL_SUB_COLORS;
+	job->source         = program.tiles_source;
+	job->source_palette = program.source_palette;
+	job->tiles_palette  = tiles_palette;
+	job->colors         = colors;
+	job->dest           = program.tiles_pixels;
+	job->error          = error;
+	job->error_pitch    = error_pitch;
+	for (t_uint y = 0; y < NAM_TILE; ++y)
+	for (t_uint x = 0; x < NAM_TILE; ++x)
+	{   // each offset is centered on zero, and spans `DITHER_SPREAD`
+		t_sint value = dither_bayer[y % 8][x % 8];
+		job->threshold[y * NAM_TILE + x] = (t_s16)(((2 * value + 1) * DITHER_SPREAD) / 128 - DITHER_SPREAD / 2);
+	}
+	Dither_Run(job);
+	PROFILE_COUNT(PROFILE_PIXELS, NAM_TILES * NAM_TILE_PIXELS);
+	PROFILE_COUNT(PROFILE_NEAREST, NAM_TILES * NAM_TILE_PIXELS);
+	return (OK);
+}
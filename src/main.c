@@ -3,6 +3,7 @@
 #include <libccc/memory.h>
 #include <libccc/string.h>
 #include <libccc/sys/logger.h>
+#include <libccc/image/color.h>
 #include <libccc/math.h>
 #include <libccc/math/sort.h>
 
@@ -12,7 +13,8 @@
 
 
 
-s_program program = { 0 };
+s_program                   program_main = { 0 };
+_Thread_local s_program*    program_context = &program_main;
 
 //! A special return value to signal when a help argument has been provided by the user
 #define MATCHED_HELP    ((int)-1)
@@ -27,6 +29,15 @@ t_bool HandleArg_Verbose(t_char const* arg)
 	return (OK);
 }
 
+static
+t_bool HandleArg_Quiet(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	program.logger.silence_logs = TRUE;
+	program.logger.verbose = FALSE;
+	return (OK);
+}
+
 static
 t_bool HandleArg_BitmapWidth(t_char const* arg)
 {
@@ -48,59 +59,376 @@ t_bool HandleArg_BitmapHeight(t_char const* arg)
 }
 
 static
-t_bool HandleArg_Palette(t_char const* arg)
+t_bool HandleArg_Target(t_char const* arg)
 {
 	if (arg == NULL) return (ERROR);
-	t_fd fd = IO_Open(arg, OPEN_READONLY, 0);
-	if (fd < 0)
+	program.target = Target_Find(arg);
+	if (program.target == NULL)
 	{
-		Log_Error_STD(&program.logger, 0, "Could not open user-specified palette file: %s", arg);
+		Log_Error(&program.logger, 0, "Unknown hardware target: \"%s\"", arg);
+		for (t_uint i = 0; i < TARGETS_AMOUNT; ++i)
+		{
+			Log_Error(&program.logger, 0, "\t%s:\t%s", targets[i].name, targets[i].description);
+		}
 		return (ERROR);
 	}
-	t_u8* file = NULL;
-	t_sintmax size = IO_Read_File(fd, (void**)&file, 0);
-	if (size < 0)
+	return (OK);
+}
+
+static
+t_bool HandleArg_RefPal(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	// the file is only loaded once all arguments are parsed, since its amount of colors is checked against the `--target`
+	if (program.files_refpal_amount == REFPAL_FILES_MAX)
 	{
-		Log_Error_STD(&program.logger, 0, "Could not read user-specified palette file: %s", arg);
+		Log_Error(&program.logger, 0, "Too many reference palette files given (maximum is %i)", REFPAL_FILES_MAX);
 		return (ERROR);
 	}
-	if ((t_size)size != PAL_SIZE)
+	program.files_refpal[program.files_refpal_amount++] = arg;
+	program.file_refpal = program.files_refpal[0];
+	return (OK);
+}
+
+static
+t_bool HandleArg_Emphasis(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	if (String_Equals_IgnoreCase(arg, "auto"))
+	{
+		program.emphasis = REFPAL_EMPHASIS_AUTO;
+		return (OK);
+	}
+	if (arg[0] < '0' || arg[0] >= '0' + REFPAL_EMPHASIS_AMOUNT || arg[1] != '\0')
 	{
-		Log_Warning(&program.logger, "Palette file specified has incorrect size: %s (was %zu bytes, but should be %zu bytes)",
-			arg, (t_size)size, PAL_SIZE);
+		Log_Error(&program.logger, 0, "Color emphasis must be `auto`, or a number from 0 to %i", REFPAL_EMPHASIS_AMOUNT - 1);
 		return (ERROR);
 	}
-	t_size index = 0;
-	for (int i = 0; i < PAL_SUB_AMOUNT; ++i)
+	program.emphasis = arg[0] - '0';
+	return (OK);
+}
+
+static
+t_bool HandleArg_Palette(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	// the file is only loaded once all arguments are parsed, since its format depends on the `--target`
+	program.file_palette = arg;
+	return (OK);
+}
+
+static
+t_bool HandleArg_ColorKey(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	// the reference palette is only loaded once all arguments are parsed, so the index is set by `RefPal_Select()`
+	program.colorkey = (s_color_use)
 	{
-		program.output_palettes[i].length = PAL_SUB_COLORS;
-		for (int j = 0; j < PAL_SUB_COLORS; ++j)
+		.color = U32_FromString_Hex(arg),
+		.index = 0,
+		.occurences = TRUE,
+	};
+	return (OK);
+}
+
+static
+t_bool HandleArg_Crop(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	int values[4] = { 0 };
+	for (int i = 0; i < 4; ++i)
+	{
+		if (arg[0] < '0' || arg[0] > '9')
+			return (ERROR);
+		while (arg[0] >= '0' && arg[0] <= '9')
 		{
-			program.output_palettes[i].colors[j] = file[index++];
+			values[i] = values[i] * 10 + (arg[0] - '0');
+			++arg;
 		}
+		if (arg[0] != (i == 3 ? '\0' : ','))
+			return (ERROR);
+		++arg;
+	}
+	if (values[2] == 0 || values[3] == 0)
+	{
+		Log_Error(&program.logger, 0, "Crop region must have a non-zero width and height");
+		return (ERROR);
 	}
-	Memory_Delete((void**)&file);
+	program.crop = (SDL_Rect){ .x=values[0], .y=values[1], .w=values[2], .h=values[3] };
 	return (OK);
 }
 
 static
-t_bool HandleArg_ColorKey(t_char const* arg)
+t_bool HandleArg_Align(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	if (String_Equals_IgnoreCase(arg, "auto"))
+	{
+		program.align_auto = TRUE;
+		return (OK);
+	}
+	int values[2] = { 0 };
+	for (int i = 0; i < 2; ++i)
+	{
+		if (arg[0] < '0' || arg[0] > '9')
+			return (ERROR);
+		while (arg[0] >= '0' && arg[0] <= '9')
+		{
+			values[i] = values[i] * 10 + (arg[0] - '0');
+			++arg;
+		}
+		if (arg[0] != (i == 1 ? '\0' : ','))
+			return (ERROR);
+		++arg;
+	}
+	program.align = (SDL_Point){ .x=values[0], .y=values[1] };
+	return (OK);
+}
+
+static
+t_bool HandleArg_Scale(t_char const* arg)
 {
 	if (arg == NULL) return (ERROR);
-	t_argb32 color = U32_FromString_Hex(arg);
-	t_argb32 const* match = Color_ARGB32_GetNearest(color, program.ref_palette, REFPAL_COLORS);
-	if (match == NULL)
+	program.scale = Scale_Find(arg);
+	if (program.scale == SCALE_AMOUNT)
 	{
-		Log_Error(&program.logger, 0, "Error while processing color key argument given");
+		program.scale = SCALE_NONE;
+		Log_Error(&program.logger, 0, "Unknown scaling filter: \"%s\" (expected `none`, `nearest`, `box` or `area`)", arg);
 		return (ERROR);
 	}
-	t_u8 index = (match - program.ref_palette);
-	program.colorkey = (s_color_use)
+	return (OK);
+}
+
+static
+t_bool HandleArg_Dither(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	program.dither = Dither_Find(arg);
+	if (program.dither == DITHER_AMOUNT)
 	{
-		.color = match[0],
-		.index = index,
-		.occurences = TRUE,
-	};
+		program.dither = DITHER_NONE;
+		Log_Error(&program.logger, 0, "Unknown dithering algorithm: \"%s\" (expected `none`, `bayer`, `floyd` or `atkinson`)", arg);
+		return (ERROR);
+	}
+	return (OK);
+}
+
+static
+t_bool HandleArg_Progressive(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	if (arg[0] < '0' || arg[0] > '9')
+	{
+		Log_Error(&program.logger, 0, "The `--progressive` option expects a time budget in milliseconds (or 0 for no limit)");
+		return (ERROR);
+	}
+	program.progressive = TRUE;
+	program.progressive_budget = U32_FromString(arg);
+	return (OK);
+}
+
+static
+t_bool HandleArg_Portfolio(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	program.portfolio = TRUE;
+	return (OK);
+}
+
+static
+t_bool HandleArg_Heatmap(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	program.heatmap = TRUE;
+	return (OK);
+}
+
+static
+t_bool HandleArg_Report(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	if (!String_Equals_IgnoreCase(arg, "json"))
+	{
+		Log_Error(&program.logger, 0, "Unknown report format: \"%s\" (expected `json`)", arg);
+		return (ERROR);
+	}
+	program.report.format = REPORT_JSON;
+	return (OK);
+}
+
+static
+t_bool HandleArg_Compress(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	// either one format for both files, or `NAM_FORMAT,CHR_FORMAT`
+	t_char const* separator = String_Find_Char(arg, ',');
+	t_char const* chr = (separator ? separator + 1 : arg);
+	t_char nam[16] = { 0 };
+	t_size length = (separator ? (t_size)(separator - arg) : String_Length(arg));
+	if (length < sizeof(nam))
+		Memory_Copy(nam, arg, length);
+	program.compress_nam = Compress_Find(nam);
+	program.compress_chr = Compress_Find(chr);
+	if (program.compress_nam == COMPRESS_AMOUNT || program.compress_chr == COMPRESS_AMOUNT)
+	{
+		program.compress_nam = COMPRESS_NONE;
+		program.compress_chr = COMPRESS_NONE;
+		Log_Error(&program.logger, 0, "Unknown compression format: \"%s\" (expected `none`, `rle`, `lz4` or `tiles`, or two of them as `NAM,CHR`)", arg);
+		return (ERROR);
+	}
+	if (program.compress_nam == COMPRESS_TILES)
+	{
+		if (separator)
+		{
+			program.compress_nam = COMPRESS_NONE;
+			program.compress_chr = COMPRESS_NONE;
+			Log_Error(&program.logger, 0, "The `tiles` compression format only applies to CHR data: \"%s\"", arg);
+			return (ERROR);
+		}
+		program.compress_nam = COMPRESS_NONE;
+	}
+	return (OK);
+}
+
+static
+t_bool HandleArg_CompressFast(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	program.compress_fast = TRUE;
+	return (OK);
+}
+
+static
+t_bool HandleArg_Verify(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	program.verify = TRUE;
+	return (OK);
+}
+
+static
+t_bool HandleArg_TileCache(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	program.tilecache.enabled = TRUE;
+	return (OK);
+}
+
+static
+t_bool HandleArg_CacheDir(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	if (arg[0] == '\0')
+		return (ERROR);
+	program.buildcache.dir = arg;
+	return (OK);
+}
+
+static
+t_bool HandleArg_DepFile(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	if (arg[0] == '\0')
+		return (ERROR);
+	program.buildcache.file_deps = arg;
+	return (OK);
+}
+
+static
+t_bool HandleArg_Frames(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	program.frames = U32_FromString(arg);
+	if (program.frames == 0 || program.frames > ANIM_FRAMES_MAX)
+	{
+		Log_Error(&program.logger, 0, "The amount of animation frames must be between 1 and %i", ANIM_FRAMES_MAX);
+		return (ERROR);
+	}
+	return (OK);
+}
+
+static
+t_bool HandleArg_Check(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	program.check = TRUE;
+	return (OK);
+}
+
+static
+t_bool HandleArg_Watch(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	program.watch = TRUE;
+	return (OK);
+}
+
+static
+t_bool HandleArg_Server(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	if (arg[0] == '\0')
+		return (ERROR);
+	program.server = arg;
+	return (OK);
+}
+
+static
+t_bool HandleArg_Stdout(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	if (arg[0] == '\0')
+		return (ERROR);
+	program.output_stream = (arg[0] == '.' ? arg + 1 : arg);
+	return (OK);
+}
+
+static
+t_bool HandleArg_Bundle(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	program.output_bundle = TRUE;
+	return (OK);
+}
+
+static
+t_bool HandleArg_Profile(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+#if PROFILING
+	program.profile.enabled = TRUE;
+#else
+	LOG_WARNING("This program was built without profiling support (PROFILING=0), ignoring `--profile`");
+#endif
+	return (OK);
+}
+
+static
+t_bool HandleArg_ProfileJSON(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	if (arg[0] == '\0')
+		return (ERROR);
+#if PROFILING
+	program.profile.enabled = TRUE;
+	program.profile.file_json = arg;
+#else
+	LOG_WARNING("This program was built without profiling support (PROFILING=0), ignoring `--profile_json`");
+#endif
+	return (OK);
+}
+
+static
+t_bool HandleArg_Trace(t_char const* arg)
+{
+	if (arg == NULL) return (ERROR);
+	if (arg[0] == '\0')
+		return (ERROR);
+#if PROFILING
+	Trace_Init(arg);
+#else
+	LOG_WARNING("This program was built without profiling support (PROFILING=0), ignoring `--trace`");
+#endif
 	return (OK);
 }
 
@@ -111,10 +439,37 @@ static s_program_arg const program_args[PROGRAM_ARGS_AMOUNT] =
 {
 	(s_program_arg){ NULL,                  'h', "help",     FALSE, "If provided, display only the program usage help and exit." },
 	(s_program_arg){ HandleArg_Verbose,     'v', "verbose",  FALSE, "If provided, displays additional information while processing the BMP." },
+	(s_program_arg){ HandleArg_Quiet,       'q', "quiet",    FALSE, "If provided, displays nothing other than errors while processing the BMP." },
 	(s_program_arg){ HandleArg_BitmapWidth, 'w', "bitmap_w", FALSE, "(expects value, integer: `-w=256`) If provided, sets the expected bitmap width dimension." },
 	(s_program_arg){ HandleArg_BitmapHeight,'h', "bitmap_h", FALSE, "(expects value, integer: `-h=240`) If provided, sets the expected bitmap height dimension." },
-	(s_program_arg){ HandleArg_Palette,     'p', "palette",  TRUE,  "(expects value, filepath: `-p=./path/to/file.pal`) If provided, forces the output to use the given palette (must be a binary .pal file, containing at most 64 different 32-bit colors)." },
-	(s_program_arg){ HandleArg_ColorKey,    'c', "colorkey", TRUE,  "(expects value, color: `-c=FF00FF`) If provided, the given color value will be present as the first color for all palettes."}
+	(s_program_arg){ HandleArg_Target,      't', "target",   TRUE,  "(expects value, name: `-t=nes`) If provided, sets the hardware target to convert for, which decides the screen size, tile/palette limits and output file formats: `nes` (default), `gb`, `sms`, or `snes4`." },
+	(s_program_arg){ HandleArg_RefPal,      'R', "refpal",   TRUE,  "(expects value, filepath: `-R=./pal/nes.pal`) If provided, uses the colors of the given reference palette file (a binary .pal or a TOML .palette file), instead of the palette built into the program for the `--target`. Can be given several times: the palette with the least color error is then chosen for each bitmap." },
+	(s_program_arg){ HandleArg_Emphasis,    'e', "emphasis", TRUE,  "(expects value, bits: `-e=3` or `-e=auto`) If provided, applies the given NES color emphasis bits (1=red, 2=green, 4=blue) to the reference palette, or with `auto`, chooses the combination with the least color error for each bitmap." },
+	(s_program_arg){ HandleArg_Palette,     'p', "palette",  TRUE,  "(expects value, filepath: `-p=./path/to/file.pal`) If provided, forces the output to use the given palette (must be a binary .pal file, in the same format as the .pal file output for the `--target`)." },
+	(s_program_arg){ HandleArg_ColorKey,    'c', "colorkey", TRUE,  "(expects value, color: `-c=FF00FF`) If provided, the given color value will be present as the first color for all palettes."},
+	(s_program_arg){ HandleArg_Crop,        'r', "crop",     TRUE,  "(expects value, region: `-r=256,0,256,240`) If provided, only the given region (x,y,w,h) of the BMP is converted, instead of its top-left corner." },
+	(s_program_arg){ HandleArg_Align,       'a', "align",    TRUE,  "(expects value, offset: `-a=8,4` or `-a=auto`) If provided, the attribute grid starts at this pixel offset within the converted region (the output is shifted accordingly), or with `auto`, at the offset where the fewest metatiles have too many colors." },
+	(s_program_arg){ HandleArg_Scale,       's', "scale",    TRUE,  "(expects value, name: `-s=box`) If provided, shrinks a high-resolution BMP (like a 2x or 4x export, in any pixel format) down to the output size, mapping it to the reference palette in the same pass: `none` (default), `nearest` or `box` (by the largest whole factor), or `area` (area-average, stretched to exactly the output size). The `--crop` region is then taken from the scaled BMP." },
+	(s_program_arg){ HandleArg_Dither,      'D', "dither",   TRUE,  "(expects value, name: `-D=floyd`) If provided, dithers the output with the colors of each tile's palette: `none` (default), `bayer` (ordered), `floyd` (Floyd-Steinberg), or `atkinson`." },
+	(s_program_arg){ HandleArg_Progressive, 'g', "progressive", TRUE, "(expects value, milliseconds: `-g=2000`) If provided, a fast greedy result is written first, and then the palettes keep being refined for up to this long (or until no improvement is found, if 0), overwriting the output files each time the total error is lower." },
+	(s_program_arg){ HandleArg_Portfolio,   'f', "portfolio", FALSE, "If provided, several conversion strategies (color fusing thresholds, global-then-tile or tile-only color reduction, shared backdrop color) are run at once on separate threads, and the outputs of the one with the lowest total color error are written." },
+	(s_program_arg){ HandleArg_Heatmap,     'H', "heatmap",  FALSE, "If provided, also outputs a `.heatmap.bmp` file, which shows how far the color of each output pixel is from its reference color (from black for none, through red and yellow, to white)." },
+	(s_program_arg){ HandleArg_Report,      'O', "report",   TRUE,  "(expects value, format: `-O=json`) If provided, also writes a `.report.json` file next to the outputs, with the input color statistics, the unique tile palettes and their popularity, the chosen output palettes, the violations of the target's limits, the conversion error, and the timings." },
+	(s_program_arg){ HandleArg_Compress,    'z', "compress", TRUE,  "(expects value, format: `-z=lz4`, or `-z=rle,tiles` for the NAM and CHR separately) If provided, also outputs compressed copies of the NAM and CHR files, as `.nam.rle`/`.chr.rle` (the RLE format of neslib's `vram_unrle()`), `.nam.lz4`/`.chr.lz4` (one raw LZ4 block), or `.chr.tiles` (a bitstream of CHR tile rows, for CHR only): by default, the smallest possible output is searched for." },
+	(s_program_arg){ HandleArg_CompressFast,'Z', "compress_fast", FALSE, "If provided, the `--compress` outputs are made with a fast greedy parse, rather than the slower search for the smallest output." },
+	(s_program_arg){ HandleArg_Verify,      'V', "verify",   FALSE, "If provided, the NAM/CHR/PAL outputs are rendered back into an image (as the target would show them), and compared with every pixel of the BMP output before anything is written: the conversion fails if they differ." },
+	(s_program_arg){ HandleArg_TileCache,   'k', "tilecache", FALSE, "If provided, per-tile results are saved to a `.tilecache` file next to the output, so that re-running only recomputes the tiles which changed." },
+	(s_program_arg){ HandleArg_CacheDir,    'C', "cache_dir", TRUE, "(expects value, dirpath: `-C=./.cache`) If provided, outputs are stored in this directory by the hash of all inputs, and restored from it instead of converting when nothing has changed." },
+	(s_program_arg){ HandleArg_DepFile,     'M', "depfile",  TRUE,  "(expects value, filepath: `-M=./obj/file.d`) If provided, writes a make-style dependency file, listing the output files and all the input files they depend on." },
+	(s_program_arg){ HandleArg_Frames,      'F', "frames",   TRUE,  "(expects value, integer: `-F=8`) If provided, `INPUTFILE` is a filepath pattern (like `water_%02d.bmp`) for this many animation frames, which are converted with shared palettes and CHR tiles: the outputs are the NAM of the first frame, and a `.namdelta` file with the NAM changes for each following frame." },
+	(s_program_arg){ HandleArg_Check,       'K', "check",    FALSE, "If provided, nothing is converted: every `INPUTFILE` given is only checked against the limits of the `--target` (colors per tile, amount of palettes, unique CHR tiles), outputting one line per violation, and the exit status is non-zero if any file fails." },
+	(s_program_arg){ HandleArg_Watch,       'W', "watch",    FALSE, "If provided, the program keeps running, and converts the BMP again every time it (or a palette file) is saved." },
+	(s_program_arg){ HandleArg_Server,      'S', "server",   TRUE,  "(expects value, socket path: `-S=/tmp/bmp2nam.sock`, or `-S=-` for stdin/stdout) If provided, runs as a server which handles length-prefixed conversion requests concurrently, instead of converting `INPUTFILE`." },
+	(s_program_arg){ HandleArg_Stdout,      'o', "stdout",   TRUE,  "(expects value, file extension: `-o=bmp`) If `OUTPUTFILE` is `-`, chooses which output file is written to stdout (by default, the first one)." },
+	(s_program_arg){ HandleArg_Bundle,      'b', "bundle",   FALSE, "If provided, and `OUTPUTFILE` is `-`, all output files are written to stdout as one tar archive stream." },
+	(s_program_arg){ HandleArg_Profile,     'P', "profile",  FALSE, "If provided, measures the time and work done by each processing stage, and displays it as a table at the end." },
+	(s_program_arg){ HandleArg_ProfileJSON, 'J', "profile_json", TRUE, "(expects value, filepath: `-J=./profile.json`) If provided, writes the `--profile` report as a JSON file, rather than as a table." },
+	(s_program_arg){ HandleArg_Trace,       'T', "trace",    TRUE,  "(expects value, filepath: `-T=./trace.json`) If provided, records a timeline of all processing stages, and writes it as a Chrome/Perfetto trace-event JSON file." },
 };
 
 
@@ -133,11 +488,13 @@ void PrintUsage(void)
 	IO_Output_Line("");
 	IO_Output_Line(IO_TEXT_BOLD"INPUTFILE"IO_RESET": (necessary)");
 	IO_Output_Line("\t""The filepath of the BMP file to read (it must be in 8BPP indexed palette format, and must have fewer than 16 colors total).");
+	IO_Output_Line("\t""If it is `-`, the BMP file is read from stdin.");
 	IO_Output_Line("");
 	IO_Output_Line(IO_TEXT_BOLD"OUTPUTFILE"IO_RESET":");
 	IO_Output_Line("\t""The filepath of the NAM file to create.");
 	IO_Output_Line("\t""If not provided, this program will output a file with the same name as the given BMP `INPUTFILE`,");
 	IO_Output_Line("\t""but will add a CHR/NAM file extension to the output filepath (only if needed).");
+	IO_Output_Line("\t""If it is `-` (the default when reading from stdin), one output file is written to stdout (see `--stdout` and `--bundle`).");
 	IO_Output_Line("");
 	IO_Output_Line(IO_TEXT_BOLD"OPTIONS"IO_RESET":");
 	IO_Output_Line("\t""Here is the list of accepted options, both in `-c` short t_char format, and `--string` long string format:");
@@ -198,8 +555,9 @@ t_bool HandleArgs_Option_String(t_char const* arg)
 	for (t_u32 i = 0; i < PROGRAM_ARGS_AMOUNT; ++i)
 	{
 		length = String_Length(program_args[i].arg_long);
+		// an option which takes a value must still match a whole name (`--compress` is a prefix of `--compress_fast`)
 		if (String_Equals(arg, program_args[i].arg_long) || (program_args[i].has_value &&
-			String_Equals_N(arg, program_args[i].arg_long, length)))
+			String_Equals_N(arg, program_args[i].arg_long, length) && arg[length] == '='))
 		{
 			if (program_args[i].has_value)
 			{
@@ -229,13 +587,6 @@ static
 int HandleArgs_FilePath_Input(t_char const* arg)
 {
 	program.file_input = arg;
-	Log_Message(&program.logger, "Processing file: %s...", program.file_input);
-	program.bitmap = SDL_LoadBMP(program.file_input);
-	if (program.bitmap == NULL)
-	{
-		Log_Error(&program.logger, 0, "Could not load BMP file => %s\n", SDL_GetError());
-		return (ERROR);
-	}
 	return (OK);
 }
 
@@ -265,14 +616,10 @@ int HandleArgs(int argc, t_char** argv)
 	for (int i = 1; i < argc; ++i)
 	{
 		match = FALSE;
-		if (argv[i][0] == '-')
+		// a lone '-' is not an option, it is a filepath which stands for stdin/stdout
+		if (argv[i][0] == '-' && argv[i][1] != '\0')
 		{
-			if (argv[i][1] == '\0')
-			{
-				Log_Error(&program.logger, 0, "Unexpected end of argument after '-'.");
-				continue;
-			}
-			else if (argv[i][1] == '-')
+			if (argv[i][1] == '-')
 			{
 				match = HandleArgs_Option_String(argv[i] + 2);
 			}
@@ -286,7 +633,7 @@ int HandleArgs(int argc, t_char** argv)
 		}
 		else
 		{
-			if (program.bitmap == NULL)
+			if (program.file_input == NULL)
 			{
 				if (HandleArgs_FilePath_Input(argv[i]) != OK)
 					return (ERROR);
@@ -322,10 +669,60 @@ int HandleArgs(int argc, t_char** argv)
 ** ************************************************************************** *|
 */
 
+//! Loads the user-specified `--palette` file (in the output PAL file format of the current target) as the output palettes
+static
+int     LoadUserPalette(t_char const* filepath)
+{
+	t_fd fd = IO_Open(filepath, OPEN_READONLY, 0);
+	if (fd < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not open user-specified palette file: %s", filepath);
+		return (ERROR);
+	}
+	t_u8* file = NULL;
+	t_sintmax size = Arena_ReadFile(&program.arena, fd, &file);
+	IO_Close(fd);
+	if (size < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not read user-specified palette file: %s", filepath);
+		return (ERROR);
+	}
+	if ((t_size)size != PAL_SIZE)
+	{
+		LOG_WARNING("Palette file specified has incorrect size: %s (was %zu bytes, but should be %zu bytes)",
+			filepath, (t_size)size, PAL_SIZE);
+		return (ERROR);
+	}
+	t_u8 const* entry = file;
+	for (t_uint i = 0; i < PAL_SUB_AMOUNT; ++i)
+	{
+		program.output_palettes[i].length = PAL_SUB_COLORS;
+		for (t_uint j = 0; j < PAL_SUB_COLORS; ++j, entry += PAL_COLORSIZE)
+		{
+			if (TARGET(pal_format) == PAL_FORMAT_INDEX)
+			{
+				program.output_palettes[i].colors[j] = entry[0];
+				continue;
+			}
+			// a direct color is stored as the reference palette color which is nearest to it
+			t_u16 bgr = (t_u16)(entry[0] | (entry[1] << 8));
+			t_argb32 color = Color_ARGB32_Set(0,
+				((bgr >>  0) & 0x1F) << 3,
+				((bgr >>  5) & 0x1F) << 3,
+				((bgr >> 10) & 0x1F) << 3);
+			t_argb32 const* nearest = Color_ARGB32_GetNearest(color, program.ref_palette, REFPAL_COLORS);
+			program.output_palettes[i].colors[j] = (nearest ? (t_u8)(nearest - program.ref_palette) : 0);
+		}
+	}
+	return (OK);
+}
+
 static
 int init(t_char const* name)
 {
 	program.called = name;
+	program.target = &targets[TARGET_NES];
+	program.threshold = THRESHOLD;
 
 	// logger initiliazing
 	program.logger = (s_logger)
@@ -347,88 +744,373 @@ int init(t_char const* name)
 
 
 
-#ifdef main
-#undef main
-#endif
-int main(int argc, t_char** argv)
+void    Program_Reset(void)
 {
-	t_char* tmp;
-	// perform initialisation of program state variables
-	if (init(argv[0]))
+	if (program.output)
+	{
+		SDL_FreeSurface(program.output);
+		program.output = NULL;
+	}
+	if (program.bitmap)
+	{
+		SDL_FreeSurface(program.bitmap);
+		program.bitmap = NULL;
+	}
+	program.view = (s_view){ 0 };
+	program.input_data = NULL;
+	program.input_size = 0;
+	program.outputs_amount = 0;
+	program.buildcache.hit = FALSE;
+	program.bitmap_colors_total = 0;
+	Memory_Clear(program.bitmap_colors, sizeof(program.bitmap_colors));
+	Memory_Clear(program.occur_colors,  sizeof(program.occur_colors));
+	Memory_Clear(program.tiles_colors,  sizeof(program.tiles_colors));
+	Memory_Clear(program.tiles_palettes, sizeof(program.tiles_palettes));
+	program.tiles_palettes_amount = 0;
+	if (program.file_palette == NULL)
+	{   // output palettes which were generated must be chosen anew
+		Memory_Clear(program.output_palettes, sizeof(program.output_palettes));
+	}
+	// free all scratch memory used for this conversion at once
+	Arena_Reset(&program.arena);
+}
+
+
+
+int     Program_ConvertTiles(void)
+{
+	if (PROFILE_STAGE(CheckBitmap_LoadColors()))
 		return (ERROR);
-	// parse and handle commandline arguments
-	if (HandleArgs(argc, argv))
+	if (PROFILE_STAGE(CheckBitmap_TotalColors()))
+		return (ERROR);
+	if (PROFILE_STAGE(CheckBitmap_TilesColors()))
+		return (ERROR);
+
+	if (!program.reduce_tiles_only && PROFILE_STAGE(ConvertBitmap_TotalColorReduction()))
+		return (ERROR);
+	if (PROFILE_STAGE(ConvertBitmap_TilesColorReduction()))
+		return (ERROR);
+
+	if (PROFILE_STAGE(CheckBitmap_LoadColors()))
 		return (ERROR);
-	// create default output filepath if not provided
-	if (program.file_output == NULL)
+	if (PROFILE_STAGE(CheckBitmap_TotalColors()))
+		return (ERROR);
+	if (PROFILE_STAGE(CheckBitmap_TilesColors()))
+		return (ERROR);
+	// TODO skip this step if the user has provided output palettes
+	if (program.output_palettes[0].length == 0)
 	{
-		int extension = String_IndexOf_R_Char(program.file_input, '.');
-		program.file_output = String_Sub(program.file_input, 0, extension);
+		if (PROFILE_STAGE(CheckBitmap_DuplicatePalettes()))
+			return (ERROR);
+		if (PROFILE_STAGE(ConvertBitmap_AssertOutputPalettes()))
+			return (ERROR);
+		if (PROFILE_STAGE(ConvertBitmap_ApplyOutputPalettes(FALSE)))
+			return (ERROR);
 	}
-	else if (String_Equals_IgnoreCase(program.file_output + String_Length(program.file_output) - 4, ".nam"))
-	{   // remove ".nam" file extension if provided
-		((t_char*)program.file_output)[String_Length(program.file_output) - 4] = '\0';
+	else
+	{
+		if (PROFILE_STAGE(CheckBitmap_TilesPalettes()))
+			return (ERROR);
+		if (PROFILE_STAGE(ConvertBitmap_ApplyOutputPalettes(TRUE)))
+			return (ERROR);
 	}
+	return (OK);
+}
+
+
 
-	if (CheckBitmap_LoadReferencePalette())
+int     Program_EncodeOutputs(void)
+{
+	if (PROFILE_STAGE(ConvertBitmap_UnpackTiles()))
+		return (ERROR);
+	if (PROFILE_STAGE(Output_AddBitmap(".bmp", program.output)))
+		return (ERROR);
+	SDL_FreeSurface(program.output);
+	program.output = NULL;
+	if (program.heatmap && PROFILE_STAGE(Metrics_AddHeatmap()))
+		return (ERROR);
+	if (PROFILE_STAGE(EncodeBitmap_Outputs()))
 		return (ERROR);
+	return (OK);
+}
+
 
-	if (CheckBitmap_PixelFormat())
+
+//! Converts the loaded bitmap, and writes its outputs (this is the "ConvertBitmap" span of the `--trace` timeline)
+static
+int     Program_ConvertBitmap(void)
+{
+	if (program.scale && PROFILE_STAGE(Scale_Bitmap()))
+		return (ERROR);
+	if (PROFILE_STAGE(CheckBitmap_PixelFormat()))
+		return (ERROR);
+	if (PROFILE_STAGE(CheckBitmap_Dimensions()))
+		return (ERROR);
+	if (PROFILE_STAGE(Align_View()))
 		return (ERROR);
-	if (CheckBitmap_Dimensions())
+	if (PROFILE_STAGE(ConvertBitmap_PackTiles()))
 		return (ERROR);
-	if (CheckBitmap_LoadColors())
+	if (PROFILE_STAGE(RefPal_Choose()))
+		return (ERROR);
+	if (PROFILE_STAGE(CheckBitmap_LoadColors()))
+		return (ERROR);
+	if (program.dither && PROFILE_STAGE(Dither_SaveSource()))
 		return (ERROR);
 
-	if (ConvertBitmap_ApplyRefPalette())
+	if (program.report.format && PROFILE_STAGE(Report_SaveInput()))
 		return (ERROR);
 
-	if (CheckBitmap_LoadColors())
+	if (PROFILE_STAGE(ConvertBitmap_ApplyRefPalette()))
 		return (ERROR);
-	if (CheckBitmap_TotalColors())
+
+	if (program.portfolio)
+	{   // each strategy converts its own copy of the tiles, and the outputs of the best one are kept
+		if (PROFILE_STAGE(Portfolio_Run()))
+			return (ERROR);
+		if (PROFILE_STAGE(Metrics_Measure()))
+			return (ERROR);
+	}
+	else if (Program_ConvertTiles() ||
+		Program_EncodeOutputs())
 		return (ERROR);
-	if (CheckBitmap_TilesColors())
+
+	if (program.verify && PROFILE_STAGE(Render_Verify()))
 		return (ERROR);
+	if (PROFILE_STAGE(Output_WriteAll()))
+		return (ERROR);
+	// the outputs above are the preview: the refined outputs overwrite them, and are the ones stored in the build cache
+	if (program.progressive && PROFILE_STAGE(Progressive_Refine()))
+		return (ERROR);
+	if (program.report.format && PROFILE_STAGE(Report_Output()))
+		return (ERROR);
+	return (OK);
+}
+
 
-	if (ConvertBitmap_TotalColorReduction())
+
+int     Program_Convert(void)
+{
+	if (program.report.format)
+		program.report.start_ns = Time_GetMonotonic();
+	if (PROFILE_STAGE(Input_Read()))
 		return (ERROR);
-	if (ConvertBitmap_TilesColorReduction())
+	if (program.buildcache.dir)
+	{   // skip conversion entirely if the outputs for these exact inputs are already in the cache
+		if (PROFILE_STAGE(BuildCache_GetKey()))
+			return (ERROR);
+		if (PROFILE_STAGE(BuildCache_Restore()))
+		{
+			if (program.verify && PROFILE_STAGE(Render_Verify()))
+				return (ERROR);
+			if (PROFILE_STAGE(Output_WriteAll()))
+				return (ERROR);
+			if (program.report.format && PROFILE_STAGE(Report_Output()))
+				return (ERROR);
+			return (BuildCache_WriteDeps());
+		}
+	}
+	LOG_MESSAGE("Processing file: %s...", program.file_input);
+	program.bitmap = SDL_LoadBMP_RW(SDL_RWFromConstMem(program.input_data, (int)program.input_size), TRUE);
+	if (program.bitmap == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not load BMP file => %s\n", SDL_GetError());
 		return (ERROR);
+	}
 
-	if (CheckBitmap_LoadColors())
+	// the span is ended on every path, so that the trace of a failed conversion stays balanced
+	TRACE_BEGIN("ConvertBitmap");
+	int result = Program_ConvertBitmap();
+	TRACE_END("ConvertBitmap");
+	if (result)
 		return (ERROR);
-	if (CheckBitmap_TotalColors())
+	if (PROFILE_STAGE(TileCache_Save(&program.tilecache, program.tilecache.filepath)))
 		return (ERROR);
-	if (CheckBitmap_TilesColors())
+	if (PROFILE_STAGE(BuildCache_Store()))
 		return (ERROR);
-	// TODO skip this step if the user has provided output palettes
-	if (program.output_palettes[0].length == 0)
+	if (BuildCache_WriteDeps())
+		return (ERROR);
+	return (OK);
+}
+
+
+
+//! Called by `Watch_Run()`: reloads whichever palette files have `changed`, and converts again
+static
+int     Program_OnChange(t_u32 changed)
+{
+	if (changed & WATCH_REFPAL)
 	{
-		if (CheckBitmap_DuplicatePalettes())
-			return (ERROR);
-		if (ConvertBitmap_AssertOutputPalettes())
-			return (ERROR);
-		if (ConvertBitmap_ApplyOutputPalettes(FALSE))
+		if (PROFILE_STAGE(CheckBitmap_LoadReferencePalette()))
 			return (ERROR);
 	}
-	else
+	if ((changed & (WATCH_REFPAL | WATCH_PALETTE)) && program.file_palette)
 	{
-		if (ConvertBitmap_ApplyOutputPalettes(TRUE))
+		if (LoadUserPalette(program.file_palette))
 			return (ERROR);
 	}
+	Program_Reset();
+	int result = Program_Convert();
+	Program_Reset();
+	return (result);
+}
+
+
 
-	tmp = String_Concat(program.file_output, ".bmp");
-	if (SDL_SaveBMP(program.bitmap, tmp))
+#ifdef main
+#undef main
+#endif
+int main(int argc, t_char** argv)
+{
+	int result;
+	// perform initialisation of program state variables
+	if (init(argv[0]))
+		return (ERROR);
+	// parse and handle commandline arguments
+	if (HandleArgs(argc, argv))
+		return (ERROR);
+	if (program.file_input == NULL && program.server == NULL)
+		return (OK); // only `--help` was given
+	if (program.frames && (program.watch || program.server))
+	{
+		Log_Error(&program.logger, 0, "The `--frames` option cannot be used together with `--watch` or `--server`");
+		return (ERROR);
+	}
+	if ((program.files_refpal_amount > 1 || program.emphasis == REFPAL_EMPHASIS_AUTO) && (program.frames || program.server))
+	{   // every frame (or request) must use the same reference palette, which is shared by all threads
+		Log_Error(&program.logger, 0, "Several reference palette candidates cannot be used together with `--frames` or `--server`");
+		return (ERROR);
+	}
+	if (program.scale && (program.files_refpal_amount > 1 || program.emphasis == REFPAL_EMPHASIS_AUTO))
+	{   // the scaled bitmap is mapped to the first reference palette, so the candidates could not be compared fairly
+		Log_Error(&program.logger, 0, "The `--scale` option cannot be used together with several reference palette candidates");
+		return (ERROR);
+	}
+	if (program.portfolio && (program.frames || program.server || program.check))
+	{   // each of these has its own pipeline, or its own threads
+		Log_Error(&program.logger, 0, "The `--portfolio` option cannot be used together with `--frames`, `--server` or `--check`");
+		return (ERROR);
+	}
+	if (program.progressive && (program.frames || program.server || program.check))
+	{   // each of these writes its outputs only once
+		Log_Error(&program.logger, 0, "The `--progressive` option cannot be used together with `--frames`, `--server` or `--check`");
+		return (ERROR);
+	}
+	if (program.report.format && (program.frames || program.check))
+	{   // neither of these runs the pipeline which gathers the information for the report
+		Log_Error(&program.logger, 0, "The `--report` option cannot be used together with `--frames` or `--check`");
+		return (ERROR);
+	}
+	if (program.heatmap && (program.frames || program.check))
+	{   // the heatmap is drawn like the output bitmap, which neither of these writes
+		Log_Error(&program.logger, 0, "The `--heatmap` option cannot be used together with `--frames` or `--check`");
+		return (ERROR);
+	}
+	if (program.verify && (program.frames || program.check))
+	{   // the outputs are checked against the output bitmap, which neither of these writes
+		Log_Error(&program.logger, 0, "The `--verify` option cannot be used together with `--frames` or `--check`");
+		return (ERROR);
+	}
+	if (program.frames && program.dither)
+	{   // the frames share their CHR tiles, which dithering would make unique to each frame
+		Log_Error(&program.logger, 0, "The `--dither` option cannot be used together with `--frames`");
+		return (ERROR);
+	}
+	if (program.frames && program.buildcache.dir)
+	{   // the build cache key is the hash of one input bitmap, but the outputs of an animation depend on all of its frames
+		Log_Error(&program.logger, 0, "The `--cache_dir` option cannot be used together with `--frames`");
+		return (ERROR);
+	}
+	if (program.check && (program.frames || program.watch || program.server))
+	{
+		Log_Error(&program.logger, 0, "The `--check` option cannot be used together with `--frames`, `--watch` or `--server`");
+		return (ERROR);
+	}
+	if (program.frames && program.file_output == NULL)
+	{   // the default output filepath would contain the frame number pattern
+		Log_Error(&program.logger, 0, "The `--frames` option requires an `OUTPUTFILE` to be given");
+		return (ERROR);
+	}
+	if (program.check)
+	{   // the violation list is written to stdout, so logs must go elsewhere (and file arguments are all input files)
+		program.logger.fd = STDERR;
+		program.file_output = NULL;
+	}
+	// create default output filepath if not provided (in server mode, each request gives its own filepaths)
+	if (program.file_input && program.file_output == NULL &&
+		String_Equals(program.file_input, PATH_STDIO))
+	{   // when reading from stdin, write to stdout by default, so that the program can be used in a pipeline
+		program.file_output = PATH_STDIO;
+	}
+	else if (program.file_input && program.file_output == NULL)
 	{
-		String_Delete(&tmp);
-		Log_Error(&program.logger, 0, "Could not save BMP file => %s\n", SDL_GetError());
+		int extension = String_IndexOf_R_Char(program.file_input, '.');
+		program.file_output = String_Sub(program.file_input, 0, extension);
+	}
+	else if (program.file_output &&
+		String_Equals_IgnoreCase(program.file_output + String_Length(program.file_output) - 4, ".nam"))
+	{   // remove ".nam" file extension if provided
+		((t_char*)program.file_output)[String_Length(program.file_output) - 4] = '\0';
+	}
+	if (program.file_output && String_Equals(program.file_output, PATH_STDIO))
+	{   // stdout is used for output files, so logs must go elsewhere
+		program.logger.fd = STDERR;
+	}
+	if (program.progressive && program.file_output && String_Equals(program.file_output, PATH_STDIO))
+	{   // each improvement writes all the outputs again, which would append several complete files onto stdout
+		Log_Error(&program.logger, 0, "The `--progressive` option cannot be used when writing the outputs to stdout");
+		return (ERROR);
+	}
+	if (program.watch && program.file_input && String_Equals(program.file_input, PATH_STDIO))
+	{
+		Log_Error(&program.logger, 0, "The `--watch` option cannot be used when reading the input from stdin");
 		return (ERROR);
 	}
-	Log_Success(&program.logger, "Wrote output file: %s", tmp);
-	String_Delete(&tmp);
 
-	tmp = String_Concat(program.file_output, ".nam");
-	// TODO code here
-	String_Delete(&tmp);
-	return (OK);
+	if (PROFILE_STAGE(CheckBitmap_LoadReferencePalette()))
+		return (ERROR);
+	if (program.file_palette && LoadUserPalette(program.file_palette))
+		return (ERROR);
+	if (program.tilecache.enabled && program.file_output && !String_Equals(program.file_output, PATH_STDIO))
+	{
+		program.tilecache.filepath = String_Join(program.file_output, TILECACHE_FILE(""));
+		if (program.tilecache.filepath == NULL ||
+			PROFILE_STAGE(TileCache_Load(&program.tilecache, program.tilecache.filepath)))
+			return (ERROR);
+	}
+	if (program.server)
+	{   // the reference palette is loaded once, and shared by all requests
+		result = Server_Run(program.server);
+	}
+	else if (program.watch)
+	{   // the reference palette and the tile cache stay resident, so only the tiles which changed are recomputed
+		program.tilecache.enabled = TRUE;
+		result = Watch_Run(Program_OnChange);
+	}
+	else if (program.check)
+	{   // every file argument is an input file to check, so that many files can be checked by one process
+		result = OK;
+		for (int i = 1; i < argc; ++i)
+		{
+			if (argv[i][0] == '-' && argv[i][1] != '\0')
+				continue;
+			if (Compliance_Check(argv[i]))
+				result = ERROR;
+			Program_Reset();
+		}
+	}
+	else if (program.frames)
+	{   // tiles which are the same as in an earlier frame are not analyzed again, thanks to the tile cache
+		program.tilecache.enabled = TRUE;
+		result = Animation_Convert();
+	}
+	else result = Program_Convert();
+	Program_Reset();
+	TileCache_Delete(&program.tilecache);
+#if PROFILING
+	if (Profile_Output())
+		return (ERROR);
+	if (Trace_Output())
+		return (ERROR);
+#endif
+	return (result);
 }
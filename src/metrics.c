@@ -0,0 +1,201 @@
+
+#include <math.h>
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/logger.h>
+#include <libccc/image/color.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+/*
+** ************************************************************************** *|
+**                          Quality Metrics Functions                         *|
+** ************************************************************************** *|
+*/
+
+//! Returns the linear-light value (from 0 to 1) of the given 8-bit sRGB channel value
+static
+t_float Metrics_Linear(t_u8 channel)
+{
+	t_float value = channel / (t_float)255;
+	return ((value <= (t_float)0.04045) ? value / (t_float)12.92 : (t_float)pow((value + 0.055) / 1.055, 2.4));
+}
+
+//! Returns the CIE L*a*b* transfer function of the given (white-relative) XYZ component
+static
+t_float Metrics_LabCurve(t_float value)
+{
+	return ((value > (t_float)0.008856) ? (t_float)cbrt(value) : (t_float)7.787 * value + (t_float)16 / 116);
+}
+
+//! Returns the index of the reference color of the given output pixel value (`palette * PAL_SUB_COLORS + color`)
+static inline
+t_u8    Metrics_OutputColor(t_u8 pixel)
+{
+	t_uint p = pixel / PAL_SUB_COLORS;
+	// a pixel which was given no output color was left as its reference color
+	return ((p < PAL_SUB_AMOUNT) ? program.output_palettes[p].colors[pixel % PAL_SUB_COLORS] : pixel);
+}
+
+t_float Metrics_PSNR(s_metrics const* metrics)
+{
+	if (metrics->pixels == 0 || metrics->squared_sum == 0)
+		return ((t_float)METRICS_PSNR_MAX);
+	t_float mse = (t_float)metrics->squared_sum / ((t_float)metrics->pixels * 3);
+	t_float psnr = (t_float)(10 * log10(255. * 255. / mse));
+	return ((psnr > (t_float)METRICS_PSNR_MAX) ? (t_float)METRICS_PSNR_MAX : psnr);
+}
+
+
+
+int     Metrics_Begin(void)
+{
+	Memory_Clear(&program.metrics, sizeof(program.metrics));
+	Memory_Clear(program.metrics_tiles, sizeof(program.metrics_tiles));
+	if (program.heatmap)
+		Memory_Clear(program.metrics_pixels, sizeof(program.metrics_pixels));
+	// the output colors are all reference colors, so only the reference colors need to be converted to L*a*b*
+	for (t_uint i = 0; i < REFPAL_COLORS; ++i)
+	{
+		t_argb32 color = program.ref_palette[i];
+		t_float r = Metrics_Linear(Color_ARGB32_Get_R(color));
+		t_float g = Metrics_Linear(Color_ARGB32_Get_G(color));
+		t_float b = Metrics_Linear(Color_ARGB32_Get_B(color));
+		// sRGB to XYZ, relative to the D65 white point
+		t_float x = Metrics_LabCurve((r * (t_float)0.4124 + g * (t_float)0.3576 + b * (t_float)0.1805) / (t_float)0.95047);
+		t_float y = Metrics_LabCurve((r * (t_float)0.2126 + g * (t_float)0.7152 + b * (t_float)0.0722));
+		t_float z = Metrics_LabCurve((r * (t_float)0.0193 + g * (t_float)0.1192 + b * (t_float)0.9505) / (t_float)1.08883);
+		program.metrics_lab[i][0] = 116 * y - 16;
+		program.metrics_lab[i][1] = 500 * (x - y);
+		program.metrics_lab[i][2] = 200 * (y - z);
+	}
+	return (OK);
+}
+
+void    Metrics_AddTile(t_uint tile, t_u8 const* reference, t_u8 const* pixels)
+{
+	s_metrics* metrics = &program.metrics_tiles[tile];
+	t_u8* heat = (program.heatmap ? program.metrics_pixels + (t_size)tile * NAM_TILE_PIXELS : NULL);
+	*metrics = (s_metrics){ .pixels = NAM_TILE_PIXELS };
+	for (t_uint i = 0; i < NAM_TILE_PIXELS; ++i)
+	{
+		t_u8 expected = reference[i];
+		t_u8 actual = Metrics_OutputColor(pixels[i]);
+		if (program.ref_palette[expected] == program.ref_palette[actual])
+			continue;
+		t_float const* lab_expected = program.metrics_lab[expected];
+		t_float const* lab_actual   = program.metrics_lab[actual];
+		t_float dl = lab_expected[0] - lab_actual[0];
+		t_float da = lab_expected[1] - lab_actual[1];
+		t_float db = lab_expected[2] - lab_actual[2];
+		t_float delta = (t_float)sqrt(dl * dl + da * da + db * db);
+		t_argb32 a = program.ref_palette[expected];
+		t_argb32 b = program.ref_palette[actual];
+		t_sint red   = (t_sint)Color_ARGB32_Get_R(a) - (t_sint)Color_ARGB32_Get_R(b);
+		t_sint green = (t_sint)Color_ARGB32_Get_G(a) - (t_sint)Color_ARGB32_Get_G(b);
+		t_sint blue  = (t_sint)Color_ARGB32_Get_B(a) - (t_sint)Color_ARGB32_Get_B(b);
+		metrics->changed += 1;
+		metrics->delta_sum += delta;
+		metrics->squared_sum += (t_u64)(red * red + green * green + blue * blue);
+		if (metrics->delta_max < delta)
+			metrics->delta_max = delta;
+		if (heat)
+			heat[i] = (delta >= METRICS_HEATMAP_MAX) ? 0xFF : (t_u8)(delta * 255 / METRICS_HEATMAP_MAX);
+	}
+	program.metrics.pixels      += metrics->pixels;
+	program.metrics.changed     += metrics->changed;
+	program.metrics.delta_sum   += metrics->delta_sum;
+	program.metrics.squared_sum += metrics->squared_sum;
+	if (program.metrics.delta_max < metrics->delta_max)
+		program.metrics.delta_max = metrics->delta_max;
+}
+
+int     Metrics_End(void)
+{
+	s_metrics const* total = &program.metrics;
+	if (total->pixels == 0)
+		return (OK);
+	LOG_MESSAGE("Conversion error: mean dE %.2f, max dE %.2f, PSNR %.2f dB, %u of %u pixels changed color (%.1f%%)",
+		total->delta_sum / total->pixels,
+		total->delta_max,
+		Metrics_PSNR(total),
+		total->changed, total->pixels,
+		total->changed / (total->pixels / 100.));
+	t_uint worst = 0;
+	for (t_uint i = 1; i < NAM_TILES; ++i)
+	{
+		if (program.metrics_tiles[i].delta_sum > program.metrics_tiles[worst].delta_sum)
+			worst = i;
+	}
+	if (program.metrics_tiles[worst].changed)
+	{
+		LOG_VERBOSE("The metatile with the most error is at (x:%u, y:%u): mean dE %.2f, max dE %.2f, %u pixels changed color",
+			(worst % NAM_W_TILES) * NAM_TILE,
+			(worst / NAM_W_TILES) * NAM_TILE,
+			program.metrics_tiles[worst].delta_sum / NAM_TILE_PIXELS,
+			program.metrics_tiles[worst].delta_max,
+			program.metrics_tiles[worst].changed);
+	}
+	return (OK);
+}
+
+int     Metrics_Measure(void)
+{
+	if (Metrics_Begin())
+		return (ERROR);
+	for (t_uint t = 0; t < NAM_TILES; ++t)
+	{
+		Metrics_AddTile(t, program.tiles_reference + (t_size)t * NAM_TILE_PIXELS, TILE_PIXELS(t));
+	}
+	PROFILE_COUNT(PROFILE_PIXELS, NAM_TILES * NAM_TILE_PIXELS);
+	return (Metrics_End());
+}
+
+
+
+int     Metrics_AddHeatmap(void)
+{
+	SDL_Surface* heatmap = SDL_CreateRGBSurfaceWithFormat(0,
+		NAM_W, NAM_H, BMP_BPP,
+		SDL_PIXELFORMAT_INDEX8);
+	PROFILE_COUNT(PROFILE_ALLOCATIONS, 1);
+	if (heatmap == NULL || heatmap->format->palette == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not create heatmap bitmap which is %ix%i pixels => %s\n",
+			NAM_W, NAM_H,
+			SDL_GetError());
+		if (heatmap)
+			SDL_FreeSurface(heatmap);
+		return (ERROR);
+	}
+	// black (no error), then red, then yellow, then white (an error of `METRICS_HEATMAP_MAX` or more)
+	SDL_Color colors[256];
+	for (t_uint i = 0; i < 256; ++i)
+	{
+		t_uint level = i * 3;
+		colors[i] = (SDL_Color)
+		{
+			.r = (t_u8)(level < 256 ? level : 255),
+			.g = (t_u8)(level < 256 ? 0 : level < 512 ? level - 256 : 255),
+			.b = (t_u8)(level < 512 ? 0 : level - 512),
+			.a = 0,
+		};
+	}
+	if (SDL_SetPaletteColors(heatmap->format->palette, colors, 0, 256))
+	{
+		Log_Error(&program.logger, 0, "Could not set palette for heatmap bitmap => %s\n", SDL_GetError());
+		SDL_FreeSurface(heatmap);
+		return (ERROR);
+	}
+	TARGET(unpack_tiles)(program.metrics_pixels, (t_u8*)heatmap->pixels, heatmap->pitch);
+	PROFILE_COUNT(PROFILE_PIXELS, NAM_TILES * NAM_TILE_PIXELS);
+	int result = Output_AddBitmap(METRICS_HEATMAP_FILE(""), heatmap);
+	SDL_FreeSurface(heatmap);
+	return (result);
+}
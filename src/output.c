@@ -0,0 +1,192 @@
+
+#include <stdio.h>
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/io.h>
+#include <libccc/sys/logger.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+/*
+** ************************************************************************** *|
+**                             Input File Functions                           *|
+** ************************************************************************** *|
+*/
+
+int     Input_Read(void)
+{
+	t_bool use_stdin = String_Equals(program.file_input, PATH_STDIO);
+	t_fd fd = (use_stdin ? STDIN : IO_Open(program.file_input, OPEN_READONLY, 0));
+	if (fd < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not open input file: %s", program.file_input);
+		return (ERROR);
+	}
+	t_u8* file = NULL;
+	t_sintmax size = Arena_ReadFile(&program.arena, fd, &file);
+	if (!use_stdin)
+		IO_Close(fd);
+	if (size < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not read input file: %s", program.file_input);
+		return (ERROR);
+	}
+	program.input_data = file;
+	program.input_size = (t_size)size;
+	return (OK);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                            Output File Functions                           *|
+** ************************************************************************** *|
+*/
+
+int     Output_Add(t_char const* extension, t_u8 const* data, t_size size)
+{
+	if (program.outputs_amount == OUTPUT_FILES_MAX)
+	{
+		Log_Error(&program.logger, 0, "Too many output files (maximum is %i)", OUTPUT_FILES_MAX);
+		return (ERROR);
+	}
+	program.outputs[program.outputs_amount++] = (s_output_file)
+	{
+		.extension = extension,
+		.data = data,
+		.size = size,
+	};
+	return (OK);
+}
+
+
+
+int     Output_AddBitmap(t_char const* extension, SDL_Surface* surface)
+{
+	// the largest header SDL may write (file header + BITMAPV4 info header), then the palette, then the padded rows
+	t_size capacity = 14 + 108 + 4 * BMP_MAXCOLORS + (t_size)((surface->w + 3) & ~3) * surface->h;
+	t_u8* data = (t_u8*)Arena_Allocate(&program.arena, capacity);
+	if (data == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not allocate memory for output BMP file");
+		return (ERROR);
+	}
+	SDL_RWops* rw = SDL_RWFromMem(data, (int)capacity);
+	if (rw == NULL || SDL_SaveBMP_RW(surface, rw, FALSE))
+	{
+		Log_Error(&program.logger, 0, "Could not save BMP file => %s\n", SDL_GetError());
+		if (rw)
+			SDL_RWclose(rw);
+		return (ERROR);
+	}
+	t_size size = (t_size)SDL_RWtell(rw);
+	SDL_RWclose(rw);
+	return (Output_Add(extension, data, size));
+}
+
+
+
+//! Writes one member of a tar archive (a "ustar" header block, then the file contents, padded to a whole block)
+static
+void    Output_WriteTar(t_fd fd, t_char const* name, s_output_file const* output)
+{
+	t_u8 header[OUTPUT_TAR_BLOCK] = { 0 };
+	snprintf((t_char*)header +   0, 100, "%s%s", name, output->extension);
+	snprintf((t_char*)header + 100,   8, "%07o", 0644);
+	snprintf((t_char*)header + 108,   8, "%07o", 0);
+	snprintf((t_char*)header + 116,   8, "%07o", 0);
+	snprintf((t_char*)header + 124,  12, "%011llo", (unsigned long long)output->size);
+	snprintf((t_char*)header + 136,  12, "%011o", 0);
+	header[156] = '0'; // regular file
+	Memory_Copy(header + 257, "ustar\0" "00", 8);
+	// the checksum is computed as if its own field was filled with spaces
+	Memory_Set(header + 148, ' ', 8);
+	t_u32 checksum = 0;
+	for (t_uint i = 0; i < OUTPUT_TAR_BLOCK; ++i)
+	{
+		checksum += header[i];
+	}
+	snprintf((t_char*)header + 148, 8, "%06o", checksum);
+	header[155] = ' ';
+	IO_Write_Data(fd, header, OUTPUT_TAR_BLOCK);
+	IO_Write_Data(fd, output->data, output->size);
+	t_size padding = (OUTPUT_TAR_BLOCK - output->size % OUTPUT_TAR_BLOCK) % OUTPUT_TAR_BLOCK;
+	Memory_Clear(header, OUTPUT_TAR_BLOCK);
+	IO_Write_Data(fd, header, padding);
+}
+
+//! Writes the output files to stdout: either only the chosen one, or all of them as a tar archive
+static
+int     Output_WriteStdout(void)
+{
+	if (program.output_bundle)
+	{   // members are named after the input file (without its directory or extension)
+		t_char const* name = "bmp2nam";
+		t_char* stem = NULL;
+		if (!String_Equals(program.file_input, PATH_STDIO))
+		{
+			t_char const* filename = program.file_input + String_IndexOf_R_Char(program.file_input, '/') + 1;
+			t_sintmax extension = String_IndexOf_R_Char(filename, '.');
+			name = stem = String_Sub(filename, 0, (extension < 0 ? String_Length(filename) : (t_size)extension));
+		}
+		for (t_uint i = 0; i < program.outputs_amount; ++i)
+		{
+			Output_WriteTar(STDOUT, name, &program.outputs[i]);
+		}
+		t_u8 end[2 * OUTPUT_TAR_BLOCK] = { 0 };
+		IO_Write_Data(STDOUT, end, sizeof(end));
+		Memory_Free(stem);
+		return (OK);
+	}
+	for (t_uint i = 0; i < program.outputs_amount; ++i)
+	{
+		s_output_file const* output = &program.outputs[i];
+		if (program.output_stream && !String_Equals_IgnoreCase(output->extension + 1, program.output_stream))
+			continue;
+		if (IO_Write_Data(STDOUT, output->data, output->size) != output->size)
+		{
+			Log_Error_STD(&program.logger, 0, "Could not write output file to stdout");
+			return (ERROR);
+		}
+		return (OK);
+	}
+	Log_Error(&program.logger, 0, "There is no output file of the given kind: %s", program.output_stream);
+	return (ERROR);
+}
+
+
+
+int     Output_WriteAll(void)
+{
+	if (String_Equals(program.file_output, PATH_STDIO))
+		return (Output_WriteStdout());
+	for (t_uint i = 0; i < program.outputs_amount; ++i)
+	{
+		s_output_file const* output = &program.outputs[i];
+		t_char* filepath = Arena_Concat(&program.arena, program.file_output, output->extension);
+		if (filepath == NULL)
+			return (ERROR);
+		t_fd fd = IO_Open(filepath, OPEN_WRITEONLY | OPEN_CREATE | OPEN_CLEARFILE, 0644);
+		if (fd < 0)
+		{
+			Log_Error_STD(&program.logger, 0, "Could not open output file: %s", filepath);
+			return (ERROR);
+		}
+		t_size written = IO_Write_Data(fd, output->data, output->size);
+		IO_Close(fd);
+		if (written != output->size)
+		{
+			Log_Error_STD(&program.logger, 0, "Could not write output file: %s", filepath);
+			return (ERROR);
+		}
+		LOG_SUCCESS("Wrote output file: %s", filepath);
+	}
+	return (OK);
+}
@@ -0,0 +1,254 @@
+
+#define _POSIX_C_SOURCE 200809L
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/logger.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+//! Stores one set of conversion settings which is tried by `--portfolio`
+typedef struct s_strategy_
+{
+	t_char const*   name;               //!< The name of this strategy (for the log)
+	t_u32           threshold;          //!< The color distance at or below which colors are fused (see `program.threshold`)
+	t_bool          reduce_tiles_only;  //!< If TRUE, colors are only fused within each tile (see `program.reduce_tiles_only`)
+	t_bool          backdrop;           //!< If TRUE (and no colorkey was given), the most used color is shared by all palettes, like a colorkey
+}
+s_strategy;
+
+//! The strategies tried by `--portfolio` (the first one is the same as a normal conversion)
+static s_strategy const strategies[] =
+{
+	{ "default",            THRESHOLD,      FALSE,  FALSE },
+	{ "tiles-only",         THRESHOLD,      TRUE,   FALSE },
+	{ "fine",               THRESHOLD / 2,  FALSE,  FALSE },
+	{ "coarse",             THRESHOLD * 2,  FALSE,  FALSE },
+	{ "coarse tiles-only",  THRESHOLD * 2,  TRUE,   FALSE },
+	{ "backdrop",           THRESHOLD,      FALSE,  TRUE  },
+	{ "backdrop tiles-only",THRESHOLD,      TRUE,   TRUE  },
+};
+//! The amount of items in `strategies`
+#define PORTFOLIO_STRATEGIES    (sizeof(strategies) / sizeof(s_strategy))
+
+//! Stores the inputs and results of one strategy of the portfolio
+typedef struct s_portfolio_run_
+{
+	s_strategy const*   strategy;                   //!< The settings to convert with
+	s_program const*    shared;                     //!< The program state, as it was once the reference palette was applied (read-only)
+	s_program*          context;                    //!< This run's own copy of the program state, used by its thread (see `program_context`)
+	SDL_Surface*        bitmap;                     //!< This run's own copy of the input bitmap (whose palette and pixels are changed by the conversion)
+	int                 result;                     //!< The result of the conversion (OK or ERROR)
+	t_u64               error;                      //!< The total error of the output pixels, compared to the reference colors
+	s_arena             arena;                      //!< The scratch memory of this run, which holds its output files
+	s_output_file       outputs[OUTPUT_FILES_MAX];  //!< The output files of this run
+	t_uint              outputs_amount;             //!< The amount of items in `outputs`
+	t_u8                tiles_pixels[NAM_PIXELS_MAX];           //!< The output pixels of this run
+	s_palette           output_palettes[PAL_SUB_AMOUNT_MAX];    //!< The output palettes of this run
+}
+s_portfolio_run;
+
+
+
+/*
+** ************************************************************************** *|
+**                         Strategy Portfolio Functions                       *|
+** ************************************************************************** *|
+*/
+
+//! Returns the sum of the distances between the reference color of each pixel, and the output color it was given
+static
+t_u64   Portfolio_Error(void)
+{
+	t_u64 result = 0;
+	for (t_uint i = 0; i < NAM_TILES * NAM_TILE_PIXELS; ++i)
+	{
+		t_u8 pixel = program.tiles_pixels[i];
+		t_uint p = pixel / PAL_SUB_COLORS;
+		// a pixel which was given no output color is counted as the worst possible match
+		result += (p < PAL_SUB_AMOUNT) ?
+			program.ref_distances[program.tiles_reference[i]][program.output_palettes[p].colors[pixel % PAL_SUB_COLORS]] :
+			(t_u32)-1;
+	}
+	PROFILE_COUNT(PROFILE_PIXELS, NAM_TILES * NAM_TILE_PIXELS);
+	return (result);
+}
+
+//! Uses the most used reference color as the colorkey, so that it is the first color of every palette
+static
+void    Portfolio_SetBackdrop(void)
+{
+	t_u32 counts[REFPAL_COLORS_MAX] = { 0 };
+	for (t_uint i = 0; i < NAM_TILES * NAM_TILE_PIXELS; ++i)
+	{
+		counts[program.tiles_pixels[i]] += 1;
+	}
+	t_uint best = 0;
+	for (t_uint i = 1; i < REFPAL_COLORS; ++i)
+	{
+		if (counts[i] > counts[best])
+			best = i;
+	}
+	program.colorkey = (s_color_use)
+	{
+		.color = program.ref_palette[best],
+		.index = (t_u8)best,
+		.occurences = TRUE,
+	};
+}
+
+//! Converts the shared tiles with one strategy, in the calling thread (whose `program` is set up as the run's copy of the shared one)
+static
+void    Portfolio_Convert(s_portfolio_run* run)
+{
+	s_strategy const* strategy = run->strategy;
+	Memory_Copy(run->context, run->shared, sizeof(s_program));
+	program_context = run->context;
+	// every run has its own scratch memory and bitmap, and neither reads nor writes any cache
+	program.arena = (s_arena){ 0 };
+	program.tilecache = (s_tilecache){ 0 };
+	program.buildcache = (s_buildcache){ 0 };
+	program.logger.silence_logs = TRUE;
+	program.outputs_amount = 0;
+	program.output = NULL;
+	program.bitmap = run->bitmap;
+	program.view.pixels = (t_u8*)run->bitmap->pixels +
+		((t_u8 const*)run->shared->view.pixels - (t_u8 const*)run->shared->bitmap->pixels);
+#if PROFILING
+	program.profile = (s_profile){ .enabled = run->shared->profile.enabled };
+#endif
+	program.threshold = strategy->threshold;
+	program.reduce_tiles_only = strategy->reduce_tiles_only;
+	if (strategy->backdrop && !program.colorkey.occurences)
+		Portfolio_SetBackdrop();
+	run->result = Program_ConvertTiles();
+	if (run->result == OK)
+	{
+		run->error = Portfolio_Error();
+		Memory_Copy(run->tiles_pixels, program.tiles_pixels, sizeof(run->tiles_pixels));
+		Memory_Copy(run->output_palettes, program.output_palettes, sizeof(run->output_palettes));
+		run->result = Program_EncodeOutputs();
+	}
+	Memory_Copy(run->outputs, program.outputs, sizeof(run->outputs));
+	run->outputs_amount = program.outputs_amount;
+	run->arena = program.arena;
+	program.arena = (s_arena){ 0 };
+	program.bitmap = NULL;
+	program_context = &program_main;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+static
+void*   Portfolio_Worker(void* arg)
+{
+	s_portfolio_run* run = (s_portfolio_run*)arg;
+#if PROFILING
+	Trace_SetThreadName(run->strategy->name);
+#endif
+	Portfolio_Convert(run);
+#if PROFILING
+	Trace_EndThread();
+#endif
+	return (NULL);
+}
+
+#endif
+
+
+
+int     Portfolio_Run(void)
+{
+#if defined(__unix__) || defined(__APPLE__)
+	pthread_t threads[PORTFOLIO_STRATEGIES];
+	pthread_attr_t attr;
+	s_portfolio_run* runs = (s_portfolio_run*)Arena_Allocate(&program.arena, PORTFOLIO_STRATEGIES * sizeof(s_portfolio_run));
+	if (runs == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not allocate memory for the strategy portfolio");
+		return (ERROR);
+	}
+	LOG_MESSAGE("Running a portfolio of %u conversion strategies...", (t_uint)PORTFOLIO_STRATEGIES);
+	Memory_Clear(runs, PORTFOLIO_STRATEGIES * sizeof(s_portfolio_run));
+	for (t_uint i = 0; i < PORTFOLIO_STRATEGIES; ++i)
+	{   // the bitmaps are copied beforehand, so that the threads only ever read the shared state
+		runs[i].strategy = &strategies[i];
+		runs[i].shared = &program;
+		runs[i].result = ERROR;
+		runs[i].bitmap = SDL_DuplicateSurface(program.bitmap);
+		if (runs[i].bitmap == NULL)
+		{
+			Log_Error(&program.logger, 0, "Could not copy the bitmap for strategy \"%s\" => %s",
+				strategies[i].name, SDL_GetError());
+		}
+		runs[i].context = (s_program*)Memory_Allocate(sizeof(s_program));
+		if (runs[i].context == NULL)
+		{
+			Log_Error(&program.logger, 0, "Could not allocate the program state for strategy \"%s\"",
+				strategies[i].name);
+		}
+	}
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, sizeof(s_program) + PORTFOLIO_THREAD_STACK);
+	t_bool started[PORTFOLIO_STRATEGIES] = { 0 };
+	for (t_uint i = 0; i < PORTFOLIO_STRATEGIES; ++i)
+	{
+		if (runs[i].bitmap && runs[i].context)
+			started[i] = (pthread_create(&threads[i], &attr, Portfolio_Worker, &runs[i]) == 0);
+	}
+	pthread_attr_destroy(&attr);
+	s_portfolio_run* best = NULL;
+	for (t_uint i = 0; i < PORTFOLIO_STRATEGIES; ++i)
+	{
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		if (runs[i].bitmap)
+			SDL_FreeSurface(runs[i].bitmap);
+#if PROFILING
+		if (started[i])
+			Profile_Merge(&program.profile, &runs[i].context->profile);
+#endif
+		Memory_Free(runs[i].context);
+		if (runs[i].result)
+		{
+			LOG_WARNING("Strategy \"%s\" failed", strategies[i].name);
+			continue;
+		}
+		LOG_VERBOSE("Strategy \"%s\": total error %llu", strategies[i].name, (unsigned long long)runs[i].error);
+		if (best == NULL || runs[i].error < best->error)
+			best = &runs[i];
+	}
+	int result = ERROR;
+	if (best == NULL)
+		Log_Error(&program.logger, 0, "Every strategy of the portfolio failed");
+	else
+	{   // the output file contents are copied out of the best run's arena, since every run's arena is freed here
+		LOG_SUCCESS("Strategy \"%s\" has the lowest total error: %llu", best->strategy->name, (unsigned long long)best->error);
+		Memory_Copy(program.tiles_pixels, best->tiles_pixels, sizeof(best->tiles_pixels));
+		Memory_Copy(program.output_palettes, best->output_palettes, sizeof(best->output_palettes));
+		program.outputs_amount = 0;
+		result = OK;
+		for (t_uint i = 0; i < best->outputs_amount && result == OK; ++i)
+		{
+			t_u8 const* data = (t_u8 const*)Arena_Duplicate(&program.arena, best->outputs[i].data, best->outputs[i].size);
+			result = (data ? Output_Add(best->outputs[i].extension, data, best->outputs[i].size) : ERROR);
+		}
+	}
+	for (t_uint i = 0; i < PORTFOLIO_STRATEGIES; ++i)
+	{
+		Arena_Delete(&runs[i].arena);
+	}
+	return (result);
+#else
+	Log_Error(&program.logger, 0, "The `--portfolio` option is not available on this platform");
+	return (ERROR);
+#endif
+}
@@ -0,0 +1,201 @@
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/io.h>
+#include <libccc/sys/logger.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+#if PROFILING
+
+//! The display names for each of the `e_profile_counter` values
+static t_char const* const profile_counters[PROFILE_COUNTERS_AMOUNT] =
+{
+	"pixels",
+	"nearest",
+	"comparisons",
+	"allocations",
+};
+
+
+
+/*
+** ************************************************************************** *|
+**                           Stage Timing Functions                           *|
+** ************************************************************************** *|
+*/
+
+//! Returns the index of the stage of the given `name` in `profile`, adding it if needed (or `PROFILE_STAGES_MAX` if there is no room left)
+static
+t_uint Profile_FindStage(s_profile* profile, t_char const* name)
+{
+	if (profile->stages_amount == 0)
+	{   // stage 0 accumulates any counters incremented outside of a profiled stage
+		profile->stages[0].name = "(other)";
+		profile->stages_amount = 1;
+	}
+	t_uint i;
+	for (i = 0; i < profile->stages_amount; ++i)
+	{
+		if (profile->stages[i].name == name ||
+			String_Equals(profile->stages[i].name, name))
+			break;
+	}
+	if (i == profile->stages_amount)
+	{
+		if (i == PROFILE_STAGES_MAX)
+			return (PROFILE_STAGES_MAX);
+		profile->stages[i].name = name;
+		profile->stages_amount += 1;
+	}
+	return (i);
+}
+
+
+
+void Profile_Begin(t_char const* name)
+{
+	s_profile* profile = &program.profile;
+	profile->stage = name;
+	Trace_Begin(name);
+	if (!profile->enabled)
+		return;
+	t_uint i = Profile_FindStage(profile, name);
+	if (i == PROFILE_STAGES_MAX)
+		return;
+	profile->current = i;
+	profile->start_ns = Time_GetMonotonic();
+}
+
+
+
+int Profile_End(int result)
+{
+	s_profile* profile = &program.profile;
+	Trace_End(profile->stage);
+	profile->stage = NULL;
+	if (!profile->enabled || profile->current == 0)
+		return (result);
+	s_profile_stage* stage = &profile->stages[profile->current];
+	stage->time_ns += Time_GetMonotonic() - profile->start_ns;
+	stage->calls += 1;
+	profile->current = 0;
+	return (result);
+}
+
+
+
+void Profile_Merge(s_profile* dest, s_profile const* src)
+{
+	if (!dest->enabled)
+		return;
+	for (t_uint i = 0; i < src->stages_amount; ++i)
+	{
+		s_profile_stage const* stage = &src->stages[i];
+		// the work done outside any stage of the other thread (stage 0) also stays outside any stage
+		t_uint j = Profile_FindStage(dest, stage->name);
+		if (j == PROFILE_STAGES_MAX)
+			continue;
+		dest->stages[j].calls   += stage->calls;
+		dest->stages[j].time_ns += stage->time_ns;
+		for (t_uint k = 0; k < PROFILE_COUNTERS_AMOUNT; ++k)
+		{
+			dest->stages[j].counters[k] += stage->counters[k];
+		}
+	}
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                           Report Output Functions                          *|
+** ************************************************************************** *|
+*/
+
+static
+void Profile_Output_Table(s_profile const* profile)
+{
+	t_u64 total = 0;
+	for (t_uint i = 1; i < profile->stages_amount; ++i)
+	{
+		total += profile->stages[i].time_ns;
+	}
+	IO_Output_Line(IO_TEXT_BOLD"PROFILE"IO_RESET":");
+	IO_Output_Format("\t%-44s %5s %12s %6s", "stage", "calls", "time (us)", "%");
+	for (t_uint j = 0; j < PROFILE_COUNTERS_AMOUNT; ++j)
+	{
+		IO_Output_Format(" %12s", profile_counters[j]);
+	}
+	IO_Output_Line("");
+	for (t_uint i = 0; i < profile->stages_amount; ++i)
+	{
+		s_profile_stage const* stage = &profile->stages[i];
+		IO_Output_Format("\t%-44s %5u %12.1f %5.1f%%",
+			stage->name,
+			stage->calls,
+			stage->time_ns / 1000.,
+			(total ? stage->time_ns * 100. / total : 0.));
+		for (t_uint j = 0; j < PROFILE_COUNTERS_AMOUNT; ++j)
+		{
+			IO_Output_Format(" %12llu", (unsigned long long)stage->counters[j]);
+		}
+		IO_Output_Line("");
+	}
+	IO_Output_Format("\t%-44s %5s %12.1f\n", "total", "", total / 1000.);
+}
+
+static
+int Profile_Output_JSON(s_profile const* profile)
+{
+	t_fd fd = IO_Open(profile->file_json, OPEN_WRITEONLY | OPEN_CREATE | OPEN_CLEARFILE, 0644);
+	if (fd < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not open profile output file: %s", profile->file_json);
+		return (ERROR);
+	}
+	// the stage names are stringified calls, which may contain quotes: all strings are escaped
+	IO_Write_String(fd, "{\n\t\"file\": ");
+	JSON_WriteString(JSON_Write_FD, &fd, program.file_input);
+	IO_Write_String(fd, ",\n\t\"stages\": [");
+	for (t_uint i = 0; i < profile->stages_amount; ++i)
+	{
+		s_profile_stage const* stage = &profile->stages[i];
+		IO_Write_Format(fd, "%s\n\t\t{ \"name\": ", (i == 0 ? "" : ","));
+		JSON_WriteString(JSON_Write_FD, &fd, stage->name);
+		IO_Write_Format(fd, ", \"calls\": %u, \"time_ns\": %llu",
+			stage->calls,
+			(unsigned long long)stage->time_ns);
+		for (t_uint j = 0; j < PROFILE_COUNTERS_AMOUNT; ++j)
+		{
+			IO_Write_Format(fd, ", \"%s\": %llu",
+				profile_counters[j],
+				(unsigned long long)stage->counters[j]);
+		}
+		IO_Write_String(fd, " }");
+	}
+	IO_Write_String(fd, "\n\t]\n}\n");
+	IO_Close(fd);
+	LOG_SUCCESS("Wrote profile file: %s", profile->file_json);
+	return (OK);
+}
+
+
+
+int Profile_Output(void)
+{
+	s_profile const* profile = &program.profile;
+	if (!profile->enabled)
+		return (OK);
+	if (profile->file_json)
+		return (Profile_Output_JSON(profile));
+	Profile_Output_Table(profile);
+	return (OK);
+}
+
+#endif
@@ -0,0 +1,311 @@
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/logger.h>
+#include <libccc/image/color.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+//! Stores the state of the refinement of the output palettes (allocated from `program.arena`)
+typedef struct s_progressive_
+{
+	t_uint          tiles_start[NAM_TILES_MAX + 1];             //!< The index of the first histogram item of each metatile, in `colors`/`counts`
+	t_u8            colors[NAM_PIXELS_MAX];                     //!< The unique reference colors of each metatile (before any color reduction)
+	t_u16           counts[NAM_PIXELS_MAX];                     //!< The amount of pixels of each item of `colors`
+	t_u32           others[NAM_PIXELS_MAX];                     //!< Scratch: the distance of each item of `colors` to the palette being changed, without the slot being changed
+	t_u8            candidates[REFPAL_COLORS_MAX];              //!< The reference colors present in the bitmap (the only ones worth trying)
+	t_uint          candidates_amount;                          //!< The amount of items in `candidates`
+	t_u8            palettes[PAL_SUB_AMOUNT_MAX][PAL_SUB_COLORS_MAX];   //!< The current output palettes
+	t_u64           tiles_error[NAM_TILES_MAX][PAL_SUB_AMOUNT_MAX];     //!< The error of each metatile, with each palette
+	t_u64           tiles_other[NAM_TILES_MAX];                 //!< Scratch: the lowest error of each metatile, among the palettes not being changed
+	t_u8            tiles_palette[NAM_TILES_MAX];               //!< The palette with the lowest error, for each metatile
+	t_u64           error;                                      //!< The total error of the current state (the sum of the lowest error of each metatile)
+}
+s_progressive;
+
+
+
+/*
+** ************************************************************************** *|
+**                           Palette Error Functions                          *|
+** ************************************************************************** *|
+*/
+
+//! Returns the distance from the reference `color` to the nearest color of the given `palette`
+static inline
+t_u32   Progressive_Distance(t_u8 color, t_u8 const* palette, t_uint length)
+{
+	t_u32 result = (t_u32)-1;
+	for (t_uint k = 0; k < length; ++k)
+	{
+		t_u32 distance = program.ref_distances[color][palette[k]];
+		result = (distance < result ? distance : result);
+	}
+	return (result);
+}
+
+//! Computes the error of every metatile with the palette `p`
+static
+void    Progressive_TilesError(s_progressive* state, t_uint p)
+{
+	for (t_uint t = 0; t < NAM_TILES; ++t)
+	{
+		t_u64 error = 0;
+		for (t_uint i = state->tiles_start[t]; i < state->tiles_start[t + 1]; ++i)
+		{
+			error += (t_u64)state->counts[i] * Progressive_Distance(state->colors[i], state->palettes[p], PAL_SUB_COLORS);
+		}
+		state->tiles_error[t][p] = error;
+	}
+	PROFILE_COUNT(PROFILE_COMPARISONS, state->tiles_start[NAM_TILES] * PAL_SUB_COLORS);
+}
+
+//! Gives each metatile the palette with which it has the lowest error, and updates the total error
+static
+void    Progressive_Assign(s_progressive* state)
+{
+	state->error = 0;
+	for (t_uint t = 0; t < NAM_TILES; ++t)
+	{
+		t_uint best = 0;
+		for (t_uint p = 1; p < PAL_SUB_AMOUNT; ++p)
+		{
+			if (state->tiles_error[t][p] < state->tiles_error[t][best])
+				best = p;
+		}
+		state->tiles_palette[t] = (t_u8)best;
+		state->error += state->tiles_error[t][best];
+	}
+}
+
+//! Finds the color which lowers the total error the most, when put in slot `j` of palette `p` - returns TRUE if it is not the current one
+static
+t_bool  Progressive_RefineSlot(s_progressive* state, t_uint p, t_uint j)
+{
+	t_u8 palette[PAL_SUB_COLORS_MAX];
+	t_uint length = 0;
+	// the palette without slot `j`, to find the distance of each color to the rest of the palette
+	for (t_uint k = 0; k < PAL_SUB_COLORS; ++k)
+	{
+		if (k != j)
+			palette[length++] = state->palettes[p][k];
+	}
+	for (t_uint i = 0; i < state->tiles_start[NAM_TILES]; ++i)
+	{
+		state->others[i] = (length ? Progressive_Distance(state->colors[i], palette, length) : (t_u32)-1);
+	}
+	for (t_uint t = 0; t < NAM_TILES; ++t)
+	{
+		t_u64 other = (t_u64)-1;
+		for (t_uint q = 0; q < PAL_SUB_AMOUNT; ++q)
+		{
+			if (q != p && state->tiles_error[t][q] < other)
+				other = state->tiles_error[t][q];
+		}
+		state->tiles_other[t] = other;
+	}
+	t_u8  best_color = state->palettes[p][j];
+	t_u64 best_error = state->error;
+	for (t_uint c = 0; c < state->candidates_amount; ++c)
+	{
+		t_u8 color = state->candidates[c];
+		t_bool present = FALSE;
+		for (t_uint k = 0; k < PAL_SUB_COLORS; ++k)
+		{
+			if (state->palettes[p][k] == color)
+				present = TRUE;
+		}
+		if (present)
+			continue;
+		t_u64 error = 0;
+		for (t_uint t = 0; t < NAM_TILES && error < best_error; ++t)
+		{
+			t_u64 tile = 0;
+			for (t_uint i = state->tiles_start[t]; i < state->tiles_start[t + 1] && tile < state->tiles_other[t]; ++i)
+			{
+				t_u32 distance = program.ref_distances[state->colors[i]][color];
+				tile += (t_u64)state->counts[i] * (distance < state->others[i] ? distance : state->others[i]);
+			}
+			error += (tile < state->tiles_other[t] ? tile : state->tiles_other[t]);
+		}
+		PROFILE_COUNT(PROFILE_COMPARISONS, state->tiles_start[NAM_TILES]);
+		if (error < best_error)
+		{
+			best_color = color;
+			best_error = error;
+		}
+	}
+	if (best_color == state->palettes[p][j])
+		return (FALSE);
+	state->palettes[p][j] = best_color;
+	Progressive_TilesError(state, p);
+	Progressive_Assign(state);
+	return (TRUE);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                       Progressive Conversion Functions                     *|
+** ************************************************************************** *|
+*/
+
+//! Applies the current state to the output pixels and palettes, then encodes and writes all output files again
+static
+int     Progressive_Output(s_progressive const* state)
+{
+	t_u8     lookup[PAL_SUB_AMOUNT_MAX][REFPAL_COLORS_MAX];
+	t_argb32 colors[PAL_SUB_AMOUNT_MAX][PAL_SUB_COLORS_MAX];
+
+	Memory_Clear(colors, sizeof(colors));
+	for (t_uint p = 0; p < PAL_SUB_AMOUNT; ++p)
+	{
+		program.output_palettes[p].length = (t_u8)PAL_SUB_COLORS;
+		for (t_uint k = 0; k < PAL_SUB_COLORS; ++k)
+		{
+			program.output_palettes[p].colors[k] = state->palettes[p][k];
+			colors[p][k] = program.ref_palette[state->palettes[p][k]];
+		}
+		for (t_uint c = 0; c < state->candidates_amount; ++c)
+		{
+			t_u8 color = state->candidates[c];
+			t_uint nearest = 0;
+			for (t_uint k = 1; k < PAL_SUB_COLORS; ++k)
+			{
+				if (program.ref_distances[color][state->palettes[p][k]] <
+					program.ref_distances[color][state->palettes[p][nearest]])
+					nearest = k;
+			}
+			lookup[p][color] = (t_u8)(p * PAL_SUB_COLORS + nearest);
+		}
+	}
+	for (t_uint t = 0; t < NAM_TILES; ++t)
+	{
+		t_u8 const* reference = program.tiles_reference + t * NAM_TILE_PIXELS;
+		t_u8* pixels = TILE_PIXELS(t);
+		Memory_Copy(pixels, reference, NAM_TILE_PIXELS);
+		TARGET(remap_tile)(pixels, lookup[state->tiles_palette[t]]);
+	}
+	PROFILE_COUNT(PROFILE_PIXELS, NAM_TILES * NAM_TILE_PIXELS);
+	if (program.dither && Dither_Apply(state->tiles_palette, (t_argb32 const(*)[PAL_SUB_COLORS_MAX])colors))
+		return (ERROR);
+	program.outputs_amount = 0;
+	if (Metrics_Measure() ||
+		ConvertBitmap_OutputColors() ||
+		ConvertBitmap_UnpackTiles() ||
+		Output_AddBitmap(".bmp", program.output))
+		return (ERROR);
+	SDL_FreeSurface(program.output);
+	program.output = NULL;
+	if ((program.heatmap && Metrics_AddHeatmap()) ||
+		EncodeBitmap_Outputs() ||
+		(program.verify && Render_Verify()) ||
+		Output_WriteAll())
+		return (ERROR);
+	return (OK);
+}
+
+
+
+int     Progressive_Refine(void)
+{
+	t_u64 start = (Time_GetMonotonic() / 1000000);
+	if (program.file_palette)
+	{   // the output palettes were given by the user, so there is nothing to refine
+		LOG_VERBOSE("Skipping progressive refinement, since the output palettes are user-specified");
+		return (OK);
+	}
+	s_progressive* state = (s_progressive*)Arena_Allocate(&program.arena, sizeof(s_progressive));
+	if (state == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not allocate memory for progressive refinement");
+		return (ERROR);
+	}
+	// build the histogram of original reference colors of each metatile, and the error of the preview
+	t_bool present[REFPAL_COLORS_MAX] = { 0 };
+	t_u16  counts[REFPAL_COLORS_MAX] = { 0 };
+	t_u64  preview = 0;
+	t_uint length = 0;
+	state->candidates_amount = 0;
+	for (t_uint t = 0; t < NAM_TILES; ++t)
+	{
+		t_u8 const* reference = program.tiles_reference + t * NAM_TILE_PIXELS;
+		t_u8 const* pixels = TILE_PIXELS(t);
+		state->tiles_start[t] = length;
+		for (t_uint i = 0; i < NAM_TILE_PIXELS; ++i)
+		{
+			t_u8 color = reference[i];
+			t_uint p = pixels[i] / PAL_SUB_COLORS;
+			if (p < PAL_SUB_AMOUNT)
+				preview += program.ref_distances[color][program.output_palettes[p].colors[pixels[i] % PAL_SUB_COLORS]];
+			if (counts[color]++ == 0)
+				state->colors[length++] = color;
+			if (!present[color])
+			{
+				present[color] = TRUE;
+				state->candidates[state->candidates_amount++] = color;
+			}
+		}
+		for (t_uint i = state->tiles_start[t]; i < length; ++i)
+		{
+			state->counts[i] = counts[state->colors[i]];
+			counts[state->colors[i]] = 0;
+		}
+	}
+	state->tiles_start[NAM_TILES] = length;
+	PROFILE_COUNT(PROFILE_PIXELS, NAM_TILES * NAM_TILE_PIXELS);
+	// start from the greedy palettes of the preview (any palettes it left unused are filled by the refinement)
+	for (t_uint p = 0; p < PAL_SUB_AMOUNT; ++p)
+	{
+		for (t_uint k = 0; k < PAL_SUB_COLORS; ++k)
+		{
+			state->palettes[p][k] = program.output_palettes[p].colors[k];
+		}
+		Progressive_TilesError(state, p);
+	}
+	Progressive_Assign(state);
+	LOG_MESSAGE("Refining the output palettes, rewriting the outputs whenever the error is lower (preview error: %llu)...", (unsigned long long)preview);
+	t_u64 written = preview;
+	// the colorkey must stay the first color of every palette
+	t_uint fixed = (program.colorkey.occurences ? 1 : 0);
+	t_bool improved = TRUE;
+	t_bool timeout = FALSE;
+	while (improved && !timeout)
+	{
+		if (state->error < written)
+		{
+			if (Progressive_Output(state))
+				return (ERROR);
+			LOG_SUCCESS("Refined the output (error: %llu -> %llu, after %llums)",
+				(unsigned long long)written,
+				(unsigned long long)state->error,
+				(unsigned long long)((Time_GetMonotonic() / 1000000) - start));
+			written = state->error;
+		}
+		improved = FALSE;
+		for (t_uint p = 0; p < PAL_SUB_AMOUNT && !timeout; ++p)
+		for (t_uint j = fixed; j < PAL_SUB_COLORS && !timeout; ++j)
+		{
+			if (Progressive_RefineSlot(state, p, j))
+				improved = TRUE;
+			timeout = (program.progressive_budget && (Time_GetMonotonic() / 1000000) - start >= program.progressive_budget);
+		}
+	}
+	if (state->error < written)
+	{
+		if (Progressive_Output(state))
+			return (ERROR);
+		written = state->error;
+	}
+	LOG_MESSAGE("Progressive refinement %s after %llums (final error: %llu)",
+		(timeout ? "ran out of time" : "converged"),
+		(unsigned long long)((Time_GetMonotonic() / 1000000) - start),
+		(unsigned long long)written);
+	return (OK);
+}
@@ -0,0 +1,725 @@
+
+#define _POSIX_C_SOURCE 200809L
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define REFPAL_MMAP 1
+#else
+#define REFPAL_MMAP 0
+#endif
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/io.h>
+#include <libccc/sys/logger.h>
+#include <libccc/image/color.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+//! Stores the format and the colors of a reference palette file, as they are read (before being decoded)
+typedef struct s_refpal_file_
+{
+	t_char const*   filepath;                           //!< The filepath of the file being read (for error messages)
+	t_uint          version;                            //!< The `version` of the file format
+	t_uint          color_amount;                       //!< The amount of colors in the file
+	t_uint          color_size;                         //!< The size (in bytes) of one color
+	t_char          encoding[4];                        //!< The channel of each part of one color (the first channel is in the highest bits)
+	t_u8            encoding_bits[4];                   //!< The amount of bits of each channel in `encoding`
+	t_uint          colors;                             //!< The amount of items in `values`
+	t_u32           values[REFPAL_COLORS_MAX][4];       //!< The colors: either packed in `values[i][0]`, or one value per channel (see `unpacked`)
+	t_bool          unpacked[REFPAL_COLORS_MAX];        //!< If TRUE, the color was given as one value per (non-blank) channel, rather than as one integer
+}
+s_refpal_file;
+
+
+
+/*
+** ************************************************************************** *|
+**                           Color Decoding Functions                         *|
+** ************************************************************************** *|
+*/
+
+//! Checks that the `encoding` of the given file is one that can be decoded into RGB colors
+static
+int     RefPal_CheckEncoding(s_refpal_file const* file)
+{
+	t_uint total = 0;
+	t_uint found = 0;
+	for (t_uint i = 0; i < 4; ++i)
+	{
+		t_uint channel;
+		switch (file->encoding[i])
+		{   // other color models (HSL, CMYK) are not supported
+			case ' ': channel = 0; break;
+			case 'A': channel = 1; break;
+			case 'R': channel = 2; break;
+			case 'G': channel = 3; break;
+			case 'B': channel = 4; break;
+			default:  channel = 5; break;
+		}
+		if (channel == 5)
+		{
+			Log_Error(&program.logger, 0, "Reference palette file has unsupported color encoding \"%.4s\" (only RGB colors are supported): %s",
+				file->encoding, file->filepath);
+			return (ERROR);
+		}
+		if (file->encoding_bits[i] > 16)
+		{
+			Log_Error(&program.logger, 0, "Reference palette file has too many bits for channel '%c' (%u bits, maximum is 16): %s",
+				file->encoding[i], file->encoding_bits[i], file->filepath);
+			return (ERROR);
+		}
+		if (file->encoding_bits[i] > 0)
+			found |= (1 << channel);
+		total += file->encoding_bits[i];
+	}
+	if ((found & 0x1C) != 0x1C)
+	{
+		Log_Error(&program.logger, 0, "Reference palette file color encoding \"%.4s\" must have R, G and B channels: %s",
+			file->encoding, file->filepath);
+		return (ERROR);
+	}
+	if (total > 32)
+	{
+		Log_Error(&program.logger, 0, "Reference palette file colors are too large (%u bits, maximum is 32): %s",
+			total, file->filepath);
+		return (ERROR);
+	}
+	return (OK);
+}
+
+//! Returns the given channel `value` of the given amount of `bits`, scaled up/down to 8 bits
+static inline
+t_u8    RefPal_ScaleChannel(t_u32 value, t_u8 bits)
+{
+	if (bits == 0)
+		return (0);
+	t_u32 max = ((t_u32)1 << bits) - 1;
+	return ((t_u8)((value * 255 + max / 2) / max));
+}
+
+//! Decodes all the colors of the given `file` into `dest` (the first channel of the encoding is in the highest bits of a packed color)
+static
+void    RefPal_DecodeColors(t_argb32* dest, s_refpal_file const* file)
+{
+	for (t_uint i = 0; i < file->colors; ++i)
+	{
+		t_u32 channels[4] = { 0 };
+		if (file->unpacked[i])
+		{   // each value is one of the non-blank channels, in order
+			t_uint index = 0;
+			for (t_uint c = 0; c < 4; ++c)
+			{
+				if (file->encoding[c] != ' ')
+					channels[c] = file->values[i][index++];
+			}
+		}
+		else
+		{
+			t_uint shift = 0;
+			for (t_uint c = 0; c < 4; ++c)
+				shift += file->encoding_bits[c];
+			for (t_uint c = 0; c < 4; ++c)
+			{
+				shift -= file->encoding_bits[c];
+				channels[c] = (t_u32)(((t_u64)file->values[i][0] >> shift) & (((t_u64)1 << file->encoding_bits[c]) - 1));
+			}
+		}
+		t_u8 rgb[3] = { 0 };
+		for (t_uint c = 0; c < 4; ++c)
+		{
+			t_u8 value = RefPal_ScaleChannel(channels[c], file->encoding_bits[c]);
+			switch (file->encoding[c])
+			{
+				case 'R': rgb[0] = value; break;
+				case 'G': rgb[1] = value; break;
+				case 'B': rgb[2] = value; break;
+				default: break; // the alpha channel is ignored, since output colors are always opaque
+			}
+		}
+		dest[i] = Color_ARGB32_Set(0, rgb[0], rgb[1], rgb[2]);
+	}
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                          Binary File Format Functions                      *|
+** ************************************************************************** *|
+*/
+
+//! Returns the 16-bit big-endian unsigned integer at the given `data`
+static inline
+t_u16   RefPal_Read_U16(t_u8 const* data)
+{
+	return ((t_u16)((data[0] << 8) | data[1]));
+}
+
+//! Reads the header and colors of a binary `.pal` file, from the given `data`
+static
+int     RefPal_Parse_Binary(s_refpal_file* file, t_u8 const* data, t_size size)
+{
+	if (size < REFPAL_HEADER_SIZE || !Memory_Equals(data, REFPAL_MAGIC, 3))
+	{
+		Log_Error(&program.logger, 0, "Reference palette file does not start with a valid \"%s\" header: %s",
+			REFPAL_MAGIC, file->filepath);
+		return (ERROR);
+	}
+	file->version      = data[3];
+	file->color_amount = RefPal_Read_U16(data + 4);
+	file->color_size   = RefPal_Read_U16(data + 6);
+	Memory_Copy(file->encoding,      data + 8,  4);
+	Memory_Copy(file->encoding_bits, data + 12, 4);
+	if (file->version != REFPAL_VERSION)
+	{
+		Log_Error(&program.logger, 0, "Reference palette file has unsupported version %u (expected %u): %s",
+			file->version, REFPAL_VERSION, file->filepath);
+		return (ERROR);
+	}
+	if (file->color_size == 0 || file->color_size > REFPAL_COLORSIZE_MAX)
+	{
+		Log_Error(&program.logger, 0, "Reference palette file has unsupported color size %u (maximum is %u bytes): %s",
+			file->color_size, REFPAL_COLORSIZE_MAX, file->filepath);
+		return (ERROR);
+	}
+	if (file->color_amount == 0 || file->color_amount > REFPAL_COLORS_MAX)
+	{
+		Log_Error(&program.logger, 0, "Reference palette file must have between 1 and %u colors (has %u): %s",
+			REFPAL_COLORS_MAX, file->color_amount, file->filepath);
+		return (ERROR);
+	}
+	if (RefPal_CheckEncoding(file))
+		return (ERROR);
+	t_uint total = 0;
+	for (t_uint c = 0; c < 4; ++c)
+		total += file->encoding_bits[c];
+	if (total > file->color_size * 8)
+	{
+		Log_Error(&program.logger, 0, "Reference palette file color encoding needs %u bits, but colors are only %u bytes: %s",
+			total, file->color_size, file->filepath);
+		return (ERROR);
+	}
+	t_size expected = REFPAL_HEADER_SIZE + (t_size)file->color_amount * file->color_size;
+	if (size < expected)
+	{
+		Log_Error(&program.logger, 0, "Reference palette file is truncated (was %zu bytes, but its header says %zu bytes): %s",
+			size, expected, file->filepath);
+		return (ERROR);
+	}
+	if (size > expected)
+	{
+		LOG_WARNING("Reference palette file has %zu trailing bytes, which are ignored: %s",
+			size - expected, file->filepath);
+	}
+	file->colors = file->color_amount;
+	t_u8 const* color = data + REFPAL_HEADER_SIZE;
+	for (t_uint i = 0; i < file->colors; ++i)
+	{
+		t_u32 value = 0;
+		for (t_uint j = 0; j < file->color_size; ++j)
+			value = (value << 8) | *color++;
+		file->values[i][0] = value;
+		file->unpacked[i] = FALSE;
+	}
+	return (OK);
+}
+
+//! Reads a binary `.pal` file (the file is mapped in memory rather than copied, whenever possible)
+static
+int     RefPal_Read_Binary(s_refpal_file* file)
+{
+	t_fd fd = IO_Open(file->filepath, OPEN_READONLY, 0);
+	if (fd < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not open reference palette file: %s", file->filepath);
+		return (ERROR);
+	}
+	int result;
+#if REFPAL_MMAP
+	struct stat info;
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+	{
+		t_size size = (t_size)info.st_size;
+		void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		IO_Close(fd);
+		if (data == MAP_FAILED)
+		{
+			Log_Error_STD(&program.logger, 0, "Could not map reference palette file: %s", file->filepath);
+			return (ERROR);
+		}
+		result = RefPal_Parse_Binary(file, (t_u8 const*)data, size);
+		munmap(data, size);
+		return (result);
+	}
+#endif
+	t_u8* data = NULL;
+	t_sintmax size = Arena_ReadFile(&program.arena, fd, &data);
+	IO_Close(fd);
+	if (size < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not read reference palette file: %s", file->filepath);
+		return (ERROR);
+	}
+	result = RefPal_Parse_Binary(file, data, (t_size)size);
+	return (result);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                           Text File Format Functions                       *|
+** ************************************************************************** *|
+*/
+
+//! Stores the current position while parsing a TOML `.palette` file
+typedef struct s_refpal_parser_
+{
+	s_refpal_file*  file;   //!< The file being read
+	t_char const*   str;    //!< The current position in the file contents
+	t_uint          line;   //!< The current line number (for error messages)
+}
+s_refpal_parser;
+
+//! Logs an error at the current line of the file being parsed, and returns ERROR
+static
+int     RefPal_Text_Error(s_refpal_parser const* parser, t_char const* expected)
+{
+	Log_Error(&program.logger, 0, "Reference palette file has invalid syntax at line %u (expected %s): %s",
+		parser->line, expected, parser->file->filepath);
+	return (ERROR);
+}
+
+//! Skips any blank space and comments (and newlines too, if `newlines` is TRUE)
+static
+void    RefPal_Text_Skip(s_refpal_parser* parser, t_bool newlines)
+{
+	while (*parser->str)
+	{
+		if (*parser->str == ' ' || *parser->str == '\t' || *parser->str == '\r')
+			++parser->str;
+		else if (*parser->str == '#')
+		{
+			while (*parser->str && *parser->str != '\n')
+				++parser->str;
+		}
+		else if (*parser->str == '\n' && newlines)
+		{
+			++parser->str;
+			++parser->line;
+		}
+		else break;
+	}
+}
+
+//! Parses a TOML integer (decimal, or with a `0x`/`0o`/`0b` prefix, and with optional `_` digit separators)
+static
+int     RefPal_Text_Integer(s_refpal_parser* parser, t_u32* dest)
+{
+	t_char const* str = parser->str;
+	t_u32 base = 10;
+	if (str[0] == '+')
+		++str;
+	if (str[0] == '0' && (str[1] == 'x' || str[1] == 'o' || str[1] == 'b'))
+	{
+		base = (str[1] == 'x' ? 16 : (str[1] == 'o' ? 8 : 2));
+		str += 2;
+	}
+	t_u64 result = 0;
+	t_uint digits = 0;
+	for (;; ++str)
+	{
+		t_u32 digit;
+		if      (*str >= '0' && *str <= '9') digit = *str - '0';
+		else if (*str >= 'a' && *str <= 'f') digit = *str - 'a' + 10;
+		else if (*str >= 'A' && *str <= 'F') digit = *str - 'A' + 10;
+		else if (*str == '_' && digits > 0)  continue;
+		else break;
+		if (digit >= base)
+			break;
+		result = result * base + digit;
+		if (result > (t_u32)-1)
+			return (RefPal_Text_Error(parser, "an integer in the UInt32 range"));
+		++digits;
+	}
+	if (digits == 0)
+		return (RefPal_Text_Error(parser, "an integer"));
+	parser->str = str;
+	*dest = (t_u32)result;
+	return (OK);
+}
+
+//! Parses a TOML string of at most 4 characters (the rest of `dest` is filled with spaces)
+static
+int     RefPal_Text_String(s_refpal_parser* parser, t_char dest[4])
+{
+	t_char quote = *parser->str;
+	if (quote != '"' && quote != '\'')
+		return (RefPal_Text_Error(parser, "a string"));
+	t_char const* str = parser->str + 1;
+	t_uint length = 0;
+	Memory_Set(dest, ' ', 4);
+	for (; *str != quote; ++str, ++length)
+	{
+		if (*str == '\0' || *str == '\n' || length >= 4)
+			return (RefPal_Text_Error(parser, "a string of at most 4 characters"));
+		dest[length] = *str;
+	}
+	parser->str = str + 1;
+	return (OK);
+}
+
+//! Parses a TOML array of integers (which may span several lines, and may have a trailing comma)
+static
+int     RefPal_Text_Array(s_refpal_parser* parser, t_u32* dest, t_uint max, t_uint* a_count)
+{
+	if (*parser->str != '[')
+		return (RefPal_Text_Error(parser, "an array"));
+	++parser->str;
+	t_uint count = 0;
+	while (TRUE)
+	{
+		RefPal_Text_Skip(parser, TRUE);
+		if (*parser->str == ']')
+			break;
+		if (count >= max)
+			return (RefPal_Text_Error(parser, "fewer array items"));
+		if (RefPal_Text_Integer(parser, &dest[count++]))
+			return (ERROR);
+		RefPal_Text_Skip(parser, TRUE);
+		if (*parser->str == ',')
+			++parser->str;
+		else if (*parser->str != ']')
+			return (RefPal_Text_Error(parser, "',' or ']'"));
+	}
+	++parser->str;
+	*a_count = count;
+	return (OK);
+}
+
+//! Parses the `palette` array of colors: each color is either one integer, or an array with one integer per channel
+static
+int     RefPal_Text_Palette(s_refpal_parser* parser)
+{
+	s_refpal_file* file = parser->file;
+	if (*parser->str != '[')
+		return (RefPal_Text_Error(parser, "an array"));
+	++parser->str;
+	file->colors = 0;
+	while (TRUE)
+	{
+		RefPal_Text_Skip(parser, TRUE);
+		if (*parser->str == ']')
+			break;
+		if (file->colors >= REFPAL_COLORS_MAX)
+			return (RefPal_Text_Error(parser, "at most 256 colors"));
+		t_uint count;
+		t_uint i = file->colors++;
+		file->unpacked[i] = (*parser->str == '[');
+		if (file->unpacked[i] ?
+			RefPal_Text_Array(parser, file->values[i], 4, &count) :
+			RefPal_Text_Integer(parser, &file->values[i][0]))
+			return (ERROR);
+		RefPal_Text_Skip(parser, TRUE);
+		if (*parser->str == ',')
+			++parser->str;
+		else if (*parser->str != ']')
+			return (RefPal_Text_Error(parser, "',' or ']'"));
+	}
+	++parser->str;
+	return (OK);
+}
+
+//! Parses the value of the given `key` (only the keys of the spec are accepted)
+static
+int     RefPal_Text_Value(s_refpal_parser* parser, t_char const* key, t_size length)
+{
+	s_refpal_file* file = parser->file;
+	t_u32 value;
+	if (length == 7 && String_Equals_N(key, "version", length))
+	{
+		if (RefPal_Text_Integer(parser, &value))
+			return (ERROR);
+		file->version = value;
+	}
+	else if (length == 12 && String_Equals_N(key, "color_amount", length))
+	{
+		if (RefPal_Text_Integer(parser, &value))
+			return (ERROR);
+		file->color_amount = value;
+	}
+	else if (length == 10 && String_Equals_N(key, "color_size", length))
+	{
+		if (RefPal_Text_Integer(parser, &value))
+			return (ERROR);
+		file->color_size = value;
+	}
+	else if (length == 8 && String_Equals_N(key, "encoding", length))
+	{
+		if (RefPal_Text_String(parser, file->encoding))
+			return (ERROR);
+	}
+	else if (length == 13 && String_Equals_N(key, "encoding_bits", length))
+	{   // either one amount of bits for all channels, or an array of one amount per channel
+		t_u32 bits[4] = { 0 };
+		t_uint count = 0;
+		if (*parser->str == '[' ?
+			RefPal_Text_Array(parser, bits, 4, &count) :
+			RefPal_Text_Integer(parser, &bits[0]))
+			return (ERROR);
+		for (t_uint c = 0; c < 4; ++c)
+			file->encoding_bits[c] = (t_u8)(count ? bits[c] : bits[0]);
+	}
+	else if (length == 7 && String_Equals_N(key, "palette", length))
+	{
+		if (RefPal_Text_Palette(parser))
+			return (ERROR);
+	}
+	else return (RefPal_Text_Error(parser, "one of the keys: version, encoding, encoding_bits, color_size, color_amount, palette"));
+	return (OK);
+}
+
+//! Reads a TOML `.palette` file
+static
+int     RefPal_Read_Text(s_refpal_file* file)
+{
+	t_fd fd = IO_Open(file->filepath, OPEN_READONLY, 0);
+	if (fd < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not open reference palette file: %s", file->filepath);
+		return (ERROR);
+	}
+	t_u8* data = NULL;
+	t_sintmax size = Arena_ReadFile(&program.arena, fd, &data);
+	IO_Close(fd);
+	if (size < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not read reference palette file: %s", file->filepath);
+		return (ERROR);
+	}
+	s_refpal_parser parser = { .file = file, .str = (t_char const*)data, .line = 1 };
+	file->version = 0;
+	while (TRUE)
+	{
+		RefPal_Text_Skip(&parser, TRUE);
+		if (*parser.str == '\0')
+			break;
+		t_char const* key = parser.str;
+		while ((*parser.str >= 'a' && *parser.str <= 'z') || *parser.str == '_')
+			++parser.str;
+		t_size length = (t_size)(parser.str - key);
+		RefPal_Text_Skip(&parser, FALSE);
+		if (length == 0 || *parser.str != '=')
+			return (RefPal_Text_Error(&parser, "a `key = value` pair"));
+		++parser.str;
+		RefPal_Text_Skip(&parser, FALSE);
+		if (RefPal_Text_Value(&parser, key, length))
+			return (ERROR);
+		RefPal_Text_Skip(&parser, FALSE);
+		if (*parser.str != '\n' && *parser.str != '\0')
+			return (RefPal_Text_Error(&parser, "a newline after the value"));
+	}
+	if (file->version != REFPAL_VERSION)
+	{
+		Log_Error(&program.logger, 0, "Reference palette file has unsupported version %u (expected %u): %s",
+			file->version, REFPAL_VERSION, file->filepath);
+		return (ERROR);
+	}
+	if (RefPal_CheckEncoding(file))
+		return (ERROR);
+	if (file->colors != file->color_amount)
+	{
+		Log_Error(&program.logger, 0, "Reference palette file has %u colors, but its `color_amount` is %u: %s",
+			file->colors, file->color_amount, file->filepath);
+		return (ERROR);
+	}
+	return (OK);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                          Reference Palette Functions                       *|
+** ************************************************************************** *|
+*/
+
+t_uint  RefPal_LoadFile(t_argb32 dest[REFPAL_COLORS_MAX], t_char const* filepath)
+{
+	s_refpal_file file;
+	Memory_Clear(&file, sizeof(file));
+	file.filepath = filepath;
+	t_size length = String_Length(filepath);
+	t_size ext = String_Length(REFPAL_TEXTFILE(""));
+	if (length >= ext && String_Equals_IgnoreCase(filepath + length - ext, REFPAL_TEXTFILE("")) ?
+		RefPal_Read_Text(&file) :
+		RefPal_Read_Binary(&file))
+		return (0);
+	if (file.colors == 0 || file.colors > REFPAL_COLORS_MAX)
+	{
+		Log_Error(&program.logger, 0, "Reference palette file must have between 1 and %u colors (has %u): %s",
+			REFPAL_COLORS_MAX, file.colors, filepath);
+		return (0);
+	}
+	RefPal_DecodeColors(dest, &file);
+	return (file.colors);
+}
+
+
+
+//! The distances between each pair of colors of the last palette given to `RefPal_GetDistances()`
+static t_u32    refpal_distances[REFPAL_COLORS_MAX][REFPAL_COLORS_MAX];
+//! The hash of the palette for which `refpal_distances` were computed (or 0 if they were never computed)
+static t_u64    refpal_distances_hash = 0;
+
+t_u32 const (*RefPal_GetDistances(t_argb32 const* palette, t_uint colors))[REFPAL_COLORS_MAX]
+{
+	// this is only ever called from the main thread (`RefPal_Choose()` cannot be used with `--server`)
+	t_u64 hash = Hash_FNV1a(&colors, sizeof(colors), HASH_SEED);
+	hash = Hash_FNV1a(palette, colors * sizeof(t_argb32), hash);
+	if (hash == refpal_distances_hash)
+		return ((t_u32 const (*)[REFPAL_COLORS_MAX])refpal_distances);
+	Memory_Clear(refpal_distances, sizeof(refpal_distances));
+	for (t_uint i = 0; i < colors; ++i)
+	for (t_uint j = i; j < colors; ++j)
+	{   // the distance is symmetric, so only half of the table needs to be computed
+		refpal_distances[i][j] = Color_ARGB32_Difference(palette[i], palette[j]);
+		refpal_distances[j][i] = refpal_distances[i][j];
+	}
+	refpal_distances_hash = hash;
+	return ((t_u32 const (*)[REFPAL_COLORS_MAX])refpal_distances);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                      Reference Palette Candidate Functions                 *|
+** ************************************************************************** *|
+*/
+
+void    RefPal_Emphasis(t_argb32* dest, t_argb32 const* palette, t_uint colors, t_uint emphasis)
+{
+	for (t_uint i = 0; i < colors; ++i)
+	{
+		t_argb32 color = palette[i];
+		// only 64-color (NES) palettes have emphasis, and the black columns ($xE/$xF) are never affected by it
+		if (emphasis == 0 || colors != REFPAL_EMPHASIS_COLORS || (i & 0xF) >= 0xE)
+		{
+			dest[i] = color;
+			continue;
+		}
+		t_uint rgb[3] =
+		{
+			Color_ARGB32_Get_R(color),
+			Color_ARGB32_Get_G(color),
+			Color_ARGB32_Get_B(color),
+		};
+		// each emphasis bit dims the two other color channels
+		for (t_uint bit = 0; bit < 3; ++bit)
+		{
+			if (!(emphasis & (1 << bit)))
+				continue;
+			for (t_uint channel = 0; channel < 3; ++channel)
+			{
+				if (channel != bit)
+					rgb[channel] = rgb[channel] * REFPAL_EMPHASIS_DIM / 256;
+			}
+		}
+		dest[i] = Color_ARGB32_Set(Color_ARGB32_Get_A(color), rgb[0], rgb[1], rgb[2]);
+	}
+}
+
+
+
+void    RefPal_Select(t_uint base, t_uint emphasis)
+{
+	program.ref_base = base;
+	program.ref_emphasis = emphasis;
+	program.ref_colors = program.ref_bases_colors[base];
+	Memory_Clear(program.ref_palette, sizeof(program.ref_palette));
+	RefPal_Emphasis(program.ref_palette, program.ref_bases[base], program.ref_colors, emphasis);
+	// palette reduction only ever compares reference colors, so their distances are precomputed
+	program.ref_distances = RefPal_GetDistances(program.ref_palette, REFPAL_COLORS);
+	if (program.colorkey.occurences)
+	{   // the colorkey keeps the color given by the user, and its index is the nearest color of each new palette
+		t_argb32 const* nearest = Color_ARGB32_GetNearest(program.colorkey.color, program.ref_palette, REFPAL_COLORS);
+		program.colorkey.index = (nearest ? (t_u8)(nearest - program.ref_palette) : 0);
+	}
+}
+
+
+
+int     RefPal_Choose(void)
+{
+	t_uint bases = (program.files_refpal_amount ? program.files_refpal_amount : 1);
+	t_uint emphases = (program.emphasis == REFPAL_EMPHASIS_AUTO ? REFPAL_EMPHASIS_AMOUNT : 1);
+	if (bases * emphases <= 1)
+		return (OK);
+	// the histogram of the bitmap is computed once, and shared by every candidate
+	t_u32 counts[BMP_MAXCOLORS] = { 0 };
+	for (t_uint i = 0; i < NAM_TILES * NAM_TILE_PIXELS; ++i)
+	{
+		counts[program.tiles_pixels[i]] += 1;
+	}
+	PROFILE_COUNT(PROFILE_PIXELS, NAM_TILES * NAM_TILE_PIXELS);
+	SDL_Palette const* bitmap_palette = program.bitmap->format->palette;
+	t_argb32 used[BMP_MAXCOLORS];
+	t_u32    used_counts[BMP_MAXCOLORS];
+	t_uint   used_amount = 0;
+	for (int i = 0; i < bitmap_palette->ncolors && i < BMP_MAXCOLORS; ++i)
+	{
+		if (counts[i] == 0)
+			continue;
+		used[used_amount] = Color_ARGB32_Set(0,
+			bitmap_palette->colors[i].r,
+			bitmap_palette->colors[i].g,
+			bitmap_palette->colors[i].b);
+		used_counts[used_amount++] = counts[i];
+	}
+	// each candidate is scored by the error of the nearest reference color of every pixel
+	t_argb32 palette[REFPAL_COLORS_MAX];
+	t_uint best_base = 0;
+	t_uint best_emphasis = 0;
+	t_u64  best_error = (t_u64)-1;
+	for (t_uint b = 0; b < bases; ++b)
+	for (t_uint e = 0; e < emphases; ++e)
+	{
+		t_uint emphasis = (emphases == 1 ? (t_uint)program.emphasis : e);
+		t_uint colors = program.ref_bases_colors[b];
+		if (emphasis && colors != REFPAL_EMPHASIS_COLORS)
+			continue;
+		RefPal_Emphasis(palette, program.ref_bases[b], colors, emphasis);
+		t_u64 error = 0;
+		for (t_uint i = 0; i < used_amount && error < best_error; ++i)
+		{
+			t_argb32 const* nearest = Color_ARGB32_GetNearest(used[i], palette, colors);
+			if (nearest)
+				error += (t_u64)used_counts[i] * Color_ARGB32_Difference(used[i], *nearest);
+		}
+		PROFILE_COUNT(PROFILE_NEAREST, used_amount);
+		LOG_VERBOSE("Reference palette candidate %s (emphasis %u): error %llu",
+			(program.files_refpal_amount ? program.files_refpal[b] : TARGET(name)),
+			emphasis, (unsigned long long)error);
+		if (error < best_error)
+		{
+			best_base = b;
+			best_emphasis = emphasis;
+			best_error = error;
+		}
+	}
+	if (best_base != program.ref_base || best_emphasis != program.ref_emphasis)
+		RefPal_Select(best_base, best_emphasis);
+	LOG_SUCCESS("Using reference palette %s with color emphasis %u%s",
+		(program.files_refpal_amount ? program.files_refpal[best_base] : TARGET(name)),
+		best_emphasis,
+		(best_emphasis ? " (the emphasis bits of the PPU mask register must be set to match)" : ""));
+	return (OK);
+}
@@ -0,0 +1,174 @@
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/logger.h>
+#include <libccc/image/color.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+/*
+** ************************************************************************** *|
+**                            Screen Render Functions                         *|
+** ************************************************************************** *|
+*/
+
+//! Returns the color shown by the target for the given entry of a PAL file
+static
+t_argb32    Render_PaletteColor(t_u8 const* entry)
+{
+	switch (TARGET(pal_format))
+	{
+		case PAL_FORMAT_INDEX:
+			return ((entry[0] < REFPAL_COLORS) ? program.ref_palette[entry[0]] : 0);
+		case PAL_FORMAT_BGR555:
+		{
+			t_u16 bgr = (t_u16)(entry[0] | (entry[1] << 8));
+			return (Color_ARGB32_Set(0,
+				(t_u8)(((bgr >>  0) & 0x1F) << 3),
+				(t_u8)(((bgr >>  5) & 0x1F) << 3),
+				(t_u8)(((bgr >> 10) & 0x1F) << 3)));
+		}
+	}
+	return (0);
+}
+
+//! Returns the output file with the given `extension`, or NULL if the current conversion has none
+static
+s_output_file const*    Render_FindOutput(t_char const* extension)
+{
+	for (t_uint i = 0; i < program.outputs_amount; ++i)
+	{
+		if (String_Equals(program.outputs[i].extension, extension))
+			return (&program.outputs[i]);
+	}
+	return (NULL);
+}
+
+
+
+int     Render_Screen(t_u8 const* nam, t_u8 const* chr, t_uint chr_tiles, t_u8* pixels, t_sint pitch)
+{
+	t_u8 const* attributes = nam + NAM_SIZE - NAM_SIZE_ATTR;
+	t_uint      chr_per_tile = NAM_TILE / CHR_TILE;
+	t_u32       tile_mask = (TARGET(nam_palette) ? (1u << TARGET(nam_palette)) - 1 : (t_u32)-1);
+	for (t_uint y = 0; y < NAM_H_CHR; ++y)
+	for (t_uint x = 0; x < NAM_W_CHR; ++x)
+	{
+		t_u8 const* entry = nam + (y * NAM_W_CHR + x) * NAM_SIZE_TILE;
+		t_u32 index = 0;
+		for (t_size i = 0; i < NAM_SIZE_TILE; ++i)
+			index |= (t_u32)entry[i] << (i * 8);
+		t_uint palette = 0;
+		if (NAM_SIZE_ATTR == 0)
+		{   // the palette is stored in the nametable entry, above the tile index
+			if (PAL_SUB_AMOUNT > 1)
+				palette = (index >> TARGET(nam_palette)) % PAL_SUB_AMOUNT;
+			index &= tile_mask;
+		}
+		else
+		{   // each attribute byte holds the palettes of 2x2 metatiles, 2 bits each
+			t_uint tile_x = x / chr_per_tile;
+			t_uint tile_y = y / chr_per_tile;
+			t_u8 shift = (t_u8)(((tile_y % 2) * 2 + (tile_x % 2)) * 2);
+			palette = (attributes[(tile_y / 2) * NAM_W_ATTR + (tile_x / 2)] >> shift) & 0x3;
+		}
+		if (index >= chr_tiles)
+		{
+			Log_Error(&program.logger, 0, "The NAM entry at (x:%u, y:%u) uses CHR tile %u, but there are only %u CHR tiles",
+				x, y, index, chr_tiles);
+			return (ERROR);
+		}
+		TARGET(decode_tile)(pixels + (t_sint)(y * CHR_TILE) * pitch + x * CHR_TILE, pitch,
+			chr + index * CHR_SIZE_TILE,
+			(t_u8)(palette * PAL_SUB_COLORS));
+	}
+	PROFILE_COUNT(PROFILE_PIXELS, NAM_W * NAM_H);
+	return (OK);
+}
+
+
+
+int     Render_Verify(void)
+{
+	s_output_file const* bmp = Render_FindOutput(".bmp");
+	s_output_file const* chr = Render_FindOutput(CHR_FILE(""));
+	s_output_file const* nam = Render_FindOutput(NAM_FILE(""));
+	s_output_file const* pal = Render_FindOutput(PAL_FILE(""));
+	if (bmp == NULL || chr == NULL || nam == NULL || pal == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not verify the outputs: the BMP, CHR, NAM and PAL outputs are all needed");
+		return (ERROR);
+	}
+	if (nam->size != NAM_SIZE || pal->size != PAL_SIZE || chr->size % CHR_SIZE_TILE)
+	{
+		Log_Error(&program.logger, 0, "Could not verify the outputs: wrong file sizes for the target (NAM: %zu bytes, CHR: %zu bytes, PAL: %zu bytes)",
+			nam->size, chr->size, pal->size);
+		return (ERROR);
+	}
+	SDL_Surface* expected = SDL_LoadBMP_RW(SDL_RWFromConstMem(bmp->data, (int)bmp->size), TRUE);
+	if (expected == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not load the BMP output to verify it => %s\n", SDL_GetError());
+		return (ERROR);
+	}
+	int result = ERROR;
+	t_u8* rendered = (t_u8*)Arena_Allocate(&program.arena, NAM_W * NAM_H);
+	PROFILE_COUNT(PROFILE_ALLOCATIONS, 1);
+	if (rendered == NULL)
+		Log_Error(&program.logger, 0, "Could not allocate memory to render the outputs");
+	else if (expected->w != (int)NAM_W || expected->h != (int)NAM_H ||
+		expected->format->BitsPerPixel != BMP_BPP || expected->format->palette == NULL)
+		Log_Error(&program.logger, 0, "Could not verify the outputs: the BMP output is not a %ux%u indexed bitmap", NAM_W, NAM_H);
+	else if (Render_Screen(nam->data, chr->data, (t_uint)(chr->size / CHR_SIZE_TILE), rendered, (t_sint)NAM_W) == OK)
+	{
+		t_argb32 wanted[BMP_MAXCOLORS] = { 0 };
+		t_argb32 actual[BMP_MAXCOLORS] = { 0 };
+		SDL_Palette const* palette = expected->format->palette;
+		for (int i = 0; i < palette->ncolors && i < BMP_MAXCOLORS; ++i)
+			wanted[i] = Color_ARGB32_Set(0, palette->colors[i].r, palette->colors[i].g, palette->colors[i].b);
+		for (t_uint i = 0; i < PAL_COLORS; ++i)
+			actual[i] = Render_PaletteColor(pal->data + i * PAL_COLORSIZE);
+		// a BGR555 palette only keeps the 5 highest bits of each channel
+		t_argb32 mask = (TARGET(pal_format) == PAL_FORMAT_BGR555) ?
+			Color_ARGB32_Set(0, 0xF8, 0xF8, 0xF8) :
+			Color_ARGB32_Set(0, 0xFF, 0xFF, 0xFF);
+		t_uint mismatches = 0;
+		SDL_Point first = { .x=-1, .y=-1 };
+		for (t_uint y = 0; y < NAM_H; ++y)
+		{
+			t_u8 const* row_expected = (t_u8 const*)expected->pixels + (t_sint)y * expected->pitch;
+			t_u8 const* row_rendered = rendered + y * NAM_W;
+			t_uint row_mismatches = 0;
+			for (t_uint x = 0; x < NAM_W; ++x)
+				row_mismatches += (((wanted[row_expected[x]] ^ actual[row_rendered[x]]) & mask) != 0);
+			if (row_mismatches && mismatches == 0)
+			{   // only the first row with differences is searched again, to report where they start
+				for (t_uint x = 0; first.x < 0; ++x)
+					if ((wanted[row_expected[x]] ^ actual[row_rendered[x]]) & mask)
+						first = (SDL_Point){ .x=(int)x, .y=(int)y };
+			}
+			mismatches += row_mismatches;
+		}
+		PROFILE_COUNT(PROFILE_PIXELS, NAM_W * NAM_H);
+		if (mismatches)
+		{
+			t_u8 expected_pixel = ((t_u8 const*)expected->pixels)[first.y * expected->pitch + first.x];
+			Log_Error(&program.logger, 0, "The NAM/CHR/PAL outputs do not render to the BMP output: %u pixels differ, the first one at (x:%i, y:%i) is 0x%.6X instead of 0x%.6X",
+				mismatches, first.x, first.y,
+				actual[rendered[first.y * NAM_W + first.x]],
+				wanted[expected_pixel]);
+		}
+		else
+		{
+			LOG_SUCCESS("Verified the outputs: the NAM/CHR/PAL files render to the same %ux%u pixels as the BMP output.", NAM_W, NAM_H);
+			result = OK;
+		}
+	}
+	SDL_FreeSurface(expected);
+	return (result);
+}
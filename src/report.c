@@ -0,0 +1,432 @@
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/io.h>
+#include <libccc/sys/logger.h>
+#include <libccc/image/color.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+//! Stores the state of the streaming JSON writer: values are formatted straight into one fixed buffer, which is written out whenever it is full
+typedef struct s_report_writer_
+{
+	t_fd        fd;                     //!< The file to which the report is written
+	t_bool      failed;                 //!< If TRUE, a write has failed (nothing more is written)
+	t_bool      comma;                  //!< If TRUE, the next value of the current object/array must be preceded by a comma
+	t_uint      depth;                  //!< The current nesting depth of objects/arrays (for indentation)
+	t_size      length;                 //!< The amount of bytes currently held in `buffer`
+	t_char      buffer[REPORT_BUFFER];  //!< The bytes which are not written to the file yet
+}
+s_report_writer;
+
+
+
+/*
+** ************************************************************************** *|
+**                            JSON Writer Functions                           *|
+** ************************************************************************** *|
+*/
+
+//! Writes out the contents of the buffer
+static
+void    ReportWriter_Flush(s_report_writer* writer)
+{
+	if (writer->length && !writer->failed &&
+		IO_Write_Data(writer->fd, (t_u8 const*)writer->buffer, writer->length) != writer->length)
+		writer->failed = TRUE;
+	writer->length = 0;
+}
+
+//! Appends the given bytes to the buffer
+static
+void    ReportWriter_Data(s_report_writer* writer, t_char const* data, t_size size)
+{
+	while (size > 0)
+	{
+		if (writer->length == REPORT_BUFFER)
+			ReportWriter_Flush(writer);
+		t_size part = REPORT_BUFFER - writer->length;
+		if (part > size)
+			part = size;
+		Memory_Copy(writer->buffer + writer->length, data, part);
+		writer->length += part;
+		data += part;
+		size -= part;
+	}
+}
+
+//! Appends one formatted value to the buffer (formatted in place, in the free space at the end of the buffer)
+static
+void    ReportWriter_Format(s_report_writer* writer, t_char const* format, ...)
+{
+	va_list args;
+	if (REPORT_BUFFER - writer->length < REPORT_VALUE_MAX)
+		ReportWriter_Flush(writer);
+	va_start(args, format);
+	int length = vsnprintf(writer->buffer + writer->length, REPORT_BUFFER - writer->length, format, args);
+	va_end(args);
+	if (length < 0 || (t_size)length >= REPORT_BUFFER - writer->length)
+	{   // only numbers and short tokens are formatted, so this should never happen
+		writer->failed = TRUE;
+		return;
+	}
+	writer->length += (t_size)length;
+}
+
+//! Appends the given bytes to the buffer of the given writer (as a `f_json_write` function)
+static
+void    ReportWriter_JSON(void* writer, t_char const* data, t_size size)
+{
+	ReportWriter_Data((s_report_writer*)writer, data, size);
+}
+
+//! Appends the given string, as a quoted and escaped JSON string
+static
+void    ReportWriter_String(s_report_writer* writer, t_char const* str)
+{
+	JSON_WriteString(ReportWriter_JSON, writer, str);
+}
+
+//! Starts a new value in the current object (with the given `key`) or array (if `key` is NULL)
+static
+void    ReportWriter_Key(s_report_writer* writer, t_char const* key)
+{
+	if (writer->comma)
+		ReportWriter_Data(writer, ",", 1);
+	ReportWriter_Data(writer, "\n", 1);
+	for (t_uint i = 0; i < writer->depth; ++i)
+		ReportWriter_Data(writer, "\t", 1);
+	if (key)
+	{
+		ReportWriter_String(writer, key);
+		ReportWriter_Data(writer, ": ", 2);
+	}
+	writer->comma = TRUE;
+}
+
+//! Opens a new object (if `c` is '{') or array (if `c` is '[')
+static
+void    ReportWriter_Open(s_report_writer* writer, t_char const* key, t_char c)
+{
+	ReportWriter_Key(writer, key);
+	ReportWriter_Data(writer, &c, 1);
+	writer->depth += 1;
+	writer->comma = FALSE;
+}
+
+//! Closes the current object (if `c` is '}') or array (if `c` is ']')
+static
+void    ReportWriter_Close(s_report_writer* writer, t_char c)
+{
+	writer->depth -= 1;
+	ReportWriter_Data(writer, "\n", 1);
+	for (t_uint i = 0; i < writer->depth; ++i)
+		ReportWriter_Data(writer, "\t", 1);
+	ReportWriter_Data(writer, &c, 1);
+	writer->comma = TRUE;
+}
+
+//! Writes an unsigned integer value
+static
+void    ReportWriter_Uint(s_report_writer* writer, t_char const* key, t_u64 value)
+{
+	ReportWriter_Key(writer, key);
+	ReportWriter_Format(writer, "%llu", (unsigned long long)value);
+}
+
+//! Writes a fractional number value
+static
+void    ReportWriter_Float(s_report_writer* writer, t_char const* key, t_float value)
+{
+	ReportWriter_Key(writer, key);
+	ReportWriter_Format(writer, "%.4f", (double)value);
+}
+
+//! Writes a string value
+static
+void    ReportWriter_Text(s_report_writer* writer, t_char const* key, t_char const* value)
+{
+	ReportWriter_Key(writer, key);
+	ReportWriter_String(writer, value);
+}
+
+//! Writes a color value, as a "#RRGGBB" string
+static
+void    ReportWriter_Color(s_report_writer* writer, t_char const* key, t_argb32 color)
+{
+	ReportWriter_Key(writer, key);
+	ReportWriter_Format(writer, "\"#%.6X\"", (t_uint)(color & 0xFFFFFF));
+}
+
+//! Writes a palette, as an array of reference palette indices on one line
+static
+void    ReportWriter_Palette(s_report_writer* writer, t_char const* key, s_palette const* palette)
+{
+	ReportWriter_Key(writer, key);
+	ReportWriter_Data(writer, "[", 1);
+	for (t_uint i = 0; i < palette->length && i < PAL_SUB_COLORS; ++i)
+	{
+		ReportWriter_Format(writer, (i == 0 ? "%u" : ", %u"), (t_uint)palette->colors[i]);
+	}
+	ReportWriter_Data(writer, "]", 1);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                           Report Section Functions                         *|
+** ************************************************************************** *|
+*/
+
+//! Writes the dimensions and color statistics of the input bitmap (as they were before any color reduction)
+static
+void    Report_Input(s_report_writer* writer)
+{
+	s_report const* report = &program.report;
+	t_uint total = 0;
+	for (t_uint i = 0; i < BMP_MAXCOLORS; ++i)
+		total += (report->colors_used[i] != 0);
+	ReportWriter_Open(writer, "input", '{');
+	ReportWriter_Uint(writer, "width",  report->bitmap_w);
+	ReportWriter_Uint(writer, "height", report->bitmap_h);
+	ReportWriter_Uint(writer, "colors_total", total);
+	ReportWriter_Open(writer, "colors", '[');
+	for (t_uint i = 0; i < BMP_MAXCOLORS; ++i)
+	{
+		if (report->colors_used[i] == 0)
+			continue;
+		ReportWriter_Open(writer, NULL, '{');
+		ReportWriter_Uint(writer, "index", i);
+		ReportWriter_Color(writer, "color", report->colors[i]);
+		ReportWriter_Uint(writer, "occurences", report->colors_used[i]);
+		ReportWriter_Close(writer, '}');
+	}
+	ReportWriter_Close(writer, ']');
+	ReportWriter_Close(writer, '}');
+}
+
+//! Writes the unique palettes needed by the metatiles, and the output palettes which were chosen
+static
+void    Report_Palettes(s_report_writer* writer)
+{
+	ReportWriter_Open(writer, "tile_palettes", '[');
+	for (t_uint i = 0; i < program.tiles_palettes_amount; ++i)
+	{
+		ReportWriter_Open(writer, NULL, '{');
+		ReportWriter_Palette(writer, "colors", &program.tiles_palettes[i]);
+		ReportWriter_Uint(writer, "popularity", program.tiles_palettes[i].popularity);
+		ReportWriter_Close(writer, '}');
+	}
+	ReportWriter_Close(writer, ']');
+	ReportWriter_Open(writer, "output_palettes", '[');
+	for (t_uint i = 0; i < PAL_SUB_AMOUNT; ++i)
+	{
+		s_palette const* palette = &program.output_palettes[i];
+		ReportWriter_Open(writer, NULL, '{');
+		ReportWriter_Palette(writer, "colors", palette);
+		ReportWriter_Open(writer, "rgb", '[');
+		for (t_uint j = 0; j < palette->length && j < PAL_SUB_COLORS; ++j)
+			ReportWriter_Color(writer, NULL, program.ref_palette[palette->colors[j]]);
+		ReportWriter_Close(writer, ']');
+		ReportWriter_Uint(writer, "popularity", palette->popularity);
+		ReportWriter_Close(writer, '}');
+	}
+	ReportWriter_Close(writer, ']');
+}
+
+//! Writes every limit of the target which the input bitmap exceeds
+static
+void    Report_Violations(s_report_writer* writer)
+{
+	s_report const* report = &program.report;
+	ReportWriter_Open(writer, "violations", '[');
+	for (t_uint i = 0; i < NAM_TILES; ++i)
+	{
+		if (report->tiles_colors[i] <= PAL_SUB_COLORS)
+			continue;
+		ReportWriter_Open(writer, NULL, '{');
+		ReportWriter_Text(writer, "type", "tile_colors");
+		ReportWriter_Uint(writer, "x", (i % NAM_W_TILES) * NAM_TILE);
+		ReportWriter_Uint(writer, "y", (i / NAM_W_TILES) * NAM_TILE);
+		ReportWriter_Uint(writer, "colors", report->tiles_colors[i]);
+		ReportWriter_Uint(writer, "maximum", PAL_SUB_COLORS);
+		ReportWriter_Close(writer, '}');
+	}
+	if (program.tiles_palettes_amount > PAL_SUB_AMOUNT)
+	{
+		ReportWriter_Open(writer, NULL, '{');
+		ReportWriter_Text(writer, "type", "palettes");
+		ReportWriter_Uint(writer, "amount", program.tiles_palettes_amount);
+		ReportWriter_Uint(writer, "maximum", PAL_SUB_AMOUNT);
+		ReportWriter_Close(writer, '}');
+	}
+	ReportWriter_Close(writer, ']');
+}
+
+//! Writes the conversion error, in total and for each metatile which has any (see `s_metrics`)
+static
+void    Report_Metrics(s_report_writer* writer)
+{
+	s_metrics const* total = &program.metrics;
+	ReportWriter_Open(writer, "metrics", '{');
+	ReportWriter_Float(writer, "mean_delta_e", (total->pixels ? total->delta_sum / total->pixels : 0));
+	ReportWriter_Float(writer, "max_delta_e", total->delta_max);
+	ReportWriter_Float(writer, "psnr", Metrics_PSNR(total));
+	ReportWriter_Uint(writer, "changed_pixels", total->changed);
+	ReportWriter_Uint(writer, "pixels", total->pixels);
+	ReportWriter_Open(writer, "tiles", '[');
+	for (t_uint i = 0; i < NAM_TILES; ++i)
+	{
+		s_metrics const* tile = &program.metrics_tiles[i];
+		if (tile->changed == 0)
+			continue;
+		ReportWriter_Open(writer, NULL, '{');
+		ReportWriter_Uint(writer, "x", (i % NAM_W_TILES) * NAM_TILE);
+		ReportWriter_Uint(writer, "y", (i / NAM_W_TILES) * NAM_TILE);
+		ReportWriter_Float(writer, "mean_delta_e", tile->delta_sum / NAM_TILE_PIXELS);
+		ReportWriter_Float(writer, "max_delta_e", tile->delta_max);
+		ReportWriter_Uint(writer, "changed_pixels", tile->changed);
+		ReportWriter_Close(writer, '}');
+	}
+	ReportWriter_Close(writer, ']');
+	ReportWriter_Close(writer, '}');
+}
+
+//! Writes the total time spent, and the time spent in each stage (if `--profile` is enabled)
+static
+void    Report_Timings(s_report_writer* writer)
+{
+	ReportWriter_Open(writer, "timings", '{');
+	ReportWriter_Uint(writer, "total_ns", Time_GetMonotonic() - program.report.start_ns);
+#if PROFILING
+	s_profile const* profile = &program.profile;
+	if (profile->enabled)
+	{
+		ReportWriter_Open(writer, "stages", '[');
+		for (t_uint i = 1; i < profile->stages_amount; ++i)
+		{
+			ReportWriter_Open(writer, NULL, '{');
+			ReportWriter_Text(writer, "name", profile->stages[i].name);
+			ReportWriter_Uint(writer, "calls", profile->stages[i].calls);
+			ReportWriter_Uint(writer, "time_ns", profile->stages[i].time_ns);
+			ReportWriter_Close(writer, '}');
+		}
+		ReportWriter_Close(writer, ']');
+	}
+#endif
+	ReportWriter_Close(writer, '}');
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                          Conversion Report Functions                       *|
+** ************************************************************************** *|
+*/
+
+int     Report_SaveInput(void)
+{
+	s_report* report = &program.report;
+	t_u8 lookup[BMP_MAXCOLORS] = { 0 };
+	report->bitmap_w = (t_uint)program.bitmap->w;
+	report->bitmap_h = (t_uint)program.bitmap->h;
+	Memory_Clear(report->colors_used, sizeof(report->colors_used));
+	for (t_uint i = 0; i < NAM_TILES * NAM_TILE_PIXELS; ++i)
+	{
+		report->colors_used[program.tiles_pixels[i]] += 1;
+	}
+	for (t_uint i = 0; i < BMP_MAXCOLORS; ++i)
+	{
+		report->colors[i] = program.bitmap_colors[i].color;
+		if (report->colors_used[i] == 0)
+			continue;
+		t_argb32 const* nearest = Color_ARGB32_GetNearest(report->colors[i], program.ref_palette, REFPAL_COLORS);
+		PROFILE_COUNT(PROFILE_NEAREST, 1);
+		lookup[i] = (nearest ? (t_u8)(nearest - program.ref_palette) : 0);
+	}
+	// the amount of reference colors in each metatile (the colorkey counts as one of the colors of every metatile)
+	for (t_uint t = 0; t < NAM_TILES; ++t)
+	{
+		t_u64 mask[REFPAL_COLORS_MAX / 64] = { 0 };
+		t_u8 const* pixels = TILE_PIXELS(t);
+		t_uint colors = 0;
+		if (program.colorkey.occurences)
+		{
+			mask[program.colorkey.index / 64] |= 1ull << (program.colorkey.index % 64);
+			colors = 1;
+		}
+		for (t_uint i = 0; i < NAM_TILE_PIXELS; ++i)
+		{
+			t_u8 color = lookup[pixels[i]];
+			t_u64 bit = 1ull << (color % 64);
+			colors += ((mask[color / 64] & bit) == 0);
+			mask[color / 64] |= bit;
+		}
+		report->tiles_colors[t] = (t_u8)(colors > 0xFF ? 0xFF : colors);
+	}
+	PROFILE_COUNT(PROFILE_PIXELS, 2 * NAM_TILES * NAM_TILE_PIXELS);
+	return (OK);
+}
+
+
+
+int     Report_Output(void)
+{
+	if (String_Equals(program.file_output, PATH_STDIO))
+	{
+		LOG_WARNING("The conversion report is not written, since the outputs are written to stdout");
+		return (OK);
+	}
+	t_char* filepath = Arena_Concat(&program.arena, program.file_output, REPORT_FILE(""));
+	if (filepath == NULL)
+		return (ERROR);
+	s_report_writer* writer = (s_report_writer*)Arena_Allocate(&program.arena, sizeof(s_report_writer));
+	if (writer == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not allocate memory for the conversion report");
+		return (ERROR);
+	}
+	Memory_Clear(writer, offsetof(s_report_writer, buffer));
+	writer->fd = IO_Open(filepath, OPEN_WRITEONLY | OPEN_CREATE | OPEN_CLEARFILE, 0644);
+	if (writer->fd < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not open report output file: %s", filepath);
+		return (ERROR);
+	}
+	ReportWriter_Data(writer, "{", 1);
+	writer->depth = 1;
+	ReportWriter_Text(writer, "file", program.file_input);
+	ReportWriter_Text(writer, "target", TARGET(name));
+	ReportWriter_Key(writer, "cache_hit");
+	ReportWriter_Format(writer, "%s", (program.buildcache.hit ? "true" : "false"));
+	if (!program.buildcache.hit)
+	{   // the outputs restored from the build cache come with none of the information gathered while converting
+		Report_Input(writer);
+		Report_Palettes(writer);
+		Report_Violations(writer);
+		Report_Metrics(writer);
+	}
+	Report_Timings(writer);
+	ReportWriter_Close(writer, '}');
+	ReportWriter_Data(writer, "\n", 1);
+	ReportWriter_Flush(writer);
+	IO_Close(writer->fd);
+	if (writer->failed)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not write report output file: %s", filepath);
+		return (ERROR);
+	}
+	LOG_SUCCESS("Wrote report file: %s", filepath);
+	return (OK);
+}
@@ -0,0 +1,318 @@
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/logger.h>
+#include <libccc/image/color.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+//! Stores the state of the downscaling of the bitmap (allocated from `program.arena`)
+typedef struct s_scale_
+{
+	t_uint      src_unit_x;     //!< The width of one source pixel, in the units shared with `dst_unit_x`
+	t_uint      dst_unit_x;     //!< The width of one scaled pixel, in the units shared with `src_unit_x`
+	t_uint      src_unit_y;     //!< The height of one source pixel, in the units shared with `dst_unit_y`
+	t_uint      dst_unit_y;     //!< The height of one scaled pixel, in the units shared with `src_unit_y`
+	t_u8        palette[BMP_MAXCOLORS][3];      //!< The RGB colors of each pixel value (only used for indexed bitmaps)
+	t_u8      (*row)[3];        //!< The RGB colors of the source row currently being read (one item per source pixel)
+	t_u32     (*row_sums)[3];   //!< The weighted RGB sums of the source row currently being read (one item per scaled pixel)
+	t_u64     (*sums)[3];       //!< The weighted RGB sums of the scaled row currently being written (one item per scaled pixel)
+	t_u32       cache_keys[SCALE_CACHE_SIZE];   //!< The colors whose nearest reference color is cached (with the alpha bits set, so that 0 is an empty slot)
+	t_u8        cache_values[SCALE_CACHE_SIZE]; //!< The nearest reference color of each item of `cache_keys`
+}
+s_scale;
+
+
+
+/*
+** ************************************************************************** *|
+**                          Bitmap Scaling Functions                          *|
+** ************************************************************************** *|
+*/
+
+//! Returns the index of the reference color nearest to the given (alpha-less) `color`, using a direct-mapped cache
+static inline
+t_u8    Scale_Nearest(s_scale* scale, t_argb32 color)
+{
+	t_u32 key = (t_u32)color | 0xFF000000;
+	t_uint slot = (t_uint)(((t_u32)color * 2654435761u) >> 20) % SCALE_CACHE_SIZE;
+	if (scale->cache_keys[slot] == key)
+		return (scale->cache_values[slot]);
+	t_argb32 const* nearest = Color_ARGB32_GetNearest(color, program.ref_palette, REFPAL_COLORS);
+	PROFILE_COUNT(PROFILE_NEAREST, 1);
+	scale->cache_keys[slot] = key;
+	scale->cache_values[slot] = (nearest ? (t_u8)(nearest - program.ref_palette) : 0);
+	return (scale->cache_values[slot]);
+}
+
+//! Reads source row `y` of the bitmap (in any pixel format) into `scale->row`, as 8-bit RGB
+static
+void    Scale_ReadRow(s_scale* scale, SDL_Surface const* bitmap, t_uint y)
+{
+	SDL_PixelFormat const* format = bitmap->format;
+	t_u8 const* row = (t_u8 const*)bitmap->pixels + (t_size)y * (t_size)bitmap->pitch;
+	t_uint width = (t_uint)bitmap->w;
+	if (format->palette)
+	{   // indexed bitmaps have 1, 2, 4 or 8 bits per pixel (packed most significant bits first, as in BMP files)
+		t_uint bits = format->BitsPerPixel;
+		t_uint mask = (1u << bits) - 1;
+		for (t_uint x = 0; x < width; ++x)
+		{
+			t_uint index = (bits == 8) ? row[x] :
+				(row[x * bits / 8] >> (8 - bits - (x * bits) % 8)) & mask;
+			Memory_Copy(scale->row[x], scale->palette[index], 3);
+		}
+	}
+	else if (format->BytesPerPixel == 4 && !format->Rloss && !format->Gloss && !format->Bloss)
+	{   // the common case of 8-bit channels is read with shifts only
+		for (t_uint x = 0; x < width; ++x)
+		{
+			t_u32 pixel;
+			Memory_Copy(&pixel, row + x * 4, 4);
+			scale->row[x][0] = (t_u8)(pixel >> format->Rshift);
+			scale->row[x][1] = (t_u8)(pixel >> format->Gshift);
+			scale->row[x][2] = (t_u8)(pixel >> format->Bshift);
+		}
+	}
+	else
+	{
+		t_uint bytes = format->BytesPerPixel;
+		for (t_uint x = 0; x < width; ++x)
+		{
+			t_u8 const* p = row + x * bytes;
+			t_u32 pixel = 0;
+			if (bytes == 3)
+			{
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+				pixel = (t_u32)p[0] | ((t_u32)p[1] << 8) | ((t_u32)p[2] << 16);
+#else
+				pixel = ((t_u32)p[0] << 16) | ((t_u32)p[1] << 8) | (t_u32)p[2];
+#endif
+			}
+			else if (bytes == 2)
+			{
+				t_u16 value;
+				Memory_Copy(&value, p, 2);
+				pixel = value;
+			}
+			else Memory_Copy(&pixel, p, 4);
+			SDL_GetRGB(pixel, format, &scale->row[x][0], &scale->row[x][1], &scale->row[x][2]);
+		}
+	}
+	PROFILE_COUNT(PROFILE_PIXELS, width);
+}
+
+//! Returns the length of the overlap of source pixel `i` and scaled pixel `x` (in the units given)
+static inline
+t_uint  Scale_Overlap(t_uint i, t_uint x, t_uint src_unit, t_uint dst_unit)
+{
+	t_uint start = (i * src_unit > x * dst_unit) ? i * src_unit : x * dst_unit;
+	t_uint end = ((i + 1) * src_unit < (x + 1) * dst_unit) ? (i + 1) * src_unit : (x + 1) * dst_unit;
+	return (end > start ? end - start : 0);
+}
+
+//! Sums up the colors of `scale->row` covered by each scaled pixel, weighted by how much of each source pixel is covered
+static
+void    Scale_SumRow(s_scale* scale, t_uint src_w, t_uint dst_w)
+{
+	t_uint su = scale->src_unit_x;
+	t_uint du = scale->dst_unit_x;
+	for (t_uint x = 0; x < dst_w; ++x)
+	{
+		t_uint first = x * du / su;
+		t_uint last = ((x + 1) * du + su - 1) / su;
+		if (last > src_w)
+			last = src_w;
+		t_u32 r = 0, g = 0, b = 0;
+		for (t_uint i = first; i < last; ++i)
+		{
+			t_u32 weight = Scale_Overlap(i, x, su, du);
+			r += weight * scale->row[i][0];
+			g += weight * scale->row[i][1];
+			b += weight * scale->row[i][2];
+		}
+		scale->row_sums[x][0] = r;
+		scale->row_sums[x][1] = g;
+		scale->row_sums[x][2] = b;
+	}
+}
+
+//! Writes scaled row `y`: each pixel averages every source pixel it covers (in proportion to the area covered)
+static
+void    Scale_AverageRow(s_scale* scale, SDL_Surface const* bitmap, t_u8* dest, t_uint y, t_uint dst_w)
+{
+	t_uint su = scale->src_unit_y;
+	t_uint du = scale->dst_unit_y;
+	t_uint first = y * du / su;
+	t_uint last = ((y + 1) * du + su - 1) / su;
+	if (last > (t_uint)bitmap->h)
+		last = (t_uint)bitmap->h;
+	Memory_Clear(scale->sums, dst_w * sizeof(*scale->sums));
+	for (t_uint i = first; i < last; ++i)
+	{
+		t_u64 weight = Scale_Overlap(i, y, su, du);
+		Scale_ReadRow(scale, bitmap, i);
+		Scale_SumRow(scale, (t_uint)bitmap->w, dst_w);
+		// this loop only has contiguous multiply-adds, so that the compiler can vectorize it
+		t_u32 const* sums_row = &scale->row_sums[0][0];
+		t_u64* sums = &scale->sums[0][0];
+		for (t_uint j = 0; j < dst_w * 3; ++j)
+		{
+			sums[j] += weight * sums_row[j];
+		}
+	}
+	// every scaled pixel covers the same total area, so the sums are all divided alike
+	t_u64 total = (t_u64)scale->dst_unit_x * (t_u64)scale->dst_unit_y;
+	for (t_uint x = 0; x < dst_w; ++x)
+	{
+		t_argb32 color = Color_ARGB32_Set(0,
+			(t_u8)((scale->sums[x][0] + total / 2) / total),
+			(t_u8)((scale->sums[x][1] + total / 2) / total),
+			(t_u8)((scale->sums[x][2] + total / 2) / total));
+		dest[x] = Scale_Nearest(scale, color);
+	}
+}
+
+//! Writes scaled row `y`: each pixel takes the color of the source pixel at its center
+static
+void    Scale_SampleRow(s_scale* scale, SDL_Surface const* bitmap, t_u8* dest, t_uint y, t_uint dst_w)
+{
+	t_uint source_y = (y * scale->dst_unit_y + scale->dst_unit_y / 2) / scale->src_unit_y;
+	Scale_ReadRow(scale, bitmap, source_y);
+	for (t_uint x = 0; x < dst_w; ++x)
+	{
+		t_uint source_x = (x * scale->dst_unit_x + scale->dst_unit_x / 2) / scale->src_unit_x;
+		t_u8 const* rgb = scale->row[source_x];
+		dest[x] = Scale_Nearest(scale, Color_ARGB32_Set(0, rgb[0], rgb[1], rgb[2]));
+	}
+}
+
+
+
+e_scale Scale_Find(t_char const* name)
+{
+	static t_char const* const names[SCALE_AMOUNT] =
+	{
+		[SCALE_NONE]    = "none",
+		[SCALE_NEAREST] = "nearest",
+		[SCALE_BOX]     = "box",
+		[SCALE_AREA]    = "area",
+	};
+	for (t_uint i = 0; i < SCALE_AMOUNT; ++i)
+	{
+		if (String_Equals_IgnoreCase(name, names[i]))
+			return ((e_scale)i);
+	}
+	return (SCALE_AMOUNT);
+}
+
+
+
+int     Scale_Bitmap(void)
+{
+	SDL_Surface* bitmap = program.bitmap;
+	t_uint src_w = (t_uint)bitmap->w;
+	t_uint src_h = (t_uint)bitmap->h;
+	t_uint dst_w = NAM_W;
+	t_uint dst_h = NAM_H;
+	if (src_w == 0 || src_h == 0)
+	{
+		Log_Error(&program.logger, 0, "Cannot scale an empty bitmap (%ux%u)", src_w, src_h);
+		return (ERROR);
+	}
+	s_scale* scale = (s_scale*)Arena_Allocate(&program.arena, sizeof(s_scale));
+	if (scale == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not allocate memory for scaling the bitmap");
+		return (ERROR);
+	}
+	Memory_Clear(scale, sizeof(s_scale));
+	if (program.scale == SCALE_AREA)
+	{   // the bitmap is stretched to exactly the output size: source pixels are `NAM_W` units wide, scaled ones are `src_w` units wide
+		scale->src_unit_x = dst_w;  scale->dst_unit_x = src_w;
+		scale->src_unit_y = dst_h;  scale->dst_unit_y = src_h;
+	}
+	else
+	{   // the bitmap is shrunk by the largest whole factor which still covers the output, keeping its aspect ratio
+		t_uint factor = (src_w / dst_w < src_h / dst_h) ? src_w / dst_w : src_h / dst_h;
+		if (factor == 0)
+		{
+			LOG_WARNING("BMP file (%ux%u) is smaller than the output (%ux%u), it is not scaled down",
+				src_w, src_h, dst_w, dst_h);
+			factor = 1;
+		}
+		if (src_w % factor || src_h % factor)
+		{
+			LOG_WARNING("BMP file dimensions (%ux%u) are not a multiple of the scale factor (%u): the last %u columns and %u rows are ignored",
+				src_w, src_h, factor, src_w % factor, src_h % factor);
+		}
+		scale->src_unit_x = 1;  scale->dst_unit_x = factor;
+		scale->src_unit_y = 1;  scale->dst_unit_y = factor;
+		dst_w = src_w / factor;
+		dst_h = src_h / factor;
+	}
+	scale->row      = (t_u8 (*)[3])Arena_Allocate(&program.arena, src_w * sizeof(*scale->row));
+	scale->row_sums = (t_u32(*)[3])Arena_Allocate(&program.arena, dst_w * sizeof(*scale->row_sums));
+	scale->sums     = (t_u64(*)[3])Arena_Allocate(&program.arena, dst_w * sizeof(*scale->sums));
+	if (scale->row == NULL || scale->row_sums == NULL || scale->sums == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not allocate memory for scaling the bitmap");
+		return (ERROR);
+	}
+	if (bitmap->format->palette)
+	{
+		SDL_Palette const* palette = bitmap->format->palette;
+		for (int i = 0; i < palette->ncolors && i < BMP_MAXCOLORS; ++i)
+		{
+			scale->palette[i][0] = palette->colors[i].r;
+			scale->palette[i][1] = palette->colors[i].g;
+			scale->palette[i][2] = palette->colors[i].b;
+		}
+	}
+	// the scaled bitmap uses the reference palette, so its pixels are mapped to reference colors as they are written
+	SDL_Surface* result = SDL_CreateRGBSurfaceWithFormat(0, (int)dst_w, (int)dst_h, BMP_BPP, SDL_PIXELFORMAT_INDEX8);
+	PROFILE_COUNT(PROFILE_ALLOCATIONS, 1);
+	if (result == NULL)
+	{
+		Log_Error(&program.logger, 0, "Could not create scaled bitmap which is %ux%u pixels => %s\n",
+			dst_w, dst_h, SDL_GetError());
+		return (ERROR);
+	}
+	SDL_Color colors[REFPAL_COLORS_MAX];
+	for (t_uint i = 0; i < REFPAL_COLORS; ++i)
+	{
+		colors[i] = (SDL_Color)
+		{
+			.r = Color_ARGB32_Get_R(program.ref_palette[i]),
+			.g = Color_ARGB32_Get_G(program.ref_palette[i]),
+			.b = Color_ARGB32_Get_B(program.ref_palette[i]),
+			.a = 0xFF,
+		};
+	}
+	if (result->format->palette == NULL ||
+		SDL_SetPaletteColors(result->format->palette, colors, 0, (int)REFPAL_COLORS))
+	{
+		Log_Error(&program.logger, 0, "Could not set palette for scaled bitmap => %s\n", SDL_GetError());
+		SDL_FreeSurface(result);
+		return (ERROR);
+	}
+	for (t_uint y = 0; y < dst_h; ++y)
+	{
+		t_u8* dest = (t_u8*)result->pixels + (t_size)y * (t_size)result->pitch;
+		if (program.scale == SCALE_NEAREST)
+			Scale_SampleRow(scale, bitmap, dest, y, dst_w);
+		else Scale_AverageRow(scale, bitmap, dest, y, dst_w);
+	}
+	PROFILE_COUNT(PROFILE_PIXELS, dst_w * dst_h);
+	LOG_SUCCESS("Scaled the BMP file from %ux%u down to %ux%u (%s)",
+		src_w, src_h, dst_w, dst_h,
+		(program.scale == SCALE_NEAREST ? "nearest" : program.scale == SCALE_BOX ? "box" : "area-average"));
+	SDL_FreeSurface(program.bitmap);
+	program.bitmap = result;
+	return (OK);
+}
@@ -0,0 +1,504 @@
+
+#define _POSIX_C_SOURCE 200809L
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/logger.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+#if defined(__unix__) || defined(__APPLE__)
+
+//! Stores one unit of work for the server's worker threads
+typedef struct s_server_job_
+{
+	int     fd;         //!< The file descriptor to which the response(s) should be written
+	t_char* request;    //!< The request to handle - if NULL, then `fd` is a connection, whose requests are all handled in order
+}
+s_server_job;
+
+//! Stores the counters which are reported by a `stats` request
+typedef struct s_server_stats_
+{
+	atomic_ullong   requests;           //!< The amount of `convert` requests handled
+	atomic_ullong   errors;             //!< The amount of `convert` requests which failed
+	atomic_ullong   time_ns;            //!< The total time spent converting
+	atomic_ullong   time_max_ns;        //!< The longest time spent on one conversion
+	atomic_ullong   buildcache_hits;    //!< The amount of conversions which were restored from the `--cache_dir` build cache
+	atomic_ullong   tilecache_hits;     //!< The amount of per-tile results which were found in a worker's tile cache
+	atomic_ullong   tilecache_misses;   //!< The amount of per-tile results which had to be computed
+}
+s_server_stats;
+
+//! Stores the state which is shared between all the server's threads
+typedef struct s_server_
+{
+	pthread_mutex_t lock;                       //!< Protects the job queue
+	pthread_cond_t  pushed;                     //!< Signaled whenever a job is pushed into the queue
+	pthread_cond_t  popped;                     //!< Signaled whenever a job is popped from the queue
+	s_server_job    queue[SERVER_QUEUE_SIZE];   //!< The ring buffer of pending jobs
+	t_size          queue_start;                //!< The index of the oldest pending job in `queue`
+	t_size          queue_amount;               //!< The amount of pending jobs in `queue`
+	t_bool          closed;                     //!< If TRUE, no more jobs will be pushed (workers exit once the queue is empty)
+	pthread_mutex_t output_lock;                //!< Ensures that responses written to a shared output (ie: stdout) are not interleaved
+	s_program const* shared;                    //!< The state of the main thread, copied by each worker when it starts
+	t_uint          workers;                    //!< The amount of worker threads
+	s_server_stats  stats;                      //!< The counters reported by the `stats` request
+}
+s_server;
+
+static s_server server =
+{
+	.lock        = PTHREAD_MUTEX_INITIALIZER,
+	.pushed      = PTHREAD_COND_INITIALIZER,
+	.popped      = PTHREAD_COND_INITIALIZER,
+	.output_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+
+/*
+** ************************************************************************** *|
+**                             Job Queue Functions                            *|
+** ************************************************************************** *|
+*/
+
+static
+void    Server_PushJob(s_server_job job)
+{
+	pthread_mutex_lock(&server.lock);
+	while (server.queue_amount == SERVER_QUEUE_SIZE)
+		pthread_cond_wait(&server.popped, &server.lock);
+	server.queue[(server.queue_start + server.queue_amount) % SERVER_QUEUE_SIZE] = job;
+	server.queue_amount += 1;
+	pthread_cond_signal(&server.pushed);
+	pthread_mutex_unlock(&server.lock);
+}
+
+//! Waits for a job - returns FALSE once the queue is closed and empty
+static
+t_bool  Server_PopJob(s_server_job* job)
+{
+	pthread_mutex_lock(&server.lock);
+	while (server.queue_amount == 0 && !server.closed)
+		pthread_cond_wait(&server.pushed, &server.lock);
+	if (server.queue_amount == 0)
+	{
+		pthread_mutex_unlock(&server.lock);
+		return (FALSE);
+	}
+	*job = server.queue[server.queue_start];
+	server.queue_start = (server.queue_start + 1) % SERVER_QUEUE_SIZE;
+	server.queue_amount -= 1;
+	pthread_cond_signal(&server.popped);
+	pthread_mutex_unlock(&server.lock);
+	return (TRUE);
+}
+
+static
+void    Server_CloseQueue(void)
+{
+	pthread_mutex_lock(&server.lock);
+	server.closed = TRUE;
+	pthread_cond_broadcast(&server.pushed);
+	pthread_mutex_unlock(&server.lock);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                           Frame Protocol Functions                         *|
+** ************************************************************************** *|
+*/
+
+//! Reads exactly `size` bytes - returns ERROR on failure, or if the end of the stream is reached first
+static
+int     Server_ReadAll(int fd, void* data, t_size size)
+{
+	t_size total = 0;
+	while (total < size)
+	{
+		ssize_t result = read(fd, (t_u8*)data + total, size - total);
+		if (result <= 0)
+			return (ERROR);
+		total += result;
+	}
+	return (OK);
+}
+
+static
+int     Server_WriteAll(int fd, void const* data, t_size size)
+{
+	t_size total = 0;
+	while (total < size)
+	{
+		ssize_t result = write(fd, (t_u8 const*)data + total, size - total);
+		if (result <= 0)
+			return (ERROR);
+		total += result;
+	}
+	return (OK);
+}
+
+
+
+//! Reads one frame (a 32-bit little-endian length, then that many bytes), as a newly allocated string
+static
+t_char* Server_ReadFrame(int fd)
+{
+	t_u8 header[4];
+	if (Server_ReadAll(fd, header, sizeof(header)))
+		return (NULL);
+	t_u32 length = header[0] | (header[1] << 8) | (header[2] << 16) | ((t_u32)header[3] << 24);
+	if (length > SERVER_REQUEST_MAX)
+	{
+		Log_Error(&program.logger, 0, "Server request is too large (%u bytes, maximum is %u)",
+			length, SERVER_REQUEST_MAX);
+		return (NULL);
+	}
+	t_char* request = (t_char*)Memory_Allocate(length + 1);
+	if (request == NULL)
+		return (NULL);
+	if (Server_ReadAll(fd, request, length))
+	{
+		Memory_Free(request);
+		return (NULL);
+	}
+	request[length] = '\0';
+	return (request);
+}
+
+//! Writes one frame (a 32-bit little-endian length, then the `response` string)
+static
+int     Server_WriteFrame(int fd, t_char const* response)
+{
+	t_u32 length = String_Length(response);
+	t_u8 header[4] =
+	{
+		(t_u8)(length),
+		(t_u8)(length >> 8),
+		(t_u8)(length >> 16),
+		(t_u8)(length >> 24),
+	};
+	if (Server_WriteAll(fd, header, sizeof(header)) ||
+		Server_WriteAll(fd, response, length))
+		return (ERROR);
+	return (OK);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                           Request Handling Functions                       *|
+** ************************************************************************** *|
+*/
+
+//! Splits off the next tab-separated field of a request (the request string is modified in-place)
+static
+t_char* Server_NextField(t_char** a_str)
+{
+	t_char* field = *a_str;
+	if (field == NULL)
+		return (NULL);
+	t_char* tab = String_Find_Char(field, '\t');
+	if (tab)
+	{
+		*tab = '\0';
+		*a_str = tab + 1;
+	}
+	else *a_str = NULL;
+	return (field);
+}
+
+
+
+static
+t_char* Server_HandleConvert(t_char const* id, t_char* args)
+{
+	t_char const* input  = Server_NextField(&args);
+	t_char const* output = Server_NextField(&args);
+	if (input == NULL || input[0] == '\0')
+		return (String_Format("%s\tERROR\texpected an input filepath", id));
+	// stdin/stdout belong to the server (with `-S=-`, they carry the protocol frames), so no request may use them
+	if (String_Equals(input, PATH_STDIO) || (output && String_Equals(output, PATH_STDIO)))
+		return (String_Format("%s\tERROR\tthe input and output filepaths cannot be `%s` in server mode", id, PATH_STDIO));
+	t_char* file_output = NULL;
+	if (output == NULL || output[0] == '\0')
+	{   // same default as the commandline: the input filepath, without its file extension
+		int extension = String_IndexOf_R_Char(input, '.');
+		output = file_output = String_Sub(input, 0, extension);
+	}
+	program.file_input = input;
+	program.file_output = output;
+	t_size tilecache_hits   = program.tilecache.hits;
+	t_size tilecache_misses = program.tilecache.misses;
+	t_u64 start = Time_GetMonotonic();
+	int result = Program_Convert();
+	t_u64 time_ns = Time_GetMonotonic() - start;
+	t_bool buildcache_hit = program.buildcache.hit;
+	Program_Reset();
+	program.file_input = NULL;
+	program.file_output = NULL;
+	Memory_Free(file_output);
+
+	atomic_fetch_add(&server.stats.requests, 1);
+	atomic_fetch_add(&server.stats.errors, (result ? 1 : 0));
+	atomic_fetch_add(&server.stats.time_ns, time_ns);
+	unsigned long long time_max = atomic_load(&server.stats.time_max_ns);
+	while (time_max < time_ns &&
+		!atomic_compare_exchange_weak(&server.stats.time_max_ns, &time_max, time_ns))
+		continue;
+	atomic_fetch_add(&server.stats.buildcache_hits, (buildcache_hit ? 1 : 0));
+	atomic_fetch_add(&server.stats.tilecache_hits,   program.tilecache.hits   - tilecache_hits);
+	atomic_fetch_add(&server.stats.tilecache_misses, program.tilecache.misses - tilecache_misses);
+	return (String_Format("%s\t%s\t%llu", id, (result ? "ERROR" : "OK"),
+		(unsigned long long)(time_ns / 1000)));
+}
+
+static
+t_char* Server_HandleStats(t_char const* id)
+{
+	unsigned long long requests = atomic_load(&server.stats.requests);
+	unsigned long long time_ns  = atomic_load(&server.stats.time_ns);
+	return (String_Format("%s\tSTATS\t{"
+			"\"workers\":%u,"
+			"\"requests\":%llu,"
+			"\"errors\":%llu,"
+			"\"latency_mean_us\":%llu,"
+			"\"latency_max_us\":%llu,"
+			"\"buildcache_hits\":%llu,"
+			"\"tilecache_hits\":%llu,"
+			"\"tilecache_misses\":%llu}",
+		id,
+		server.workers,
+		requests,
+		(unsigned long long)atomic_load(&server.stats.errors),
+		(requests ? time_ns / requests / 1000 : 0),
+		(unsigned long long)atomic_load(&server.stats.time_max_ns) / 1000,
+		(unsigned long long)atomic_load(&server.stats.buildcache_hits),
+		(unsigned long long)atomic_load(&server.stats.tilecache_hits),
+		(unsigned long long)atomic_load(&server.stats.tilecache_misses)));
+}
+
+//! Handles one request (`ID \t COMMAND [\t ARGS...]`), and returns the response, as a newly allocated string
+static
+t_char* Server_HandleRequest(t_char* request)
+{
+	t_char const* id = Server_NextField(&request);
+	t_char const* command = Server_NextField(&request);
+	if (command == NULL)
+		return (String_Format("%s\tERROR\texpected a command", id));
+	if (String_Equals(command, "convert"))
+		return (Server_HandleConvert(id, request));
+	if (String_Equals(command, "stats"))
+		return (Server_HandleStats(id));
+	return (String_Format("%s\tERROR\tunknown command: %s", id, command));
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                            Worker Thread Functions                         *|
+** ************************************************************************** *|
+*/
+
+//! Sets up the given `context` as the calling thread's own copy of the program state, from the (already initialized) main thread's state
+static
+void    Server_InitWorker(s_program* context)
+{
+	Memory_Copy(context, server.shared, sizeof(s_program));
+	program_context = context;
+	// every worker has its own scratch memory and tile cache, which stay warm between requests
+	program.arena = (s_arena){ 0 };
+	program.tilecache = (s_tilecache){ .enabled = TRUE };
+	program.buildcache.file_deps = NULL;
+	program.file_input = NULL;
+	program.file_output = NULL;
+	program.bitmap = NULL;
+	program.output = NULL;
+#if PROFILING
+	// the worker's timings are added to the main thread's profile once it is joined, by `Server_Run()`
+	program.profile = (s_profile){ .enabled = server.shared->profile.enabled };
+#endif
+}
+
+static
+void*   Server_Worker(void* arg)
+{
+	s_server_job job;
+	t_char* response;
+
+	Server_InitWorker((s_program*)arg);
+#if PROFILING
+	Trace_SetThreadName("server worker");
+#endif
+	while (Server_PopJob(&job))
+	{
+		if (job.request)
+		{   // a single request, whose response goes to a shared output
+			response = Server_HandleRequest(job.request);
+			pthread_mutex_lock(&server.output_lock);
+			Server_WriteFrame(job.fd, (response ? response : "\tERROR\tout of memory"));
+			pthread_mutex_unlock(&server.output_lock);
+			Memory_Free(response);
+			Memory_Free(job.request);
+			continue;
+		}
+		// a connection, whose requests are handled in order until the client closes it
+		t_char* request;
+		while ((request = Server_ReadFrame(job.fd)))
+		{
+			response = Server_HandleRequest(request);
+			Memory_Free(request);
+			if (Server_WriteFrame(job.fd, (response ? response : "\tERROR\tout of memory")))
+			{
+				Memory_Free(response);
+				break;
+			}
+			Memory_Free(response);
+		}
+		close(job.fd);
+	}
+	Program_Reset();
+	TileCache_Delete(&program.tilecache);
+	Arena_Delete(&program.arena);
+	program_context = &program_main;
+#if PROFILING
+	Trace_EndThread();
+#endif
+	return (NULL);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                            Server Mode Functions                           *|
+** ************************************************************************** *|
+*/
+
+//! Reads length-prefixed requests from stdin until the end of the stream, and writes responses to stdout
+static
+int     Server_Run_Stdio(void)
+{
+	t_char* request;
+	while ((request = Server_ReadFrame(STDIN_FILENO)))
+	{
+		Server_PushJob((s_server_job){ .fd = STDOUT_FILENO, .request = request });
+	}
+	return (OK);
+}
+
+//! Accepts connections on the Unix domain socket at the given `path`, until an error occurs
+static
+int     Server_Run_Socket(t_char const* path)
+{
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	if (String_Length(path) >= sizeof(address.sun_path))
+	{
+		Log_Error(&program.logger, 0, "Server socket path is too long: %s", path);
+		return (ERROR);
+	}
+	String_Copy(address.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not create server socket");
+		return (ERROR);
+	}
+	unlink(path); // remove the socket file left over by a previous server, if any
+	if (bind(fd, (struct sockaddr const*)&address, sizeof(address)) ||
+		listen(fd, SOMAXCONN))
+	{
+		Log_Error_STD(&program.logger, 0, "Could not listen on server socket: %s", path);
+		close(fd);
+		return (ERROR);
+	}
+	LOG_MESSAGE("Listening for conversion requests on: %s", path);
+	int connection;
+	while ((connection = accept(fd, NULL, NULL)) >= 0)
+	{
+		Server_PushJob((s_server_job){ .fd = connection, .request = NULL });
+	}
+	Log_Error_STD(&program.logger, 0, "Could not accept connection on server socket: %s", path);
+	close(fd);
+	unlink(path);
+	return (ERROR);
+}
+
+
+
+int     Server_Run(t_char const* address)
+{
+	pthread_t workers[SERVER_WORKERS_MAX];
+	s_program* contexts[SERVER_WORKERS_MAX];
+	pthread_attr_t attr;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	t_bool use_stdio = String_Equals(address, "-");
+	if (use_stdio)
+	{   // stdout is used for responses, so logs must go elsewhere
+		program.logger.fd = STDERR;
+	}
+	server.shared = &program;
+	server.workers = (cpus < 1 ? 1 : (cpus > SERVER_WORKERS_MAX ? SERVER_WORKERS_MAX : (t_uint)cpus));
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, sizeof(s_program) + SERVER_WORKER_STACK);
+	t_uint started = 0;
+	for (; started < server.workers; ++started)
+	{   // each worker has its own copy of the (large) program state
+		contexts[started] = (s_program*)Memory_Allocate(sizeof(s_program));
+		if (contexts[started] == NULL)
+			break;
+		if (pthread_create(&workers[started], &attr, Server_Worker, contexts[started]))
+		{
+			Memory_Free(contexts[started]);
+			break;
+		}
+	}
+	pthread_attr_destroy(&attr);
+	if (started == 0)
+	{
+		Log_Error(&program.logger, 0, "Could not start any server worker thread");
+		return (ERROR);
+	}
+	server.workers = started;
+	LOG_VERBOSE("Started %u server worker threads", started);
+	int result = (use_stdio ? Server_Run_Stdio() : Server_Run_Socket(address));
+	Server_CloseQueue();
+	for (t_uint i = 0; i < started; ++i)
+	{
+		pthread_join(workers[i], NULL);
+#if PROFILING
+		Profile_Merge(&program.profile, &contexts[i]->profile);
+#endif
+		Memory_Free(contexts[i]);
+	}
+	return (result);
+}
+
+#else
+
+int     Server_Run(t_char const* address)
+{
+	(void)address;
+	Log_Error(&program.logger, 0, "The `--server` option is not available on this platform");
+	return (ERROR);
+}
+
+#endif
@@ -0,0 +1,237 @@
+
+#include <libccc.h>
+#include <libccc/string.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+/*
+** ************************************************************************** *|
+**                        Built-in Reference Palettes                         *|
+** ************************************************************************** *|
+*/
+
+//! The 64 colors of the NES/Famicom PPU (the same as `pal/nes.pal`: the index is the hardware color value)
+static t_argb32 const refpal_nes[64] =
+{
+	0x7C7C7C, 0x0000FC, 0x1A28BC, 0x4428BC, 0x940084, 0xA80020, 0xA81000, 0x881400,
+	0x503000, 0x007800, 0x006800, 0x005800, 0x004058, 0x000000, 0x000000, 0x000000,
+	0xBCBCBC, 0x0078F8, 0x2C58F8, 0x6844FC, 0xD800CC, 0xE40058, 0xF83800, 0xE45C10,
+	0xAC7C00, 0x00B800, 0x00A800, 0x00A844, 0x008888, 0x1F1F1F, 0x000000, 0x000000,
+	0xF8F8F8, 0x3CBCFC, 0x6888FC, 0x9878F8, 0xF878F8, 0xF85898, 0xF87858, 0xFCA044,
+	0xF8B800, 0xB8F818, 0x58D854, 0x58F898, 0x00E8D8, 0x7C7C7C, 0x000000, 0x000000,
+	0xFFFFFF, 0xFFE4FC, 0xB8B8F8, 0xD8B8F8, 0xF8B8F8, 0xF8A4C0, 0xF0D0B0, 0xFCE0A8,
+	0xF8D878, 0xD8F878, 0xB8F8B8, 0xB8F8D8, 0x00FCFC, 0xF8D8F8, 0x000000, 0x000000,
+};
+
+//! The 4 shades of the original Game Boy screen (index 0 is the lightest, as in the `BGP` register)
+static t_argb32 const refpal_gb[4] =
+{
+	0x9BBC0F, 0x8BAC0F, 0x306230, 0x0F380F,
+};
+
+//! The 64 colors of the Master System (the index is the hardware color value: `--BBGGRR`)
+static t_argb32 const refpal_sms[64] =
+{
+	0x000000, 0x550000, 0xAA0000, 0xFF0000, 0x005500, 0x555500, 0xAA5500, 0xFF5500,
+	0x00AA00, 0x55AA00, 0xAAAA00, 0xFFAA00, 0x00FF00, 0x55FF00, 0xAAFF00, 0xFFFF00,
+	0x000055, 0x550055, 0xAA0055, 0xFF0055, 0x005555, 0x555555, 0xAA5555, 0xFF5555,
+	0x00AA55, 0x55AA55, 0xAAAA55, 0xFFAA55, 0x00FF55, 0x55FF55, 0xAAFF55, 0xFFFF55,
+	0x0000AA, 0x5500AA, 0xAA00AA, 0xFF00AA, 0x0055AA, 0x5555AA, 0xAA55AA, 0xFF55AA,
+	0x00AAAA, 0x55AAAA, 0xAAAAAA, 0xFFAAAA, 0x00FFAA, 0x55FFAA, 0xAAFFAA, 0xFFFFAA,
+	0x0000FF, 0x5500FF, 0xAA00FF, 0xFF00FF, 0x0055FF, 0x5555FF, 0xAA55FF, 0xFF55FF,
+	0x00AAFF, 0x55AAFF, 0xAAAAFF, 0xFFAAFF, 0x00FFFF, 0x55FFFF, 0xAAFFFF, 0xFFFFFF,
+};
+
+//! 256 of the 32768 colors of the Super Nintendo (the index is `RRRGGGBB`, each channel being expanded to 5 bits)
+static t_argb32 const refpal_snes[256] =
+{
+	0x000000, 0x000052, 0x0000AD, 0x0000FF, 0x002100, 0x002152, 0x0021AD, 0x0021FF,
+	0x004A00, 0x004A52, 0x004AAD, 0x004AFF, 0x006B00, 0x006B52, 0x006BAD, 0x006BFF,
+	0x009400, 0x009452, 0x0094AD, 0x0094FF, 0x00B500, 0x00B552, 0x00B5AD, 0x00B5FF,
+	0x00DE00, 0x00DE52, 0x00DEAD, 0x00DEFF, 0x00FF00, 0x00FF52, 0x00FFAD, 0x00FFFF,
+	0x210000, 0x210052, 0x2100AD, 0x2100FF, 0x212100, 0x212152, 0x2121AD, 0x2121FF,
+	0x214A00, 0x214A52, 0x214AAD, 0x214AFF, 0x216B00, 0x216B52, 0x216BAD, 0x216BFF,
+	0x219400, 0x219452, 0x2194AD, 0x2194FF, 0x21B500, 0x21B552, 0x21B5AD, 0x21B5FF,
+	0x21DE00, 0x21DE52, 0x21DEAD, 0x21DEFF, 0x21FF00, 0x21FF52, 0x21FFAD, 0x21FFFF,
+	0x4A0000, 0x4A0052, 0x4A00AD, 0x4A00FF, 0x4A2100, 0x4A2152, 0x4A21AD, 0x4A21FF,
+	0x4A4A00, 0x4A4A52, 0x4A4AAD, 0x4A4AFF, 0x4A6B00, 0x4A6B52, 0x4A6BAD, 0x4A6BFF,
+	0x4A9400, 0x4A9452, 0x4A94AD, 0x4A94FF, 0x4AB500, 0x4AB552, 0x4AB5AD, 0x4AB5FF,
+	0x4ADE00, 0x4ADE52, 0x4ADEAD, 0x4ADEFF, 0x4AFF00, 0x4AFF52, 0x4AFFAD, 0x4AFFFF,
+	0x6B0000, 0x6B0052, 0x6B00AD, 0x6B00FF, 0x6B2100, 0x6B2152, 0x6B21AD, 0x6B21FF,
+	0x6B4A00, 0x6B4A52, 0x6B4AAD, 0x6B4AFF, 0x6B6B00, 0x6B6B52, 0x6B6BAD, 0x6B6BFF,
+	0x6B9400, 0x6B9452, 0x6B94AD, 0x6B94FF, 0x6BB500, 0x6BB552, 0x6BB5AD, 0x6BB5FF,
+	0x6BDE00, 0x6BDE52, 0x6BDEAD, 0x6BDEFF, 0x6BFF00, 0x6BFF52, 0x6BFFAD, 0x6BFFFF,
+	0x940000, 0x940052, 0x9400AD, 0x9400FF, 0x942100, 0x942152, 0x9421AD, 0x9421FF,
+	0x944A00, 0x944A52, 0x944AAD, 0x944AFF, 0x946B00, 0x946B52, 0x946BAD, 0x946BFF,
+	0x949400, 0x949452, 0x9494AD, 0x9494FF, 0x94B500, 0x94B552, 0x94B5AD, 0x94B5FF,
+	0x94DE00, 0x94DE52, 0x94DEAD, 0x94DEFF, 0x94FF00, 0x94FF52, 0x94FFAD, 0x94FFFF,
+	0xB50000, 0xB50052, 0xB500AD, 0xB500FF, 0xB52100, 0xB52152, 0xB521AD, 0xB521FF,
+	0xB54A00, 0xB54A52, 0xB54AAD, 0xB54AFF, 0xB56B00, 0xB56B52, 0xB56BAD, 0xB56BFF,
+	0xB59400, 0xB59452, 0xB594AD, 0xB594FF, 0xB5B500, 0xB5B552, 0xB5B5AD, 0xB5B5FF,
+	0xB5DE00, 0xB5DE52, 0xB5DEAD, 0xB5DEFF, 0xB5FF00, 0xB5FF52, 0xB5FFAD, 0xB5FFFF,
+	0xDE0000, 0xDE0052, 0xDE00AD, 0xDE00FF, 0xDE2100, 0xDE2152, 0xDE21AD, 0xDE21FF,
+	0xDE4A00, 0xDE4A52, 0xDE4AAD, 0xDE4AFF, 0xDE6B00, 0xDE6B52, 0xDE6BAD, 0xDE6BFF,
+	0xDE9400, 0xDE9452, 0xDE94AD, 0xDE94FF, 0xDEB500, 0xDEB552, 0xDEB5AD, 0xDEB5FF,
+	0xDEDE00, 0xDEDE52, 0xDEDEAD, 0xDEDEFF, 0xDEFF00, 0xDEFF52, 0xDEFFAD, 0xDEFFFF,
+	0xFF0000, 0xFF0052, 0xFF00AD, 0xFF00FF, 0xFF2100, 0xFF2152, 0xFF21AD, 0xFF21FF,
+	0xFF4A00, 0xFF4A52, 0xFF4AAD, 0xFF4AFF, 0xFF6B00, 0xFF6B52, 0xFF6BAD, 0xFF6BFF,
+	0xFF9400, 0xFF9452, 0xFF94AD, 0xFF94FF, 0xFFB500, 0xFFB552, 0xFFB5AD, 0xFFB5FF,
+	0xFFDE00, 0xFFDE52, 0xFFDEAD, 0xFFDEFF, 0xFFFF00, 0xFFFF52, 0xFFFFAD, 0xFFFFFF,
+};
+
+
+
+/*
+** ************************************************************************** *|
+**                            Specialized Kernels                             *|
+** ************************************************************************** *|
+*/
+
+#define K_TARGET            NES
+#define K_SCREEN_W          256
+#define K_SCREEN_H          240
+#define K_TILE              16
+#define K_BPP               2
+#define K_PLANE_OFFSET(P,Y) ((P) * CHR_TILE + (Y))
+#include "target_kernels.h"
+
+#define K_TARGET            GB
+#define K_SCREEN_W          160
+#define K_SCREEN_H          144
+#define K_TILE              8
+#define K_BPP               2
+#define K_PLANE_OFFSET(P,Y) ((Y) * 2 + (P))
+#include "target_kernels.h"
+
+#define K_TARGET            SMS
+#define K_SCREEN_W          256
+#define K_SCREEN_H          192
+#define K_TILE              8
+#define K_BPP               4
+#define K_PLANE_OFFSET(P,Y) ((Y) * 4 + (P))
+#include "target_kernels.h"
+
+#define K_TARGET            SNES_4BPP
+#define K_SCREEN_W          256
+#define K_SCREEN_H          224
+#define K_TILE              8
+#define K_BPP               4
+#define K_PLANE_OFFSET(P,Y) (((P) / 2) * 2 * CHR_TILE + (Y) * 2 + ((P) % 2))
+#include "target_kernels.h"
+
+//! Sets all the kernel function pointers of an `s_target`, for the given target name suffix
+#define TARGET_KERNELS(TARGET) \
+	.pack_tiles     = PackTiles_##TARGET,       \
+	.unpack_tiles   = UnpackTiles_##TARGET,     \
+	.histogram_tile = HistogramTile_##TARGET,   \
+	.remap_tile     = RemapTile_##TARGET,       \
+	.encode_tile    = EncodeTile_##TARGET,      \
+	.decode_tile    = DecodeTile_##TARGET,
+
+
+
+/*
+** ************************************************************************** *|
+**                           Hardware Target Table                            *|
+** ************************************************************************** *|
+*/
+
+s_target const  targets[TARGETS_AMOUNT] =
+{
+	[TARGET_NES] = (s_target)
+	{
+		.name           = "nes",
+		.description    = "NES/Famicom: 2bpp, 4 palettes of 4 colors, one palette per 16x16 area",
+		.screen_w       = 256,
+		.screen_h       = 240,
+		.tile           = 16,
+		.pal_colors     = 4,
+		.pal_amount     = 4,
+		.pal_colorsize  = 1,
+		.pal_format     = PAL_FORMAT_INDEX,
+		.chr_bpp        = 2,
+		.chr_tiles      = 256,
+		.nam_entry      = 1,
+		.nam_attr       = 64,
+		.nam_palette    = 0,
+		.refpal         = refpal_nes,
+		.refpal_colors  = 64,
+		TARGET_KERNELS(NES)
+	},
+	[TARGET_GB] = (s_target)
+	{
+		.name           = "gb",
+		.description    = "Game Boy: 2bpp, 1 palette of 4 shades",
+		.screen_w       = 160,
+		.screen_h       = 144,
+		.tile           = 8,
+		.pal_colors     = 4,
+		.pal_amount     = 1,
+		.pal_colorsize  = 1,
+		.pal_format     = PAL_FORMAT_INDEX,
+		.chr_bpp        = 2,
+		.chr_tiles      = 256,
+		.nam_entry      = 1,
+		.nam_attr       = 0,
+		.nam_palette    = 0,
+		.refpal         = refpal_gb,
+		.refpal_colors  = 4,
+		TARGET_KERNELS(GB)
+	},
+	[TARGET_SMS] = (s_target)
+	{
+		.name           = "sms",
+		.description    = "Master System: 4bpp, 2 palettes of 16 colors, one palette per 8x8 tile",
+		.screen_w       = 256,
+		.screen_h       = 192,
+		.tile           = 8,
+		.pal_colors     = 16,
+		.pal_amount     = 2,
+		.pal_colorsize  = 1,
+		.pal_format     = PAL_FORMAT_INDEX,
+		.chr_bpp        = 4,
+		.chr_tiles      = 448,
+		.nam_entry      = 2,
+		.nam_attr       = 0,
+		.nam_palette    = 11,
+		.refpal         = refpal_sms,
+		.refpal_colors  = 64,
+		TARGET_KERNELS(SMS)
+	},
+	[TARGET_SNES_4BPP] = (s_target)
+	{
+		.name           = "snes4",
+		.description    = "Super Nintendo (4bpp background): 8 palettes of 16 colors, one palette per 8x8 tile",
+		.screen_w       = 256,
+		.screen_h       = 224,
+		.tile           = 8,
+		.pal_colors     = 16,
+		.pal_amount     = 8,
+		.pal_colorsize  = 2,
+		.pal_format     = PAL_FORMAT_BGR555,
+		.chr_bpp        = 4,
+		.chr_tiles      = 1024,
+		.nam_entry      = 2,
+		.nam_attr       = 0,
+		.nam_palette    = 10,
+		.refpal         = refpal_snes,
+		.refpal_colors  = 256,
+		TARGET_KERNELS(SNES_4BPP)
+	},
+};
+
+
+
+s_target const* Target_Find(t_char const* name)
+{
+	for (t_uint i = 0; i < TARGETS_AMOUNT; ++i)
+	{
+		if (String_Equals_IgnoreCase(name, targets[i].name))
+			return (&targets[i]);
+	}
+	return (NULL);
+}
@@ -0,0 +1,150 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                   BMP2NAM                                  */
+/*                                                                            */
+/* ************************************************************************** */
+
+/*!
+**  This file is a template: it has no include guard, since it is included once
+**  per hardware target by `target.c`, to generate the inner-loop kernels which
+**  are specialized for that target (so that the compiler can unroll/vectorize
+**  them, since all of their loop bounds are compile-time constants).
+**  Before including it, these macros must be defined:
+**  - `K_TARGET`: the suffix for the names of the generated functions
+**  - `K_SCREEN_W`, `K_SCREEN_H`: the dimensions (in pixels) of one screen
+**  - `K_TILE`: the size (in pixels) of one NAM metatile (the attribute granularity)
+**  - `K_BPP`: the amount of bits-per-pixel of one CHR tile
+**  - `K_PLANE_OFFSET(P, Y)`: the offset (in bytes) of bitplane `P` of row `Y`, in one encoded CHR tile
+**  All of these macros are undefined again at the end of this file.
+*/
+
+#ifndef KERNEL
+//! Returns the name of the kernel function `NAME`, specialized for the current `K_TARGET`
+#define KERNEL(NAME)                KERNEL_NAME(NAME, K_TARGET)
+#define KERNEL_NAME(NAME, TARGET)   KERNEL_PASTE(NAME, TARGET)
+#define KERNEL_PASTE(NAME, TARGET)  NAME##_##TARGET
+//! Spreads the 8 bits of the byte `BITS` out to the lowest bit of each byte of a 64-bit integer (the highest bit, ie: the leftmost pixel, goes to the lowest byte)
+#define KERNEL_SPREAD(BITS)         ((((t_u64)(BITS) * 0x8040201008040201ull) >> 7) & 0x0101010101010101ull)
+#endif
+
+//! The amount of NAM metatiles in one row of the screen
+#define K_W_TILES       (K_SCREEN_W / K_TILE)
+//! The amount of NAM metatiles in one column of the screen
+#define K_H_TILES       (K_SCREEN_H / K_TILE)
+//! The amount of pixels in one NAM metatile
+#define K_TILE_PIXELS   (K_TILE * K_TILE)
+
+
+
+//! Copies the pixels of the `view` into `tiles`, in tile-major order (any part of a tile outside of the view is set to color 0)
+static
+void    KERNEL(PackTiles)(s_view const* view, t_u8* tiles)
+{
+	for (t_uint ty = 0; ty < K_H_TILES; ++ty)
+	for (t_uint tx = 0; tx < K_W_TILES; ++tx)
+	{
+		t_u8*  tile_pixels = tiles + (ty * K_W_TILES + tx) * K_TILE_PIXELS;
+		t_uint x = tx * K_TILE;
+		for (t_uint i = 0; i < K_TILE; ++i, tile_pixels += K_TILE)
+		{
+			t_uint y = ty * K_TILE + i;
+			t_uint length = (y < view->h && x < view->w) ? view->w - x : 0;
+			t_u8 const* row = view->pixels + (t_sint)y * view->pitch + x;
+			if (length >= K_TILE)
+			{
+				for (t_uint j = 0; j < K_TILE; ++j)
+					tile_pixels[j] = row[j];
+				continue;
+			}
+			for (t_uint j = 0; j < K_TILE; ++j)
+				tile_pixels[j] = (j < length ? row[j] : 0);
+		}
+	}
+}
+
+//! Copies the pixels of `tiles` (in tile-major order) back into a bitmap of the screen's dimensions
+static
+void    KERNEL(UnpackTiles)(t_u8 const* tiles, t_u8* pixels, t_sint pitch)
+{
+	for (t_uint ty = 0; ty < K_H_TILES; ++ty)
+	for (t_uint tx = 0; tx < K_W_TILES; ++tx)
+	{
+		t_u8 const* tile_pixels = tiles + (ty * K_W_TILES + tx) * K_TILE_PIXELS;
+		for (t_uint y = 0; y < K_TILE; ++y, tile_pixels += K_TILE)
+		{
+			t_u8* row = pixels + (t_sint)(ty * K_TILE + y) * pitch + tx * K_TILE;
+			for (t_uint x = 0; x < K_TILE; ++x)
+				row[x] = tile_pixels[x];
+		}
+	}
+}
+
+//! Counts the occurences of each pixel value in one metatile, adding them to `counts` (which has `BMP_MAXCOLORS` items)
+static
+void    KERNEL(HistogramTile)(t_u8 const* pixels, t_u32* counts)
+{
+	for (t_uint i = 0; i < K_TILE_PIXELS; ++i)
+	{
+		counts[pixels[i]] += 1;
+	}
+}
+
+//! Replaces each pixel of one metatile by its value in the `lookup` table (which has `REFPAL_COLORS_MAX` items)
+static
+void    KERNEL(RemapTile)(t_u8* pixels, t_u8 const* lookup)
+{
+	for (t_uint i = 0; i < K_TILE_PIXELS; ++i)
+	{
+		pixels[i] = lookup[pixels[i]];
+	}
+}
+
+//! Encodes the 8x8 CHR tile whose top-left pixel is at `pixels` (within one metatile), as bitplanes in the target's layout
+static
+void    KERNEL(EncodeTile)(t_u8* dest, t_u8 const* pixels)
+{
+	for (t_uint y = 0; y < CHR_TILE; ++y, pixels += K_TILE)
+	{
+		t_u8 planes[K_BPP] = { 0 };
+		for (t_uint x = 0; x < CHR_TILE; ++x)
+		for (t_uint p = 0; p < K_BPP; ++p)
+		{
+			planes[p] = (t_u8)((planes[p] << 1) | ((pixels[x] >> p) & 1));
+		}
+		for (t_uint p = 0; p < K_BPP; ++p)
+		{
+			dest[K_PLANE_OFFSET(p, y)] = planes[p];
+		}
+	}
+}
+
+//! Decodes one 8x8 CHR tile (as bitplanes in the target's layout) into pixel values plus `offset`, written as 8 rows of 8 bytes, `pitch` bytes apart.
+//! Each row is decoded 8 pixels at once, within one 64-bit integer: every bitplane byte is spread out to one bit per byte, by a multiplication.
+static
+void    KERNEL(DecodeTile)(t_u8* pixels, t_sint pitch, t_u8 const* src, t_u8 offset)
+{
+	t_u64 base = (t_u64)offset * 0x0101010101010101ull;
+	for (t_uint y = 0; y < CHR_TILE; ++y, pixels += pitch)
+	{
+		t_u64 row = base;
+		for (t_uint p = 0; p < K_BPP; ++p)
+		{
+			row += KERNEL_SPREAD(src[K_PLANE_OFFSET(p, y)]) << p;
+		}
+		for (t_uint x = 0; x < CHR_TILE; ++x)
+			pixels[x] = (t_u8)(row >> (x * 8));
+	}
+}
+
+
+
+#undef K_TILE_PIXELS
+#undef K_H_TILES
+#undef K_W_TILES
+
+#undef K_TARGET
+#undef K_SCREEN_W
+#undef K_SCREEN_H
+#undef K_TILE
+#undef K_BPP
+#undef K_PLANE_OFFSET
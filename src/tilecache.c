@@ -0,0 +1,220 @@
+
+#include <stdio.h>
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/io.h>
+#include <libccc/sys/logger.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+//! The header written at the start of a tile cache sidecar file
+typedef struct s_tilecache_header_
+{
+	t_u32   magic;      //!< Should always be `TILECACHE_MAGIC`
+	t_u32   version;    //!< Should always be `TILECACHE_VERSION`
+	t_u32   entry_size; //!< Should always be `sizeof(s_tilecache_entry)` (entries are stored in native byte order)
+	t_u32   amount;     //!< The amount of entries which follow this header
+}
+s_tilecache_header;
+
+
+
+/*
+** ************************************************************************** *|
+**                            Hash Table Functions                            *|
+** ************************************************************************** *|
+*/
+
+//! Returns the slot for the given `key` and `kind` - either the one holding it, or the empty slot where it should go
+static
+s_tilecache_entry*  TileCache_Lookup(s_tilecache_entry* entries, t_size capacity, t_u64 key, t_u8 kind)
+{
+	t_size mask = capacity - 1;
+	t_size i = (t_size)(key ^ (key >> 32)) & mask;
+	while (entries[i].key != 0)
+	{
+		if (entries[i].key == key && entries[i].kind == kind)
+			break;
+		i = (i + 1) & mask;
+	}
+	return (&entries[i]);
+}
+
+static
+int     TileCache_Resize(s_tilecache* cache, t_size capacity)
+{
+	s_tilecache_entry* entries = (s_tilecache_entry*)Memory_New(capacity * sizeof(s_tilecache_entry));
+	PROFILE_COUNT(PROFILE_ALLOCATIONS, 1);
+	if (entries == NULL)
+		return (ERROR);
+	for (t_size i = 0; i < cache->capacity; ++i)
+	{
+		if (cache->entries[i].key == 0)
+			continue;
+		*TileCache_Lookup(entries, capacity, cache->entries[i].key, cache->entries[i].kind) = cache->entries[i];
+	}
+	Memory_Free(cache->entries);
+	cache->entries = entries;
+	cache->capacity = capacity;
+	return (OK);
+}
+
+
+
+s_tilecache_entry*  TileCache_Find(s_tilecache* cache, t_u64 key, e_tilecache_kind kind)
+{
+	if (!cache->enabled || cache->entries == NULL)
+		return (NULL);
+	if (key == 0)
+		key = 1;
+	s_tilecache_entry* entry = TileCache_Lookup(cache->entries, cache->capacity, key, kind);
+	if (entry->key == 0)
+	{
+		cache->misses += 1;
+		return (NULL);
+	}
+	cache->hits += 1;
+	return (entry);
+}
+
+s_tilecache_entry*  TileCache_Insert(s_tilecache* cache, t_u64 key, e_tilecache_kind kind)
+{
+	if (!cache->enabled)
+		return (NULL);
+	if (key == 0)
+		key = 1;
+	if (cache->amount >= TILECACHE_MAXENTRIES)
+	{   // the cache has grown too large: start over rather than growing without bounds
+		Memory_Clear(cache->entries, cache->capacity * sizeof(s_tilecache_entry));
+		cache->amount = 0;
+	}
+	if (cache->entries == NULL || (cache->amount + 1) * 2 > cache->capacity)
+	{   // keep the load factor under 50%, so that linear probing stays short
+		if (TileCache_Resize(cache, (cache->entries == NULL ? TILECACHE_CAPACITY : cache->capacity * 2)))
+			return (NULL);
+	}
+	s_tilecache_entry* entry = TileCache_Lookup(cache->entries, cache->capacity, key, kind);
+	if (entry->key == 0)
+		cache->amount += 1;
+	Memory_Clear(entry, sizeof(s_tilecache_entry));
+	entry->key = key;
+	entry->kind = kind;
+	return (entry);
+}
+
+
+
+void    TileCache_Delete(s_tilecache* cache)
+{
+	Memory_Free(cache->entries);
+	cache->entries = NULL;
+	cache->capacity = 0;
+	cache->amount = 0;
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                           Sidecar File Functions                           *|
+** ************************************************************************** *|
+*/
+
+int     TileCache_Load(s_tilecache* cache, t_char const* filepath)
+{
+	if (!cache->enabled || filepath == NULL)
+		return (OK);
+	t_fd fd = IO_Open(filepath, OPEN_READONLY, 0);
+	if (fd < 0)
+	{
+		LOG_VERBOSE("No tile cache file found: %s", filepath);
+		return (OK);
+	}
+	t_u8* file = NULL;
+	t_sintmax size = Arena_ReadFile(&program.arena, fd, &file);
+	IO_Close(fd);
+	if (size < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not read tile cache file: %s", filepath);
+		return (ERROR);
+	}
+	s_tilecache_header header;
+	if ((t_size)size < sizeof(header))
+	{
+		LOG_WARNING("Ignoring invalid tile cache file: %s (file is truncated)", filepath);
+		return (OK);
+	}
+	Memory_Copy(&header, file, sizeof(header));
+	if (header.magic != TILECACHE_MAGIC ||
+		header.version != TILECACHE_VERSION ||
+		header.entry_size != sizeof(s_tilecache_entry))
+	{
+		LOG_WARNING("Ignoring outdated or incompatible tile cache file: %s", filepath);
+		return (OK);
+	}
+	if ((t_size)size != sizeof(header) + (t_size)header.amount * sizeof(s_tilecache_entry))
+	{
+		LOG_WARNING("Ignoring invalid tile cache file: %s (was %zu bytes, but should be %zu bytes)", filepath,
+			(t_size)size, sizeof(header) + (t_size)header.amount * sizeof(s_tilecache_entry));
+		return (OK);
+	}
+	s_tilecache_entry entry;
+	for (t_u32 i = 0; i < header.amount; ++i)
+	{
+		Memory_Copy(&entry, file + sizeof(header) + i * sizeof(s_tilecache_entry), sizeof(entry));
+		if (entry.key == 0)
+			continue;
+		s_tilecache_entry* slot = TileCache_Insert(cache, entry.key, entry.kind);
+		if (slot == NULL)
+			return (ERROR);
+		*slot = entry;
+	}
+	LOG_VERBOSE("Loaded %u cached tile results from: %s", header.amount, filepath);
+	return (OK);
+}
+
+
+
+int     TileCache_Save(s_tilecache const* cache, t_char const* filepath)
+{
+	if (!cache->enabled || filepath == NULL)
+		return (OK);
+	// the entries are written to a temporary file first, so that a failed write never leaves a truncated cache file
+	t_char* tmp = Arena_Concat(&program.arena, filepath, ".tmp");
+	t_fd fd = (tmp ? IO_Open(tmp, OPEN_WRITEONLY | OPEN_CREATE | OPEN_CLEARFILE, 0644) : -1);
+	if (fd < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not open tile cache file: %s", (tmp ? tmp : filepath));
+		return (ERROR);
+	}
+	s_tilecache_header header =
+	{
+		.magic = TILECACHE_MAGIC,
+		.version = TILECACHE_VERSION,
+		.entry_size = sizeof(s_tilecache_entry),
+		.amount = cache->amount,
+	};
+	t_bool failed = (IO_Write_Data(fd, (t_u8 const*)&header, sizeof(header)) != sizeof(header));
+	for (t_size i = 0; i < cache->capacity && !failed; ++i)
+	{
+		if (cache->entries[i].key == 0)
+			continue;
+		failed = (IO_Write_Data(fd, (t_u8 const*)&cache->entries[i], sizeof(s_tilecache_entry)) != sizeof(s_tilecache_entry));
+	}
+	IO_Close(fd);
+	if (failed || rename(tmp, filepath))
+	{
+		remove(tmp);
+		Log_Error_STD(&program.logger, 0, "Could not write tile cache file: %s", filepath);
+		return (ERROR);
+	}
+	LOG_MESSAGE("Tile cache: %zu hits, %zu misses (%zu entries saved to %s)",
+		cache->hits, cache->misses, cache->amount, filepath);
+	return (OK);
+}
@@ -0,0 +1,243 @@
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/io.h>
+#include <libccc/sys/logger.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+#if PROFILING
+
+//! The filepath of the trace-event JSON file to write (if NULL, then tracing is disabled)
+static t_char const*    trace_filepath = NULL;
+
+//! The ring buffers of all threads which have recorded events so far
+static s_trace_buffer*  trace_buffers[TRACE_THREADS_MAX] = { 0 };
+//! The amount of threads which have registered a ring buffer (may exceed `TRACE_THREADS_MAX`)
+static atomic_uint      trace_threads = 0;
+//! For each of `trace_buffers`, TRUE if its owner thread has exited, so that a new thread can take it over
+static atomic_bool      trace_released[TRACE_THREADS_MAX] = { 0 };
+//! The amount of threads which could not get a ring buffer, and whose events were all dropped
+static atomic_uint      trace_dropped = 0;
+
+//! The ring buffer of the calling thread (allocated upon its first recorded event)
+static _Thread_local s_trace_buffer*    trace_local = NULL;
+//! If TRUE, the calling thread could not get a ring buffer, and will not record events
+static _Thread_local t_bool             trace_local_full = FALSE;
+
+
+
+/*
+** ************************************************************************** *|
+**                          Event Recording Functions                         *|
+** ************************************************************************** *|
+*/
+
+void Trace_Init(t_char const* filepath)
+{
+	trace_filepath = filepath;
+}
+
+
+
+static
+s_trace_buffer* Trace_GetThreadBuffer(void)
+{
+	if (trace_local || trace_local_full)
+		return (trace_local);
+	// the buffer of a thread which has exited is taken over (its events are kept, and new ones are appended)
+	t_uint threads = atomic_load(&trace_threads);
+	for (t_uint i = 0; i < threads && i < TRACE_THREADS_MAX; ++i)
+	{
+		t_bool released = TRUE;
+		if (atomic_compare_exchange_strong(&trace_released[i], &released, FALSE))
+		{
+			trace_buffers[i]->name = "worker";
+			trace_local = trace_buffers[i];
+			return (trace_local);
+		}
+	}
+	t_uint tid = atomic_fetch_add(&trace_threads, 1);
+	if (tid >= TRACE_THREADS_MAX)
+	{
+		atomic_fetch_add(&trace_dropped, 1);
+		trace_local_full = TRUE;
+		return (NULL);
+	}
+	s_trace_buffer* buffer = (s_trace_buffer*)Memory_New(sizeof(s_trace_buffer));
+	if (buffer == NULL)
+	{
+		atomic_fetch_add(&trace_dropped, 1);
+		trace_local_full = TRUE;
+		return (NULL);
+	}
+	buffer->tid = tid;
+	buffer->name = (tid == 0 ? "main" : "worker");
+	buffer->count = 0;
+	trace_buffers[tid] = buffer;
+	trace_local = buffer;
+	return (buffer);
+}
+
+//! Returns the index of the buffer's own copy of the given `file` path, storing a new copy if needed (or -1 if there is none)
+static
+t_sint Trace_InternFile(s_trace_buffer* buffer, t_char const* file)
+{
+	if (file == NULL)
+		return (-1);
+	for (t_uint i = 0; i < TRACE_BUFFER_FILES; ++i)
+	{
+		if (buffer->files[i] && String_Equals(buffer->files[i], file))
+			return ((t_sint)i);
+	}
+	t_char* copy = String_Duplicate(file);
+	if (copy == NULL)
+		return (-1);
+	t_uint i = buffer->files_next;
+	Memory_Free(buffer->files[i]);
+	buffer->files[i] = copy;
+	buffer->files_since[i] = buffer->count;
+	buffer->files_next = (i + 1) % TRACE_BUFFER_FILES;
+	return ((t_sint)i);
+}
+
+static
+void Trace_Record(t_char const* name, t_char phase)
+{
+	if (trace_filepath == NULL)
+		return;
+	s_trace_buffer* buffer = Trace_GetThreadBuffer();
+	if (buffer == NULL)
+		return;
+	s_trace_event* event = &buffer->events[buffer->count % TRACE_BUFFER_EVENTS];
+	event->name = name;
+	// in server mode, the input filepath is part of a request, which is freed long before the trace is written
+	event->file = Trace_InternFile(buffer, program.file_input);
+	event->phase = phase;
+	event->time_ns = Time_GetMonotonic();
+	buffer->count += 1;
+}
+
+
+
+void Trace_SetThreadName(t_char const* name)
+{
+	if (trace_filepath == NULL)
+		return;
+	s_trace_buffer* buffer = Trace_GetThreadBuffer();
+	if (buffer == NULL)
+		return;
+	buffer->name = name;
+}
+
+void Trace_EndThread(void)
+{
+	if (trace_local == NULL)
+		return;
+	atomic_store(&trace_released[trace_local->tid], TRUE);
+	trace_local = NULL;
+}
+
+void Trace_Begin(t_char const* name)
+{
+	Trace_Record(name, 'B');
+}
+
+void Trace_End(t_char const* name)
+{
+	Trace_Record(name, 'E');
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                           Trace Output Functions                           *|
+** ************************************************************************** *|
+*/
+
+int Trace_Output(void)
+{
+	if (trace_filepath == NULL)
+		return (OK);
+	t_fd fd = IO_Open(trace_filepath, OPEN_WRITEONLY | OPEN_CREATE | OPEN_CLEARFILE, 0644);
+	if (fd < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not open trace output file: %s", trace_filepath);
+		return (ERROR);
+	}
+	t_uint threads = atomic_load(&trace_threads);
+	if (threads > TRACE_THREADS_MAX)
+		threads = TRACE_THREADS_MAX;
+	t_uint dropped = atomic_load(&trace_dropped);
+	if (dropped)
+	{
+		LOG_WARNING("%u threads could not record trace events (at most %u threads can run at once), their events were dropped",
+			dropped, TRACE_THREADS_MAX);
+	}
+	// the earliest timestamp of all buffers is used as the origin of the timeline
+	t_u64 origin = (t_u64)-1;
+	for (t_uint i = 0; i < threads; ++i)
+	{
+		s_trace_buffer const* buffer = trace_buffers[i];
+		if (buffer == NULL || buffer->count == 0)
+			continue;
+		t_size first = (buffer->count > TRACE_BUFFER_EVENTS ? buffer->count - TRACE_BUFFER_EVENTS : 0);
+		t_u64 time_ns = buffer->events[first % TRACE_BUFFER_EVENTS].time_ns;
+		if (origin > time_ns)
+			origin = time_ns;
+	}
+	t_bool comma = FALSE;
+	IO_Write_String(fd, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	for (t_uint i = 0; i < threads; ++i)
+	{
+		s_trace_buffer const* buffer = trace_buffers[i];
+		if (buffer == NULL)
+			continue;
+		t_char thread_name[64];
+		snprintf(thread_name, sizeof(thread_name), "%s %u", buffer->name, buffer->tid);
+		IO_Write_Format(fd, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+			(comma ? "," : ""), buffer->tid);
+		JSON_WriteString(JSON_Write_FD, &fd, thread_name);
+		IO_Write_String(fd, "}}");
+		comma = TRUE;
+		if (buffer->count > TRACE_BUFFER_EVENTS)
+		{
+			LOG_WARNING("Trace ring buffer of thread %u overflowed, %zu oldest events were dropped",
+				buffer->tid, buffer->count - TRACE_BUFFER_EVENTS);
+		}
+		t_size first = (buffer->count > TRACE_BUFFER_EVENTS ? buffer->count - TRACE_BUFFER_EVENTS : 0);
+		for (t_size j = first; j < buffer->count; ++j)
+		{
+			s_trace_event const* event = &buffer->events[j % TRACE_BUFFER_EVENTS];
+			// the stage names are stringified calls, which may contain quotes: all strings are escaped
+			IO_Write_String(fd, ",\n{\"name\":");
+			JSON_WriteString(JSON_Write_FD, &fd, event->name);
+			IO_Write_Format(fd, ",\"cat\":\"stage\",\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%.3f",
+				event->phase,
+				buffer->tid,
+				(event->time_ns - origin) / 1000.);
+			if (event->file >= 0 && j >= buffer->files_since[event->file])
+			{
+				IO_Write_String(fd, ",\"args\":{\"file\":");
+				JSON_WriteString(JSON_Write_FD, &fd, buffer->files[event->file]);
+				IO_Write_String(fd, "}}");
+			}
+			else IO_Write_String(fd, "}");
+		}
+	}
+	IO_Write_String(fd, "\n]}\n");
+	IO_Close(fd);
+	LOG_SUCCESS("Wrote trace file: %s", trace_filepath);
+	return (OK);
+}
+
+#endif
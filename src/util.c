@@ -1,7 +1,12 @@
 
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <time.h>
+
 #include <libccc.h>
 #include <libccc/memory.h>
 #include <libccc/string.h>
+#include <libccc/sys/io.h>
 #include <libccc/sys/logger.h>
 #include <libccc/image/color.h>
 #include <libccc/math.h>
@@ -29,6 +34,85 @@ t_u32 Color_Sum(t_argb32 color)
 
 
 
+/*
+** ************************************************************************** *|
+**                          Hashing Utility Functions                         *|
+** ************************************************************************** *|
+*/
+
+t_u64 Hash_FNV1a(void const* data, t_size size, t_u64 hash)
+{
+	t_u8 const* bytes = (t_u8 const*)data;
+	for (t_size i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001B3;
+	}
+	return (hash);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                           Time Utility Functions                           *|
+** ************************************************************************** *|
+*/
+
+t_u64   Time_GetMonotonic(void)
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		return (0);
+	return ((t_u64)ts.tv_sec * 1000000000 + (t_u64)ts.tv_nsec);
+}
+
+
+
+/*
+** ************************************************************************** *|
+**                           JSON Utility Functions                           *|
+** ************************************************************************** *|
+*/
+
+void    JSON_WriteString(f_json_write write, void* context, t_char const* str)
+{
+	write(context, "\"", 1);
+	if (str == NULL)
+		str = "";
+	t_char const* start = str;
+	for (; *str; ++str)
+	{
+		t_u8 c = (t_u8)*str;
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+		write(context, start, (t_size)(str - start));
+		t_char escaped[6] = { '\\', (t_char)c };
+		if (c == '"' || c == '\\')
+			write(context, escaped, 2);
+		else
+		{   // control characters are written as `\u00XX`
+			t_char const* hex = "0123456789ABCDEF";
+			escaped[1] = 'u';
+			escaped[2] = '0';
+			escaped[3] = '0';
+			escaped[4] = hex[c >> 4];
+			escaped[5] = hex[c & 0xF];
+			write(context, escaped, 6);
+		}
+		start = str + 1;
+	}
+	write(context, start, (t_size)(str - start));
+	write(context, "\"", 1);
+}
+
+void    JSON_Write_FD(void* fd, t_char const* data, t_size size)
+{
+	IO_Write_Data(*(t_fd*)fd, (t_u8 const*)data, size);
+}
+
+
+
 /*
 ** ************************************************************************** *|
 **                         Sorting Utility Functions                          *|
@@ -130,11 +214,10 @@ t_s64 GetSmallestColorDifference(t_u8 target, s_palette const* palette)
 {
 	t_s64 result = S64_MAX;
 	t_s64 diff;
+	PROFILE_COUNT(PROFILE_COMPARISONS, palette->length);
 	for (int i = 0; i < palette->length; ++i)
 	{
-		diff = (t_s64)Color_ARGB32_Difference(
-			program.ref_palette[target],
-			program.ref_palette[palette->colors[i]]);
+		diff = (t_s64)program.ref_distances[target][palette->colors[i]];
 		if (result > diff)
 		{
 			result = diff;
@@ -170,62 +253,58 @@ s_palette const* Palette_GetNearest(s_palette target, s_palette const* palettes,
 ** ************************************************************************** *|
 */
 
-t_char* ANSI_GetColor(t_argb32 color)
+t_char const* ANSI_GetColor(t_char dest[ANSI_COLOR_SIZE], t_argb32 color)
 {
-	return (String_Format(IO_COLOR_BG("%i")"  "IO_RESET, IO_GetColor(color)));
+	snprintf(dest, ANSI_COLOR_SIZE, IO_COLOR_BG("%i")"  "IO_RESET, IO_GetColor(color));
+	return (dest);
 }
 
 
 
-t_char* ANSI_GetPalette(s_palette* palette)
+t_char const* ANSI_GetPalette(t_char dest[ANSI_PALETTE_SIZE], s_palette const* palette)
 {
-	t_char* tmp = NULL;
-	t_char* result = String_New(0);
-	if (result == NULL)
+	t_char color[ANSI_COLOR_SIZE];
+	t_size length = 0;
+	for (t_uint j = 0; j < PAL_SUB_COLORS; ++j)
 	{
-		Log_Error(&program.logger, 0, "Could not allocate palette logging output string");
-		return (NULL);
+		length += snprintf(dest + length, ANSI_PALETTE_SIZE - length, "%s",
+			(j < palette->length) ?
+			ANSI_GetColor(color, program.ref_palette[palette->colors[j]]) : "[]");
 	}
-	for (int j = 0; j < PAL_SUB_COLORS; ++j)
+	length += snprintf(dest + length, ANSI_PALETTE_SIZE - length, " =");
+	for (t_uint j = 0; j < PAL_SUB_COLORS; ++j)
 	{
 		if (j < palette->length)
-			tmp = ANSI_GetColor(program.ref_palette[palette->colors[j]]);
-		else tmp = String_Duplicate("[]");
-		String_Merge(&result, &tmp);
+			length += snprintf(dest + length, ANSI_PALETTE_SIZE - length, " %.2X", palette->colors[j]);
+		else length += snprintf(dest + length, ANSI_PALETTE_SIZE - length, " __");
 	}
-	String_Append(&result, " =");
-	for (int j = 0; j < PAL_SUB_COLORS; ++j)
-	{
-		if (j < palette->length)
-			tmp = String_Format(" %.2X", palette->colors[j]);
-		else tmp = String_Duplicate(" __");
-		String_Merge(&result, &tmp);
-	}
-	return (result);
+	return (dest);
 }
 
 
 
 int PrintColorStats(s_color_use const* array, t_size length)
 {
-	Log_Message(&program.logger,
+	LOG_MESSAGE(
 		"The bitmap's colors which will be considered (the %u most used colors):",
 		PAL_COLORS);
-	s_color_use* sorted = QuickSort_New_Compare_ColorUse(array, length);
+	s_color_use* sorted = (s_color_use*)Arena_Duplicate(&program.arena, array, length * sizeof(s_color_use));
 	if (sorted == NULL)
 	{
 		Log_Error(&program.logger, 0, "Could not sort bitmap colors by amount of occurences");
 		return (ERROR);
 	}
+	QuickSort_Compare_ColorUse(sorted, length);
 	t_float total = (NAM_W * NAM_H);
+	t_char  color[ANSI_COLOR_SIZE];
 	for (t_u32 i = 0; i < PAL_COLORS; ++i)
 	{
 		if (sorted[i].occurences == 0)
 			continue;
 		program.occur_colors[i] = sorted[i];
-		Log_Message(&program.logger,
+		LOG_MESSAGE(
 			"%2i | %s %3i(#%.2X = 0x%.6X), occurences: %u\tie: %.1f%%", i + 1,
-			ANSI_GetColor(sorted[i].color),
+			ANSI_GetColor(color, sorted[i].color),
 			sorted[i].index,
 			sorted[i].index,
 			sorted[i].color,
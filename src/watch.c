@@ -0,0 +1,141 @@
+
+#define _POSIX_C_SOURCE 200809L
+#include <poll.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <libccc.h>
+#include <libccc/memory.h>
+#include <libccc/string.h>
+#include <libccc/sys/logger.h>
+
+#include "SDL.h"
+
+#include "bmp2nam.h"
+
+
+
+#ifdef __linux__
+
+//! Stores one of the files being watched for changes
+typedef struct s_watch_file_
+{
+	t_char const*   filepath;   //!< The full filepath of the watched file
+	t_char const*   filename;   //!< The filename part of `filepath` (inotify events only report the name within the directory)
+	int             wd;         //!< The inotify watch descriptor of the directory which contains the file
+	e_watch_file    flag;       //!< The flag which is reported to the callback when this file changes
+}
+s_watch_file;
+
+//! The inotify events which indicate that a file was saved (editors either write in-place, or rename a temporary file)
+#define WATCH_EVENTS    (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+
+
+//! Starts watching the directory which contains the given file (watching the file itself would miss atomic saves)
+static
+int     Watch_AddFile(int fd, s_watch_file* file, t_char const* filepath, e_watch_file flag)
+{
+	int slash = String_IndexOf_R_Char(filepath, '/');
+	t_char* dirpath = (slash < 0 ? String_Duplicate(".") : String_Sub(filepath, 0, (slash == 0 ? 1 : slash)));
+	if (dirpath == NULL)
+		return (ERROR);
+	file->filepath = filepath;
+	file->filename = filepath + slash + 1;
+	file->flag = flag;
+	file->wd = inotify_add_watch(fd, dirpath, WATCH_EVENTS);
+	if (file->wd < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not watch directory: %s", dirpath);
+		Memory_Free(dirpath);
+		return (ERROR);
+	}
+	LOG_VERBOSE("Watching file for changes: %s", filepath);
+	Memory_Free(dirpath);
+	return (OK);
+}
+
+//! Reads all pending inotify events, and returns the flags of the watched files which they concern
+static
+t_u32   Watch_ReadEvents(int fd, s_watch_file const* files, t_uint files_amount)
+{
+	_Alignas(struct inotify_event)
+	t_u8    buffer[4096];
+	t_u32   changed = 0;
+	ssize_t length = read(fd, buffer, sizeof(buffer));
+	if (length <= 0)
+		return (0);
+	for (ssize_t i = 0; i < length; )
+	{
+		struct inotify_event const* event = (struct inotify_event const*)(buffer + i);
+		for (t_uint j = 0; j < files_amount; ++j)
+		{
+			if (event->wd == files[j].wd && event->len > 0 &&
+				String_Equals(event->name, files[j].filename))
+				changed |= files[j].flag;
+		}
+		i += sizeof(struct inotify_event) + event->len;
+	}
+	return (changed);
+}
+
+#endif
+
+
+
+/*
+** ************************************************************************** *|
+**                             Watch Mode Functions                           *|
+** ************************************************************************** *|
+*/
+
+int     Watch_Run(int (*callback)(t_u32 changed))
+{
+#ifndef __linux__
+	(void)callback;
+	Log_Error(&program.logger, 0, "The `--watch` option is only available on Linux (it relies on inotify)");
+	return (ERROR);
+#else
+	s_watch_file files[2 + REFPAL_FILES_MAX];
+	t_uint files_amount = 0;
+	int fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0)
+	{
+		Log_Error_STD(&program.logger, 0, "Could not initialize inotify");
+		return (ERROR);
+	}
+	t_bool failed = Watch_AddFile(fd, &files[files_amount++], program.file_input, WATCH_INPUT);
+	for (t_uint i = 0; i < program.files_refpal_amount && !failed; ++i)
+	{
+		failed = Watch_AddFile(fd, &files[files_amount++], program.files_refpal[i], WATCH_REFPAL);
+	}
+	if (failed ||
+		(program.file_palette &&
+		Watch_AddFile(fd, &files[files_amount++], program.file_palette, WATCH_PALETTE)))
+	{
+		close(fd);
+		return (ERROR);
+	}
+	callback(WATCH_INPUT);
+	LOG_MESSAGE("Watching for changes (press Ctrl+C to quit)...");
+	struct pollfd pending = { .fd = fd, .events = POLLIN };
+	while (poll(&pending, 1, -1) >= 0)
+	{
+		t_u32 changed = Watch_ReadEvents(fd, files, files_amount);
+		if (changed == 0)
+			continue;
+		// an editor may write a file in several steps: wait until it is done before reconverting
+		while (poll(&pending, 1, WATCH_DEBOUNCE) > 0)
+		{
+			changed |= Watch_ReadEvents(fd, files, files_amount);
+		}
+		if (callback(changed))
+			LOG_WARNING("Conversion failed, waiting for the next change...");
+	}
+	Log_Error_STD(&program.logger, 0, "Error while waiting for file changes");
+	close(fd);
+	return (ERROR);
+#endif
+}